@@ -7,17 +7,62 @@ Description: Header file for IDistanceMetric to define the interface for distanc
 */
 
 #pragma once
+#include <cstdio>
+#include <limits>
 #include <vector>
 #include <string>
+#include "featureMatrix.hpp"
 #include "metricFactory.hpp"
+#include "quantization.hpp"
 
 /*
 IDistanceMetric is an abstract base class that defines the interface for distance metrics
 used to compare feature vectors.
 - compute(const std::vector<float> &features1, const std::vector<float> &features2):
-    A pure virtual function that takes two feature vectors as input and returns a float representing the
-    distance between them. This function must be overridden by any concrete distance metric class that
-    inherits from IDistanceMetric.
+    Takes two feature vectors as input and returns a float representing the distance between them.
+    If the vectors have different lengths it returns INFINITY.
+- compute(FeatureMatrix::RowView features1, FeatureMatrix::RowView features2):
+    Same as above for two rows of a FeatureMatrix, compared in place.
+- compute(const float *features1, const float *features2, size_t n):
+    A pure virtual function that computes the distance between two feature vectors of length n given
+    as raw pointers, e.g. rows of a memory-mapped feature DB. This function must be overridden by any
+    concrete distance metric class that inherits from IDistanceMetric.
+- computeU8(const uint8_t *codes1, const uint8_t *codes2, size_t n, const QuantParams &qp):
+    Computes the distance between two U8 encoded vectors sharing the scale/offset qp. The default
+    decodes both and calls compute(); metrics override it to work on the codes directly.
+- computeF16(const uint16_t *features1, const uint16_t *features2, size_t n):
+    Computes the distance between two fp16 vectors. The default widens both and calls compute().
+- computeEncoded(FeatureDataType type, const void *features1, const void *features2, size_t n,
+    const QuantParams &qp): Dispatches to the kernel for the storage type of a feature DB.
+- computeMany(const float *query, const FeatureMatrix &rows, float *out, const double *rowNorms):
+    Computes the distance from query (rows.cols() features) to every row of rows and writes
+    rows.rows() distances to out. The default calls compute() per row; metrics override it with
+    one tight loop over the contiguous rows, so the virtual call and any setup happen once per
+    batch. rowNorms, if not nullptr, holds the L2 norm of every row (see FeatureTable::rowNorms());
+    metrics that divide by it, like cosine, then skip summing the rows' squares.
+- computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n, size_t stride,
+    const QuantParams &qp, float *out, const double *rowNorms): computeMany for U8 codes; rows
+    are stride codes apart. The default calls computeU8() per row.
+- computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n, size_t stride,
+    float *out, const double *rowNorms): computeMany for fp16 features; rows are stride elements
+    apart. The default calls computeF16() per row.
+- computeManyEncoded(FeatureDataType type, const void *query, const void *rows, size_t count, size_t n,
+    size_t stride, const QuantParams &qp, float *out, const double *rowNorms): Dispatches a batch
+    to the kernel for the storage type of a feature DB. stride is in elements of that type.
+- computeWithin(const float *query, const float *row, size_t n, const uint32_t *blocks, float limit):
+    For scans that only need distances up to limit: returns compute() when that is at most limit,
+    otherwise any value above limit, possibly after visiting only some dimensions. blocks orders
+    the blocks of DistanceKernels::kBlockDims dimensions (see DistanceKernels::blockOrder()). The
+    default, for metrics that cannot stop early, returns compute().
+- lowerBound(const float *query, size_t n): Returns a value no distance from query to any row can
+    fall below, allowing for rounding. The matcher uses it to abandon a candidate whose remaining
+    features cannot bring it back into the top N. The default, the lowest float, never abandons one.
+- computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out, const double *rowNorms):
+    Computes the distance from every query to every row and writes out[q * rows.rows() + i], for
+    batches of many queries against one database. The default calls computeMany() per query;
+    metrics override it to walk the pairs with the tile kernels of DistanceKernels, so a row loaded
+    once serves several queries. rowNorms is as for computeMany; metrics that need norms compute
+    them if it is nullptr.
 - type() const: A virtual function that returns the MetricType of the distance metric. This allows users
     to identify which metric is being used when comparing feature vectors.
 */
@@ -27,7 +72,108 @@ public:
     // Virtual destructor to ensure proper cleanup of derived classes
     virtual ~IDistanceMetric() = default;
 
-    virtual float compute(const std::vector<float> &features1, const std::vector<float> &features2) const = 0;
+    float compute(const std::vector<float> &features1, const std::vector<float> &features2) const
+    {
+        return compute(FeatureMatrix::RowView{features1.data(), features1.size()},
+                       FeatureMatrix::RowView{features2.data(), features2.size()});
+    }
+    float compute(FeatureMatrix::RowView features1, FeatureMatrix::RowView features2) const
+    {
+        // features1 and features2 not the same size, return infinity to indicate they cannot be compared
+        if (features1.size != features2.size)
+        {
+            printf("Feature vectors size does not match\n");
+            return std::numeric_limits<float>::infinity();
+        }
+        return compute(features1.data, features2.data, features1.size);
+    }
+    virtual float compute(const float *features1, const float *features2, size_t n) const = 0;
+    virtual float computeU8(const uint8_t *codes1, const uint8_t *codes2, size_t n,
+                            const QuantParams &qp) const
+    {
+        std::vector<float> features1(n), features2(n);
+        Quantization::decode(FeatureDataType::U8, qp, codes1, n, features1.data());
+        Quantization::decode(FeatureDataType::U8, qp, codes2, n, features2.data());
+        return compute(features1.data(), features2.data(), n);
+    }
+    virtual float computeF16(const uint16_t *features1, const uint16_t *features2, size_t n) const
+    {
+        std::vector<float> widened1(n), widened2(n);
+        Quantization::decode(FeatureDataType::F16, QuantParams(), features1, n, widened1.data());
+        Quantization::decode(FeatureDataType::F16, QuantParams(), features2, n, widened2.data());
+        return compute(widened1.data(), widened2.data(), n);
+    }
+    float computeEncoded(FeatureDataType type, const void *features1, const void *features2, size_t n,
+                         const QuantParams &qp) const
+    {
+        switch (type)
+        {
+        case FeatureDataType::U8:
+            return computeU8(static_cast<const uint8_t *>(features1),
+                             static_cast<const uint8_t *>(features2), n, qp);
+        case FeatureDataType::F16:
+            return computeF16(static_cast<const uint16_t *>(features1),
+                              static_cast<const uint16_t *>(features2), n);
+        default:
+            return compute(static_cast<const float *>(features1),
+                           static_cast<const float *>(features2), n);
+        }
+    }
+    virtual void computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                             const double *rowNorms) const
+    {
+        for (size_t i = 0; i < rows.rows(); ++i)
+            out[i] = compute(query, rows.row(i), rows.cols());
+    }
+    virtual void computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n,
+                               size_t stride, const QuantParams &qp, float *out,
+                               const double *rowNorms) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = computeU8(query, rows + i * stride, n, qp);
+    }
+    virtual void computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n,
+                                size_t stride, float *out, const double *rowNorms) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = computeF16(query, rows + i * stride, n);
+    }
+    void computeManyEncoded(FeatureDataType type, const void *query, const void *rows, size_t count,
+                            size_t n, size_t stride, const QuantParams &qp, float *out,
+                            const double *rowNorms = nullptr) const
+    {
+        switch (type)
+        {
+        case FeatureDataType::U8:
+            computeManyU8(static_cast<const uint8_t *>(query), static_cast<const uint8_t *>(rows),
+                          count, n, stride, qp, out, rowNorms);
+            break;
+        case FeatureDataType::F16:
+            computeManyF16(static_cast<const uint16_t *>(query), static_cast<const uint16_t *>(rows),
+                           count, n, stride, out, rowNorms);
+            break;
+        default:
+            computeMany(static_cast<const float *>(query),
+                        FeatureMatrix::view(static_cast<const float *>(rows), count, n, stride), out,
+                        rowNorms);
+            break;
+        }
+    }
+    virtual float computeWithin(const float *query, const float *row, size_t n, const uint32_t *blocks,
+                                float limit) const
+    {
+        return compute(query, row, n);
+    }
+    virtual float lowerBound(const float *query, size_t n) const
+    {
+        return std::numeric_limits<float>::lowest();
+    }
+    virtual void computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                              const double *rowNorms) const
+    {
+        for (size_t q = 0; q < queries.rows(); ++q)
+            computeMany(queries.row(q), rows, out + q * rows.rows(), rowNorms);
+    }
     virtual std::string type() { return MetricFactory::metricTypeToString(type_); }
 
 protected:
@@ -19,6 +19,9 @@ IExtractor interface for feature extraction.
 public:
     - extract(const char *imagePath, std::vector<float> *out, Position pos):
         Extracts features from an image at a given position.
+    - extractImage(const cv::Mat &image, std::vector<float> *out, Position pos):
+        Same, for an image that is already decoded, so several extractors can share
+        one decode.
     - extractMat(const cv::Mat &image, std::vector<float> *out):
         Extracts features from a cv::Mat image.
     - type(): Returns the feature type as a string.
@@ -35,12 +38,18 @@ public:
         cv::Mat img = cv::imread(imagePath);
         if (img.empty())
             return -1;
-        // Compute the region of interest based on the given position
         cv::Rect r = roiFor(pos, img.cols, img.rows);
-        // Extract features from the region of interest
-        cv::Mat roi = img(r).clone();
         fprintf(stderr, "[IExtractor::extract] %s at {%d, %d, %d, %d}\n", imagePath, r.x, r.y, r.width, r.height);
         fflush(stderr);
+        return extractImage(img, out, pos);
+    }
+
+    int extractImage(const cv::Mat &image, std::vector<float> *out, Position pos) const
+    {
+        // Compute the region of interest based on the given position
+        cv::Rect r = roiFor(pos, image.cols, image.rows);
+        // Extract features from the region of interest
+        cv::Mat roi = image(r).clone();
         return extractMat(roi, out);
     }
 
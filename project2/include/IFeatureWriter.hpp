@@ -0,0 +1,129 @@
+/*
+Claire Liu, Yu-Jing Wei
+IFeatureWriter.hpp
+
+Path: include/IFeatureWriter.hpp
+Description: Declares the IFeatureWriter interface for writing feature databases.
+*/
+
+#pragma once
+
+#include "extractorFactory.hpp"
+#include "position.hpp"
+#include "quantization.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+IFeatureWriter interface for writing feature databases row by row.
+
+The writer keeps one file handle open for the whole run and collects output in a
+large reusable buffer that is flushed in big blocks. A new or compacted database is
+written to a temporary file next to the destination, which is renamed over the
+destination only by commit(). A run that crashes or returns early therefore never
+leaves a partial database under the final name. An append extends the existing file
+in place instead, so its cost is that of the new rows. A binary database keeps a
+header that describes valid data at every step and rewrites it last, after the new
+rows are synced; a CSV file gets its new lines at the end. An append that fails is
+cut back to the bytes the file held before. Formats whose rows cannot grow in place
+append through a temporary copy like openCompact().
+public:
+    - open(const char *path): Creates the temporary file for path.
+        Returns 0 on success, -1 on error.
+    - openAppend(const char *path): Opens the existing database at path for appending.
+        Returns 0 on success, -1 on error.
+    - openCompact(const char *path, const std::vector<char> &dropRows): Like open(), but
+        first copies the rows of the existing database at path, except the rows flagged
+        in dropRows. Returns 0 on success, -1 on error.
+    - append(const char *imageFilename, const std::vector<float> &features):
+        Adds one row. Returns 0 on success, -1 on error.
+    - appendGroups(const char *imageFilename, const std::vector<std::vector<float>> &groups):
+        Adds one row with one feature vector per column group. Single-feature formats
+        accept exactly one group. Returns 0 on success, -1 on error.
+    - transform(size_t group): The transform the database stores the features of a column
+        group with, that of the existing database after openAppend(). Rows are appended as
+        given, so callers apply it to the extracted features first. CSV stores them as is.
+    - commit(): Flushes and syncs the output and renames the temporary file to the
+        destination. Returns 0 on success, -1 on error.
+    - abort(): Closes and deletes the temporary file, or cuts an append back to the
+        database it started from. Called by the destructor if commit() was never reached.
+    - rows(): Number of rows written so far; binary formats include the rows of the
+        database they append to.
+    - create(const std::string &path, FeatureType featureType, Position position,
+        FeatureTransform transform): Returns a binary writer for ".fdb" paths and a CSV
+        writer otherwise. transform is recorded by new binary databases.
+    - create(const std::string &path, const std::vector<FeatureType> &featureTypes,
+        Position position, FeatureTransform transform): Returns a feature store writer with
+        one column group per feature type for ".fst" paths, otherwise the writer for the
+        only feature type.
+protected:
+    - begin() / finish(): Hooks for format specific preambles and trailers.
+    - copyRows(const std::vector<char> *dropRows): Hook that copies the rows of the
+        existing database at path_ into the temporary file.
+    - growsInPlace() / resume(): Hooks for formats that append in place: resume() reads
+        the existing database at path_ and seeks fp_ to where the new rows go.
+    - syncOutput(): Flushes the buffer and syncs the output to disk.
+    - copyWithin(uint64_t from, uint64_t to, uint64_t n): Copies n bytes of the output
+        file from one offset to a lower or non-overlapping one.
+    - reserve(size_t n) / advance(size_t n): Direct access to the output buffer.
+    - writeBytes(const void *data, size_t n): Copies bytes into the output buffer.
+    - flushBuffer(): Writes the buffered bytes to the temporary file.
+*/
+class IFeatureWriter
+{
+public:
+    virtual ~IFeatureWriter();
+    IFeatureWriter(const IFeatureWriter &) = delete;
+    IFeatureWriter &operator=(const IFeatureWriter &) = delete;
+
+    int open(const char *path);
+    int openAppend(const char *path);
+    int openCompact(const char *path, const std::vector<char> &dropRows);
+    virtual int append(const char *imageFilename, const std::vector<float> &features) = 0;
+    virtual int appendGroups(const char *imageFilename, const std::vector<std::vector<float>> &groups);
+    virtual FeatureTransform transform(size_t group) const { return FeatureTransform::NONE; }
+    int commit();
+    void abort();
+    size_t rows() const { return rows_; }
+
+    static std::shared_ptr<IFeatureWriter> create(const std::string &path,
+                                                  FeatureType featureType,
+                                                  Position position,
+                                                  FeatureTransform transform = FeatureTransform::NONE);
+    static std::shared_ptr<IFeatureWriter> create(const std::string &path,
+                                                  const std::vector<FeatureType> &featureTypes,
+                                                  Position position,
+                                                  FeatureTransform transform = FeatureTransform::NONE);
+
+protected:
+    IFeatureWriter() = default;
+
+    int start(const char *path, bool append, const std::vector<char> *dropRows);
+
+    virtual int begin() { return 0; }
+    virtual int finish() { return 0; }
+    virtual int copyRows(const std::vector<char> *dropRows) = 0;
+    virtual bool growsInPlace() const { return false; }
+    virtual int resume() { return -1; }
+
+    char *reserve(size_t n);
+    void advance(size_t n) { used_ += n; }
+    int writeBytes(const void *data, size_t n);
+    int flushBuffer();
+    int syncOutput();
+    int copyWithin(uint64_t from, uint64_t to, uint64_t n);
+
+    // Buffered bytes are written out once this many have accumulated
+    static const size_t kBufferSize = 1 << 20;
+
+    FILE *fp_ = nullptr;
+    std::string path_;
+    std::string tmpPath_; // empty while appending in place
+    uint64_t keepSize_ = 0; // in place: the bytes the valid header covers
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    size_t rows_ = 0;
+};
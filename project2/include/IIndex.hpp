@@ -0,0 +1,119 @@
+/*
+Claire Liu, Yu-Jing Wei
+IIndex.hpp
+
+Path: include/IIndex.hpp
+Description: Header file for IIndex to define the interface for search indexes
+             over a feature DB.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "featureTable.hpp"
+#include "indexFactory.hpp"
+#include "metricFactory.hpp"
+
+/*
+One result of an index search.
+- row: The row of the indexed table.
+- distance: The distance from the query to the row under the index's metric.
+*/
+struct IndexHit
+{
+    uint32_t row;
+    float distance;
+};
+
+/*
+What one search cost, summed over the searches it is passed to.
+- distances: The number of query-to-row distances computed.
+- visited: The number of index nodes (graph nodes, lists, tree nodes) visited.
+*/
+struct IndexStats
+{
+    size_t distances = 0;
+    size_t visited = 0;
+};
+
+/*
+IIndex is an abstract base class for search indexes over one feature table: a plain
+.csv or .fdb DB, one shard of a sharded one or one group of a .fst store. An index
+holds the structure it searches but not the rows, which it reads from the table it
+was built from, so the table must be passed to every search.
+- build(const FeatureTable &table, MetricType metric, const IndexParams &params, size_t threads):
+    A pure virtual function that indexes every row of table for metric on up to threads
+    threads. Dead rows are indexed as well and skipped by search. Returns 0 or -1.
+- save(const std::string &path): A pure virtual function that writes a built index to
+    path atomically. Returns 0 or -1.
+- load(const std::string &path): A pure virtual function that maps a saved index, so
+    loading costs O(1) and a search pages in only what it visits. Returns 0 or -1.
+- search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+    std::vector<IndexHit> &out, IndexStats *stats): A pure virtual function that writes
+    up to k live rows near query (table.dim() features, transformed like the rows) to out,
+    nearest first, and adds its cost to stats if not nullptr. Returns 0 or -1.
+- fits(const FeatureTable &table): true if the index was built from this table: same
+    shape and fingerprint (see FeatureTable::fingerprint()). A DB updated or rebuilt
+    since fails the check, so a stale index is told apart before it is searched.
+- exact(): true if search() returns the exact k nearest live rows, as a scan would, so
+    asking it for more rows than needed only adds cost. false by default.
+- type(), metric(), rows(), dim(): What the index is and what it was built from.
+protected:
+    - checkShape(const FeatureTable &table, const char *name, bool ready): The check a
+        search makes before it reads table: ready (the index holds a structure) and the
+        same shape as the indexed table. Prints why not and returns false otherwise.
+    - encodeQuery(const FeatureTable &table, const float *query): The query encoded
+        like the rows of table, so both sides of a distance use the same codes.
+*/
+class IIndex
+{
+public:
+    // Virtual destructor to ensure proper cleanup of derived classes
+    virtual ~IIndex() = default;
+
+    virtual int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                      size_t threads) = 0;
+    virtual int save(const std::string &path) const = 0;
+    virtual int load(const std::string &path) = 0;
+    virtual int search(const FeatureTable &table, const float *query, size_t k,
+                       const IndexParams &params, std::vector<IndexHit> &out,
+                       IndexStats *stats = nullptr) const = 0;
+    bool fits(const FeatureTable &table) const
+    {
+        return rows_ == table.rows() && dim_ == table.dim() && fingerprint_ == table.fingerprint();
+    }
+    virtual bool exact() const { return false; }
+
+    IndexType type() const { return type_; }
+    MetricType metric() const { return metric_; }
+    size_t rows() const { return rows_; }
+    size_t dim() const { return dim_; }
+
+protected:
+    // Constructor to initialize the index type in derived classes
+    explicit IIndex(IndexType type) : type_(type) {}
+
+    bool checkShape(const FeatureTable &table, const char *name, bool ready) const
+    {
+        // fits() is left to the caller, which checks it once rather than per query
+        if (ready && rows_ == table.rows() && dim_ == table.dim())
+            return true;
+        printf("%s index of %zu x %zu rows does not fit DB %s (%zu x %zu)\n", name, rows_, dim_,
+               table.path().c_str(), table.rows(), table.dim());
+        return false;
+    }
+    std::vector<uint8_t> encodeQuery(const FeatureTable &table, const float *query) const
+    {
+        return Quantization::encode(table.dataType(), table.quantParams(),
+                                    std::vector<float>(query, query + dim_));
+    }
+
+    IndexType type_;
+    MetricType metric_ = UNKNOWN_METRIC;
+    size_t rows_ = 0;
+    size_t dim_ = 0;
+    uint64_t fingerprint_ = 0;
+};
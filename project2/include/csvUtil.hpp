@@ -10,7 +10,9 @@
 #ifndef CVS_UTIL_H
 #define CVS_UTIL_H
 
+#include <string>
 #include <vector>
+#include "featureMatrix.hpp"
 
 class csvUtil
 {
@@ -48,6 +50,37 @@ public:
                                  std::vector<std::vector<float>> &data,
                                  int echo_file = 0);
 
+  /*
+    Same as above, but the features are stored in one contiguous
+    FeatureMatrix instead of one std::vector per image. Every row must
+    have the same number of features.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+  static int read_image_data_csv(const std::string &filename,
+                                 std::vector<std::string> &filenames,
+                                 FeatureMatrix &data,
+                                 int echo_file = 0);
+
+  /*
+    Parallel version of the FeatureMatrix reader for large files. The
+    file is mapped with mmap and split into byte ranges that start and
+    end on line boundaries. One thread per range counts its lines, the
+    matrix is allocated once, and then every thread parses its range
+    with std::from_chars directly into its rows of the matrix.
+
+    num_threads <= 0 uses one thread per hardware core. Files that
+    cannot be mapped (e.g. pipes) are read with the serial reader.
+
+  The function returns a non-zero value if something goes wrong,
+  including a line whose number of features differs from the first one
+  or a value that is not a number.
+ */
+  static int read_image_data_csv_parallel(const std::string &filename,
+                                          std::vector<std::string> &filenames,
+                                          FeatureMatrix &data,
+                                          int num_threads = 0);
+
   /*
   Clears the contents of the specified file.
   @param filename The path to the file to be cleared.
@@ -0,0 +1,68 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  dbToolCLI.hpp
+
+  Path: project2/include/dbToolCLI.hpp
+  Description: Header file for dbToolCLI.cpp to parse command-line
+                arguments for the feature database tool.
+*/
+
+#pragma once
+#include <string>
+
+/*
+DbToolCLI class to parse command-line arguments for the feature database tool.
+The first argument selects the command, the options that follow configure it.
+Struct Args:
+    - command: The command to run (quantize | compare | index | recall | selftest | bench).
+    - inputPath: The database to read.
+    - outputPath: The database to write.
+    - referencePath: The database the input is compared against.
+    - quantStr: The storage type to convert to (f32 | u8 | f16).
+    - metricStr: The distance metric used to rank images.
+    - refMetricStr: The metric used to rank the reference database, empty for metricStr.
+    - topK: The number of nearest neighbours compared per query.
+    - numQueries: The number of database rows used as queries.
+    - indexStr: The type of search index to build or check (hnsw, ivf, pq, vptree, bins).
+    - featureStr, positionStr: The group of a .fst store to index.
+    - links, efConstruction: HNSW build settings (see IndexParams).
+    - efSearch: HNSW search setting (see IndexParams).
+    - lists, nprobe: IVF build and search settings (see IndexParams).
+    - subspaces, rerank: PQ build and search settings (see IndexParams).
+    - threads: The number of threads building an index, 0 for one per core.
+    - showHelp: A flag indicating whether to display the help message.
+public:
+    - parse(int argc, char *argv[]): Parses the command-line arguments and returns an Args struct.
+    - printUsage(const char *prog): Prints the usage information for the program.
+*/
+class DbToolCLI
+{
+public:
+    struct Args
+    {
+        std::string command;
+        std::string inputPath;
+        std::string outputPath;
+        std::string referencePath;
+        std::string quantStr = "u8";
+        std::string metricStr = "ssd";
+        std::string refMetricStr;
+        int topK = 10;
+        int numQueries = 100;
+        std::string indexStr = "hnsw";
+        std::string featureStr;
+        std::string positionStr = "whole";
+        int links = 16;
+        int efConstruction = 200;
+        int efSearch = 64;
+        int lists = 0;
+        int nprobe = 8;
+        int subspaces = 0;
+        int rerank = 0;
+        int threads = 0;
+        bool showHelp = false;
+    };
+
+    static Args parse(int argc, char *argv[]);
+    static void printUsage(const char *prog);
+};
@@ -0,0 +1,45 @@
+/*
+Claire Liu, Yu-Jing Wei
+dimensionStats.hpp
+
+Path: include/dimensionStats.hpp
+Description: Header file for dimensionStats.cpp to order the dimensions of a feature
+             database by their variance.
+*/
+
+#pragma once // Include guard
+
+#include "quantization.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+DimensionStats accumulates the mean and variance of every dimension of a feature
+database one row at a time, as the writers see the rows. Its order() is stored in
+.fdb and .fst files so a distance that stops early visits the dimensions that differ
+most between images first.
+public:
+    - reset(size_t dim): Forgets all rows and expects rows of dim features.
+    - add(FeatureDataType type, const QuantParams &qp, const void *row): Adds one
+        stored row, decoded from its storage type.
+    - add(const float *row): Adds one float32 row.
+    - order(): The dimensions by decreasing variance, ties by index.
+    - isOrder(const uint32_t *order, size_t dim): true if order holds every dimension
+        of [0, dim) once, e.g. to validate an order read from a file.
+*/
+class DimensionStats
+{
+public:
+    void reset(size_t dim);
+    void add(FeatureDataType type, const QuantParams &qp, const void *row);
+    void add(const float *row);
+    std::vector<uint32_t> order() const;
+    static bool isOrder(const uint32_t *order, size_t dim);
+
+private:
+    size_t rows_ = 0;
+    std::vector<double> sum_;   // sum of every dimension
+    std::vector<double> sumSq_; // sum of squares of every dimension
+    std::vector<float> decoded_; // scratch row for quantized rows
+};
@@ -0,0 +1,107 @@
+/*
+Claire Liu, Yu-Jing Wei
+distanceKernels.hpp
+
+Path: include/distanceKernels.hpp
+Description: Header file for distanceKernels.cpp, the vectorized float32 loops behind
+             the distance metrics and their runtime selection by CPU features.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+The three inner products of a cosine distance, computed in one pass.
+- dot: sum of a[i] * b[i].
+- sq1: sum of a[i] * a[i].
+- sq2: sum of b[i] * b[i].
+*/
+struct DotNorms
+{
+    double dot;
+    double sq1;
+    double sq2;
+};
+
+/*
+One implementation of every float32 distance kernel, for one instruction set.
+- name: The instruction set, e.g. "avx2".
+- ssd(a, b, n): Sum of (a[i] - b[i])^2.
+- minSum(a, b, n): Sum of min(a[i], b[i]), the histogram intersection.
+- dotNorms(a, b, n): dot, sq1 and sq2 of a and b.
+- dot(a, b, n): Only the dot product, for cosine distances whose norms are known.
+- ssdWithin(a, b, blocks, n, limit): The SSD summed over the blocks of kBlockDims
+    dimensions in the order blocks lists them, checking the sum after every block and
+    returning as soon as it exceeds limit; otherwise the full SSD.
+- dotTile(q, r, n, out): The dot products of kTileQueries vectors q[] with kTileRows
+    vectors r[], out[i * kTileRows + j] = q[i].r[j], summed in float. Every loaded element
+    of a row is used for all the queries of the tile and vice versa, which is what lets
+    many queries share one pass over the rows.
+- minSumTile(q, r, n, out): The histogram intersections of the same tile.
+- adcScan(lut, codes, m, out): The product quantization distances of one block of
+    kAdcBlock rows: out[r] = sum over j < m of lut[j * kAdcCodes + codes[j * kAdcBlock + r]].
+    The codes of a block are stored subspace-major, so one vector of codes indexes one
+    table for several rows at once (a gather where the set has one).
+*/
+struct DistanceKernelSet
+{
+    const char *name;
+    float (*ssd)(const float *a, const float *b, size_t n);
+    float (*minSum)(const float *a, const float *b, size_t n);
+    DotNorms (*dotNorms)(const float *a, const float *b, size_t n);
+    double (*dot)(const float *a, const float *b, size_t n);
+    float (*ssdWithin)(const float *a, const float *b, const uint32_t *blocks, size_t n, float limit);
+    void (*dotTile)(const float *const *q, const float *const *r, size_t n, float *out);
+    void (*minSumTile)(const float *const *q, const float *const *r, size_t n, float *out);
+    void (*adcScan)(const float *lut, const uint8_t *codes, size_t m, float *out);
+};
+
+/*
+DistanceKernels class selects the kernels for the CPU the program runs on. x86 builds
+carry SSE4.1, AVX2 (with FMA) and AVX-512 versions compiled with per-function target
+attributes, so no special compiler flags are needed; the best one the CPU reports
+through CPUID is used. AArch64 builds use NEON. The scalar set is the reference
+every other set is tested against.
+public:
+    - active(): The kernel set chosen on first use, the fastest one supported.
+    - scalar(): The portable reference kernels.
+    - supported(): Every kernel set this CPU can run, scalar first, fastest last.
+    - forDim(size_t n): The active set with its ssd, minSum and dot kernels compiled for
+        length n when n is one of kFixedDims: the loops are unrolled completely and the
+        tail is known at compile time, summing in the same order as the generic kernels.
+        The sets are kept in a dispatch table keyed by length, built on first use; other
+        lengths get active().
+    - blockOrder(const uint32_t *dimOrder, size_t n): The blocks of kBlockDims dimensions
+        for ssdWithin, those holding the first dimensions of dimOrder first.
+    - selfTest(): Compares every supported set with the scalar one on vectors of many
+        lengths and alignments, and the ADC kernels with random tables, and prints the
+        largest error per set. Returns 0 if all are within tolerance, -1 otherwise.
+    - benchmark(): Times the generic and the fixed-length kernels of the active set for
+        every length of kFixedDims and prints the time per row and the speedup. Returns 0.
+*/
+class DistanceKernels
+{
+public:
+    // Dimensions per block of ssdWithin: one AVX-512 vector, two AVX2 or four SSE / NEON vectors
+    static const size_t kBlockDims = 16;
+    // Shape of dotTile / minSumTile: 8 accumulators plus the loads fit the 16 vector registers
+    static const size_t kTileQueries = 4;
+    static const size_t kTileRows = 2;
+    // Shape of adcScan: rows per block of codes, and the entries of one subspace table
+    static const size_t kAdcBlock = 32;
+    static const size_t kAdcCodes = 256;
+    // Feature lengths of the extractors that get fixed-length kernels: gabor 128, baseline 147,
+    // rghist2d / cielab / magnitude 256, rgbhist3d / ResNet18 512
+    static constexpr size_t kFixedDims[] = {128, 147, 256, 512};
+
+    static const DistanceKernelSet &active();
+    static const DistanceKernelSet &scalar();
+    static std::vector<const DistanceKernelSet *> supported();
+    static const DistanceKernelSet &forDim(size_t n);
+    static std::vector<uint32_t> blockOrder(const uint32_t *dimOrder, size_t n);
+    static int selfTest();
+    static int benchmark();
+};
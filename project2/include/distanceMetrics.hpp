@@ -23,9 +23,19 @@ struct SumSquaredDistance : public IDistanceMetric
     // Constructor to initialize the metric type
     SumSquaredDistance(MetricType mt) : IDistanceMetric(mt) {}
     // Override the compute function to calculate the SSD between two vectors
-    float compute(const std::vector<float> &v1,
-                  const std::vector<float> &v2)
-        const override;
+    float compute(const float *v1, const float *v2, size_t n) const override;
+    float computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const override;
+    float computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const override;
+    // Batch versions: one distance per row, written to out
+    void computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                     const double *rowNorms) const override;
+    float computeWithin(const float *query, const float *row, size_t n, const uint32_t *blocks,
+                        float limit) const override;
+    float lowerBound(const float *query, size_t n) const override;
+    void computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                      const double *rowNorms) const override;
+    // Keep the std::vector overload of the base class visible
+    using IDistanceMetric::compute;
 };
 
 /*
@@ -38,9 +48,17 @@ struct HistogramIntersection : public IDistanceMetric
     // Constructor to initialize the metric type
     HistogramIntersection(MetricType mt) : IDistanceMetric(mt) {}
     // Override the compute function to calculate the histogram intersection distance between two vectors
-    float compute(const std::vector<float> &v1,
-                  const std::vector<float> &v2)
-        const override;
+    float compute(const float *v1, const float *v2, size_t n) const override;
+    float computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const override;
+    float computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const override;
+    // Batch versions: one distance per row, written to out
+    void computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                     const double *rowNorms) const override;
+    float lowerBound(const float *query, size_t n) const override;
+    void computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                      const double *rowNorms) const override;
+    // Keep the std::vector overload of the base class visible
+    using IDistanceMetric::compute;
 };
 
 /*
@@ -53,7 +71,49 @@ struct CosDistance : public IDistanceMetric
     // Constructor to initialize the metric type
     CosDistance(MetricType mt) : IDistanceMetric(mt) {}
     // Override the compute function to calculate the cosine distance between two vectors
-    float compute(const std::vector<float> &v1,
-                  const std::vector<float> &v2)
-        const override;
+    float compute(const float *v1, const float *v2, size_t n) const override;
+    float computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const override;
+    float computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const override;
+    // Batch versions: one distance per row, written to out
+    void computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                     const double *rowNorms) const override;
+    void computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n,
+                       size_t stride, const QuantParams &qp, float *out,
+                       const double *rowNorms) const override;
+    void computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n,
+                        size_t stride, float *out, const double *rowNorms) const override;
+    float lowerBound(const float *query, size_t n) const override;
+    void computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                      const double *rowNorms) const override;
+    // Keep the std::vector overload of the base class visible
+    using IDistanceMetric::compute;
+};
+
+/*
+    Hellinger Distance metric
+    Computes the squared Hellinger distance between two histograms, 1 minus their
+    Bhattacharyya coefficient. Both vectors must be square-rooted histograms (see
+    FeatureTransform::SQRT), so the coefficient is a plain dot product.
+    Lower values indicate more similar features.
+*/
+struct HellingerDistance : public IDistanceMetric
+{
+    // Constructor to initialize the metric type
+    HellingerDistance(MetricType mt) : IDistanceMetric(mt) {}
+    // Override the compute function to calculate the Hellinger distance between two vectors
+    float compute(const float *v1, const float *v2, size_t n) const override;
+    float computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const override;
+    float computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const override;
+    // Batch versions: one distance per row, written to out
+    void computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                     const double *rowNorms) const override;
+    void computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n,
+                       size_t stride, const QuantParams &qp, float *out,
+                       const double *rowNorms) const override;
+    void computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n,
+                        size_t stride, float *out, const double *rowNorms) const override;
+    void computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                      const double *rowNorms) const override;
+    // Keep the std::vector overload of the base class visible
+    using IDistanceMetric::compute;
 };
@@ -0,0 +1,158 @@
+/*
+Claire Liu, Yu-Jing Wei
+featureDB.hpp
+
+Path: include/featureDB.hpp
+Description: Header file for featureDB.cpp to write and memory-map binary
+             feature databases (.fdb).
+*/
+
+#pragma once // Include guard
+
+#include "extractorFactory.hpp"
+#include "featureMatrix.hpp"
+#include "position.hpp"
+#include "quantization.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of a binary feature database (.fdb), all values little-endian:
+- [0, headerSize): FeatureDBHeader.
+- [dataOffset, ...): rows x stride matrix of dataType elements. dataOffset is page
+    aligned and stride is Quantization::strideFor(dataType, dim), so every row starts
+    on a cache line; for float32 the mapped rows have the same layout as an in-memory
+    FeatureMatrix. Padding elements are written as 0. U8 rows hold codes q with
+    value = quantOffset + quantScale * q.
+- [namesOffset, ...): filename string table. (rows + 1) uint64 offsets relative to
+    the start of the blob that follows them, then the blob itself holding the
+    0-terminated filenames back to back.
+- [normsOffset, ...): rows doubles, the L2 norm of every decoded row, so cosine
+    distances need one dot product per row. 8-byte aligned after the filename table;
+    normsOffset is 0 in files written before norms were stored.
+- [orderOffset, ...): dim uint32, the dimensions ordered by decreasing variance over
+    all rows (see DimensionStats), right after the norms. orderOffset is 0 in files
+    written before the order was stored.
+Bytes past fileSize are left over from an interrupted append in place and ignored.
+*/
+struct FeatureDBHeader
+{
+    char magic[8];        // "CBIRFDB" + '\0'
+    uint32_t version;     // format version, currently 1
+    uint32_t headerSize;  // sizeof(FeatureDBHeader)
+    int32_t featureType;  // FeatureType enum value
+    int32_t position;     // Position enum value
+    uint32_t dim;         // number of features per row
+    uint32_t stride;      // number of elements between the starts of two rows
+    uint64_t rows;        // number of images
+    uint64_t dataOffset;  // byte offset of the feature matrix
+    uint64_t namesOffset; // byte offset of the filename string table
+    uint64_t fileSize;    // total file size, used to detect truncated files
+    int32_t dataType;     // FeatureDataType of the matrix, 0 (F32) in older files
+    float quantScale;     // U8 only: value = quantOffset + quantScale * code
+    float quantOffset;    // U8 only
+    uint32_t transform;   // FeatureTransform applied before storing, 0 (none) in older files
+    uint64_t normsOffset; // byte offset of the row norms, 0 if the file has none
+    uint64_t orderOffset; // byte offset of the dimension order, 0 if the file has none
+    uint8_t reserved[32]; // zero, room for future fields
+};
+
+/*
+FeatureDB class opens a binary feature database with mmap and gives direct access
+to its rows and filenames, so opening a database costs O(1) and a scan only touches
+the pages it reads.
+public:
+    - open(const char *path): Maps the file and validates its header.
+        Returns 0 on success, -1 on error.
+    - close(): Unmaps the file. Called by the destructor.
+    - rows(), dim(), stride(): Matrix shape; stride is in elements.
+    - featureType(), position(): The feature and region the database was built with.
+    - dataType(), quantParams(): How the features are stored.
+    - transform(): The transform applied to the features before they were stored.
+    - matrix(): The mapped rows as a read-only FeatureMatrix view (float32 only).
+    - row(size_t i): Pointer to the dim features of row i (float32 only).
+    - rawRow(size_t i): Pointer to the stored elements of row i, any data type.
+    - readRow(size_t i, float *out): Decodes the dim features of row i to floats.
+    - filename(size_t i): 0-terminated image filename of row i.
+    - norms(): The L2 norm of every decoded row, nullptr for files without norms.
+    - dimOrder(): The dimensions by decreasing variance, nullptr for files without it.
+    - write(...): Writes filenames and feature vectors to a new .fdb file through
+        FDBFeatureWriter. Returns 0 on success, -1 on error.
+    - quantize(const char *inPath, const char *outPath, FeatureDataType dataType):
+        Re-encodes a float32 database as U8 or F16. For U8 the scale and offset are
+        fitted to the value range of the whole database; the transform is kept.
+        Returns 0 on success, -1 on error.
+    - makeHeader(...): Fills in a header, including the section offsets, for a file
+        with the given shape, data type, transform and filename blob size. The file holds row norms
+        and the dimension order.
+    - isFeatureDBPath(const std::string &path): true if path has the .fdb extension.
+*/
+class FeatureDB
+{
+public:
+    FeatureDB() = default;
+    ~FeatureDB();
+    FeatureDB(const FeatureDB &) = delete;
+    FeatureDB &operator=(const FeatureDB &) = delete;
+
+    int open(const char *path);
+    void close();
+    bool isOpen() const { return header_ != nullptr; }
+
+    size_t rows() const { return header_ ? header_->rows : 0; }
+    size_t dim() const { return header_ ? header_->dim : 0; }
+    size_t stride() const { return header_ ? header_->stride : 0; }
+    FeatureType featureType() const { return static_cast<FeatureType>(header_->featureType); }
+    Position position() const { return static_cast<Position>(header_->position); }
+    FeatureDataType dataType() const { return static_cast<FeatureDataType>(header_->dataType); }
+    QuantParams quantParams() const { return QuantParams{header_->quantScale, header_->quantOffset}; }
+    FeatureTransform transform() const { return static_cast<FeatureTransform>(header_->transform); }
+
+    const FeatureMatrix matrix() const
+    {
+        if (!header_ || dataType() != FeatureDataType::F32)
+            return FeatureMatrix::view(nullptr, 0, 0, 0);
+        return FeatureMatrix::view(reinterpret_cast<const float *>(data_), rows(), dim(), stride());
+    }
+    const float *row(size_t i) const { return reinterpret_cast<const float *>(rawRow(i)); }
+    const void *rawRow(size_t i) const { return data_ + i * rowBytes_; }
+    void readRow(size_t i, float *out) const
+    {
+        Quantization::decode(dataType(), quantParams(), rawRow(i), dim(), out);
+    }
+    const char *filename(size_t i) const { return names_ + nameOffsets_[i]; }
+    const double *norms() const { return norms_; }
+    const uint32_t *dimOrder() const { return dimOrder_; }
+
+    static int write(const char *path,
+                     FeatureType featureType,
+                     Position position,
+                     const std::vector<std::string> &filenames,
+                     const std::vector<std::vector<float>> &data);
+
+    static int quantize(const char *inPath, const char *outPath, FeatureDataType dataType);
+
+    static FeatureDBHeader makeHeader(FeatureType featureType,
+                                      Position position,
+                                      size_t dim,
+                                      uint64_t rows,
+                                      uint64_t namesBytes,
+                                      FeatureDataType dataType = FeatureDataType::F32,
+                                      const QuantParams &qp = QuantParams(),
+                                      FeatureTransform transform = FeatureTransform::NONE);
+
+    static bool isFeatureDBPath(const std::string &path);
+
+private:
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+    const FeatureDBHeader *header_ = nullptr;
+    const char *data_ = nullptr;
+    size_t rowBytes_ = 0;
+    const uint64_t *nameOffsets_ = nullptr;
+    const char *names_ = nullptr;
+    const double *norms_ = nullptr;
+    const uint32_t *dimOrder_ = nullptr;
+};
@@ -20,6 +20,12 @@ Struct Args:
     - featureStrs: A list of feature types to extract.
     - outputPath: The path to save the extracted features.
     - positionStr: The position string specifying the region of interest.
+    - quantStr: The storage type of binary feature DBs (f32 | u8 | f16).
+    - transformStr: The transform binary feature DBs store the features with (none | sqrt).
+    - compact: Drop the dead rows of existing DBs even below the automatic threshold.
+    - numShards: Split each DB into this many shards (0 or 1: a single file).
+    - shardScheme: How images are assigned to shards (hash | range).
+    - shardDirs: Directories to spread the shard files over, e.g. one per disk.
     - showHelp: A flag indicating whether to display the help message.
 public:
     - parse(int argc, char *argv[]): Parses the command-line arguments and returns an Args struct.
@@ -37,6 +43,12 @@ public:
         std::vector<std::string> featureStrs;
         std::string outputPath;
         std::string positionStr = "whole";
+        std::string quantStr = "f32";
+        std::string transformStr = "none";
+        bool compact = false;
+        int numShards = 0;
+        std::string shardScheme = "hash";
+        std::vector<std::string> shardDirs;
         bool showHelp = false;
     };
 
@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "extractorFactory.hpp"
+#include "indexFactory.hpp"
 #include "metricFactory.hpp"
 #include "position.hpp"
 
@@ -40,17 +41,24 @@ public:
         bool hasMetric = false;
         float weight = 1.0f;
         std::string dbPath;
+
+        IndexType indexType = UNKNOWN_INDEX; // --index given after this entry
+        bool hasIndex = false;
     };
 
     struct Args
     {
         std::string targetPath;
+        std::string targetsPath; // list file of targets for batch mode, one image per line
         std::vector<DbEntry> dbs;
 
         MetricType metricType = UNKNOWN_METRIC;
         bool hasGlobalMetric = false;
 
+        IndexParams indexParams; // search settings of indexed entries
+
         int topN = 0;
+        int threads = 0; // <= 0 for one per core
         bool showHelp = false;
     };
 
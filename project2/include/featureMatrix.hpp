@@ -0,0 +1,92 @@
+/*
+Claire Liu, Yu-Jing Wei
+featureMatrix.hpp
+
+Path: include/featureMatrix.hpp
+Description: Header file for featureMatrix.cpp, a contiguous row-major matrix of
+             feature vectors.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <vector>
+
+/*
+FeatureMatrix stores all feature vectors of a database in one 64-byte aligned block.
+Rows are padded to a multiple of kAlignFloats floats (the widest SIMD register), so
+every row starts on a cache-line boundary and a scan over the database is a single
+sequential stream. Padding floats are always 0.
+
+A matrix either owns its memory or is a read-only view over memory owned by someone
+else, e.g. the mapping of a binary feature DB.
+public:
+    - FeatureMatrix(size_t rows, size_t cols): Allocates a zero-filled matrix.
+    - view(const float *data, size_t rows, size_t cols, size_t stride):
+        Wraps existing row-major data without copying it. The view is const, so
+        writing a row or appending to it does not compile, and it cannot be moved
+        into a non-const matrix by assignment.
+    - reserveRows(size_t rows): Grows the capacity so appends do not reallocate.
+    - appendRow(const float *values, size_t n): Adds a row. The first row fixes the
+        number of columns; returns -1 if n differs from it, 0 otherwise.
+    - rows(), cols(), stride(): Shape of the matrix; stride is in floats.
+    - row(size_t i), rowView(size_t i): Access to row i.
+    - strideFor(size_t cols): The padded row length used for cols columns.
+*/
+class FeatureMatrix
+{
+public:
+    /*
+    RowView is a non-owning view of one row (cols floats).
+    */
+    struct RowView
+    {
+        const float *data;
+        size_t size;
+
+        const float *begin() const { return data; }
+        const float *end() const { return data + size; }
+        float operator[](size_t i) const { return data[i]; }
+    };
+
+    FeatureMatrix() = default;
+    FeatureMatrix(size_t rows, size_t cols);
+    ~FeatureMatrix();
+    FeatureMatrix(FeatureMatrix &&other) noexcept;
+    FeatureMatrix &operator=(FeatureMatrix &&other) noexcept;
+    FeatureMatrix(const FeatureMatrix &) = delete;
+    FeatureMatrix &operator=(const FeatureMatrix &) = delete;
+
+    static const FeatureMatrix view(const float *data, size_t rows, size_t cols, size_t stride);
+
+    void reserveRows(size_t rows);
+    int appendRow(const float *values, size_t n);
+    int appendRow(const std::vector<float> &values) { return appendRow(values.data(), values.size()); }
+    void clear();
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t stride() const { return stride_; }
+    bool empty() const { return rows_ == 0; }
+
+    const float *data() const { return data_; }
+    const float *row(size_t i) const { return data_ + i * stride_; }
+    float *row(size_t i) { return owned_ + i * stride_; }
+    RowView rowView(size_t i) const { return RowView{row(i), cols_}; }
+
+    static size_t strideFor(size_t cols) { return (cols + kAlignFloats - 1) / kAlignFloats * kAlignFloats; }
+
+    // Rows are padded to a multiple of this many floats (one 64-byte cache line)
+    static const size_t kAlignFloats = 16;
+    static const size_t kAlignBytes = kAlignFloats * sizeof(float);
+
+private:
+    void reallocate(size_t capacityRows);
+
+    const float *data_ = nullptr; // first row, owned or viewed
+    float *owned_ = nullptr;      // allocation owned by this matrix, if any
+    size_t rows_ = 0;
+    size_t cols_ = 0;
+    size_t stride_ = 0;
+    size_t capacityRows_ = 0;
+};
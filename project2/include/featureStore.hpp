@@ -0,0 +1,157 @@
+/*
+Claire Liu, Yu-Jing Wei
+featureStore.hpp
+
+Path: include/featureStore.hpp
+Description: Header file for featureStore.cpp to write and memory-map multi-feature
+             stores (.fst), which keep several features of the same images in one file.
+*/
+
+#pragma once // Include guard
+
+#include "extractorFactory.hpp"
+#include "position.hpp"
+#include "quantization.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of a feature store (.fst), all values little-endian:
+- [0, headerSize): FeatureStoreHeader.
+- [groupsOffset, ...): groupCount FeatureGroupHeader entries, one per column group.
+- One matrix per column group at its page aligned dataOffset: rows x stride elements
+    of the group's data type, laid out like the matrix of a .fdb file.
+- [namesOffset, ...): filename string table shared by all groups, laid out like the
+    one of a .fdb file.
+- Then, 8-byte aligned, one table of rows doubles per group at its normsOffset: the L2
+    norm of every decoded row. normsOffset is 0 in stores written before norms were stored.
+- Then one table of dim uint32 per group at its orderOffset: the group's dimensions by
+    decreasing variance (see DimensionStats). orderOffset is 0 in stores written before
+    the order was stored.
+Row i of every group belongs to the same image, so the row index is the image ID and
+features of one image are joined by index instead of by filename.
+*/
+struct FeatureStoreHeader
+{
+    char magic[8];            // "CBIRFST" + '\0'
+    uint32_t version;         // format version, currently 1
+    uint32_t headerSize;      // sizeof(FeatureStoreHeader)
+    uint32_t groupCount;      // number of column groups
+    uint32_t groupHeaderSize; // sizeof(FeatureGroupHeader)
+    uint64_t rows;            // number of images
+    uint64_t groupsOffset;    // byte offset of the group directory
+    uint64_t namesOffset;     // byte offset of the filename string table
+    uint64_t fileSize;        // total file size, used to detect truncated files
+    uint8_t reserved[64];     // zero, room for future fields
+};
+
+/*
+One column group of a feature store: the features of one (feature, position) pair.
+*/
+struct FeatureGroupHeader
+{
+    int32_t featureType;  // FeatureType enum value
+    int32_t position;     // Position enum value
+    uint32_t dim;         // number of features per row
+    uint32_t stride;      // number of elements between the starts of two rows
+    int32_t dataType;     // FeatureDataType of the matrix
+    float quantScale;     // U8 only: value = quantOffset + quantScale * code
+    float quantOffset;    // U8 only
+    uint32_t transform;   // FeatureTransform applied before storing, 0 (none) in older stores
+    uint64_t dataOffset;  // byte offset of the matrix, page aligned
+    uint64_t normsOffset; // byte offset of the row norms, 0 if the store has none
+    uint64_t orderOffset; // byte offset of the dimension order, 0 if the store has none
+    uint8_t reserved[8];  // zero, room for future fields
+};
+
+/*
+Describes a column group to write: its feature, region, storage type and the transform
+its features have been through.
+*/
+struct FeatureGroupSpec
+{
+    FeatureType featureType = UNKNOWN_FEATURE;
+    Position position = Position::WHOLE;
+    FeatureDataType dataType = FeatureDataType::F32;
+    QuantParams qp;
+    FeatureTransform transform = FeatureTransform::NONE;
+};
+
+/*
+FeatureStore class opens a feature store with mmap. Like FeatureDB, opening costs
+O(1); a scan of one group only pages in that group's matrix.
+public:
+    - open(const char *path): Maps the file and validates its header and groups.
+        Returns 0 on success, -1 on error.
+    - close(): Unmaps the file. Called by the destructor.
+    - rows(), groupCount(): Number of images and column groups.
+    - findGroup(FeatureType featureType, Position position): Index of the group, -1 if none.
+    - featureType(g), position(g), dim(g), stride(g), dataType(g), quantParams(g), transform(g):
+        Description of group g.
+    - rawRow(size_t g, size_t i): Pointer to the stored elements of row i of group g.
+    - readRow(size_t g, size_t i, float *out): Decodes row i of group g to floats.
+    - filename(size_t i): 0-terminated image filename of row i.
+    - norms(size_t g): The L2 norm of every decoded row of group g, nullptr for stores
+        without norms.
+    - dimOrder(size_t g): The dimensions of group g by decreasing variance, nullptr for
+        stores without it.
+    - quantize(const char *inPath, const char *outPath, FeatureDataType dataType):
+        Re-encodes every group of a float32 store as U8 or F16; U8 scale and offset
+        are fitted per group, transforms are kept. Returns 0 on success, -1 on error.
+    - makeHeader(size_t groupCount, uint64_t rows, uint64_t namesOffset, uint64_t namesBytes,
+        uint64_t totalDim): Fills in a header for a store whose filename table starts at
+        namesOffset and is followed by the row norms and the dimension orders of every group.
+    - isFeatureStorePath(const std::string &path): true if path has the .fst extension.
+*/
+class FeatureStore
+{
+public:
+    FeatureStore() = default;
+    ~FeatureStore();
+    FeatureStore(const FeatureStore &) = delete;
+    FeatureStore &operator=(const FeatureStore &) = delete;
+
+    int open(const char *path);
+    void close();
+    bool isOpen() const { return header_ != nullptr; }
+
+    size_t rows() const { return header_ ? header_->rows : 0; }
+    size_t groupCount() const { return header_ ? header_->groupCount : 0; }
+    int findGroup(FeatureType featureType, Position position) const;
+
+    FeatureType featureType(size_t g) const { return static_cast<FeatureType>(groups_[g].featureType); }
+    Position position(size_t g) const { return static_cast<Position>(groups_[g].position); }
+    size_t dim(size_t g) const { return groups_[g].dim; }
+    size_t stride(size_t g) const { return groups_[g].stride; }
+    FeatureDataType dataType(size_t g) const { return static_cast<FeatureDataType>(groups_[g].dataType); }
+    QuantParams quantParams(size_t g) const { return QuantParams{groups_[g].quantScale, groups_[g].quantOffset}; }
+    FeatureTransform transform(size_t g) const { return static_cast<FeatureTransform>(groups_[g].transform); }
+
+    const void *rawRow(size_t g, size_t i) const { return groupData_[g] + i * rowBytes_[g]; }
+    void readRow(size_t g, size_t i, float *out) const
+    {
+        Quantization::decode(dataType(g), quantParams(g), rawRow(g, i), dim(g), out);
+    }
+    const char *filename(size_t i) const { return names_ + nameOffsets_[i]; }
+    const double *norms(size_t g) const { return norms_[g]; }
+    const uint32_t *dimOrder(size_t g) const { return dimOrders_[g]; }
+
+    static int quantize(const char *inPath, const char *outPath, FeatureDataType dataType);
+    static FeatureStoreHeader makeHeader(size_t groupCount, uint64_t rows, uint64_t namesOffset,
+                                         uint64_t namesBytes, uint64_t totalDim);
+    static bool isFeatureStorePath(const std::string &path);
+
+private:
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+    const FeatureStoreHeader *header_ = nullptr;
+    const FeatureGroupHeader *groups_ = nullptr;
+    std::vector<const char *> groupData_; // start of each group's matrix
+    std::vector<size_t> rowBytes_;        // bytes per row of each group
+    std::vector<const double *> norms_;   // row norms of each group, or nullptr
+    std::vector<const uint32_t *> dimOrders_; // dimension order of each group, or nullptr
+    const uint64_t *nameOffsets_ = nullptr;
+    const char *names_ = nullptr;
+};
@@ -0,0 +1,124 @@
+/*
+Claire Liu, Yu-Jing Wei
+featureTable.hpp
+
+Path: include/featureTable.hpp
+Description: Header file for featureTable.cpp to read a CSV file or a binary feature
+             database through one interface.
+*/
+
+#pragma once // Include guard
+
+#include "featureDB.hpp"
+#include "featureMatrix.hpp"
+#include "featureStore.hpp"
+#include "quantization.hpp"
+#include <string>
+#include <vector>
+
+/*
+FeatureTable is one loaded feature database, either a parsed CSV file, a mapped
+.fdb file or one column group of a mapped .fst store, together with the rows its
+manifest marks dead. The matcher uses it for plain databases and for each shard of
+a sharded one. Loading a binary table maps the file and reads only its header and
+filename table; feature rows are paged in when a scan reaches them, and only those
+of the table's own group of a .fst store.
+public:
+    - load(const std::string &path, int csvThreads, FeatureType featureType, Position position):
+        Loads the database. CSV files are parsed on csvThreads threads (<= 0 for one
+        per core); of a .fst store only the group of featureType and position is
+        used. Returns 0 or -1.
+    - path(): The path the table was loaded from.
+    - isStore(): true if the table is a group of a .fst store, whose row i is the same
+        image in every group.
+    - rows(), dim(), dataType(), quantParams(): Shape and storage type. CSV rows are float32.
+    - transform(): The transform the rows hold the features with.
+    - applyTransform(FeatureTransform t): Makes a CSV table hold its features transformed
+        by t; binary tables only hold the transform they were built with. Returns 0 or -1.
+    - rowBytes(): Bytes between the starts of two rows.
+    - rawRow(size_t i): Pointer to the stored elements of row i.
+    - prefetch(size_t first, size_t count): Starts paging in rows [first, first + count)
+        of a mapped .fdb or .fst table; a CSV table is in memory already.
+    - release(size_t first, size_t count): Drops those rows of a mapped table from the
+        process once a scan is done with them, if the mapped tables loaded before it
+        left too little of the resident budget for all of its rows. The budget is
+        CBIR_RESIDENT_MB MiB if that is set, otherwise a quarter of physical memory.
+    - readRow(size_t i, float *out): Decodes the dim features of row i to floats.
+    - rowNorms(): The L2 norm of every row, stored in .fdb / .fst files and computed when
+        a CSV file is parsed; nullptr for binary files written before norms were stored.
+    - dimOrder(): The dimensions by decreasing variance, stored in .fdb / .fst files and
+        computed when a CSV file is parsed; nullptr for binary files written before it was stored.
+    - filename(size_t i): Image filename of row i.
+    - isDead(size_t i): true if row i was replaced or deleted by an incremental update.
+    - findRow(const char *targetPath): The live row of the target image, -1 if none.
+    - fingerprint(): A hash of the shape and of sampled rows and filenames, by which an
+        index tells the table it was built from apart from a rebuilt or replaced one.
+*/
+class FeatureTable
+{
+public:
+    FeatureTable() = default;
+    ~FeatureTable();
+    FeatureTable(const FeatureTable &) = delete;
+    FeatureTable &operator=(const FeatureTable &) = delete;
+
+    int load(const std::string &path, int csvThreads = 0, FeatureType featureType = UNKNOWN_FEATURE,
+             Position position = Position::WHOLE);
+
+    const std::string &path() const { return path_; }
+    bool isStore() const { return kind_ == Kind::STORE; }
+    size_t rows() const { return rows_; }
+    size_t dim() const { return dim_; }
+    FeatureDataType dataType() const { return dataType_; }
+    QuantParams quantParams() const { return qp_; }
+    FeatureTransform transform() const { return transform_; }
+    int applyTransform(FeatureTransform t);
+
+    size_t rowBytes() const { return rowBytes_; }
+    const void *rawRow(size_t i) const { return data_ + i * rowBytes_; }
+    void prefetch(size_t first, size_t count) const;
+    void release(size_t first, size_t count) const;
+    void readRow(size_t i, float *out) const
+    {
+        Quantization::decode(dataType_, qp_, rawRow(i), dim_, out);
+    }
+    const double *rowNorms() const { return norms_; }
+    const uint32_t *dimOrder() const { return dimOrder_; }
+    const char *filename(size_t i) const;
+    bool isDead(size_t i) const { return !dead_.empty() && dead_[i]; }
+    long findRow(const char *targetPath) const;
+    uint64_t fingerprint() const;
+
+private:
+    void computeCsvStats();
+    static bool claimResident(size_t bytes);
+
+    enum class Kind
+    {
+        CSV,
+        DB,
+        STORE
+    };
+
+    std::string path_;
+    Kind kind_ = Kind::CSV;
+    FeatureDB db_;                       // mapped binary database
+    FeatureStore store_;                 // mapped multi-feature store
+    std::vector<std::string> csvNames_;  // image filenames of a CSV file
+    FeatureMatrix csvData_;              // feature rows of a CSV file
+    std::vector<double> csvNorms_;       // row norms of a CSV file
+    std::vector<uint32_t> csvOrder_;     // dimension order of a CSV file
+    std::vector<char> dead_;             // tombstones from the manifest, empty if none
+
+    // shape of the loaded matrix, whichever kind holds it
+    const char *data_ = nullptr;
+    size_t rows_ = 0;
+    size_t dim_ = 0;
+    size_t rowBytes_ = 0;
+    const double *norms_ = nullptr;
+    const uint32_t *dimOrder_ = nullptr;
+    bool keepResident_ = false; // holds rows_ * rowBytes_ of the resident budget
+    FeatureDataType dataType_ = FeatureDataType::F32;
+    QuantParams qp_;
+    FeatureTransform transform_ = FeatureTransform::NONE;
+};
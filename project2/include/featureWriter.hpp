@@ -0,0 +1,128 @@
+/*
+Claire Liu, Yu-Jing Wei
+featureWriter.hpp
+
+Path: include/featureWriter.hpp
+Description: Header file for featureWriter.cpp to write feature databases as CSV
+             or as binary feature DB files.
+*/
+
+#pragma once
+
+#include "IFeatureWriter.hpp"
+#include "dimensionStats.hpp"
+#include "featureDB.hpp"
+#include "featureStore.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+CSVFeatureWriter writes one line per image: the filename followed by the features
+formatted with std::to_chars as fixed-point numbers with 4 decimals, the same text
+csvUtil::append_image_data_csv produces.
+*/
+struct CSVFeatureWriter : public IFeatureWriter
+{
+    int append(const char *imageFilename, const std::vector<float> &features) override;
+
+protected:
+    int finish() override;
+    int copyRows(const std::vector<char> *dropRows) override;
+    bool growsInPlace() const override { return true; }
+    int resume() override;
+};
+
+/*
+FDBFeatureWriter streams rows into the binary feature DB layout described in
+featureDB.hpp. The matrix is written as rows arrive, encoded in the requested data
+type; the filename table, the row norms and the per-dimension statistics are kept in
+memory and written (the statistics as the dimension order) after the last row, and the header is filled in by finish() once the row count is known. When appending, the
+data type, scale/offset and transform of the existing database are kept. Rows are stored
+as given: the caller applies transform() to them. An append in place moves the trailer
+and rewrites the header without touching the existing rows (see finishInPlace()).
+*/
+struct FDBFeatureWriter : public IFeatureWriter
+{
+    FDBFeatureWriter(FeatureType featureType, Position position,
+                     FeatureDataType dataType = FeatureDataType::F32,
+                     const QuantParams &qp = QuantParams(),
+                     FeatureTransform transform = FeatureTransform::NONE)
+        : featureType_(featureType), position_(position), dataType_(dataType), qp_(qp),
+          transform_(transform) {}
+
+    int append(const char *imageFilename, const std::vector<float> &features) override;
+    FeatureTransform transform(size_t group) const override { return transform_; }
+
+protected:
+    int begin() override;
+    int finish() override;
+    int copyRows(const std::vector<char> *dropRows) override;
+    bool growsInPlace() const override { return true; }
+    int resume() override;
+
+private:
+    void adopt(const FeatureDB &db);
+    int finishInPlace(const FeatureDBHeader &h);
+    int writeTrailer(const FeatureDBHeader &h);
+    int writeHeader(const FeatureDBHeader &h);
+
+    FeatureType featureType_;
+    Position position_;
+    FeatureDataType dataType_;
+    QuantParams qp_;
+    FeatureTransform transform_;
+    size_t dim_ = 0;
+    size_t stride_ = 0;
+    std::vector<uint64_t> nameOffsets_;
+    std::string names_;
+    std::vector<double> norms_;
+    DimensionStats stats_;
+    std::vector<uint32_t> keptOrder_; // dimension order of the database appended to
+    FeatureDBHeader old_{}; // in place: the header of the database appended to
+    size_t oldRows_ = 0;
+    uint64_t spillStart_ = 0; // in place: where the new rows wait until commit()
+};
+
+/*
+FSTFeatureWriter writes a feature store (see featureStore.hpp). Rows arrive one image
+at a time but every column group is stored contiguously, so each group is first
+encoded into its own spill file next to the temporary output (unlinked right away, so
+nothing is left behind). finish() copies the spills after each other into the output,
+followed by the filename table, the row norms and dimension orders of every group and the final header. When appending, the groups of
+the existing store must match the requested ones and keep their data types and transforms.
+A group cannot grow without moving the groups after it, so an append copies the store.
+*/
+struct FSTFeatureWriter : public IFeatureWriter
+{
+    explicit FSTFeatureWriter(const std::vector<FeatureGroupSpec> &groups);
+    ~FSTFeatureWriter() override;
+
+    int append(const char *imageFilename, const std::vector<float> &features) override;
+    int appendGroups(const char *imageFilename, const std::vector<std::vector<float>> &groups) override;
+    FeatureTransform transform(size_t group) const override { return columns_[group].spec.transform; }
+
+protected:
+    int begin() override;
+    int finish() override;
+    int copyRows(const std::vector<char> *dropRows) override;
+
+private:
+    struct Column
+    {
+        FeatureGroupSpec spec;
+        size_t dim = 0;
+        size_t stride = 0;
+        FILE *spill = nullptr;
+        std::vector<double> norms;
+        DimensionStats stats;
+    };
+
+    void closeSpills();
+    int addName(const char *imageFilename);
+
+    std::vector<Column> columns_;
+    std::vector<char> rowBuffer_;
+    std::vector<uint64_t> nameOffsets_;
+    std::string names_;
+};
@@ -0,0 +1,62 @@
+/*
+Claire Liu, Yu-Jing Wei
+fileUtil.hpp
+
+Path: include/fileUtil.hpp
+Description: Header file for fileUtil.cpp to write binary files atomically and map
+             them back read-only.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/*
+FileUtil class provides the static helpers shared by the writers and readers of the
+binary files (.fdb, .fst, indexes, manifests). A file is written under a temporary
+name next to its final one and renamed into place once it is synced, so a reader sees
+either the old or the new file, never a partial one. A database extended in place
+instead keeps a valid header at every step and is cut back to the bytes that header
+covers when it is closed.
+public:
+    - alignUp(uint64_t value, uint64_t align): Rounds value up to a multiple of align.
+    - writeAll(FILE *fp, const void *data, size_t size): Writes a buffer; true if all
+        of it was written.
+    - writePadding(FILE *fp, uint64_t from, uint64_t to): Writes zero bytes from one
+        offset up to another.
+    - createTemp(const std::string &path, std::string &tmpPath): Opens the temporary
+        file "<path>.tmp.<pid>" for writing. Returns nullptr on error.
+    - commitTemp(FILE *fp, const std::string &tmpPath, const std::string &path, bool ok):
+        Syncs and closes the temporary file and renames it to path if ok and every step
+        succeeds; otherwise removes it. Returns 0 or -1.
+    - discardTemp(FILE *fp, const std::string &tmpPath): Closes and removes the
+        temporary file without reporting an error.
+    - syncFile(FILE *fp): Flushes a file and syncs it to disk; true on success.
+    - commitInPlace(FILE *fp, const std::string &path, uint64_t size, bool ok): Syncs a
+        file updated in place, cuts it to size and closes it. Returns 0, or -1 if ok is
+        false or a step fails.
+    - restoreInPlace(FILE *fp, uint64_t size): Cuts a file updated in place back to size
+        and closes it.
+    - mapReadOnly(const std::string &path, size_t minSize, const char *what, size_t &size):
+        Maps a whole file read-only if it holds at least minSize bytes; what names the
+        kind of file in the messages. Returns nullptr on error.
+    - unmap(void *map, size_t size): Unmaps a mapping from mapReadOnly() if not nullptr.
+*/
+class FileUtil
+{
+public:
+    static uint64_t alignUp(uint64_t value, uint64_t align);
+    static bool writeAll(FILE *fp, const void *data, size_t size);
+    static bool writePadding(FILE *fp, uint64_t from, uint64_t to);
+    static FILE *createTemp(const std::string &path, std::string &tmpPath);
+    static int commitTemp(FILE *fp, const std::string &tmpPath, const std::string &path, bool ok);
+    static void discardTemp(FILE *fp, const std::string &tmpPath);
+    static bool syncFile(FILE *fp);
+    static int commitInPlace(FILE *fp, const std::string &path, uint64_t size, bool ok);
+    static void restoreInPlace(FILE *fp, uint64_t size);
+    static void *mapReadOnly(const std::string &path, size_t minSize, const char *what, size_t &size);
+    static void unmap(void *map, size_t size);
+};
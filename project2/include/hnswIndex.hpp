@@ -0,0 +1,109 @@
+/*
+Claire Liu, Yu-Jing Wei
+hnswIndex.hpp
+
+Path: include/hnswIndex.hpp
+Description: Header file for hnswIndex.cpp, a hierarchical navigable small world
+             graph for approximate nearest-neighbour search.
+*/
+
+#pragma once // Include guard
+
+#include "IIndex.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of an HNSW index (.hnsw), all values little-endian:
+- [0, headerSize): HnswHeader.
+- [levelsOffset, ...): rows uint8, the top layer of every node.
+- [upperStartOffset, ...): rows uint64, where the upper-layer lists of every node
+    start in the upper section, in uint32 elements; 8-byte aligned.
+- [baseOffset, ...): rows lists of layer 0, each a count followed by room for
+    2 * links neighbour rows (uint32).
+- [upperOffset, ...): upperCount uint32, the lists of layers 1 .. level of every node
+    with a level above 0, each a count followed by room for links neighbour rows.
+*/
+struct HnswHeader
+{
+    char magic[8];             // "CBIRHNS" + '\0'
+    uint32_t version;          // format version, currently 1
+    uint32_t headerSize;       // sizeof(HnswHeader)
+    int32_t metric;            // MetricType the graph was built for
+    uint32_t dim;              // features per row of the indexed table
+    uint64_t rows;             // rows of the indexed table, one node each
+    uint64_t fingerprint;      // FeatureTable::fingerprint() of the indexed table
+    uint32_t links;            // neighbours per node and upper layer (M)
+    uint32_t efConstruction;   // candidate list length the graph was built with
+    uint32_t entryPoint;       // the node every search starts from
+    uint32_t maxLevel;         // the top layer of the entry point
+    uint64_t levelsOffset;     // byte offset of the node levels
+    uint64_t upperStartOffset; // byte offset of the upper list starts
+    uint64_t baseOffset;       // byte offset of the layer 0 lists
+    uint64_t upperOffset;      // byte offset of the upper layer lists
+    uint64_t upperCount;       // number of uint32 in the upper section
+    uint64_t fileSize;         // total file size, used to detect truncated files
+    uint8_t reserved[32];      // zero, room for future fields
+};
+
+/*
+HnswIndex is an HNSW graph (Malkov & Yashunin) over the rows of a feature table.
+Every row is a node of layer 0; a row reaches layer l with probability links^-l, so
+each layer up holds about 1/links of the nodes below it. A search walks greedily
+from the entry point on the top layer down to layer 1 and then keeps the efSearch
+nearest nodes found on layer 0, expanding the nearest one not yet expanded until
+none of them can improve the list. Neighbours are picked with the diversity
+heuristic of the paper, which keeps links into other clusters that plain nearest
+neighbours would crowd out. Distances are computed by the metric on the stored rows
+of the table, in its storage type, so the index adds only the links to the DB.
+Rows are inserted on several threads; each neighbour list has a lock while it is
+changed. A graph built on one thread is the same on every run.
+public:
+    - build(), save(), load(), search(): See IIndex. Only ssd and cosine are supported.
+    - links(): The neighbours per node and upper layer the graph was built with.
+    - levels(): The number of layers.
+*/
+class HnswIndex : public IIndex
+{
+public:
+    HnswIndex() : IIndex(HNSW) {}
+    ~HnswIndex() override;
+    HnswIndex(const HnswIndex &) = delete;
+    HnswIndex &operator=(const HnswIndex &) = delete;
+
+    int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+              size_t threads) override;
+    int save(const std::string &path) const override;
+    int load(const std::string &path) override;
+    int search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+               std::vector<IndexHit> &out, IndexStats *stats = nullptr) const override;
+
+    size_t links() const { return links_; }
+    size_t levels() const { return rows_ > 0 ? maxLevel_ + 1 : 0; }
+
+private:
+    void close();
+
+    size_t links_ = 0;
+    size_t efConstruction_ = 0;
+    uint32_t entry_ = 0;
+    size_t maxLevel_ = 0;
+
+    // a graph built in memory, empty when the index is mapped
+    std::vector<uint8_t> levelsBuf_;
+    std::vector<uint64_t> upperStartBuf_;
+    std::vector<uint32_t> baseBuf_;
+    std::vector<uint32_t> upperBuf_;
+
+    // the graph in use, pointing into the buffers or into the mapping
+    const uint8_t *levels_ = nullptr;
+    const uint64_t *upperStart_ = nullptr;
+    const uint32_t *base_ = nullptr;
+    const uint32_t *upper_ = nullptr;
+    uint64_t upperCount_ = 0;
+
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+};
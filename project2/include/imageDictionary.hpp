@@ -0,0 +1,40 @@
+/*
+Claire Liu, Yu-Jing Wei
+imageDictionary.hpp
+
+Path: include/imageDictionary.hpp
+Description: Header file for imageDictionary.cpp to map image filenames to dense
+             integer IDs.
+*/
+
+#pragma once // Include guard
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ImageDictionary interns image filenames: every distinct filename gets the next
+integer ID, so scores of the same image from several databases can be summed in
+a plain array indexed by ID. The filenames are not copied; they must outlive the
+dictionary, which holds for the filename tables of loaded feature databases.
+public:
+    - kNone: ID for rows that have no image, e.g. dead rows.
+    - intern(const char *filename): The ID of filename, assigned on first use.
+    - name(uint32_t id): The filename of an ID.
+    - size(): The number of IDs handed out.
+*/
+class ImageDictionary
+{
+public:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    uint32_t intern(const char *filename);
+    std::string_view name(uint32_t id) const { return names_[id]; }
+    size_t size() const { return names_.size(); }
+
+private:
+    std::unordered_map<std::string_view, uint32_t> ids_;
+    std::vector<std::string_view> names_;
+};
@@ -0,0 +1,98 @@
+/*
+Claire Liu, Yu-Jing Wei
+indexFactory.hpp
+
+Path: include/indexFactory.hpp
+Description: Header file for indexFactory.cpp to create search index instances
+             based on index type.
+*/
+
+#pragma once // Include guard
+
+#include "extractorFactory.hpp"
+#include "position.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Forward declaration of IIndex to avoid circular dependency
+class IIndex;
+
+/*
+Enumeration for the search indexes a feature DB can be given.
+- HNSW: Hierarchical navigable small world graph, an approximate nearest-neighbour
+    index for ssd and cosine. Each row is linked to its nearest rows on a stack of
+    ever sparser layers, and a query walks the graph greedily from the top layer down.
+- IVF: Inverted file, for any metric. The rows are clustered with k-means and stored
+    in one contiguous list per cluster; a query scans only the lists of the nprobe
+    centroids nearest to it.
+- PQ: Product quantization, for any metric. Every row is kept as one byte per
+    subspace of its features, naming the nearest of 256 trained centroids; a query
+    sums lookup tables over the codes of every row and may re-rank the best exactly.
+- VP_TREE: Vantage-point tree, exact search for ssd. Every node splits its rows at
+    the median distance to a vantage point, and a query skips the subtrees the
+    triangle inequality rules out.
+- INVERTED_BINS: Sparse inverted index over histogram bins, exact search for hist_ix.
+    Every bin lists the rows with mass in it, largest first; a query reads only the
+    lists of its occupied bins and stops once its top K are settled.
+- UNKNOWN_INDEX: A default value for unrecognized index types.
+*/
+enum IndexType
+{
+    HNSW,
+    IVF,
+    PQ,
+    VP_TREE,
+    INVERTED_BINS,
+    UNKNOWN_INDEX
+};
+
+/*
+Tuning knobs of the indexes. Build settings are stored in the index file, search
+settings are given per query.
+- links: HNSW build, the number of neighbours (M) a node keeps per layer; the bottom
+    layer keeps twice as many.
+- efConstruction: HNSW build, the length of the candidate list while inserting a row.
+- efSearch: HNSW search, the length of the candidate list of a query, at least the
+    number of results asked for. Larger values raise recall and cost.
+- lists: IVF build, the number of clusters, 0 for the square root of the rows.
+- nprobe: IVF search, the number of lists scanned per query. Larger values raise
+    recall and cost.
+- subspaces: PQ build, the number of subspaces (code bytes per row), 0 for one per
+    8 features.
+- rerank: PQ search, the number of best rows by estimated distance that are re-scored
+    exactly, 0 to return the estimates.
+*/
+struct IndexParams
+{
+    size_t links = 16;
+    size_t efConstruction = 200;
+    size_t efSearch = 64;
+    size_t lists = 0;
+    size_t nprobe = 8;
+    size_t subspaces = 0;
+    size_t rerank = 0;
+};
+
+/*
+IndexFactory class that provides static methods to create and name search indexes.
+- create(IndexType type): Returns a shared pointer to an empty IIndex of that type,
+                    to be built or loaded; nullptr if the type is unrecognized.
+- stringToIndexType(const char *typeStr): Converts a name ("hnsw", "ivf", "pq", "vptree", "bins") to the IndexType,
+                    UNKNOWN_INDEX if it does not match any known type.
+- indexTypeToString(IndexType type): Converts an IndexType back to its name, "Unknown"
+                    if the type is unrecognized.
+- indexPath(const std::string &dbPath, IndexType type, FeatureType featureType, Position position):
+                    The file the index of a DB lives in, next to it: "<db>.<type>", or
+                    "<db>.<feature>_<position>.<type>" for a group of a .fst store, whose
+                    groups each get their own index.
+*/
+class IndexFactory
+{
+public:
+    static std::shared_ptr<IIndex> create(IndexType type);
+    static IndexType stringToIndexType(const char *typeStr);
+    static std::string indexTypeToString(IndexType type);
+    static std::string indexPath(const std::string &dbPath, IndexType type, FeatureType featureType,
+                                 Position position);
+};
@@ -0,0 +1,101 @@
+/*
+Claire Liu, Yu-Jing Wei
+invertedBinIndex.hpp
+
+Path: include/invertedBinIndex.hpp
+Description: Header file for invertedBinIndex.cpp, a sparse inverted index over the
+             bins of histogram DBs for exact histogram-intersection search.
+*/
+
+#pragma once // Include guard
+
+#include "IIndex.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of an inverted bin index (.bins), all values little-endian:
+- [0, headerSize): BinsHeader.
+- [binStartOffset, ...): dim + 1 uint64, where each bin's postings start, in postings;
+    bin j holds postings [binStart[j], binStart[j + 1]).
+- [rowIdsOffset, ...): postings uint32, the table row of every posting.
+- [massesOffset, ...): postings float32, the mass of the row in the bin above base.
+Within a bin the postings run from the largest mass down, ties by row. Only masses
+above base are stored; every other row holds base in that bin.
+*/
+struct BinsHeader
+{
+    char magic[8];           // "CBIRBIN" + '\0'
+    uint32_t version;        // format version, currently 1
+    uint32_t headerSize;     // sizeof(BinsHeader)
+    int32_t metric;          // MetricType, always HIST_INTERSECTION
+    uint32_t dim;            // bins per row of the indexed table
+    float base;              // the empty bin value: 0, or the offset of a u8 table
+    uint32_t reserved0;      // zero, keeps the fields below 8-byte aligned
+    uint64_t rows;           // rows of the indexed table
+    uint64_t fingerprint;    // FeatureTable::fingerprint() of the indexed table
+    uint64_t postings;       // number of (row, mass) postings over all bins
+    uint64_t binStartOffset; // byte offset of the bin starts
+    uint64_t rowIdsOffset;   // byte offset of the posting rows
+    uint64_t massesOffset;   // byte offset of the posting masses
+    uint64_t fileSize;       // total file size, used to detect truncated files
+    uint8_t reserved[32];    // zero, room for future fields
+};
+
+/*
+InvertedBinIndex keeps, for every bin of a histogram DB, the rows with mass in that
+bin, largest mass first. Since min(q, 0) = 0, the intersection of a query with a row
+only gets contributions from the bins both occupy, so a search reads only the
+postings of the query's occupied bins. It goes score-at-a-time: it always takes the
+next postings of the bin whose next contribution min(q, mass) is largest, and adds
+them to the rows' partial scores. The unread postings of a bin contribute at most its
+next contribution, so once the K-th best partial score beats every other row's
+partial score plus those bounds, the top K are settled and the search stops; the K
+rows are then scored exactly. Colour histograms occupy few of their bins, so a query
+costs in proportion to the postings of its bins rather than to bins x rows. Only
+hist_ix and tables of non-negative features are supported. The postings are built on
+several threads, one block of rows or one bin per task.
+public:
+    - build(), save(), load(), search(), exact(): See IIndex; exact() is true. search() takes no parameters; its
+        stats count the postings read as visited and the exact scores as distances.
+    - postings(): The number of postings over all bins.
+*/
+class InvertedBinIndex : public IIndex
+{
+public:
+    InvertedBinIndex() : IIndex(INVERTED_BINS) {}
+    ~InvertedBinIndex() override;
+    InvertedBinIndex(const InvertedBinIndex &) = delete;
+    InvertedBinIndex &operator=(const InvertedBinIndex &) = delete;
+
+    int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+              size_t threads) override;
+    int save(const std::string &path) const override;
+    int load(const std::string &path) override;
+    int search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+               std::vector<IndexHit> &out, IndexStats *stats = nullptr) const override;
+    bool exact() const override { return true; }
+
+    size_t postings() const { return postings_; }
+
+private:
+    void close();
+
+    size_t postings_ = 0;
+    float base_ = 0.0f;
+
+    // an index built in memory, empty when the index is mapped
+    std::vector<uint64_t> binStartBuf_;
+    std::vector<uint32_t> rowIdsBuf_;
+    std::vector<float> massesBuf_;
+
+    // the index in use, pointing into the buffers or into the mapping
+    const uint64_t *binStart_ = nullptr;
+    const uint32_t *rowIds_ = nullptr;
+    const float *masses_ = nullptr;
+
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+};
@@ -0,0 +1,106 @@
+/*
+Claire Liu, Yu-Jing Wei
+ivfIndex.hpp
+
+Path: include/ivfIndex.hpp
+Description: Header file for ivfIndex.cpp, an inverted file index that clusters the
+             rows of a feature DB with k-means and searches only the nearest clusters.
+*/
+
+#pragma once // Include guard
+
+#include "IIndex.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of an IVF index (.ivf), all values little-endian:
+- [0, headerSize): IvfHeader.
+- [centroidsOffset, ...): lists centroids, float32, each padded to centroidStride floats.
+- [listStartOffset, ...): lists + 1 uint64, where each list starts in the rows below,
+    in rows; list l holds rows [listStart[l], listStart[l + 1]).
+- [rowIdsOffset, ...): rows uint32, the table row of every stored row.
+- [dataOffset, ...): rows copies of the table rows in list order, rowBytes each, encoded
+    like the table (dataType); page-aligned.
+- [normsOffset, ...): rows float64, the L2 norms of the stored rows in list order;
+    normsOffset is 0 if the table has no stored norms.
+*/
+struct IvfHeader
+{
+    char magic[8];            // "CBIRIVF" + '\0'
+    uint32_t version;         // format version, currently 1
+    uint32_t headerSize;      // sizeof(IvfHeader)
+    int32_t metric;           // MetricType the lists were clustered for
+    int32_t dataType;         // FeatureDataType of the stored rows
+    uint32_t dim;             // features per row of the indexed table
+    uint32_t lists;           // number of clusters (posting lists)
+    uint64_t rows;            // rows of the indexed table, each in exactly one list
+    uint64_t fingerprint;     // FeatureTable::fingerprint() of the indexed table
+    uint64_t rowBytes;        // bytes between the starts of two stored rows
+    uint64_t centroidStride;  // floats between the starts of two centroids
+    uint64_t centroidsOffset; // byte offset of the centroids
+    uint64_t listStartOffset; // byte offset of the list starts
+    uint64_t rowIdsOffset;    // byte offset of the row IDs
+    uint64_t dataOffset;      // byte offset of the stored rows
+    uint64_t normsOffset;     // byte offset of the row norms, 0 if none
+    uint64_t fileSize;        // total file size, used to detect truncated files
+    uint8_t reserved[32];     // zero, room for future fields
+};
+
+/*
+IvfIndex is an inverted file over the rows of a feature table. A k-means coarse
+quantizer is trained on rows sampled evenly from the table, and every row is then
+stored in the posting list of its nearest centroid: a contiguous copy of the row in
+the table's storage type, with its row number and norm. A search ranks the centroids
+against the query and scans only the nprobe nearest lists with the batch kernels of
+the metric, so it reads nprobe / lists of the rows. The file is memory-mapped, and
+a search pages in the centroids and the lists it probes only. Training runs KMeans
+on several threads. Any metric works, as the centroids are plain means of the rows.
+public:
+    - build(), save(), load(), search(): See IIndex. build() uses lists; search() uses nprobe.
+    - lists(): The number of posting lists.
+*/
+class IvfIndex : public IIndex
+{
+public:
+    IvfIndex() : IIndex(IVF) {}
+    ~IvfIndex() override;
+    IvfIndex(const IvfIndex &) = delete;
+    IvfIndex &operator=(const IvfIndex &) = delete;
+
+    int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+              size_t threads) override;
+    int save(const std::string &path) const override;
+    int load(const std::string &path) override;
+    int search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+               std::vector<IndexHit> &out, IndexStats *stats = nullptr) const override;
+
+    size_t lists() const { return lists_; }
+
+private:
+    void close();
+
+    size_t lists_ = 0;
+    size_t centroidStride_ = 0;
+    size_t rowBytes_ = 0;
+    FeatureDataType dataType_ = FeatureDataType::F32;
+
+    // an index built in memory, empty when the index is mapped
+    std::vector<float> centroidsBuf_;
+    std::vector<uint64_t> listStartBuf_;
+    std::vector<uint32_t> rowIdsBuf_;
+    std::vector<char> dataBuf_;
+    std::vector<double> normsBuf_;
+
+    // the index in use, pointing into the buffers or into the mapping
+    const float *centroids_ = nullptr;
+    const uint64_t *listStart_ = nullptr;
+    const uint32_t *rowIds_ = nullptr;
+    const char *data_ = nullptr;
+    const double *norms_ = nullptr;
+
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+};
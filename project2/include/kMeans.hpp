@@ -0,0 +1,40 @@
+/*
+Claire Liu, Yu-Jing Wei
+kMeans.hpp
+
+Path: include/kMeans.hpp
+Description: Header file for kMeans.cpp, the k-means clustering the search indexes
+             train their quantizers with.
+*/
+
+#pragma once // Include guard
+
+#include "featureMatrix.hpp"
+#include <cstddef>
+#include <cstdint>
+
+class IDistanceMetric;
+
+/*
+KMeans class provides static helpers for Lloyd's k-means over the rows of a matrix.
+Rows are assigned with the batch kernels of a metric (IDistanceMetric::computeCross),
+one block of rows per task, and centroids are the means of their rows. The centroids
+start at evenly spaced rows and ties go to the lower centroid, so a clustering is the
+same on every run and thread count.
+public:
+    - train(const IDistanceMetric &metric, const FeatureMatrix &sample, size_t k,
+        size_t iterations, size_t threads): Clusters the rows of sample into k <=
+        sample.rows() centroids, stopping early once no row changes cluster. An empty
+        cluster takes over half of the largest one. Returns the centroids, k rows.
+    - assign(const IDistanceMetric &metric, const FeatureMatrix &rows, const FeatureMatrix &centroids,
+        uint32_t *out, size_t threads): Writes the nearest centroid of every row to out.
+    threads == 0 uses one per core.
+*/
+class KMeans
+{
+public:
+    static FeatureMatrix train(const IDistanceMetric &metric, const FeatureMatrix &sample, size_t k,
+                               size_t iterations, size_t threads);
+    static void assign(const IDistanceMetric &metric, const FeatureMatrix &rows,
+                       const FeatureMatrix &centroids, uint32_t *out, size_t threads);
+};
@@ -0,0 +1,110 @@
+/*
+Claire Liu, Yu-Jing Wei
+manifest.hpp
+
+Path: include/manifest.hpp
+Description: Header file for manifest.cpp to track which image each row of a
+             feature database was extracted from, so fg can update it incrementally.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+One row of a feature database as recorded in its manifest.
+- size, mtimeSec, mtimeNsec: File size and modification time (st_mtim of stat(), in
+    seconds and nanoseconds since the epoch) of the image when it was extracted.
+- hash: FNV-1a hash of the image bytes, 0 if unknown (rows of a database that was
+    built before it had a manifest).
+- path: The image path, identical to the filename column of the row.
+*/
+struct ManifestEntry
+{
+    uint64_t size = 0;
+    int64_t mtimeSec = 0;
+    int64_t mtimeNsec = 0;
+    uint64_t hash = 0;
+    std::string path;
+};
+
+/*
+Manifest describes every row of a feature database and lives next to it as
+"<db>.manifest". It is a text file:
+
+    # CBIR feature manifest v2
+    rows <N>
+    dead <row> <row> ...
+    <size> <sec>.<nsec> <hash> <path>     (N lines, one per database row)
+
+Version 1 stored the mtime as a count of std::filesystem clock ticks, which depends on
+the standard library. Such manifests are still read; their mtimes match no file, so
+each image is compared by hash once and gets its mtime in the new form.
+
+Rows are never rewritten in place. When an image changes its old row is marked dead
+(a tombstone) and a new row is appended; rows of deleted images are marked dead too.
+compact() drops the dead rows once the database has been rewritten without them.
+Readers only need the first three lines, so honouring tombstones stays cheap.
+
+The database is committed before its manifest, so after a crash the database may
+have rows the manifest does not know yet (an interrupted append) or fewer rows
+(an interrupted compaction). reconcile() and readDeadRows() resolve both cases.
+public:
+    - load(const std::string &dbPath): Reads the manifest of a database.
+        Returns 0 on success, -1 if it is missing or invalid.
+    - save(const std::string &dbPath): Writes the manifest atomically.
+        Returns 0 on success, -1 on error.
+    - bootstrap(const std::vector<std::string> &dbFilenames): Builds a manifest for
+        a database that has none, from its filename column and the files on disk.
+    - reconcile(size_t dbRows): Repairs the manifest after an interrupted run.
+        Returns 0 on success, -1 if the database must be rebuilt.
+    - update(const std::vector<std::string> &imagePaths, std::vector<std::string> &toExtract):
+        Marks the rows of deleted and changed images dead and lists the images that
+        need to be extracted. Returns the number of rows marked dead.
+    - append(const std::string &path): Records a new row for an extracted image.
+    - compact(): Drops the dead rows, matching a database rewritten without them.
+    - rows(), deadCount(), isDead(size_t row), deadRows(): Row bookkeeping.
+    - modified(): true if the manifest changed since it was loaded or saved.
+    - pathFor(const std::string &dbPath): The manifest path of a database.
+    - readDeadRows(const std::string &dbPath, size_t dbRows, std::vector<char> &dead):
+        Reads only the header of a manifest and flags the rows a reader must skip.
+        dead stays empty if the database has no manifest. Returns 0 or -1.
+    - statFile(const std::string &path, ManifestEntry &out): Fills in the size and mtime
+        of out from stat(). Returns 0, or -1 if the file does not exist.
+    - hashFile(const std::string &path): Content hash of a file.
+*/
+class Manifest
+{
+public:
+    int load(const std::string &dbPath);
+    int save(const std::string &dbPath) const;
+
+    void bootstrap(const std::vector<std::string> &dbFilenames);
+    int reconcile(size_t dbRows);
+    size_t update(const std::vector<std::string> &imagePaths, std::vector<std::string> &toExtract);
+    int append(const std::string &path);
+    void compact();
+
+    size_t rows() const { return entries_.size(); }
+    size_t deadCount() const { return deadCount_; }
+    bool isDead(size_t row) const { return dead_[row] != 0; }
+    const std::vector<char> &deadRows() const { return dead_; }
+    bool modified() const { return modified_; }
+
+    static std::string pathFor(const std::string &dbPath);
+    static int readDeadRows(const std::string &dbPath, size_t dbRows, std::vector<char> &dead);
+    static int statFile(const std::string &path, ManifestEntry &out);
+    static uint64_t hashFile(const std::string &path);
+
+private:
+    void markDead(size_t row);
+
+    std::vector<ManifestEntry> entries_;
+    std::vector<char> dead_; // one flag per row, 1 = tombstone
+    size_t deadCount_ = 0;
+    mutable bool modified_ = false;
+};
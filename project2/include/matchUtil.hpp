@@ -9,7 +9,10 @@ Description: Header file for matchUtil.cpp to
 
 #pragma once // Include guard
 
+#include <cstdint>
+#include <limits>
 #include <vector>
+#include "imageDictionary.hpp"
 #include "matchResult.hpp"
 
 /*
@@ -41,4 +44,101 @@ class MatchUtil
 public:
     static bool compareMatches(const MatchResult &a, const MatchResult &b);
     static std::vector<MatchResult> getTopNMatches(const std::vector<MatchResult> &results, int N);
-};
\ No newline at end of file
+};
+
+/*
+TopKSelector keeps the K smallest (distance, id) pairs of a stream in O(K) memory.
+Pairs are ordered by distance, ties by ID, so the result does not depend on the
+order they arrive in or on how the stream was split between threads. Up to
+kSmallK entries live in a sorted array (an insertion shifts a few cache-resident
+entries); larger K uses a max-heap. Either way the worst kept entry is known, so
+most pairs are rejected with one comparison and selection costs O(N log K).
+public:
+    - TopKSelector(size_t k): Empty selector keeping at most k pairs.
+    - push(float distance, uint32_t id): Offers one pair.
+    - merge(const TopKSelector &other): Offers every pair other kept, e.g. to combine
+        the selectors of several threads.
+    - size(), capacity(): Number of pairs kept and K.
+    - threshold(): Distance of the worst kept pair once K are kept, infinity before;
+        a pair farther than this can never be selected.
+    - sorted(): The kept pairs, nearest first.
+    - appendResults(const ImageDictionary &dict, std::vector<MatchResult> &out): Appends
+        the kept pairs, nearest first, with the filenames of their IDs.
+*/
+class TopKSelector
+{
+public:
+    struct Entry
+    {
+        float distance;
+        uint32_t id;
+    };
+
+    explicit TopKSelector(size_t k) : k_(k) { entries_.reserve(k); }
+
+    void push(float distance, uint32_t id)
+    {
+        Entry e{distance, id};
+        if (entries_.size() == k_ && (k_ == 0 || !before(e, worst())))
+            return;
+        insert(e);
+    }
+    void merge(const TopKSelector &other);
+    size_t size() const { return entries_.size(); }
+    size_t capacity() const { return k_; }
+    float threshold() const
+    {
+        return k_ > 0 && entries_.size() == k_ ? worst().distance : std::numeric_limits<float>::infinity();
+    }
+    std::vector<Entry> sorted() const;
+    void appendResults(const ImageDictionary &dict, std::vector<MatchResult> &out) const;
+
+    static bool before(const Entry &a, const Entry &b)
+    {
+        return a.distance < b.distance || (a.distance == b.distance && a.id < b.id);
+    }
+
+    // Up to this K the entries are kept in a sorted array instead of a heap
+    static const size_t kSmallK = 32;
+
+private:
+    const Entry &worst() const { return k_ <= kSmallK ? entries_.back() : entries_.front(); }
+    void insert(const Entry &e);
+
+    size_t k_;
+    std::vector<Entry> entries_; // sorted ascending if k_ <= kSmallK, else a max-heap
+};
+
+/*
+ScoreBoard accumulates the fused distance of every image by its ImageDictionary ID.
+A bit per image records whether any database scored it, so images that no database
+holds are not ranked with distance 0.
+public:
+    - ScoreBoard(size_t numImages): Board for IDs [0, numImages), all unscored.
+    - add(uint32_t id, float distance): Adds a weighted distance to image id.
+    - isCovered(uint32_t id): true if any distance was added to image id.
+    - select(uint32_t first, uint32_t last, TopKSelector &best): Streams the covered
+        images with IDs in [first, last) into best.
+    - topN(const ImageDictionary &dict, int N, std::vector<MatchResult> &out, size_t threads):
+        Appends the N covered images with the smallest scores, nearest first, ties broken
+        by ID. The IDs are split into ranges selected on up to threads threads and the
+        selectors merged; filenames are only looked up for the N winners.
+*/
+class ScoreBoard
+{
+public:
+    explicit ScoreBoard(size_t numImages) : score_(numImages, 0.0f), covered_((numImages + 63) / 64, 0) {}
+
+    void add(uint32_t id, float distance)
+    {
+        score_[id] += distance;
+        covered_[id >> 6] |= uint64_t(1) << (id & 63);
+    }
+    bool isCovered(uint32_t id) const { return (covered_[id >> 6] >> (id & 63)) & 1; }
+    void select(uint32_t first, uint32_t last, TopKSelector &best) const;
+    void topN(const ImageDictionary &dict, int N, std::vector<MatchResult> &out, size_t threads = 1) const;
+
+private:
+    std::vector<float> score_;
+    std::vector<uint64_t> covered_; // one bit per image
+};
@@ -10,6 +10,7 @@ instances based on feature type.
 #pragma once // Include guard
 
 #include "extractorFactory.hpp"
+#include "quantization.hpp"
 #include <memory>
 #include <vector>
 
@@ -27,6 +28,9 @@ Enumeration for different distance metric types that can be used to compare feat
 - COSINE: Cosine similarity, which computes the cosine of the angle between two feature vectors.
     Higher values indicate more similar features, so we convert it to a distance
     by subtracting from 1.
+- HELLINGER: Squared Hellinger distance of two histograms, 1 minus their Bhattacharyya
+    coefficient sum(sqrt(a[i] * b[i])). It runs on square-rooted features, where the
+    coefficient is a dot product, so the DB must store them with FeatureTransform::SQRT.
 - UNKNOWN_METRIC: A default value for unrecognized metric types.
 */
 enum MetricType
@@ -34,6 +38,7 @@ enum MetricType
     SSD,
     HIST_INTERSECTION,
     COSINE,
+    HELLINGER,
     UNKNOWN_METRIC
 };
 
@@ -50,6 +55,8 @@ based on the specified MetricType.
 - metricTypeToString(MetricType type): A utility method that converts a MetricType enum
                     value back to its string representation for display purposes. If the
                     type is unrecognized, it returns "Unknown".
+- transformFor(MetricType type): The transform the features of a DB must be stored with
+                    for the metric, FeatureTransform::SQRT for HELLINGER and NONE otherwise.
 */
 class MetricFactory
 {
@@ -57,4 +64,5 @@ public:
     static std::shared_ptr<IDistanceMetric> create(MetricType type);
     static MetricType stringToMetricType(const char *typeStr);
     static std::string metricTypeToString(MetricType type);
+    static FeatureTransform transformFor(MetricType type);
 };
\ No newline at end of file
@@ -0,0 +1,33 @@
+/*
+Claire Liu, Yu-Jing Wei
+pageUtil.hpp
+
+Path: include/pageUtil.hpp
+Description: Header file for pageUtil.cpp to control which pages of a memory-mapped
+             file are resident.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+
+/*
+PageUtil class provides static helpers that tell the kernel how a read-only file
+mapping (.fdb, .fst) is about to be used. They are hints: on failure nothing happens
+and the pages are faulted in on demand as before.
+public:
+    - pageSize(): The size of a virtual memory page.
+    - willNeed(const void *addr, size_t bytes): Starts reading the pages of the range
+        in the background, so a scan does not stall on each page fault.
+    - release(const void *addr, size_t bytes): Drops the pages that lie completely
+        inside the range from the process. The page cache keeps the data as long as
+        memory allows, so touching it again is cheap, but the kernel can reclaim it
+        without pressure on the rest of the process.
+*/
+class PageUtil
+{
+public:
+    static size_t pageSize();
+    static void willNeed(const void *addr, size_t bytes);
+    static void release(const void *addr, size_t bytes);
+};
@@ -0,0 +1,103 @@
+/*
+Claire Liu, Yu-Jing Wei
+pqIndex.hpp
+
+Path: include/pqIndex.hpp
+Description: Header file for pqIndex.cpp, a product quantization index that keeps
+             every row of a feature DB as a few bytes of codes.
+*/
+
+#pragma once // Include guard
+
+#include "IIndex.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk layout of a PQ index (.pq), all values little-endian:
+- [0, headerSize): PqHeader.
+- [codebooksOffset, ...): subspaces codebooks of DistanceKernels::kAdcCodes centroids
+    each, float32, every centroid padded to codeStride floats; centroids past codes
+    are zero.
+- [codesOffset, ...): the codes of the rows in blocks of DistanceKernels::kAdcBlock
+    rows, each block subspace-major (the codes of subspace 0 for its rows, then of
+    subspace 1, ...); the last block is padded with code 0; page-aligned.
+Subspace j covers dim / subspaces features, one more for the first dim % subspaces.
+*/
+struct PqHeader
+{
+    char magic[8];            // "CBIRPQ" + '\0' '\0'
+    uint32_t version;         // format version, currently 1
+    uint32_t headerSize;      // sizeof(PqHeader)
+    int32_t metric;           // MetricType the distances are estimated for
+    uint32_t dim;             // features per row of the indexed table
+    uint32_t subspaces;       // code bytes per row (M)
+    uint32_t codes;           // centroids trained per subspace, at most 256
+    uint64_t rows;            // rows of the indexed table
+    uint64_t fingerprint;     // FeatureTable::fingerprint() of the indexed table
+    uint64_t codeStride;      // floats between the starts of two centroids
+    uint64_t codebooksOffset; // byte offset of the codebooks
+    uint64_t codesOffset;     // byte offset of the row codes
+    uint64_t fileSize;        // total file size, used to detect truncated files
+    uint8_t reserved[32];     // zero, room for future fields
+};
+
+/*
+PqIndex is a product quantizer over the rows of a feature table (Jegou et al.). The
+features are split into M subspaces, a codebook of 256 centroids is trained per
+subspace with KMeans, and every row is kept as the M bytes naming its nearest
+centroid in each subspace, e.g. 64 bytes for a 512-float row. A search computes
+asymmetric distances (ADC): the exact query against the quantized rows. One lookup
+table per subspace holds the partial distance from the query to each centroid, and
+the distance to a row is the sum of M table entries, scanned with the adcScan kernel
+of DistanceKernels over blocks of codes stored subspace-major. With rerank, the best
+ADC candidates are re-scored exactly on the table's own rows, so the rows are read
+only for those. Training and encoding run on several threads.
+Every metric whose distance is a sum over the features gets its own tables: ssd sums
+squared differences, hist_ix and hellinger sum the per-feature min and product. The
+codebooks of cosine are trained on unit-length rows, for which the cosine distance
+is half the ssd.
+public:
+    - build(), save(), load(), search(): See IIndex. build() uses subspaces; search()
+        uses rerank.
+    - subspaces(): The number of subspaces, the code bytes per row.
+*/
+class PqIndex : public IIndex
+{
+public:
+    PqIndex() : IIndex(PQ) {}
+    ~PqIndex() override;
+    PqIndex(const PqIndex &) = delete;
+    PqIndex &operator=(const PqIndex &) = delete;
+
+    int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+              size_t threads) override;
+    int save(const std::string &path) const override;
+    int load(const std::string &path) override;
+    int search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+               std::vector<IndexHit> &out, IndexStats *stats = nullptr) const override;
+
+    size_t subspaces() const { return subspaces_; }
+
+private:
+    void close();
+    size_t subStart(size_t j) const;
+    size_t blocks() const;
+
+    size_t subspaces_ = 0;
+    size_t codes_ = 0;
+    size_t codeStride_ = 0;
+
+    // an index built in memory, empty when the index is mapped
+    std::vector<float> codebooksBuf_;
+    std::vector<uint8_t> rowCodesBuf_;
+
+    // the index in use, pointing into the buffers or into the mapping
+    const float *codebooks_ = nullptr;
+    const uint8_t *rowCodes_ = nullptr;
+
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+};
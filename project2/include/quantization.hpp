@@ -0,0 +1,138 @@
+/*
+Claire Liu, Yu-Jing Wei
+quantization.hpp
+
+Path: include/quantization.hpp
+Description: Header file for quantization.cpp to encode feature vectors as uint8
+             or fp16 for compact feature databases.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+Enumeration for the element types a binary feature DB can store.
+- F32: 32-bit floats, the features as extracted.
+- U8: 8-bit codes q with value = offset + scale * q, one scale/offset per database.
+- F16: IEEE half precision floats.
+*/
+enum class FeatureDataType : int32_t
+{
+    F32 = 0,
+    U8 = 1,
+    F16 = 2
+};
+
+/*
+Enumeration for the transforms a binary feature DB can apply to the features before
+storing them. Queries against the DB must be transformed the same way.
+- NONE: The features as extracted.
+- SQRT: The square root of every feature, negative values stored as 0. For histograms
+    the dot product of two transformed vectors is their Bhattacharyya coefficient, so
+    the Hellinger distance runs on the dot-product kernels (see HellingerDistance).
+*/
+enum class FeatureTransform : uint32_t
+{
+    NONE = 0,
+    SQRT = 1
+};
+
+/*
+Per-database parameters of U8 storage: value = offset + scale * code.
+*/
+struct QuantParams
+{
+    float scale = 1.0f;
+    float offset = 0.0f;
+};
+
+/*
+Quantization class provides static helpers to encode feature vectors in the
+compact storage types and to convert fp16 values.
+- elementSize(FeatureDataType type): Bytes per stored feature.
+- strideFor(FeatureDataType type, size_t dim): Row length in elements, padded so
+    every row is a multiple of 64 bytes.
+- fitU8(const float *data, size_t rows, size_t cols, size_t stride): Scale/offset
+    that map [min, max] of a row-major matrix onto the codes 0..255.
+- encode(FeatureDataType type, const QuantParams &qp, const float *values, size_t n,
+    void *out): Writes n values in the given storage type to out.
+- encode(FeatureDataType type, const QuantParams &qp, const std::vector<float> &values):
+    Same, into a new byte vector.
+- decode(FeatureDataType type, const QuantParams &qp, const void *in, size_t n,
+    float *out): The inverse of encode (lossy for U8 and F16).
+- norm(FeatureDataType type, const QuantParams &qp, const void *in, size_t n): L2 norm
+    of the decoded values, summed in double.
+- floatToHalf(float v), halfToFloat(uint16_t h): IEEE fp16 conversions.
+- stringToDataType(const char *s), dataTypeToString(FeatureDataType type):
+    "f32" | "u8" | "f16" conversions; unknown strings return F32 and set ok to false.
+- applyTransform(FeatureTransform t, float *values, size_t n): Transforms n values in place.
+- stringToTransform(const char *s), transformToString(FeatureTransform t):
+    "none" | "sqrt" conversions; unknown strings return NONE and set ok to false.
+*/
+class Quantization
+{
+public:
+    static size_t elementSize(FeatureDataType type);
+    static size_t strideFor(FeatureDataType type, size_t dim);
+
+    static QuantParams fitU8(const float *data, size_t rows, size_t cols, size_t stride);
+
+    static void encode(FeatureDataType type, const QuantParams &qp,
+                       const float *values, size_t n, void *out);
+    static std::vector<uint8_t> encode(FeatureDataType type, const QuantParams &qp,
+                                       const std::vector<float> &values);
+    static void decode(FeatureDataType type, const QuantParams &qp,
+                       const void *in, size_t n, float *out);
+    static double norm(FeatureDataType type, const QuantParams &qp, const void *in, size_t n);
+
+    static uint16_t floatToHalf(float v);
+    static inline float halfToFloat(uint16_t h);
+
+    static FeatureDataType stringToDataType(const char *s, bool *ok = nullptr);
+    static std::string dataTypeToString(FeatureDataType type);
+    static void applyTransform(FeatureTransform t, float *values, size_t n);
+    static FeatureTransform stringToTransform(const char *s, bool *ok = nullptr);
+    static std::string transformToString(FeatureTransform t);
+};
+
+/*
+Converts an IEEE half to float. Inline because the fp16 distance kernels call it
+for every element; ARM has a native half type, elsewhere the bits are rebuilt.
+*/
+inline float Quantization::halfToFloat(uint16_t h)
+{
+#if defined(__ARM_FP16_FORMAT_IEEE)
+    __fp16 v;
+    std::memcpy(&v, &h, sizeof(h));
+    return (float)v;
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) // inf / nan
+        bits = sign | 0x7f800000 | (mant << 13);
+    else if (exp != 0) // normal
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    else if (mant == 0) // zero
+        bits = sign;
+    else // subnormal half: normalize the mantissa
+    {
+        exp = 113;
+        while ((mant & 0x400) == 0)
+        {
+            mant <<= 1;
+            --exp;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+#endif
+}
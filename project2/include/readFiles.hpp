@@ -8,6 +8,8 @@ Description: Header file for readFiles.cpp to read image files in a directory.
 
 #pragma once // Include guard
 
+#include "featureDB.hpp"
+#include "featureMatrix.hpp"
 #include <opencv2/opencv.hpp>
 
 /*
@@ -20,14 +22,27 @@ to read features from a CSV file.
     It reads all the files in the specified directory and stores their full paths in
     the provided vector. It returns an integer status code (e.g., 0 for success, -1 for failure).
 - readFeaturesFromCSV(
-        char *filename,
-        std::vector<char *> &filenames,
-        std::vector<std::vector<float>> &data):
-    A static method that takes a CSV filename, a reference to a vector of character pointers
-    for filenames, and a reference to a vector of vectors of floats for feature data.
+        const char *filename,
+        std::vector<std::string> &filenames,
+        FeatureMatrix &data,
+        int numThreads):
+    A static method that takes a CSV filename, a reference to a vector of strings
+    for filenames, and a reference to a FeatureMatrix for feature data.
     It reads the CSV file, extracts the filenames and their corresponding feature vectors,
-    and stores them in the provided vectors.
+    and stores the filenames in the vector and the features as the rows of the matrix.
+    The file is parsed on numThreads threads (<= 0 for one per core).
     It returns an integer status code (e.g., 0 for success, -1 for failure).
+- readFeaturesFromDB(
+        const char *filename,
+        FeatureDB &db):
+    A static method that opens a binary feature database (.fdb) with mmap. The rows and
+    filenames are read in place from the mapping instead of being parsed and copied.
+    It returns an integer status code (e.g., 0 for success, -1 for failure).
+- readFilenamesFromDB(
+        const char *filename,
+        std::vector<std::string> &filenames):
+    A static method that reads only the filename column of a CSV file, a binary feature
+    database or a feature store, one entry per row. It returns an integer status code (e.g., 0 for success, -1 for failure).
 - isTargetImageInDatabase(
         const char *targetPath,
         const std::vector<char *> &dbFilenames):
@@ -45,7 +60,16 @@ public:
     static int readFeaturesFromCSV(
         const char *filename,
         std::vector<std::string> &filenames,
-        std::vector<std::vector<float>> &data);
+        FeatureMatrix &data,
+        int numThreads = 0);
+
+    static int readFeaturesFromDB(
+        const char *filename,
+        FeatureDB &db);
+
+    static int readFilenamesFromDB(
+        const char *filename,
+        std::vector<std::string> &filenames);
 
     static bool isTargetImageInDatabase(
         const char *targetPath,
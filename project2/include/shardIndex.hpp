@@ -0,0 +1,72 @@
+/*
+Claire Liu, Yu-Jing Wei
+shardIndex.hpp
+
+Path: include/shardIndex.hpp
+Description: Header file for shardIndex.cpp to describe a feature database that is
+             split into several shard files.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+Enumeration for how images are assigned to shards.
+- HASH: By a hash of the image filename (without directories), so an image always
+    lands in the same shard and shards of different features cover the same images.
+- RANGE: By position in the sorted image list when the database is first built;
+    images added later go to the last shard.
+*/
+enum class ShardScheme
+{
+    HASH,
+    RANGE
+};
+
+/*
+ShardIndex is the small text file ("<db>.shards") that lists the shards of a
+database, each of them an ordinary .csv or .fdb file with its own manifest:
+
+    # CBIR shard index v1
+    scheme hash
+    shards <N>
+    <shard path>     (N lines; relative paths are relative to the index file)
+
+Shards may live in other directories, e.g. on other disks.
+public:
+    - load(const std::string &indexPath): Reads an index. Returns 0 on success, -1 on error.
+    - save(const std::string &indexPath): Writes the index atomically. Returns 0 or -1.
+    - create(...): Lays out a new index with numShards shards named
+        "<index base>.<i><ext>", spread round-robin over dirs (or next to the index).
+    - size(), scheme(): Number of shards and assignment scheme.
+    - shardPath(size_t i): Path of shard i, usable with fopen.
+    - hashShard(const std::string &imagePath, size_t numShards): The HASH shard of an image.
+    - isShardIndexPath(const std::string &path): true if path has the .shards extension.
+    - stringToScheme(const char *s, bool *ok), schemeToString(ShardScheme scheme):
+        "hash" | "range" conversions.
+*/
+class ShardIndex
+{
+public:
+    int load(const std::string &indexPath);
+    int save(const std::string &indexPath) const;
+    static ShardIndex create(const std::string &indexPath, size_t numShards, ShardScheme scheme,
+                             const std::string &ext, const std::vector<std::string> &dirs);
+
+    size_t size() const { return paths_.size(); }
+    ShardScheme scheme() const { return scheme_; }
+    std::string shardPath(size_t i) const;
+
+    static size_t hashShard(const std::string &imagePath, size_t numShards);
+    static bool isShardIndexPath(const std::string &path);
+    static ShardScheme stringToScheme(const char *s, bool *ok = nullptr);
+    static std::string schemeToString(ShardScheme scheme);
+
+private:
+    ShardScheme scheme_ = ShardScheme::HASH;
+    std::string dir_;                // directory of the index file
+    std::vector<std::string> paths_; // shard paths as written in the index
+};
@@ -0,0 +1,28 @@
+/*
+Claire Liu, Yu-Jing Wei
+threadUtil.hpp
+
+Path: include/threadUtil.hpp
+Description: Header file for threadUtil.cpp to run independent tasks on several threads.
+*/
+
+#pragma once // Include guard
+
+#include <cstddef>
+#include <functional>
+
+/*
+ThreadUtil class provides static helpers for running independent tasks in parallel.
+public:
+    - defaultThreads(): The number of hardware threads, at least 1.
+    - parallelFor(size_t n, const std::function<void(size_t)> &fn, size_t maxThreads):
+        Runs fn(i) for every i in [0, n). Tasks are handed out one at a time, so
+        tasks of different cost (e.g. shards of different size) balance out. The
+        calling thread works too. maxThreads == 0 uses defaultThreads().
+*/
+class ThreadUtil
+{
+public:
+    static size_t defaultThreads();
+    static void parallelFor(size_t n, const std::function<void(size_t)> &fn, size_t maxThreads = 0);
+};
@@ -0,0 +1,108 @@
+/*
+Claire Liu, Yu-Jing Wei
+vpTreeIndex.hpp
+
+Path: include/vpTreeIndex.hpp
+Description: Header file for vpTreeIndex.cpp, a vantage-point tree that answers exact
+             Euclidean queries on a feature DB with triangle-inequality pruning.
+*/
+
+#pragma once // Include guard
+
+#include "IIndex.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+One node of a VP-tree, covering the rows order[begin, end). An inner node's vantage
+point is order[begin]; the rows nearer to it than the median follow in
+order[begin + 1, mid) and form the inside child, stored right after the node, and the
+others form the outside child at node outside. A leaf has outside == 0 and holds its
+rows itself. The bounds are Euclidean distances to the vantage point.
+*/
+struct VpNode
+{
+    uint32_t begin;     // first position in order
+    uint32_t end;       // one past the last position in order
+    uint32_t outside;   // node of the outside child, 0 for a leaf
+    float insideMax;    // largest distance from the vantage point inside
+    float outsideMin;   // smallest distance from the vantage point outside
+};
+
+/*
+On-disk layout of a VP-tree index (.vptree), all values little-endian:
+- [0, headerSize): VpHeader.
+- [nodesOffset, ...): nodes VpNode, in preorder; node 0 is the root.
+- [orderOffset, ...): rows uint32, the table rows in tree order.
+*/
+struct VpHeader
+{
+    char magic[8];        // "CBIRVPT" + '\0'
+    uint32_t version;     // format version, currently 1
+    uint32_t headerSize;  // sizeof(VpHeader)
+    int32_t metric;       // MetricType, always SSD
+    uint32_t dim;         // features per row of the indexed table
+    uint32_t leafRows;    // largest number of rows in a leaf
+    uint32_t reserved0;   // zero, keeps the fields below 8-byte aligned
+    uint64_t rows;        // rows of the indexed table
+    uint64_t fingerprint; // FeatureTable::fingerprint() of the indexed table
+    uint64_t nodes;       // number of nodes
+    uint64_t nodesOffset; // byte offset of the nodes
+    uint64_t orderOffset; // byte offset of the row order
+    uint64_t fileSize;    // total file size, used to detect truncated files
+    uint8_t reserved[32]; // zero, room for future fields
+};
+
+/*
+VpTreeIndex is a vantage-point tree (Yianilos) for exact search under ssd. Every inner
+node picks a row as vantage point and splits its other rows at the median Euclidean
+distance (the square root of the ssd) to it; since that distance is a metric, the
+triangle inequality bounds the distance from a query to every row of a child, and a
+search skips every child whose bound is beyond the K-th best distance found so far.
+The result is the exact top K of a scan, at a cost that depends on how well the rows
+spread out: low-dimensional features such as baseline prune far more than 512-bin
+histograms. The nodes are one flat array in preorder, so an inside child follows its
+parent in memory, and the levels of the tree are split on several threads; the
+layout depends only on the number of rows, so a build is the same on every thread
+count.
+public:
+    - build(), save(), load(), search(), exact(): See IIndex; exact() is true. Only ssd is supported; search()
+        takes no parameters and its stats count the tree nodes visited.
+    - nodes(): The number of tree nodes.
+*/
+class VpTreeIndex : public IIndex
+{
+public:
+    VpTreeIndex() : IIndex(VP_TREE) {}
+    ~VpTreeIndex() override;
+    VpTreeIndex(const VpTreeIndex &) = delete;
+    VpTreeIndex &operator=(const VpTreeIndex &) = delete;
+
+    int build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+              size_t threads) override;
+    int save(const std::string &path) const override;
+    int load(const std::string &path) override;
+    int search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+               std::vector<IndexHit> &out, IndexStats *stats = nullptr) const override;
+    bool exact() const override { return true; }
+
+    size_t nodes() const { return nodeCount_; }
+
+private:
+    void close();
+
+    size_t nodeCount_ = 0;
+
+    // an index built in memory, empty when the index is mapped
+    std::vector<VpNode> nodesBuf_;
+    std::vector<uint32_t> orderBuf_;
+
+    // the index in use, pointing into the buffers or into the mapping
+    const VpNode *nodes_ = nullptr;
+    const uint32_t *order_ = nullptr;
+
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+};
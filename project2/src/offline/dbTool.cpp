@@ -0,0 +1,476 @@
+/*
+Claire Liu, Yu-Jing Wei
+dbTool.cpp
+
+Path: project2/src/offline/dbTool.cpp
+Description: Maintenance tool for binary feature databases: converts them to
+compact storage types and measures how that changes the rankings, builds search
+indexes and measures their recall, and checks and times the SIMD distance kernels
+of this CPU.
+*/
+
+#include "IDistanceMetric.hpp"
+#include "IIndex.hpp"
+#include "dbToolCLI.hpp"
+#include "distanceKernels.hpp"
+#include "featureDB.hpp"
+#include "featureStore.hpp"
+#include "featureTable.hpp"
+#include "indexFactory.hpp"
+#include "matchUtil.hpp"
+#include "metricFactory.hpp"
+#include "quantization.hpp"
+#include "readFiles.hpp"
+#include "shardIndex.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+  /*
+  Computes the distance from row q to every row of a database, in the storage
+  type of the database. The query row itself gets infinity so it never ranks.
+  - @param db The database.
+  - @param metric The distance metric.
+  - @param q The query row.
+  - @param out Receives one distance per row.
+  */
+  void distancesFromRow(const FeatureDB &db, const IDistanceMetric &metric,
+                        size_t q, std::vector<float> &out)
+  {
+    out.resize(db.rows());
+    metric.computeManyEncoded(db.dataType(), db.rawRow(q), db.rawRow(0), db.rows(),
+                              db.dim(), db.stride(), db.quantParams(), out.data(),
+                              db.norms());
+    out[q] = std::numeric_limits<float>::infinity();
+  }
+
+  /*
+  Returns the row indices of the k smallest distances, ties broken by index.
+  - @param dist The distances.
+  - @param k The number of rows to return.
+  - @return The row indices, nearest first.
+  */
+  std::vector<size_t> topK(const std::vector<float> &dist, size_t k)
+  {
+    TopKSelector best(k);
+    for (size_t i = 0; i < dist.size(); ++i)
+      best.push(dist[i], (uint32_t)i);
+    std::vector<size_t> idx;
+    for (const TopKSelector::Entry &e : best.sorted())
+      idx.push_back(e.id);
+    return idx;
+  }
+
+  /*
+  Re-encodes a float32 database or feature store in a compact storage type.
+  - @param args The parsed command line arguments.
+  - @return 0 on success, -1 on error.
+  */
+  int runQuantize(const DbToolCLI::Args &args)
+  {
+    if (args.inputPath.empty() || args.outputPath.empty())
+    {
+      printf("Error: quantize needs --input and --output.\n");
+      return -1;
+    }
+    bool ok = false;
+    FeatureDataType type = Quantization::stringToDataType(args.quantStr.c_str(), &ok);
+    if (FeatureStore::isFeatureStorePath(args.outputPath))
+    {
+      if (ok && FeatureStore::isFeatureStorePath(args.inputPath))
+        return FeatureStore::quantize(args.inputPath.c_str(), args.outputPath.c_str(), type);
+    }
+    else if (ok && FeatureDB::isFeatureDBPath(args.outputPath))
+    {
+      return FeatureDB::quantize(args.inputPath.c_str(), args.outputPath.c_str(), type);
+    }
+    printf("Error: expected -q u8|f16 and an .fdb or .fst output path.\n");
+    return -1;
+  }
+
+  /*
+  Creates the metric named on the command line and checks that a database stores
+  its features the way the metric needs them (see MetricFactory::transformFor).
+  - @param name The metric name.
+  - @param db The database the metric ranks.
+  - @param path The path of the database, for messages.
+  - @return The metric, nullptr on error.
+  */
+  std::shared_ptr<IDistanceMetric> metricFor(const std::string &name, const FeatureDB &db,
+                                             const std::string &path)
+  {
+    MetricType metricType = MetricFactory::stringToMetricType(name.c_str());
+    auto metric = MetricFactory::create(metricType);
+    if (!metric)
+    {
+      printf("Error: unknown metric '%s'\n", name.c_str());
+      return nullptr;
+    }
+    FeatureTransform needed = MetricFactory::transformFor(metricType);
+    if (needed != FeatureTransform::NONE && db.transform() != needed)
+    {
+      printf("Error: metric %s needs %s features but %s stores them as %s\n", name.c_str(),
+             Quantization::transformToString(needed).c_str(), path.c_str(),
+             Quantization::transformToString(db.transform()).c_str());
+      return nullptr;
+    }
+    return metric;
+  }
+
+  /*
+  Ranks sampled queries in a reference database and in a test database holding
+  the same images (e.g. float32 and its u8 copy) and reports how far the test
+  rankings drift: recall@K of the reference top K, how often the nearest image
+  agrees, and how many positions the reference top K images move on average.
+  The reference may be ranked with its own metric, e.g. hist_ix on the raw
+  histograms against hellinger on their square roots.
+  - @param args The parsed command line arguments.
+  - @return 0 on success, -1 on error.
+  */
+  int runCompare(const DbToolCLI::Args &args)
+  {
+    if (args.referencePath.empty() || args.inputPath.empty() || args.topK <= 0 ||
+        args.numQueries <= 0)
+    {
+      printf("Error: compare needs --reference, --input and positive -k / -n.\n");
+      return -1;
+    }
+    FeatureDB ref, test;
+    if (ReadFiles::readFeaturesFromDB(args.referencePath.c_str(), ref) != 0 ||
+        ReadFiles::readFeaturesFromDB(args.inputPath.c_str(), test) != 0)
+      return -1;
+    const std::string refMetricStr = args.refMetricStr.empty() ? args.metricStr : args.refMetricStr;
+    auto metric = metricFor(args.metricStr, test, args.inputPath);
+    auto refMetric = metricFor(refMetricStr, ref, args.referencePath);
+    if (!metric || !refMetric)
+      return -1;
+    if (ref.rows() != test.rows() || ref.dim() != test.dim())
+    {
+      printf("Error: DBs differ in shape (%zu x %zu vs %zu x %zu)\n", ref.rows(),
+             ref.dim(), test.rows(), test.dim());
+      return -1;
+    }
+    for (size_t i = 0; i < ref.rows(); ++i)
+    {
+      if (std::strcmp(ref.filename(i), test.filename(i)) != 0)
+      {
+        printf("Error: row %zu is %s in one DB and %s in the other\n", i,
+               ref.filename(i), test.filename(i));
+        return -1;
+      }
+    }
+    if (ref.rows() < 2)
+    {
+      printf("Error: need at least two rows to compare rankings.\n");
+      return -1;
+    }
+
+    size_t k = std::min((size_t)args.topK, ref.rows() - 1);
+    size_t queries = std::min((size_t)args.numQueries, ref.rows());
+    double recallSum = 0.0, displacementSum = 0.0;
+    size_t top1Agree = 0;
+    std::vector<float> refDist, testDist;
+    for (size_t qi = 0; qi < queries; ++qi)
+    {
+      size_t q = qi * ref.rows() / queries; // spread the queries over the DB
+      distancesFromRow(ref, *refMetric, q, refDist);
+      distancesFromRow(test, *metric, q, testDist);
+      std::vector<size_t> refTop = topK(refDist, k);
+      std::vector<size_t> testTop = topK(testDist, k);
+
+      size_t hits = 0;
+      for (size_t r : refTop)
+        hits += std::find(testTop.begin(), testTop.end(), r) != testTop.end();
+      recallSum += (double)hits / k;
+      top1Agree += refTop[0] == testTop[0];
+
+      // rank of each reference neighbour in the full test ordering
+      for (size_t pos = 0; pos < k; ++pos)
+      {
+        size_t r = refTop[pos], rank = 0;
+        for (size_t i = 0; i < testDist.size(); ++i)
+          rank += testDist[i] < testDist[r] || (testDist[i] == testDist[r] && i < r);
+        displacementSum += rank > pos ? rank - pos : pos - rank;
+      }
+    }
+
+    printf("Reference: %s (%s, %s, %s)\n", args.referencePath.c_str(),
+           Quantization::dataTypeToString(ref.dataType()).c_str(),
+           Quantization::transformToString(ref.transform()).c_str(), refMetricStr.c_str());
+    printf("Test:      %s (%s, %s, %s)\n", args.inputPath.c_str(),
+           Quantization::dataTypeToString(test.dataType()).c_str(),
+           Quantization::transformToString(test.transform()).c_str(), args.metricStr.c_str());
+    printf("Queries: %zu, K: %zu\n", queries, k);
+    printf("recall@%zu: %.4f\n", k, recallSum / queries);
+    printf("top-1 agreement: %.4f\n", (double)top1Agree / queries);
+    printf("mean rank displacement: %.3f\n", displacementSum / (queries * k));
+    return 0;
+  }
+
+  /*
+  Returns the milliseconds elapsed since start.
+  - @param start The start time.
+  - @return The elapsed time in milliseconds.
+  */
+  double msSince(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /*
+  Reads the index type and the .fst group of the index and recall commands.
+  - @param args The parsed command line arguments.
+  - @param type Receives the index type.
+  - @param featureType Receives the feature of the group, UNKNOWN_FEATURE if none was given.
+  - @param position Receives the position of the group.
+  - @return 0 on success, -1 on error.
+  */
+  int indexTarget(const DbToolCLI::Args &args, IndexType &type, FeatureType &featureType,
+                  Position &position)
+  {
+    type = IndexFactory::stringToIndexType(args.indexStr.c_str());
+    if (args.inputPath.empty() || type == UNKNOWN_INDEX)
+    {
+      printf("Error: %s needs --input and -x hnsw, ivf, pq, vptree or bins.\n", args.command.c_str());
+      return -1;
+    }
+    featureType = args.featureStr.empty() ? UNKNOWN_FEATURE
+                                          : ExtractorFactory::stringToFeatureType(args.featureStr.c_str());
+    position = stringToPosition(args.positionStr);
+    if (!args.featureStr.empty() && featureType == UNKNOWN_FEATURE)
+    {
+      printf("Error: unknown feature '%s'\n", args.featureStr.c_str());
+      return -1;
+    }
+    return 0;
+  }
+
+  /*
+  Loads a table to index and makes it hold the features the way a metric needs
+  them (see MetricFactory::transformFor).
+  - @param path The DB file.
+  - @param featureType, position The group of a .fst store.
+  - @param metricType The metric of the index.
+  - @param table Receives the table.
+  - @return 0 on success, -1 on error.
+  */
+  int loadIndexed(const std::string &path, FeatureType featureType, Position position,
+                  MetricType metricType, FeatureTable &table)
+  {
+    if (table.load(path, 0, featureType, position) != 0)
+      return -1;
+    FeatureTransform needed = MetricFactory::transformFor(metricType);
+    if (table.applyTransform(needed) != 0)
+    {
+      printf("Error: metric %s needs %s features but %s stores them as %s\n",
+             MetricFactory::metricTypeToString(metricType).c_str(),
+             Quantization::transformToString(needed).c_str(), path.c_str(),
+             Quantization::transformToString(table.transform()).c_str());
+      return -1;
+    }
+    return 0;
+  }
+
+  /*
+  Builds the search index of a DB, or of every shard of a .shards DB, and saves each
+  next to its file (see IndexFactory::indexPath), where the matcher finds it.
+  - @param args The parsed command line arguments.
+  - @return 0 on success, -1 on error.
+  */
+  int runIndex(const DbToolCLI::Args &args)
+  {
+    IndexType type;
+    FeatureType featureType;
+    Position position;
+    if (indexTarget(args, type, featureType, position) != 0)
+      return -1;
+    MetricType metricType = MetricFactory::stringToMetricType(args.metricStr.c_str());
+    if (metricType == UNKNOWN_METRIC)
+    {
+      printf("Error: unknown metric '%s'\n", args.metricStr.c_str());
+      return -1;
+    }
+    IndexParams params;
+    params.links = (size_t)std::max(0, args.links);
+    params.efConstruction = (size_t)std::max(0, args.efConstruction);
+    params.lists = (size_t)std::max(0, args.lists);
+    params.subspaces = (size_t)std::max(0, args.subspaces);
+
+    std::vector<std::string> files;
+    if (ShardIndex::isShardIndexPath(args.inputPath))
+    {
+      ShardIndex shards;
+      if (shards.load(args.inputPath) != 0)
+        return -1;
+      for (size_t i = 0; i < shards.size(); ++i)
+        files.push_back(shards.shardPath(i));
+    }
+    else
+    {
+      files.push_back(args.inputPath);
+    }
+
+    for (const std::string &file : files)
+    {
+      FeatureTable table;
+      if (loadIndexed(file, featureType, position, metricType, table) != 0)
+        return -1;
+      auto index = IndexFactory::create(type);
+      auto start = std::chrono::steady_clock::now();
+      if (index->build(table, metricType, params, (size_t)std::max(0, args.threads)) != 0)
+        return -1;
+      double ms = msSince(start);
+      std::string path = IndexFactory::indexPath(file, type, featureType, position);
+      if (index->save(path) != 0)
+        return -1;
+      printf("Wrote %s (%s, %s, %zu rows in %.2f s)\n", path.c_str(), args.indexStr.c_str(),
+             args.metricStr.c_str(), table.rows(), ms / 1000.0);
+    }
+    return 0;
+  }
+
+  /*
+  Measures how well the index of a DB finds the exact nearest neighbours. Sampled
+  rows are used as queries, ranked by a full scan with the metric of the index and
+  searched through the index. A returned row counts as found if it is no farther
+  than the exact K-th neighbour, so rows tied with it count whichever the index
+  picks. Also reports what a query costs both ways.
+  - @param args The parsed command line arguments.
+  - @return 0 on success, -1 on error.
+  */
+  int runRecall(const DbToolCLI::Args &args)
+  {
+    IndexType type;
+    FeatureType featureType;
+    Position position;
+    if (indexTarget(args, type, featureType, position) != 0)
+      return -1;
+    if (ShardIndex::isShardIndexPath(args.inputPath) || args.topK <= 0 || args.numQueries <= 0)
+    {
+      printf("Error: recall needs a single .csv, .fdb or .fst DB and positive -k / -n.\n");
+      return -1;
+    }
+    std::string path = IndexFactory::indexPath(args.inputPath, type, featureType, position);
+    auto index = IndexFactory::create(type);
+    if (index->load(path) != 0)
+      return -1;
+    FeatureTable table;
+    if (loadIndexed(args.inputPath, featureType, position, index->metric(), table) != 0)
+      return -1;
+    if (!index->fits(table))
+    {
+      printf("Error: %s was not built from %s as it is now; rebuild it.\n", path.c_str(),
+             args.inputPath.c_str());
+      return -1;
+    }
+    if (table.rows() < 2)
+    {
+      printf("Error: need at least two rows to measure recall.\n");
+      return -1;
+    }
+    auto metric = MetricFactory::create(index->metric());
+    IndexParams params;
+    params.efSearch = (size_t)std::max(1, args.efSearch);
+    params.nprobe = (size_t)std::max(1, args.nprobe);
+    params.rerank = (size_t)std::max(0, args.rerank);
+
+    const size_t rows = table.rows();
+    const size_t k = std::min((size_t)args.topK, rows - 1);
+    const size_t queries = std::min((size_t)args.numQueries, rows);
+    const size_t stride = table.rowBytes() / Quantization::elementSize(table.dataType());
+    double recallSum = 0.0, exactMs = 0.0, indexMs = 0.0;
+    IndexStats stats;
+    std::vector<float> dist(rows), query(table.dim());
+    std::vector<IndexHit> hits;
+    for (size_t qi = 0; qi < queries; ++qi)
+    {
+      size_t q = qi * rows / queries; // spread the queries over the DB
+      auto start = std::chrono::steady_clock::now();
+      metric->computeManyEncoded(table.dataType(), table.rawRow(q), table.rawRow(0), rows,
+                                 table.dim(), stride, table.quantParams(), dist.data(),
+                                 table.rowNorms());
+      dist[q] = std::numeric_limits<float>::infinity();
+      for (size_t i = 0; i < rows; ++i)
+        if (table.isDead(i))
+          dist[i] = std::numeric_limits<float>::infinity();
+      std::vector<size_t> exact = topK(dist, k);
+      exactMs += msSince(start);
+
+      table.readRow(q, query.data());
+      start = std::chrono::steady_clock::now();
+      index->search(table, query.data(), k + 1, params, hits, &stats);
+      indexMs += msSince(start);
+
+      size_t found = 0, returned = 0;
+      for (const IndexHit &hit : hits)
+      {
+        if (hit.row == q || returned == k)
+          continue;
+        ++returned;
+        found += dist[hit.row] <= dist[exact.back()];
+      }
+      recallSum += (double)found / k;
+    }
+
+    printf("Index: %s (%s, %s)\n", path.c_str(), IndexFactory::indexTypeToString(type).c_str(),
+           MetricFactory::metricTypeToString(index->metric()).c_str());
+    if (type == IVF)
+      printf("Queries: %zu, K: %zu, nprobe: %zu\n", queries, k, params.nprobe);
+    else if (type == PQ)
+      printf("Queries: %zu, K: %zu, rerank: %zu\n", queries, k, params.rerank);
+    else if (type == VP_TREE || type == INVERTED_BINS)
+      printf("Queries: %zu, K: %zu, exact\n", queries, k);
+    else
+      printf("Queries: %zu, K: %zu, ef: %zu\n", queries, k, params.efSearch);
+    printf("recall@%zu: %.4f\n", k, recallSum / queries);
+    printf("exact scan: %.3f ms/query, %zu distances\n", exactMs / queries, rows);
+    printf("index:      %.3f ms/query, %.0f distances (%.2f%% of rows), %.0f %s\n",
+           indexMs / queries, (double)stats.distances / queries,
+           100.0 * stats.distances / ((double)queries * rows), (double)stats.visited / queries,
+           type == INVERTED_BINS ? "postings read" : "nodes visited");
+    return 0;
+  }
+} // namespace
+
+/*
+dbtool is the maintenance tool for binary feature databases.
+- @param argc The number of command line arguments.
+- @param argv An array of character pointers representing the command line
+arguments.
+- @return 0 on success, non-zero value on error.
+*/
+int main(int argc, char *argv[])
+{
+  auto args = DbToolCLI::parse(argc, argv);
+  if (args.showHelp)
+  {
+    DbToolCLI::printUsage(argv[0]);
+    return 0;
+  }
+
+  if (args.command == "quantize")
+    return runQuantize(args);
+  if (args.command == "compare")
+    return runCompare(args);
+  if (args.command == "index")
+    return runIndex(args);
+  if (args.command == "recall")
+    return runRecall(args);
+  if (args.command == "selftest")
+    return DistanceKernels::selfTest();
+  if (args.command == "bench")
+    return DistanceKernels::benchmark();
+
+  printf("Error: unknown command '%s'\n\n", args.command.c_str());
+  DbToolCLI::printUsage(argv[0]);
+  return -1;
+}
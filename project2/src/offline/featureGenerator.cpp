@@ -9,21 +9,312 @@ them to a CSV file.
 
 #include "csvUtil.hpp"
 #include "extractorFactory.hpp"
+#include "featureDB.hpp"
 #include "featureExtractor.hpp"
 #include "featureGenCLI.hpp"
+#include "featureStore.hpp"
+#include "featureWriter.hpp"
+#include "manifest.hpp"
 #include "position.hpp"
+#include "quantization.hpp"
 #include "readFiles.hpp"
+#include "shardIndex.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Existing DBs are compacted once this fraction of their rows is dead
+const double kCompactDeadFraction = 0.25;
+
+namespace
+{
+  /*
+  One feature written to a database: its type and the extractor computing it.
+  */
+  struct Column
+  {
+    FeatureType featureType;
+    std::shared_ptr<IExtractor> extractor;
+  };
+
+  /*
+  Extracts every column of one image. Several columns share one decode of the
+  image, so a feature store with N features does not read each image N times.
+  - @param path The image path.
+  - @param columns The features to extract.
+  - @param pos The region of the image the features are extracted from.
+  - @param values Receives one feature vector per column.
+  - @return 0 on success, -1 if the image cannot be read or a feature fails.
+  */
+  int extractColumns(const std::string &path, const std::vector<Column> &columns, Position pos,
+                     std::vector<std::vector<float>> &values)
+  {
+    values.resize(columns.size());
+    if (columns.size() == 1)
+    {
+      values[0].clear();
+      return columns[0].extractor->extract(path.c_str(), &values[0], pos);
+    }
+    cv::Mat image = cv::imread(path);
+    if (image.empty())
+      return -1;
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+      values[c].clear();
+      if (columns[c].extractor->extractImage(image, &values[c], pos) != 0)
+        return -1;
+    }
+    return 0;
+  }
+
+  /*
+  Builds one feature database, or updates it incrementally if it exists: its
+  manifest tells which images are new, changed or deleted. A sharded database
+  calls this once per shard with the images assigned to that shard.
+  - @param outPath The path of the .csv, .fdb or .fst file.
+  - @param columns The features the database holds; one unless it is a .fst store.
+  - @param pos The region of the image the features are extracted from.
+  - @param imagePaths The images the database should hold.
+  - @param dataType The storage type of a new binary database.
+  - @param transform The transform a new binary database stores the features with.
+  - @param compact Drop dead rows even below kCompactDeadFraction.
+  - @return 0 on success, -1 on error.
+  */
+  int updateDatabase(const std::string &outPath, const std::vector<Column> &columns, Position pos,
+                     const std::vector<std::string> &imagePaths, FeatureDataType dataType,
+                     FeatureTransform transform, bool compact)
+  {
+    std::vector<FeatureType> featureTypes;
+    for (const auto &column : columns)
+      featureTypes.push_back(column.featureType);
+
+    // if the output feature file exists, update it instead of starting over:
+    // its manifest tells which images are new, changed or deleted. Writers
+    // only create the file once it is complete, so an existing file is never
+    // a partial leftover of an interrupted run.
+    const bool exists = csvUtil::fileExists(outPath.c_str());
+    Manifest manifest;
+    std::vector<std::string> toExtract;
+    if (exists)
+    {
+      std::vector<std::string> dbFilenames;
+      if (ReadFiles::readFilenamesFromDB(outPath.c_str(), dbFilenames) != 0)
+      {
+        printf("Error: cannot read existing feature file %s\n", outPath.c_str());
+        return -1;
+      }
+      if (manifest.load(outPath) != 0)
+      {
+        printf("No manifest for %s, building one from its %zu rows\n",
+               outPath.c_str(), dbFilenames.size());
+        manifest.bootstrap(dbFilenames);
+      }
+      else if (manifest.reconcile(dbFilenames.size()) != 0)
+      {
+        printf("Error: manifest does not match %s; delete both to rebuild\n",
+               outPath.c_str());
+        return -1;
+      }
+      size_t dead = manifest.update(imagePaths, toExtract);
+      printf("Updating %s: %zu new or changed images, %zu rows marked dead\n",
+             outPath.c_str(), toExtract.size(), dead);
+    }
+    else
+    {
+      toExtract = imagePaths;
+    }
+
+    // open a buffered writer for the output format; rows of a new DB go to a
+    // temporary file that replaces outPath only when every image has been
+    // processed. An existing DB is appended to in place and keeps its old rows
+    // until commit() makes the new ones part of it.
+    auto writer = IFeatureWriter::create(outPath, featureTypes, pos, transform);
+    if (!toExtract.empty() &&
+        (exists ? writer->openAppend(outPath.c_str()) : writer->open(outPath.c_str())) != 0)
+    {
+      printf("Error: cannot create output file %s\n", outPath.c_str());
+      return -1;
+    }
+    if (!toExtract.empty() && writer->transform(0) != transform)
+      printf("Warning: %s keeps the transform it was built with, %s\n", outPath.c_str(),
+             Quantization::transformToString(writer->transform(0)).c_str());
+    std::vector<std::vector<float>> featureVectors; // features of each column of an image
+    // extract features for each new or changed image
+    for (const auto &path : toExtract)
+    {
+      int rc = extractColumns(path, columns, pos, featureVectors);
+      if (rc != 0)
+      {
+        printf("Warning: extract failed for %s\n", path.c_str());
+        continue;
+      }
+
+      // the DB stores the features as its transform makes them, e.g. square rooted
+      for (size_t g = 0; g < featureVectors.size(); ++g)
+        Quantization::applyTransform(writer->transform(g), featureVectors[g].data(),
+                                     featureVectors[g].size());
+
+      // save features in an image to output file
+      if (writer->appendGroups(path.c_str(), featureVectors) != 0 ||
+          manifest.append(path) != 0)
+      {
+        printf("Error: failed to write features of %s\n", path.c_str());
+        return -1;
+      }
+    }
+
+    // the DB is committed before its manifest; readers and the next run
+    // treat rows the manifest does not list yet as dead
+    if (!toExtract.empty() && writer->commit() != 0)
+    {
+      printf("Error: failed to write feature file %s\n", outPath.c_str());
+      return -1;
+    }
+    // u8 codes depend on the range of the whole DB, so compact storage is a
+    // second pass over the committed float32 file. Appends keep the storage
+    // type of the existing DB.
+    if (!exists && !toExtract.empty() && dataType != FeatureDataType::F32 &&
+        (FeatureStore::isFeatureStorePath(outPath)
+             ? FeatureStore::quantize(outPath.c_str(), outPath.c_str(), dataType)
+             : FeatureDB::quantize(outPath.c_str(), outPath.c_str(), dataType)) != 0)
+    {
+      printf("Error: failed to quantize feature file %s\n", outPath.c_str());
+      return -1;
+    }
+    if (manifest.modified() && manifest.save(outPath) != 0)
+      return -1;
+
+    // drop the dead rows once they make up a large part of the DB, or when
+    // asked to. This rewrites the DB, so it is a separate commit.
+    size_t dead = manifest.deadCount();
+    if (dead > 0 && (compact || dead >= kCompactDeadFraction * manifest.rows()))
+    {
+      printf("Compacting %s: dropping %zu of %zu rows\n", outPath.c_str(), dead,
+             manifest.rows());
+      auto compactor = IFeatureWriter::create(outPath, featureTypes, pos);
+      if (compactor->openCompact(outPath.c_str(), manifest.deadRows()) != 0 ||
+          compactor->commit() != 0)
+      {
+        printf("Error: failed to compact feature file %s\n", outPath.c_str());
+        return -1;
+      }
+      manifest.compact();
+      if (manifest.save(outPath) != 0)
+        return -1;
+    }
+    return 0;
+  }
+
+  /*
+  Builds or updates a database split into shards. Each shard is an ordinary
+  database with its own manifest, updated by updateDatabase() with the images
+  assigned to it; the .shards index lists them. An existing index keeps its
+  number of shards and scheme. With the RANGE scheme existing images stay in the
+  shard that holds them and new images go to the last shard.
+  - @param indexPath The path of the .shards index.
+  - @param ext The extension of the shard files, ".csv", ".fdb" or ".fst".
+  - @param numShards The number of shards of a new index.
+  - @param scheme The scheme of a new index.
+  - @param shardDirs Directories to spread the shards of a new index over.
+  - @param columns, pos, imagePaths, dataType, transform, compact: As for updateDatabase().
+  - @return 0 on success, -1 on error.
+  */
+  int updateShards(const std::string &indexPath, const std::string &ext, size_t numShards,
+                   ShardScheme scheme, const std::vector<std::string> &shardDirs,
+                   const std::vector<Column> &columns, Position pos,
+                   const std::vector<std::string> &imagePaths, FeatureDataType dataType,
+                   FeatureTransform transform, bool compact)
+  {
+    const bool exists = csvUtil::fileExists(indexPath.c_str());
+    ShardIndex index;
+    if (exists)
+    {
+      if (index.load(indexPath) != 0)
+        return -1;
+      if (numShards > 1 && (numShards != index.size() || scheme != index.scheme()))
+        printf("Warning: %s has %zu shards by %s, keeping its layout\n", indexPath.c_str(),
+               index.size(), ShardIndex::schemeToString(index.scheme()).c_str());
+    }
+    else
+    {
+      index = ShardIndex::create(indexPath, numShards, scheme, ext, shardDirs);
+    }
+
+    // assign every image to a shard
+    const size_t count = index.size();
+    std::vector<std::vector<std::string>> shardImages(count);
+    if (index.scheme() == ShardScheme::HASH)
+    {
+      for (const auto &path : imagePaths)
+        shardImages[ShardIndex::hashShard(path, count)].push_back(path);
+    }
+    else if (!exists)
+    {
+      std::vector<std::string> sorted = imagePaths;
+      std::sort(sorted.begin(), sorted.end());
+      for (size_t i = 0; i < sorted.size(); ++i)
+        shardImages[i * count / sorted.size()].push_back(sorted[i]);
+    }
+    else
+    {
+      std::unordered_map<std::string, size_t> owner; // image -> shard holding it
+      for (size_t s = 0; s < count; ++s)
+      {
+        std::string shardPath = index.shardPath(s);
+        std::vector<std::string> names;
+        std::vector<char> dead;
+        if (!csvUtil::fileExists(shardPath.c_str()) ||
+            ReadFiles::readFilenamesFromDB(shardPath.c_str(), names) != 0)
+          continue;
+        Manifest::readDeadRows(shardPath, names.size(), dead);
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+          if (dead.empty() || !dead[i])
+            owner[names[i]] = s;
+        }
+      }
+      for (const auto &path : imagePaths)
+      {
+        auto it = owner.find(path);
+        shardImages[it == owner.end() ? count - 1 : it->second].push_back(path);
+      }
+    }
+
+    for (size_t s = 0; s < count; ++s)
+    {
+      std::string shardPath = index.shardPath(s);
+      printf("Shard %zu of %zu: %s, %zu images\n", s + 1, count, shardPath.c_str(),
+             shardImages[s].size());
+      if (shardImages[s].empty() && !csvUtil::fileExists(shardPath.c_str()))
+        continue; // nothing to build yet
+      if (updateDatabase(shardPath, columns, pos, shardImages[s], dataType, transform, compact) != 0)
+        return -1;
+    }
+    // the index is written once its shards are, so an interrupted first run
+    // starts over with the same layout
+    if (!exists && index.save(indexPath) != 0)
+      return -1;
+    return 0;
+  }
+} // namespace
 
 /*
 This program generates feature vectors for each image in a specified directory
 and saves them to a CSV file. The program takes three command line arguments:
 the directory path containing the images, the type of feature to extract (e.g.,
 "baseline", "gabor"), and the output file path for the CSV file where the
-features will be saved.
+features will be saved. If the output path ends with ".fdb", the features are
+written as a binary feature database instead, which the matcher can mmap, and
+if it ends with ".fst" all features go to one feature store keyed by row index,
+extracted from a single decode of each image. If the output file already exists, only new and changed images are extracted and
+appended; see manifest.hpp. With --shards N each database is split into N shard
+files listed in a ".shards" index; see shardIndex.hpp.
 
 - @param argc The number of command line arguments.
 - @param argv An array of character pointers representing the command line
@@ -54,6 +345,33 @@ int main(int argc, char *argv[])
   std::string dirname = args.inputDir;
   std::string outputBase = args.outputPath;
   Position pos = stringToPosition(args.positionStr);
+  bool quantOk = false;
+  FeatureDataType dataType =
+      Quantization::stringToDataType(args.quantStr.c_str(), &quantOk);
+  if (!quantOk ||
+      (dataType != FeatureDataType::F32 && !FeatureDB::isFeatureDBPath(outputBase) &&
+       !FeatureStore::isFeatureStorePath(outputBase)))
+  {
+    printf("Error: --quant must be f32, u8 or f16, and needs an .fdb or .fst output.\n");
+    return -1;
+  }
+  bool transformOk = false;
+  FeatureTransform transform =
+      Quantization::stringToTransform(args.transformStr.c_str(), &transformOk);
+  if (!transformOk ||
+      (transform != FeatureTransform::NONE && !FeatureDB::isFeatureDBPath(outputBase) &&
+       !FeatureStore::isFeatureStorePath(outputBase)))
+  {
+    printf("Error: --transform must be none or sqrt, and needs an .fdb or .fst output.\n");
+    return -1;
+  }
+  bool schemeOk = false;
+  ShardScheme shardScheme = ShardIndex::stringToScheme(args.shardScheme.c_str(), &schemeOk);
+  if (!schemeOk || args.numShards < 0)
+  {
+    printf("Error: --shards must be a positive count and --shard-by hash or range.\n");
+    return -1;
+  }
   printf("Processing directory %s\n", dirname.c_str());
 
   // read the files in the directory, get the file paths, and store them in a
@@ -61,63 +379,68 @@ int main(int argc, char *argv[])
   std::vector<std::string> imagePaths;
   ReadFiles::readFilesInDir((char *)dirname.c_str(), imagePaths);
 
-  // process each feature type
+  // create an extractor for each feature type
+  std::vector<Column> columns;
   for (const auto &featureStr : args.featureStrs)
   {
     FeatureType featureType =
         ExtractorFactory::stringToFeatureType(featureStr.c_str());
-    std::string featureName = featureStr;
     // Check if the feature type is valid
     if (featureType == UNKNOWN_FEATURE)
     {
       printf("Error: unknown feature type '%s'\n", featureStr.c_str());
       return -1;
     }
+    printf("Using feature type %s\n", featureStr.c_str());
 
-    // generate the output file path
-    std::string outPath = outputBase;
-    // append feature name and position to the output file path
-    if (outPath.size() >= 4 && outPath.substr(outPath.size() - 4) == ".csv")
-      outPath = outPath.substr(0, outPath.size() - 4) + "_" + featureName +
-                "_" + args.positionStr + ".csv";
-    else
-      outPath = outPath + "_" + featureName + "_" + args.positionStr + ".csv";
-    printf("Using feature type %s\n", featureName.c_str());
-    printf("Output feature file path: %s\n", outPath.c_str());
-
-    // if the output feature CSV file exists, return
-    if (csvUtil::fileExists(outPath.c_str()))
-    {
-      printf("Output feature file %s already exists. Skipping.\n", outPath.c_str());
-      return 0;
-    }
-    // Check the output feature CSV file not exist or empty
-    csvUtil::clearExistingFile(outPath.c_str());
-
-    // create the appropriate feature extractor based on the feature type and
-    // position
+    // create the appropriate feature extractor based on the feature type
     auto extractor = ExtractorFactory::create(featureType);
     if (!extractor)
     {
-      printf("Error: extractor is nullptr for %s\n", featureName.c_str());
+      printf("Error: extractor is nullptr for %s\n", featureStr.c_str());
       return -1;
     }
-    std::vector<float> featureVector; // vector to hold features for each image
-    // extract features for each image
-    for (const auto &path : imagePaths)
-    {
-      featureVector.clear(); // clear the feature vector for each image
-      int rc = extractor->extract(path.c_str(), &featureVector, pos);
-      if (rc != 0)
-      {
-        printf("Warning: extract failed for %s\n", path.c_str());
-        continue;
-      }
+    columns.push_back(Column{featureType, extractor});
+  }
 
-      // save features in an image to output file
-      csvUtil::append_image_data_csv(outPath.c_str(), path.c_str(),
-                                     featureVector, 0);
+  // keep the .fdb or .fst extension for binary output, default to .csv otherwise
+  const bool store = FeatureStore::isFeatureStorePath(outputBase);
+  std::string ext = store ? ".fst" : FeatureDB::isFeatureDBPath(outputBase) ? ".fdb" : ".csv";
+  std::string stem = outputBase;
+  if (stem.size() >= 4 && stem.substr(stem.size() - 4) == ext)
+    stem = stem.substr(0, stem.size() - 4);
+
+  // a feature store holds every feature in one file; the other formats get one
+  // file per feature
+  std::vector<std::vector<Column>> outputs;
+  if (store)
+    outputs.push_back(columns);
+  else
+    for (const auto &column : columns)
+      outputs.push_back({column});
+
+  for (const auto &outColumns : outputs)
+  {
+    // append feature name and position to the output file path
+    std::string outPath = stem + "_";
+    if (!store)
+      outPath += ExtractorFactory::featureTypeToString(outColumns[0].featureType) + "_";
+    outPath += args.positionStr + ext;
+
+    // a DB split into shards is described by its .shards index, which keeps
+    // being used on later runs
+    std::string indexPath = outPath.substr(0, outPath.size() - ext.size()) + ".shards";
+    if (args.numShards > 1 || csvUtil::fileExists(indexPath.c_str()))
+    {
+      printf("Output shard index path: %s\n", indexPath.c_str());
+      if (updateShards(indexPath, ext, (size_t)args.numShards, shardScheme, args.shardDirs,
+                       outColumns, pos, imagePaths, dataType, transform, args.compact) != 0)
+        return -1;
+      continue;
     }
+    printf("Output feature file path: %s\n", outPath.c_str());
+    if (updateDatabase(outPath, outColumns, pos, imagePaths, dataType, transform, args.compact) != 0)
+      return -1;
   }
   printf("Done. Processed %lu images.\n", imagePaths.size());
   return (0);
@@ -7,24 +7,970 @@ Description: Matches features from a query image to a database of feature
 vectors.
 */
 
+#include "IIndex.hpp"
+#include "csvUtil.hpp"
+#include "distanceKernels.hpp"
 #include "distanceMetrics.hpp"
 #include "extractorFactory.hpp"
 #include "featureExtractor.hpp"
 #include "featureMatcherCLI.hpp"
+#include "featureTable.hpp"
+#include "imageDictionary.hpp"
+#include "indexFactory.hpp"
 #include "matchResult.hpp"
 #include "matchUtil.hpp"
 #include "metricFactory.hpp"
+#include "quantization.hpp"
 #include "readFiles.hpp"
+#include "shardIndex.hpp"
+#include "threadUtil.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+namespace {
+// Rows are scanned in blocks of this size: each block is one task for the
+// threads and one batch for the metric, small enough to stay in the L2 cache
+// and to spread one database over many cores. A mapped block is paged in
+// before its scan, and released after it once the resident budget of
+// FeatureTable is used up.
+const size_t kScanBlockBytes = 1 << 20;
+
+// In batch mode every thread ranks up to this many targets per pass over the rows,
+// so each block of rows is read once for all of them.
+const size_t kBatchQueries = 64;
+// Upper bound of the score boards all threads of a batch keep at once: each target
+// of a pass sums its scores in a float per image.
+const size_t kBatchBoardBytes = size_t(256) << 20;
+
+/*
+One --db entry with its loaded feature tables: every shard of a sharded database,
+or the database itself as a single shard.
+- spec: The parsed --db entry.
+- scheme: How images are assigned to the shards.
+- shards: The loaded shards, in the order of the shard index.
+- metricType, metric: The distance metric of the entry.
+- transform: The transform the shards store the features with, which extracted
+    targets go through as well.
+- indexes: The search index of every shard, nullptr for shards scanned exactly.
+- target: The target feature vector, empty if the entry is skipped.
+*/
+struct LoadedEntry {
+  const FeatureMatcherCLI::DbEntry *spec = nullptr;
+  ShardScheme scheme = ShardScheme::HASH;
+  std::vector<std::unique_ptr<FeatureTable>> shards;
+  MetricType metricType = UNKNOWN_METRIC;
+  std::shared_ptr<IDistanceMetric> metric;
+  FeatureTransform transform = FeatureTransform::NONE;
+  std::vector<std::shared_ptr<IIndex>> indexes;
+  std::vector<float> target;
+};
+
+/*
+Image IDs of the rows of the loaded tables. Tables read from the same file (e.g.
+several groups of one feature store) share one mapping, so their rows are
+interned once.
+*/
+class RowIds {
+public:
+  explicit RowIds(ImageDictionary &dict) : dict_(dict) {}
+
+  /*
+  Returns the image ID of every row of a table. Dead rows and the target image
+  map to ImageDictionary::kNone, so the scoring loops never look at filenames.
+  - @param table The table.
+  - @param targetPath The target image path, which is never matched with itself.
+  - @return One ID per row.
+  */
+  const std::vector<uint32_t> &of(const FeatureTable &table,
+                                  const char *targetPath) {
+    if (table.rows() == 0)
+      return empty_;
+    auto found = cache_.find(table.path());
+    if (found != cache_.end())
+      return found->second;
+    std::vector<uint32_t> &ids = cache_[table.path()];
+    ids.assign(table.rows(), ImageDictionary::kNone);
+    for (size_t i = 0; i < table.rows(); ++i) {
+      if (!table.isDead(i) &&
+          !ReadFiles::isTargetImageInDatabase(targetPath, table.filename(i)))
+        ids[i] = dict_.intern(table.filename(i));
+    }
+    return ids;
+  }
+
+private:
+  ImageDictionary &dict_;
+  std::unordered_map<std::string, std::vector<uint32_t>> cache_;
+  const std::vector<uint32_t> empty_; // IDs of tables that failed to load
+};
+
+/*
+Shared state of the early-abandoning scans of one score group, see abandonBlock().
+- k: The number of results.
+- bound: The smallest K-th best score of any block so far.
+- abandoned, rows: Number of rows abandoned early and of rows scanned.
+*/
+struct EarlyAbandon {
+  size_t k = 0;
+  std::atomic<float> bound{std::numeric_limits<float>::infinity()};
+  std::atomic<size_t> abandoned{0}, rows{0};
+};
+
+/*
+The scan of one shard of one entry: the target encoded like the shard rows and
+the weighted distance of every row, filled in one block at a time.
+- entry: The database entry the shard belongs to.
+- table: The shard.
+- ids: The image ID of every row of the shard.
+- target: The target in the storage type of the shard.
+- blockRows: The number of rows of one block.
+- dist: The weighted distance of every row.
+- abandon: Set if rows are abandoned once they cannot make the top K.
+- blocks: The order SSD visits the dimension blocks in when abandoning rows.
+- index: The search index of the shard, nullptr if it is scanned.
+*/
+struct ScanJob {
+  const LoadedEntry *entry = nullptr;
+  const FeatureTable *table = nullptr;
+  const std::vector<uint32_t> *ids = nullptr;
+  std::vector<uint8_t> target;
+  size_t blockRows = 0;
+  std::vector<float> dist;
+  EarlyAbandon *abandon = nullptr;
+  std::vector<uint32_t> blocks;
+  const IIndex *index = nullptr;
+};
+
+/*
+Prepares the scan of one shard: encodes the target and sizes the blocks. Shards
+whose dimension does not match the target are skipped.
+- @param job The job; entry, table and ids must be set.
+- @return true if the shard is to be scanned.
+*/
+bool prepareScan(ScanJob &job) {
+  const FeatureTable &table = *job.table;
+  if (table.rows() == 0 || job.entry->target.size() != table.dim())
+    return false;
+  // Encode the target like the shard rows so both sides use the same codes;
+  // each u8 shard has its own scale and offset
+  job.target = Quantization::encode(table.dataType(), table.quantParams(),
+                                    job.entry->target);
+  job.blockRows = std::max<size_t>(
+      1, kScanBlockBytes / std::max<size_t>(1, table.rowBytes()));
+  return true;
+}
+
+/*
+Computes the unweighted distance from the target to consecutive rows with one
+batch call of the metric.
+- @param job The prepared job.
+- @param first The first row.
+- @param count The number of rows.
+- @param out Receives one distance per row.
+*/
+void computeRows(const ScanJob &job, size_t first, size_t count, float *out) {
+  const FeatureTable &table = *job.table;
+  const size_t stride =
+      table.rowBytes() / Quantization::elementSize(table.dataType());
+  // Stored row norms turn cosine into one dot product per row
+  const double *norms = table.rowNorms();
+  job.entry->metric->computeManyEncoded(
+      table.dataType(), job.target.data(), table.rawRow(first), count,
+      table.dim(), stride, table.quantParams(), out,
+      norms ? norms + first : nullptr);
+}
+
+/*
+Lowers a bound shared by the blocks of a scan to t if t is smaller.
+- @param bound The shared bound.
+- @param t The K-th best score of one block.
+*/
+void lowerBound(std::atomic<float> &bound, float t) {
+  float current = bound.load(std::memory_order_relaxed);
+  while (t < current && !bound.compare_exchange_weak(current, t))
+    ;
+}
+
+/*
+Computes the weighted distance from the target to the rows [first, end) of an
+early-abandoning scan. Each row's SSD stops once it exceeds the K-th best score
+of this block or of any other block, visiting the most varying dimensions
+first; such a row gets a distance above that score and so never ranks. Rows
+without an ID are skipped.
+- @param job The prepared job.
+- @param first The first row.
+- @param end The row after the last one.
+*/
+void abandonBlock(ScanJob &job, size_t first, size_t end) {
+  const FeatureTable &table = *job.table;
+  EarlyAbandon &state = *job.abandon;
+  const IDistanceMetric &metric = *job.entry->metric;
+  const float weight = job.entry->spec->weight;
+  const float *target = reinterpret_cast<const float *>(job.target.data());
+  TopKSelector best(state.k);
+  size_t abandoned = 0, rows = 0;
+  for (size_t i = first; i < end; ++i) {
+    const uint32_t id = (*job.ids)[i];
+    if (id == ImageDictionary::kNone)
+      continue;
+    const float limit =
+        std::min(best.threshold(), state.bound.load(std::memory_order_relaxed)) /
+        weight;
+    const float d = metric.computeWithin(
+        target, static_cast<const float *>(table.rawRow(i)), table.dim(),
+        job.blocks.data(), limit);
+    job.dist[i] = d * weight;
+    ++rows;
+    if (d > limit) {
+      ++abandoned;
+      continue;
+    }
+    best.push(job.dist[i], id);
+    lowerBound(state.bound, best.threshold());
+  }
+  state.abandoned += abandoned;
+  state.rows += rows;
+}
+
+/*
+Computes the weighted distance from the target to one block of rows with one
+batch call of the metric, so the metric is dispatched once and loops over the
+contiguous rows. Rows without an ID are computed but never added. Blocks write
+disjoint parts of job.dist, so any number of them can run at once.
+- @param job The prepared job.
+- @param first The first row of the block.
+*/
+void scanBlock(ScanJob &job, size_t first) {
+  const FeatureTable &table = *job.table;
+  const size_t end = std::min(first + job.blockRows, table.rows());
+  table.prefetch(first, end - first);
+  if (job.abandon) {
+    abandonBlock(job, first, end);
+  } else {
+    computeRows(job, first, end - first, job.dist.data() + first);
+    const float weight = job.entry->spec->weight;
+    for (size_t i = first; i < end; ++i)
+      job.dist[i] *= weight;
+  }
+  table.release(first, end - first);
+}
+
+/*
+Scans every job whose distances are allocated. The blocks of all jobs form one
+task list that the
+threads work through in order, so a single large database is spread over all
+threads as well as many small shards are.
+- @param jobs The prepared jobs.
+- @param threads The number of threads.
+*/
+void scanAll(std::vector<ScanJob> &jobs, size_t threads) {
+  struct Block {
+    size_t job, first;
+  };
+  std::vector<Block> blocks;
+  for (size_t j = 0; j < jobs.size(); ++j)
+    for (size_t first = 0; first < jobs[j].dist.size();
+         first += jobs[j].blockRows)
+      blocks.push_back({j, first});
+  ThreadUtil::parallelFor(
+      blocks.size(),
+      [&](size_t b) { scanBlock(jobs[blocks[b].job], blocks[b].first); },
+      threads);
+}
+
+/*
+Adds the distances of a scanned shard to the images of its rows.
+- @param job The scanned job.
+- @param board Accumulates the distance per image.
+*/
+void accumulate(const ScanJob &job, ScoreBoard &board) {
+  const std::vector<uint32_t> &ids = *job.ids;
+  for (size_t i = 0; i < ids.size(); ++i)
+    if (ids[i] != ImageDictionary::kNone)
+      board.add(ids[i], job.dist[i]);
+}
+/*
+Estimates the cost of one row of a job as the bytes its distance reads.
+- @param job The prepared job.
+- @return The cost of one row.
+*/
+size_t scanCost(const ScanJob &job) {
+  return job.table->dim() * Quantization::elementSize(job.table->dataType());
+}
+
+/*
+A fused scan of row-aligned tables, whose row i is the same image in every table
+(e.g. the groups of one .fst store). Instead of one pass per --db entry, each
+candidate row gets its weighted feature distances cheapest first and is
+abandoned as soon as its partial sum plus the lower bounds of the features not
+yet computed exceeds the K-th best score found so far. Such a row can never
+reach the top K, so the result is the one of the full scan.
+- jobs: The prepared scans, in --db order.
+- order: Indices into jobs, cheapest feature first.
+- rest: rest[k] is the sum of the weighted lower bounds of order[k..].
+- ids: The image ID of every row, the same for all tables.
+- blockRows: The number of rows of one block.
+- bound: The smallest K-th best score of any block so far.
+- computed, total: Number of feature distances computed and of those a full
+  scan would compute.
+*/
+struct FusedScan {
+  std::vector<const ScanJob *> jobs;
+  std::vector<size_t> order;
+  std::vector<float> rest;
+  const std::vector<uint32_t> *ids = nullptr;
+  size_t blockRows = 0;
+  std::atomic<float> bound{std::numeric_limits<float>::infinity()};
+  std::atomic<size_t> computed{0}, total{0};
+};
+
+/*
+Checks that no image has more than one live row in the given ID lists.
+- @param ids The image ID of every row of some tables.
+- @param numImages The number of images of their dictionary.
+- @return true if every image appears at most once.
+*/
+bool uniqueImages(const std::vector<const std::vector<uint32_t> *> &ids,
+                  size_t numImages) {
+  std::vector<char> seen(numImages, 0);
+  for (const std::vector<uint32_t> *list : ids)
+    for (uint32_t id : *list) {
+      if (id == ImageDictionary::kNone)
+        continue;
+      if (seen[id])
+        return false;
+      seen[id] = 1;
+    }
+  return true;
+}
+
+/*
+Checks whether the prepared jobs of a score group can be scanned fused: there
+are several, their tables hold the same live image in every row, no image has
+two live rows and no weight is negative.
+- @param jobs The prepared jobs of the group.
+- @param numImages The number of images of the group's dictionary.
+- @return true if the jobs can be scanned fused.
+*/
+bool canFuse(const std::vector<const ScanJob *> &jobs, size_t numImages) {
+  if (jobs.size() < 2)
+    return false;
+  const std::vector<uint32_t> &ids = *jobs[0]->ids;
+  for (const ScanJob *job : jobs)
+    if (job->entry->spec->weight < 0.0f ||
+        (job->ids != &ids && *job->ids != ids))
+      return false;
+  return uniqueImages({&ids}, numImages);
+}
+
+/*
+Checks whether the prepared jobs of a score group that is not fused can abandon
+rows early: they scan float32 shards of one entry with SSD and a positive
+weight, and no image has two live rows, so the score of an image is the
+distance of its one row.
+- @param jobs The prepared jobs of the group.
+- @param numImages The number of images of the group's dictionary.
+- @return true if rows can be abandoned.
+*/
+bool canAbandon(const std::vector<const ScanJob *> &jobs, size_t numImages) {
+  if (jobs.empty())
+    return false;
+  std::vector<const std::vector<uint32_t> *> ids;
+  for (const ScanJob *job : jobs) {
+    if (job->entry != jobs[0]->entry || job->entry->metricType != SSD ||
+        !(job->entry->spec->weight > 0.0f) ||
+        job->table->dataType() != FeatureDataType::F32)
+      return false;
+    ids.push_back(job->ids);
+  }
+  return uniqueImages(ids, numImages);
+}
+
+/*
+Orders the features of a fused scan cheapest first and sums the lower bounds
+of the features each candidate still has ahead of it.
+- @param scan The fused scan; jobs must be set.
+*/
+void planFused(FusedScan &scan) {
+  const size_t numJobs = scan.jobs.size();
+  scan.order.resize(numJobs);
+  for (size_t j = 0; j < numJobs; ++j)
+    scan.order[j] = j;
+  std::stable_sort(scan.order.begin(), scan.order.end(),
+                   [&](size_t a, size_t b) {
+                     return scanCost(*scan.jobs[a]) < scanCost(*scan.jobs[b]);
+                   });
+  // The bounds hold for the target the metric sees, i.e. the encoded one
+  scan.rest.assign(numJobs + 1, 0.0f);
+  std::vector<float> target;
+  for (size_t k = numJobs; k-- > 0;) {
+    const ScanJob &job = *scan.jobs[scan.order[k]];
+    const FeatureTable &table = *job.table;
+    target.resize(table.dim());
+    Quantization::decode(table.dataType(), table.quantParams(),
+                         job.target.data(), table.dim(), target.data());
+    scan.rest[k] = scan.rest[k + 1] +
+                   job.entry->spec->weight *
+                       job.entry->metric->lowerBound(target.data(),
+                                                     table.dim());
+  }
+}
+
+/*
+Scans one block of a fused scan. The cheapest feature is computed for the whole
+block with one batch call; the candidates are then visited in order of that
+distance, so the best ones come first and tighten the bound early, and every
+further feature is only computed while the candidate can still make the top K.
+Once even the best remaining candidate cannot, the rest of the block is skipped.
+- @param scan The fused scan.
+- @param first The first row of the block.
+- @param best Receives the scores of the candidates that were not abandoned.
+*/
+void fusedBlock(FusedScan &scan, size_t first, TopKSelector &best) {
+  const std::vector<uint32_t> &ids = *scan.ids;
+  const size_t end = std::min(first + scan.blockRows, ids.size());
+  const size_t count = end - first, numJobs = scan.jobs.size();
+  for (const ScanJob *job : scan.jobs)
+    job->table->prefetch(first, count);
+
+  // dist[j * count + i] is the weighted distance of job j to row first + i
+  std::vector<float> dist(numJobs * count);
+  const size_t cheapest = scan.order[0];
+  float *head = dist.data() + cheapest * count;
+  computeRows(*scan.jobs[cheapest], first, count, head);
+  const float headWeight = scan.jobs[cheapest]->entry->spec->weight;
+  std::vector<uint32_t> candidates;
+  for (size_t i = 0; i < count; ++i) {
+    head[i] *= headWeight;
+    if (ids[first + i] != ImageDictionary::kNone)
+      candidates.push_back((uint32_t)i);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [&](uint32_t a, uint32_t b) { return head[a] < head[b]; });
+
+  size_t computed = candidates.size();
+  for (uint32_t i : candidates) {
+    // Partial sums are added cheapest first but scores in --db order, so
+    // allow for the rounding difference when comparing them
+    float limit = std::min(best.threshold(),
+                           scan.bound.load(std::memory_order_relaxed));
+    limit += std::fabs(limit) * 1e-5f;
+    float partial = head[i];
+    if (partial + scan.rest[1] > limit)
+      break;
+    size_t k = 1;
+    for (; k < numJobs && !(partial + scan.rest[k] > limit); ++k) {
+      const size_t j = scan.order[k];
+      float &d = dist[j * count + i];
+      computeRows(*scan.jobs[j], first + i, 1, &d);
+      d *= scan.jobs[j]->entry->spec->weight;
+      partial += d;
+    }
+    computed += k - 1;
+    if (k < numJobs || partial > limit)
+      continue;
+    float score = 0.0f;
+    for (size_t j = 0; j < numJobs; ++j)
+      score += dist[j * count + i];
+    best.push(score, ids[first + i]);
+    lowerBound(scan.bound, best.threshold());
+  }
+
+  for (const ScanJob *job : scan.jobs)
+    job->table->release(first, count);
+  scan.computed += computed;
+  scan.total += candidates.size() * numJobs;
+}
+
+/*
+Runs a fused scan over all rows on all threads. Each block keeps its own top K;
+merging them yields the same top K whichever thread scanned which block.
+- @param scan The planned fused scan.
+- @param k The number of results.
+- @param threads The number of threads.
+- @param best Receives the top K of all blocks.
+*/
+void runFused(FusedScan &scan, size_t k, size_t threads, TopKSelector &best) {
+  size_t rowBytes = 0;
+  for (const ScanJob *job : scan.jobs)
+    rowBytes += job->table->rowBytes();
+  scan.blockRows =
+      std::max<size_t>(1, kScanBlockBytes / std::max<size_t>(1, rowBytes));
+  const size_t rows = scan.ids->size();
+  const size_t numBlocks = (rows + scan.blockRows - 1) / scan.blockRows;
+  std::vector<TopKSelector> parts(numBlocks, TopKSelector(k));
+  ThreadUtil::parallelFor(
+      numBlocks,
+      [&](size_t b) { fusedBlock(scan, b * scan.blockRows, parts[b]); },
+      threads);
+  for (const TopKSelector &part : parts)
+    best.merge(part);
+}
+
+/*
+Scores a score group with an indexed shard from the candidates of its indexes
+instead of a scan. An exact index returns the topN + 1 rows nearest the target (one
+may be the target's own row), an approximate one max(topN, efSearch) of them to make
+up for the rows it misses; the images of those rows are the candidates, and every shard of the group adds its exact
+distance for them alone, so candidates get the fused score a full scan would give
+them and only images no index returned are missed.
+- @param jobs The prepared jobs of the group.
+- @param numImages The number of images of the group's dictionary.
+- @param topN The number of results the matcher reports.
+- @param params The search settings of the indexes.
+- @param board Receives the scores of the candidates.
+- @param stats Receives the cost of the index searches.
+- @return The number of candidate images.
+*/
+size_t scoreIndexed(const std::vector<const ScanJob *> &jobs, size_t numImages,
+                    size_t topN, const IndexParams &params, ScoreBoard &board,
+                    IndexStats &stats) {
+  std::vector<char> candidate(numImages, 0);
+  std::vector<IndexHit> hits;
+  size_t count = 0;
+  for (const ScanJob *job : jobs) {
+    if (!job->index)
+      continue;
+    const size_t k =
+        job->index->exact() ? topN + 1 : std::max(topN, params.efSearch);
+    job->index->search(*job->table, job->entry->target.data(), k, params, hits,
+                       &stats);
+    for (const IndexHit &hit : hits) {
+      const uint32_t id = (*job->ids)[hit.row];
+      if (id != ImageDictionary::kNone && !candidate[id]) {
+        candidate[id] = 1;
+        ++count;
+      }
+    }
+  }
+  for (const ScanJob *job : jobs) {
+    const std::vector<uint32_t> &ids = *job->ids;
+    const float weight = job->entry->spec->weight;
+    for (size_t i = 0; i < ids.size(); ++i)
+      if (ids[i] != ImageDictionary::kNone && candidate[ids[i]]) {
+        float d;
+        computeRows(*job, i, 1, &d);
+        board.add(ids[i], d * weight);
+      }
+  }
+  return count;
+}
+
+/*
+Extracts the feature vector of an image for a database entry.
+- @param spec The database entry.
+- @param imagePath The image.
+- @param out Receives the feature vector.
+- @return 0 on success, -1 on error.
+*/
+int extractTarget(const FeatureMatcherCLI::DbEntry &spec, const char *imagePath,
+                  std::vector<float> &out) {
+  auto extractor = ExtractorFactory::create(spec.featureType);
+  if (!extractor) {
+    printf("Error: extractor nullptr for feature=%s\n", spec.featureName.c_str());
+    return -1;
+  }
+  if (extractor->extract(imagePath, &out, spec.position) != 0) {
+    printf("Error: failed to extract target features for feature=%s\n",
+           spec.featureName.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+/*
+Prints the metric and weight an entry is scored with, closing its info block.
+- @param entry The database entry, its metric set.
+*/
+void printEntrySettings(const LoadedEntry &entry) {
+  printf("Distance metric: %s\n",
+         MetricFactory::metricTypeToString(entry.metricType).c_str());
+  printf("Weight: %.3f\n", entry.spec->weight);
+  printf("--------------------\n");
+}
+
+/*
+Makes the shards of an entry hold the features the way its metric needs them, e.g.
+square-rooted for hellinger, and records the transform extracted targets need.
+CSV shards are transformed in memory; binary shards must have been built with it.
+- @param entry The database entry, its metric set.
+- @return 0 on success, -1 on error.
+*/
+int prepareTransform(LoadedEntry &entry) {
+  const FeatureTransform needed = MetricFactory::transformFor(entry.metricType);
+  bool first = true;
+  for (auto &shard : entry.shards) {
+    if (shard->rows() == 0)
+      continue;
+    if (shard->applyTransform(needed) != 0) {
+      printf("Error: metric %s needs %s features but DB '%s' stores them as %s; "
+             "rebuild it with fg --transform %s.\n",
+             MetricFactory::metricTypeToString(entry.metricType).c_str(),
+             Quantization::transformToString(needed).c_str(),
+             shard->path().c_str(),
+             Quantization::transformToString(shard->transform()).c_str(),
+             Quantization::transformToString(needed).c_str());
+      return -1;
+    }
+    if (!first && shard->transform() != entry.transform) {
+      printf("Error: shards of DB '%s' store their features differently.\n",
+             entry.spec->dbPath.c_str());
+      return -1;
+    }
+    entry.transform = shard->transform();
+    first = false;
+  }
+  return 0;
+}
+
+/*
+Loads the search index of every shard of an entry given --index. A shard without
+an index file, or whose index does not fit it (built for another metric, or before
+an update changed the number of rows), is scanned exactly instead.
+- @param entry The database entry, its metric set.
+*/
+void loadIndexes(LoadedEntry &entry) {
+  const auto &spec = *entry.spec;
+  entry.indexes.assign(entry.shards.size(), nullptr);
+  if (!spec.hasIndex)
+    return;
+  const std::string type = IndexFactory::indexTypeToString(spec.indexType);
+  for (size_t s = 0; s < entry.shards.size(); ++s) {
+    const FeatureTable &shard = *entry.shards[s];
+    if (shard.rows() == 0)
+      continue;
+    const std::string path = IndexFactory::indexPath(
+        shard.path(), spec.indexType, spec.featureType, spec.position);
+    if (!csvUtil::fileExists(path.c_str())) {
+      printf("Warning: no %s index %s, scan DB '%s' exactly.\n", type.c_str(),
+             path.c_str(), shard.path().c_str());
+      continue;
+    }
+    auto index = IndexFactory::create(spec.indexType);
+    if (index->load(path) != 0) {
+      printf("Warning: scan DB '%s' exactly.\n", shard.path().c_str());
+      continue;
+    }
+    if (!index->fits(shard)) {
+      printf("Warning: index %s was not built from DB '%s' as it is now; rebuild "
+             "it with dbtool index. Scan exactly.\n",
+             path.c_str(), shard.path().c_str());
+      continue;
+    }
+    if (index->metric() != entry.metricType) {
+      printf("Warning: index %s ranks by %s, not %s; scan DB '%s' exactly.\n",
+             path.c_str(), MetricFactory::metricTypeToString(index->metric()).c_str(),
+             MetricFactory::metricTypeToString(entry.metricType).c_str(),
+             shard.path().c_str());
+      continue;
+    }
+    entry.indexes[s] = index;
+  }
+}
+
+/*
+Returns the filename of an image path without its directories, by which the
+matcher recognises a target among the rows (see ReadFiles::isTargetImageInDatabase).
+- @param path The image path.
+- @return The filename.
+*/
+std::string baseName(std::string_view path) {
+  return std::filesystem::path(path).filename().string();
+}
+
+/*
+Reads the target list of batch mode: one image path per line, blank lines and
+lines starting with '#' skipped.
+- @param path The list file.
+- @param out Receives the image paths.
+- @return 0 on success, -1 if the file cannot be read.
+*/
+int readTargetList(const std::string &path, std::vector<std::string> &out) {
+  std::ifstream in(path);
+  if (!in) {
+    printf("Error: cannot read target list '%s'\n", path.c_str());
+    return -1;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t b = line.find_first_not_of(" \t\r");
+    size_t e = line.find_last_not_of(" \t\r");
+    if (b == std::string::npos || line[b] == '#')
+      continue;
+    out.push_back(line.substr(b, e - b + 1));
+  }
+  return 0;
+}
+
+/*
+One --db entry of a batch: the feature vectors of all targets, one row each.
+- entry: The loaded entry.
+- dim: The number of features of its rows.
+- queries: numTargets x dim target features.
+*/
+struct BatchEntry {
+  LoadedEntry *entry = nullptr;
+  size_t dim = 0;
+  std::vector<float> queries;
+};
+
+/*
+One table scanned by a batch.
+- entry: The batch entry the table belongs to.
+- table: The table.
+- ids: The image ID of every row of the table.
+*/
+struct BatchScan {
+  const BatchEntry *entry = nullptr;
+  const FeatureTable *table = nullptr;
+  const std::vector<uint32_t> *ids = nullptr;
+};
+
+/*
+Scores a range of targets against every scanned table. The tables are read one
+block of rows at a time and each block is compared with all targets of the range
+at once (see IDistanceMetric::computeCross), so the rows are read once per range
+instead of once per target.
+- @param scans The tables.
+- @param first The first target.
+- @param count The number of targets.
+- @param boards Receives the fused score of every image, one board per target.
+*/
+void scoreBatch(const std::vector<BatchScan> &scans, size_t first, size_t count,
+                std::vector<ScoreBoard> &boards) {
+  std::vector<float> dist, decoded;
+  for (const BatchScan &scan : scans) {
+    const FeatureTable &table = *scan.table;
+    const size_t dim = scan.entry->dim;
+    const float weight = scan.entry->entry->spec->weight;
+    const IDistanceMetric &metric = *scan.entry->entry->metric;
+    const FeatureMatrix queries = FeatureMatrix::view(
+        scan.entry->queries.data() + first * dim, count, dim, dim);
+    const size_t blockRows = std::max<size_t>(
+        1, kScanBlockBytes / std::max<size_t>(1, dim * sizeof(float)));
+    const double *norms = table.rowNorms();
+    for (size_t r0 = 0; r0 < table.rows(); r0 += blockRows) {
+      const size_t n = std::min(blockRows, table.rows() - r0);
+      // Every range of targets reads these rows, so they stay mapped
+      table.prefetch(r0, n);
+      const float *rows = static_cast<const float *>(table.rawRow(r0));
+      size_t stride = table.rowBytes() / sizeof(float);
+      if (table.dataType() != FeatureDataType::F32) {
+        // Compact rows are widened once per block for all targets
+        decoded.resize(n * dim);
+        for (size_t i = 0; i < n; ++i)
+          table.readRow(r0 + i, decoded.data() + i * dim);
+        rows = decoded.data();
+        stride = dim;
+      }
+      const FeatureMatrix block = FeatureMatrix::view(rows, n, dim, stride);
+      dist.resize(count * n);
+      metric.computeCross(queries, block, dist.data(),
+                          norms ? norms + r0 : nullptr);
+      for (size_t q = 0; q < count; ++q)
+        for (size_t i = 0; i < n; ++i) {
+          const uint32_t id = (*scan.ids)[r0 + i];
+          if (id != ImageDictionary::kNone)
+            boards[q].add(id, dist[q * n + i] * weight);
+        }
+    }
+  }
+}
+
+/*
+Batch mode: ranks every image of a target list against the databases in one run.
+The target features are read from the databases or extracted up front; the
+targets are then split into ranges that the threads score in one pass over the
+rows each, and the top N of every target are printed in list order, the target
+itself excluded.
+- @param args The parsed command line arguments.
+- @param entries The loaded database entries.
+- @param threads The number of threads.
+- @return 0 on success, non-zero value on error.
+*/
+int runBatch(const FeatureMatcherCLI::Args &args,
+             std::vector<LoadedEntry> &entries, size_t threads) {
+  std::vector<std::string> targets;
+  if (readTargetList(args.targetsPath, targets) != 0)
+    return -1;
+  const size_t numTargets = targets.size();
+  if (numTargets == 0) {
+    printf("Error: target list '%s' is empty.\n", args.targetsPath.c_str());
+    return -1;
+  }
+
+  std::vector<BatchEntry> batch;
+  for (auto &entry : entries) {
+    const auto &dbEntry = *entry.spec;
+    if (dbEntry.hasIndex)
+      printf("Info: batch mode scans DB '%s' exactly, --index is ignored.\n",
+             dbEntry.dbPath.c_str());
+    size_t dim = 0;
+    for (const auto &shard : entry.shards)
+      if (shard->rows() > 0 && dim == 0)
+        dim = shard->dim();
+    if (dim == 0) {
+      printf("Warning: DB is empty: %s\n", dbEntry.dbPath.c_str());
+      continue;
+    }
+    entry.metricType = dbEntry.hasMetric ? dbEntry.metricType : args.metricType;
+    entry.metric = MetricFactory::create(entry.metricType);
+    if (!entry.metric) {
+      printf("Error: invalid metric for db entry. db='%s'\n\n",
+             dbEntry.dbPath.c_str());
+      return -1;
+    }
+    if (prepareTransform(entry) != 0)
+      return -1;
+    for (const auto &shard : entry.shards)
+      if (shard->rows() > 0 && shard->dim() != dim)
+        printf("Warning: DB '%s' has %zu features but '%s' has %zu, skip.\n",
+               shard->path().c_str(), shard->dim(),
+               entry.shards[0]->path().c_str(), dim);
+    batch.push_back({&entry, dim, std::vector<float>(numTargets * dim, 0.0f)});
+  }
+
+  // Targets already in a database reuse its row. Each shard is indexed by
+  // filename once instead of searching its rows for every target.
+  std::vector<std::vector<std::unordered_map<std::string, size_t>>> rowOf(
+      batch.size());
+  for (size_t e = 0; e < batch.size(); ++e)
+    rowOf[e].resize(batch[e].entry->shards.size());
+  std::vector<std::pair<size_t, size_t>> shardList;
+  for (size_t e = 0; e < batch.size(); ++e)
+    for (size_t s = 0; s < rowOf[e].size(); ++s)
+      shardList.push_back({e, s});
+  ThreadUtil::parallelFor(shardList.size(), [&](size_t k) {
+    const auto [e, s] = shardList[k];
+    const FeatureTable &shard = *batch[e].entry->shards[s];
+    for (size_t i = 0; i < shard.rows(); ++i)
+      if (!shard.isDead(i))
+        rowOf[e][s].emplace(baseName(shard.filename(i)), i);
+  }, threads);
+
+  std::vector<char> valid(numTargets, 1);
+  std::vector<std::atomic<size_t>> reused(batch.size());
+  ThreadUtil::parallelFor(numTargets, [&](size_t t) {
+    const std::string name = baseName(targets[t]);
+    for (size_t e = 0; e < batch.size() && valid[t]; ++e) {
+      const LoadedEntry &entry = *batch[e].entry;
+      const size_t numShards = entry.shards.size();
+      size_t first = 0, last = numShards;
+      if (entry.scheme == ShardScheme::HASH && numShards > 1) {
+        first = ShardIndex::hashShard(targets[t], numShards);
+        last = first + 1;
+      }
+      float *query = batch[e].queries.data() + t * batch[e].dim;
+      bool found = false;
+      for (size_t s = first; s < last && !found; ++s) {
+        auto row = rowOf[e][s].find(name);
+        if (row == rowOf[e][s].end() || entry.shards[s]->dim() != batch[e].dim)
+          continue;
+        entry.shards[s]->readRow(row->second, query);
+        found = true;
+      }
+      if (found) {
+        ++reused[e];
+        continue;
+      }
+      std::vector<float> features;
+      if (extractTarget(*entry.spec, targets[t].c_str(), features) != 0 ||
+          features.size() != batch[e].dim) {
+        printf("Warning: no %zu-feature vector for target '%s' and DB '%s', "
+               "skip target.\n",
+               batch[e].dim, targets[t].c_str(), entry.spec->dbPath.c_str());
+        valid[t] = 0;
+        continue;
+      }
+      Quantization::applyTransform(entry.transform, features.data(),
+                                   features.size());
+      std::copy(features.begin(), features.end(), query);
+    }
+  }, threads);
+  for (size_t e = 0; e < batch.size(); ++e) {
+    printf("Info: %zu of %zu targets found in DB '%s', the rest extracted.\n",
+           (size_t)reused[e], numTargets, batch[e].entry->spec->dbPath.c_str());
+    printEntrySettings(*batch[e].entry);
+  }
+
+  // All tables share one dictionary, so scores of an image sum across entries
+  // and shards. The target of each list line is excluded by ID at selection.
+  ImageDictionary dict;
+  RowIds rowIds(dict);
+  std::vector<BatchScan> scans;
+  for (const BatchEntry &be : batch)
+    for (const auto &shard : be.entry->shards)
+      if (shard->rows() > 0 && shard->dim() == be.dim)
+        scans.push_back({&be, shard.get(), &rowIds.of(*shard, "")});
+  std::unordered_map<std::string, std::vector<uint32_t>> idsOf;
+  for (uint32_t id = 0; id < dict.size(); ++id)
+    idsOf[baseName(dict.name(id))].push_back(id);
+
+  // Each range of targets keeps one score board per target; ranges are sized
+  // so every thread has one and the boards of all threads stay bounded
+  const size_t boardBytes =
+      std::max<size_t>(1, dict.size()) * sizeof(float) * threads;
+  size_t chunk = std::min(kBatchQueries, (numTargets + threads - 1) / threads);
+  chunk = std::max<size_t>(1, std::min(chunk, kBatchBoardBytes / boardBytes));
+  const size_t numChunks = (numTargets + chunk - 1) / chunk;
+  printf("Info: batch of %zu targets, %zu per pass over the DBs.\n", numTargets,
+         chunk);
+
+  std::vector<std::vector<MatchResult>> results(numTargets);
+  ThreadUtil::parallelFor(numChunks, [&](size_t c) {
+    const size_t first = c * chunk;
+    const size_t count = std::min(chunk, numTargets - first);
+    std::vector<ScoreBoard> boards(count, ScoreBoard(dict.size()));
+    scoreBatch(scans, first, count, boards);
+    for (size_t q = 0; q < count; ++q) {
+      if (!valid[first + q])
+        continue;
+      TopKSelector best((size_t)args.topN);
+      uint32_t from = 0;
+      auto self = idsOf.find(baseName(targets[first + q]));
+      if (self != idsOf.end())
+        for (uint32_t id : self->second) {
+          boards[q].select(from, id, best);
+          from = id + 1;
+        }
+      boards[q].select(from, (uint32_t)dict.size(), best);
+      best.appendResults(dict, results[first + q]);
+    }
+  }, threads);
+
+  for (size_t t = 0; t < numTargets; ++t) {
+    if (!valid[t])
+      continue;
+    printf("Target: %s\n", targets[t].c_str());
+    if (results[t].empty())
+      printf("No matches (check DBs / feature extraction).\n");
+    else
+      MatchUtil::getTopNMatches(results[t], args.topN);
+  }
+  return 0;
+}
+} // namespace
+
 /*
 featureMatcher is the main program that matches features from a query image to
-a database of feature vectors.
+a database of feature vectors, or with --targets every image of a list (see
+runBatch()). A database may be split into shards (a .shards
+index, see shardIndex.hpp); the shards are loaded and scanned in parallel and
+their results merged. Scores are fused per image ID (see imageDictionary.hpp);
+entries that read different features of one feature store (.fst) share the IDs
+of its rows. Entries given --index are searched through the index of each shard
+instead of scanned (see scoreIndexed()).
 - @param argc The number of command line arguments.
 - @param argv An array of character pointers representing the command line
 arguments.
@@ -38,24 +984,69 @@ int main(int argc, char *argv[]) {
     FeatureMatcherCLI::printUsage(argv[0]);
     return 0;
   }
-  if (args.targetPath.empty() || args.dbs.empty() || args.topN <= 0) {
+  const bool batchMode = !args.targetsPath.empty();
+  if (batchMode == !args.targetPath.empty() || args.dbs.empty() ||
+      args.topN <= 0) {
     printf("Error: missing required arguments.\n\n");
     FeatureMatcherCLI::printUsage(argv[0]);
     return -1;
   }
 
-  // Initialize data structures to accumulate distances and track seen images
-  std::unordered_map<std::string, float> totalDistance;
-  std::unordered_map<std::string, bool> seenAny;
+  // Resolve every database entry to its shard files; a plain .csv, .fdb or
+  // .fst database is a single shard
+  struct LoadJob {
+    size_t entry, shard;
+    std::string path;
+    bool isShard;
+  };
+  std::vector<LoadedEntry> entries(args.dbs.size());
+  std::vector<LoadJob> jobs;
+  for (size_t e = 0; e < args.dbs.size(); ++e) {
+    const auto &dbEntry = args.dbs[e];
+    entries[e].spec = &dbEntry;
+    if (ShardIndex::isShardIndexPath(dbEntry.dbPath)) {
+      ShardIndex index;
+      if (index.load(dbEntry.dbPath) == 0) {
+        entries[e].scheme = index.scheme();
+        for (size_t i = 0; i < index.size(); ++i)
+          jobs.push_back({e, i, index.shardPath(i), true});
+      }
+    } else {
+      jobs.push_back({e, 0, dbEntry.dbPath, false});
+    }
+  }
+  for (const auto &job : jobs)
+    entries[job.entry].shards.push_back(std::make_unique<FeatureTable>());
+
+  // Load all shards of all entries concurrently. Binary shards are only
+  // mapped; CSV shards share the cores instead of each taking all of them.
+  const size_t threads = args.threads > 0 ? (size_t)args.threads
+                                           : ThreadUtil::defaultThreads();
+  const int csvThreads =
+      (int)std::max<size_t>(1, threads / std::max<size_t>(1, jobs.size()));
+  ThreadUtil::parallelFor(jobs.size(), [&](size_t j) {
+    // fg only creates a shard once an image is assigned to it
+    if (jobs[j].isShard && !csvUtil::fileExists(jobs[j].path.c_str())) {
+      printf("Warning: shard %s does not exist, skip.\n", jobs[j].path.c_str());
+      return;
+    }
+    const auto &spec = *entries[jobs[j].entry].spec;
+    entries[jobs[j].entry].shards[jobs[j].shard]->load(
+        jobs[j].path, csvThreads, spec.featureType, spec.position);
+  }, threads);
 
-  // Iterate over each database entry
-  for (const auto &dbEntry : args.dbs) {
-    // Load database feature vectors and filenames from the CSV file
-    std::vector<std::string> dbFilenames;   // database to save image filenames
-    std::vector<std::vector<float>> dbData; // database to save feature vectors
-    ReadFiles::readFeaturesFromCSV(dbEntry.dbPath.c_str(), dbFilenames, dbData);
+  if (batchMode)
+    return runBatch(args, entries, threads);
 
-    if (dbData.empty()) {
+  // Prepare the target feature vector of each database entry
+  std::vector<LoadedEntry *> active;
+  for (auto &entry : entries) {
+    const auto &dbEntry = *entry.spec;
+    const size_t numShards = entry.shards.size();
+    size_t numRows = 0;
+    for (const auto &shard : entry.shards)
+      numRows += shard->rows();
+    if (numRows == 0) {
       printf("Warning: DB is empty: %s\n", dbEntry.dbPath.c_str());
       continue;
     }
@@ -63,32 +1054,38 @@ int main(int argc, char *argv[]) {
     MetricType metricType =
         dbEntry.hasMetric ? dbEntry.metricType : args.metricType;
     // Create the appropriate distance metric based on the specified metric type
-    auto distanceMetric = MetricFactory::create(metricType);
-    if (!distanceMetric) {
+    entry.metricType = metricType;
+    entry.metric = MetricFactory::create(metricType);
+    if (!entry.metric) {
       printf("Error: invalid metric for db entry. db='%s'\n\n",
              dbEntry.dbPath.c_str());
       FeatureMatcherCLI::printUsage(argv[0]);
       return -1;
     }
+    if (prepareTransform(entry) != 0)
+      return -1;
+    loadIndexes(entry);
 
-    // Extract features from the target image using the specified feature
-    // extractor
-    std::vector<float> targetFeatures;
+    // Check if target image exists in the DB. With hash sharding only the
+    // shard its filename hashes to can hold it.
     bool targetFromDb = false;
+    size_t first = 0, last = numShards;
+    if (entry.scheme == ShardScheme::HASH && numShards > 1) {
+      first = ShardIndex::hashShard(args.targetPath, numShards);
+      last = first + 1;
+    }
+    for (size_t s = first; s < last && !targetFromDb; ++s) {
+      const FeatureTable &shard = *entry.shards[s];
+      long row = shard.findRow(args.targetPath.c_str());
+      if (row < 0)
+        continue;
+      // Target image found in DB: reuse its feature vector
+      entry.target.resize(shard.dim());
+      shard.readRow((size_t)row, entry.target.data());
+      targetFromDb = true;
 
-    // Check if target image exists in DB CSV
-    for (size_t i = 0; i < dbFilenames.size(); ++i) {
-      if (ReadFiles::isTargetImageInDatabase(args.targetPath.c_str(),
-                                             dbFilenames[i].c_str())) {
-        // Target image found in DB: reuse its feature vector
-        targetFeatures = dbData[i];
-        targetFromDb = true;
-
-        printf(
-            "Info: target image '%s' found in DB '%s', reuse feature vector.\n",
-            args.targetPath.c_str(), dbEntry.dbPath.c_str());
-        break;
-      }
+      printf("Info: target image '%s' found in DB '%s', reuse feature vector.\n",
+             args.targetPath.c_str(), dbEntry.dbPath.c_str());
     }
 
     // If target not in DB, extract features from image
@@ -99,63 +1096,192 @@ int main(int argc, char *argv[]) {
       printf("Extract by feature type: %s; Position: %s\n",
              dbEntry.featureName.c_str(),
              positionToString(dbEntry.position).c_str());
-      auto extractor = ExtractorFactory::create(dbEntry.featureType);
-      if (!extractor) {
-        printf("Error: extractor nullptr for feature=%s\n",
-               dbEntry.featureName.c_str());
-        return -1;
-      }
-      int rc = extractor->extract(args.targetPath.c_str(), &targetFeatures,
-                                  dbEntry.position);
-      if (rc != 0) {
-        printf("Error: failed to extract target features for feature=%s\n",
-               dbEntry.featureName.c_str());
+      if (extractTarget(dbEntry, args.targetPath.c_str(), entry.target) != 0)
         return -1;
-      }
+      Quantization::applyTransform(entry.transform, entry.target.data(),
+                                   entry.target.size());
     }
 
-    // Create the appropriate distance metric based on the specified metric type
-    printf("Distance metric: %s\n",
-           MetricFactory::metricTypeToString(dbEntry.metricType).c_str());
-    printf("Weight: %.3f\n", dbEntry.weight);
-    printf("--------------------\n");
-    // Compute distances between the target features and each database feature
-    // vector
-    for (size_t i = 0; i < dbData.size(); ++i) {
-      // Skip the target image if in the database to avoid matching it with
-      // itself
-      if (ReadFiles::isTargetImageInDatabase(args.targetPath.c_str(),
-                                             dbFilenames[i].c_str()))
+    printEntrySettings(entry);
+
+    // Every row of a shard has the same length, so check it once per shard
+    bool anyMatch = false;
+    for (const auto &shard : entry.shards) {
+      if (shard->rows() == 0)
         continue;
-      float d = distanceMetric->compute(targetFeatures, dbData[i]);
-      // Accumulate the weighted distance for this database entry
-      totalDistance[dbFilenames[i]] += dbEntry.weight * d;
-      // Mark this image as seen
-      seenAny[dbFilenames[i]] = true;
+      if (shard->dim() != entry.target.size())
+        printf("Warning: target has %zu features but DB '%s' has %zu, skip.\n",
+               entry.target.size(), shard->path().c_str(), shard->dim());
+      else
+        anyMatch = true;
     }
+    if (anyMatch)
+      active.push_back(&entry);
   }
-  // Convert the accumulated distances into a vector of MatchResult objects
-  std::vector<MatchResult> results;
-  results.reserve(totalDistance.size());
 
-  // Convert the accumulated distances into MatchResult objects
-  for (const auto &kv : totalDistance) {
-    if (!seenAny[kv.first])
+  // Shards are aligned when the same shard of every entry holds the same
+  // images: then each shard is scanned and fused on its own and only its
+  // top N results are merged. Otherwise the distances of all shards are
+  // accumulated per image first.
+  size_t numShards = active.empty() ? 0 : active[0]->shards.size();
+  bool aligned = true;
+  for (const LoadedEntry *entry : active)
+    aligned = aligned && entry->shards.size() == numShards &&
+              (numShards == 1 || active.size() == 1 ||
+               entry->scheme == ShardScheme::HASH);
+
+  // Filenames are interned to dense image IDs once, so scores are summed in
+  // float arrays and strings are only built for the top N of each group. With
+  // aligned shards every shard is its own group; otherwise all shards share one
+  // dictionary, since different shards may hold the same image.
+  struct ScoreGroup {
+    ImageDictionary dict;
+    RowIds rowIds{dict};
+    std::vector<size_t> scans;
+    std::vector<MatchResult> results;
+    EarlyAbandon abandon;
+  };
+  const size_t numGroups = aligned ? numShards : (active.empty() ? 0 : 1);
+  std::vector<ScoreGroup> groups(numGroups);
+  std::vector<ScanJob> scans;
+  for (size_t g = 0; g < numGroups; ++g)
+    for (const LoadedEntry *entry : active)
+      for (size_t s = 0; s < entry->shards.size(); ++s)
+        if (!aligned || s == g) {
+          groups[g].scans.push_back(scans.size());
+          scans.emplace_back();
+          scans.back().entry = entry;
+          scans.back().table = entry->shards[s].get();
+          if (!entry->indexes.empty())
+            scans.back().index = entry->indexes[s].get();
+        }
+  ThreadUtil::parallelFor(numGroups, [&](size_t g) {
+    for (size_t j : groups[g].scans)
+      scans[j].ids = &groups[g].rowIds.of(*scans[j].table,
+                                          args.targetPath.c_str());
+  }, threads);
+
+  std::vector<char> scanned(scans.size(), 0);
+  for (size_t j = 0; j < scans.size(); ++j)
+    scanned[j] = prepareScan(scans[j]);
+
+  // Groups with an indexed shard rank only the images its index returns
+  std::vector<char> indexed(numGroups, 0);
+  std::vector<IndexStats> indexStats(numGroups);
+  std::vector<size_t> candidates(numGroups, 0), indexedRows(numGroups, 0);
+  ThreadUtil::parallelFor(numGroups, [&](size_t g) {
+    std::vector<const ScanJob *> jobs;
+    for (size_t j : groups[g].scans)
+      if (scanned[j]) {
+        jobs.push_back(&scans[j]);
+        if (scans[j].index)
+          indexedRows[g] += scans[j].table->rows();
+      }
+    if (indexedRows[g] == 0)
+      return;
+    ScoreBoard board(groups[g].dict.size());
+    candidates[g] = scoreIndexed(
+        jobs, groups[g].dict.size(), (size_t)args.topN, args.indexParams,
+        board, indexStats[g]);
+    board.topN(groups[g].dict, args.topN, groups[g].results, 1);
+    indexed[g] = 1;
+  }, threads);
+  size_t indexDistances = 0, indexRows = 0, indexCandidates = 0;
+  for (size_t g = 0; g < numGroups; ++g) {
+    indexDistances += indexStats[g].distances;
+    indexRows += indexedRows[g];
+    indexCandidates += candidates[g];
+  }
+  if (indexRows > 0)
+    printf("Info: index search computed %zu distances for %zu rows (%.2f%%), "
+           "%zu candidate images.\n",
+           indexDistances, indexRows, 100.0 * indexDistances / indexRows,
+           indexCandidates);
+
+  // Groups whose tables are row-aligned are scanned fused, abandoning
+  // candidates that cannot reach the top N
+  std::vector<char> fused(numGroups, 0);
+  size_t fusedComputed = 0, fusedTotal = 0;
+  for (size_t g = 0; g < numGroups; ++g) {
+    if (indexed[g])
       continue;
-    MatchResult res;
-    res.filename = kv.first;
-    res.distance = kv.second;
-    results.push_back(res);
+    FusedScan scan;
+    for (size_t j : groups[g].scans)
+      if (scanned[j])
+        scan.jobs.push_back(&scans[j]);
+    if (!canFuse(scan.jobs, groups[g].dict.size()))
+      continue;
+    scan.ids = scan.jobs[0]->ids;
+    planFused(scan);
+    TopKSelector best((size_t)args.topN);
+    runFused(scan, (size_t)args.topN, threads, best);
+    best.appendResults(groups[g].dict, groups[g].results);
+    fused[g] = 1;
+    fusedComputed += scan.computed;
+    fusedTotal += scan.total;
   }
+  if (fusedTotal > 0)
+    printf("Info: fused scan computed %zu of %zu feature distances (%.1f%% "
+           "abandoned).\n",
+           fusedComputed, fusedTotal,
+           100.0 * (fusedTotal - fusedComputed) / fusedTotal);
+
+  // Scan the blocks of every other shard on all threads, then sum the
+  // distances by image in a fixed order and select the top N of each group.
+  // Each block writes its own distances, so the result does not depend on
+  // which thread scanned which block. Single-feature SSD scans abandon rows
+  // that cannot make the top N.
+  for (size_t g = 0; g < numGroups; ++g) {
+    if (fused[g] || indexed[g])
+      continue;
+    std::vector<const ScanJob *> jobs;
+    for (size_t j : groups[g].scans)
+      if (scanned[j]) {
+        scans[j].dist.assign(scans[j].table->rows(), 0.0f);
+        jobs.push_back(&scans[j]);
+      }
+    if (!canAbandon(jobs, groups[g].dict.size()))
+      continue;
+    groups[g].abandon.k = (size_t)args.topN;
+    for (size_t j : groups[g].scans)
+      if (scanned[j]) {
+        scans[j].abandon = &groups[g].abandon;
+        scans[j].blocks = DistanceKernels::blockOrder(
+            scans[j].table->dimOrder(), scans[j].table->dim());
+      }
+  }
+  scanAll(scans, threads);
+  size_t abandoned = 0, abandonRows = 0;
+  for (const ScoreGroup &group : groups) {
+    abandoned += group.abandon.abandoned;
+    abandonRows += group.abandon.rows;
+  }
+  if (abandonRows > 0)
+    printf("Info: early-abandon SSD stopped %zu of %zu rows early (%.1f%% "
+           "pruned).\n",
+           abandoned, abandonRows, 100.0 * abandoned / abandonRows);
+  ThreadUtil::parallelFor(numGroups, [&](size_t g) {
+    if (fused[g] || indexed[g])
+      return;
+    ScoreBoard board(groups[g].dict.size());
+    for (size_t j : groups[g].scans)
+      if (scanned[j])
+        accumulate(scans[j], board);
+    board.topN(groups[g].dict, args.topN, groups[g].results,
+               numGroups == 1 ? threads : 1);
+  }, threads);
+  std::vector<MatchResult> results;
+  for (const ScoreGroup &group : groups)
+    results.insert(results.end(), group.results.begin(), group.results.end());
 
   if (results.empty()) {
     printf("No matches (check DBs / feature extraction).\n");
     return 0;
   }
   // Sort the results by distance
-  std::sort(results.begin(), results.end(), MatchUtil::compareMatches);
+  std::stable_sort(results.begin(), results.end(), MatchUtil::compareMatches);
   std::vector<MatchResult> topMatches =
       MatchUtil::getTopNMatches(results, args.topN);
 
   return (0); // Success
-}
\ No newline at end of file
+}
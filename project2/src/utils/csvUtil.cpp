@@ -11,11 +11,18 @@ CPP functions for reading CSV files with a specific format
 The function returns a std::vector of char* for the filenames and a 2D std::vector of floats for the data
 */
 
+#include <charconv>
 #include <cstdio>
 #include <cstring>
+#include <string>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "opencv2/opencv.hpp"
 #include "csvUtil.hpp"
+#include "threadUtil.hpp"
 
 /*
   reads a string from a CSV file. the 0-terminated string is returned in the char array os.
@@ -112,6 +119,154 @@ int getfloat(FILE *fp, float *v)
   return (eol); // return true if eol
 }
 
+namespace
+{
+  // Ranges smaller than this are not worth a thread of their own
+  const size_t kMinChunkBytes = 1 << 20;
+
+  /*
+    A byte range of the mapped file that starts at the beginning of a
+    line and ends after a newline (or at the end of the file).
+   */
+  struct CsvChunk
+  {
+    const char *begin;
+    const char *end;
+    size_t firstRow; // matrix row of the first data line in the range
+    size_t rows;     // number of data lines in the range
+    std::string error;
+  };
+
+  /*
+    Returns the end of the line starting at p: the next newline, or end.
+   */
+  const char *lineEnd(const char *p, const char *end)
+  {
+    const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    return nl ? nl : end;
+  }
+
+  /*
+    Returns true if the line [p, e) holds only whitespace or a '\r'.
+    Such lines are skipped, e.g. a blank line at the end of the file.
+   */
+  bool isBlankLine(const char *p, const char *e)
+  {
+    for (; p < e; ++p)
+    {
+      if (*p != ' ' && *p != '\t' && *p != '\r')
+        return false;
+    }
+    return true;
+  }
+
+  /*
+    Counts the data lines in [p, end).
+   */
+  size_t countRows(const char *p, const char *end)
+  {
+    size_t rows = 0;
+    while (p < end)
+    {
+      const char *e = lineEnd(p, end);
+      if (!isBlankLine(p, e))
+        ++rows;
+      p = e + 1;
+    }
+    return rows;
+  }
+
+  /*
+    Parses one float starting at p, skipping leading blanks and a '+'
+    sign (which std::from_chars does not accept but atof does).
+
+    Returns a pointer past the number, or nullptr if there is none.
+   */
+  const char *parseFloat(const char *p, const char *e, float &value)
+  {
+    while (p < e && (*p == ' ' || *p == '\t'))
+      ++p;
+    if (p < e && *p == '+')
+      ++p;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::from_chars_result r = std::from_chars(p, e, value);
+    return r.ec == std::errc() ? r.ptr : nullptr;
+#else
+    // standard libraries without floating point from_chars: strtof needs
+    // a terminated copy, because the mapping is not 0-terminated
+    char buf[64];
+    size_t n = 0;
+    while (p + n < e && n < sizeof(buf) - 1 && p[n] != ',' && p[n] != '\r')
+      ++n;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    char *stop = nullptr;
+    value = strtof(buf, &stop);
+    return stop == buf ? nullptr : p + (stop - buf);
+#endif
+  }
+
+  /*
+    Parses the lines of a chunk into rows [firstRow, firstRow + rows) of
+    the matrix and the matching entries of filenames. On a malformed line
+    the error is stored in the chunk and parsing stops.
+   */
+  void parseChunk(CsvChunk &chunk, std::vector<std::string> &filenames,
+                  size_t filenameBase, FeatureMatrix &data)
+  {
+    const size_t cols = data.cols();
+    size_t row = chunk.firstRow;
+    const char *p = chunk.begin;
+    while (p < chunk.end)
+    {
+      const char *e = lineEnd(p, chunk.end);
+      const char *next = e + 1;
+      while (e > p && e[-1] == '\r')
+        --e;
+      if (isBlankLine(p, e))
+      {
+        p = next;
+        continue;
+      }
+
+      // the filename runs up to the first comma
+      const char *q = static_cast<const char *>(memchr(p, ',', e - p));
+      if (!q)
+        q = e;
+      filenames[filenameBase + row].assign(p, q);
+
+      // then one number after every comma
+      float *out = data.row(row);
+      size_t n = 0;
+      while (q < e)
+      {
+        float v;
+        const char *r = parseFloat(q + 1, e, v);
+        while (r && r < e && (*r == ' ' || *r == '\t'))
+          ++r;
+        if (!r || (r < e && *r != ','))
+        {
+          chunk.error = "Row " + std::to_string(row + 1) + " (" + filenames[filenameBase + row] +
+                        ") has an invalid value in column " + std::to_string(n + 2);
+          return;
+        }
+        if (n < cols)
+          out[n] = v;
+        ++n;
+        q = r;
+      }
+      if (n != cols)
+      {
+        chunk.error = "Row " + std::to_string(row + 1) + " (" + filenames[filenameBase + row] +
+                      ") has " + std::to_string(n) + " features, expected " + std::to_string(cols);
+        return;
+      }
+      ++row;
+      p = next;
+    }
+  }
+} // namespace
+
 /*
   Given a filename, and image filename, and the image features, by
   default the function will append a line of data to the CSV format
@@ -238,6 +393,194 @@ int csvUtil::read_image_data_csv(const std::string &filename,
   return (0);
 }
 
+/*
+  Given a file with the format of a string as the first column and
+  floating point numbers as the remaining columns, this function
+  returns the filenames as a std::vector of strings, and the remaining
+  data as one contiguous FeatureMatrix. The features of each line are
+  collected in a reused buffer and appended to the matrix, so reading
+  the file does not allocate per image.
+
+  The function returns a non-zero value if something goes wrong,
+  including a line whose number of features differs from the first one.
+ */
+int csvUtil::read_image_data_csv(const std::string &filename,
+                                 std::vector<std::string> &filenames,
+                                 FeatureMatrix &data,
+                                 int echo_file)
+{
+  FILE *fp;
+  float fval;
+  char img_file[256];
+  std::vector<float> dvec;
+
+  fp = fopen(filename.c_str(), "r");
+  if (!fp)
+  {
+    printf("Unable to open feature file\n");
+    return (-1);
+  }
+
+  printf("Reading %s\n", filename.c_str());
+  for (;;)
+  {
+    dvec.clear();
+
+    // read the filename
+    if (getstring(fp, img_file))
+    {
+      break;
+    }
+
+    // read the features of this line
+    for (;;)
+    {
+      float eol = getfloat(fp, &fval);
+      dvec.push_back(fval);
+      if (eol)
+        break;
+    }
+
+    if (data.appendRow(dvec) != 0)
+    {
+      printf("Line %zu (%s) has %zu features, expected %zu\n",
+             filenames.size() + 1, img_file, dvec.size(), data.cols());
+      fclose(fp);
+      return (-1);
+    }
+    filenames.push_back(std::string(img_file));
+  }
+  fclose(fp);
+  printf("Finished reading CSV file\n");
+  printf("--------------------\n");
+
+  if (echo_file)
+  {
+    for (size_t i = 0; i < data.rows(); i++)
+    {
+      for (size_t j = 0; j < data.cols(); j++)
+      {
+        printf("%.4f  ", data.row(i)[j]);
+      }
+      printf("\n");
+    }
+    printf("\n");
+  }
+
+  return (0);
+}
+
+/*
+  Parallel version of the FeatureMatrix reader. The file is mapped with
+  mmap and split into byte ranges aligned to line boundaries. Each range
+  is handed to ThreadUtil::parallelFor twice: once to count its lines, so the
+  matrix can be allocated in one go, and once to parse its lines with
+  std::from_chars straight into their rows.
+
+  The function returns a non-zero value if something goes wrong,
+  including a line whose number of features differs from the first one
+  or a value that is not a number.
+ */
+int csvUtil::read_image_data_csv_parallel(const std::string &filename,
+                                          std::vector<std::string> &filenames,
+                                          FeatureMatrix &data,
+                                          int num_threads)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    printf("Unable to open feature file\n");
+    return (-1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    // nothing to map (pipe, empty file): use the serial reader
+    close(fd);
+    return read_image_data_csv(filename, filenames, data, 0);
+  }
+
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return read_image_data_csv(filename, filenames, data, 0);
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  printf("Reading %s\n", filename.c_str());
+  const char *begin = static_cast<const char *>(map);
+  const char *end = begin + size;
+
+  // split the file into byte ranges that start right after a newline
+  size_t threads = num_threads > 0 ? (size_t)num_threads : ThreadUtil::defaultThreads();
+  if (threads > size / kMinChunkBytes + 1)
+    threads = size / kMinChunkBytes + 1;
+  std::vector<CsvChunk> chunks(threads);
+  const char *p = begin;
+  for (size_t i = 0; i < threads; i++)
+  {
+    const char *stop = i + 1 == threads ? end : begin + size * (i + 1) / threads;
+    if (stop < p)
+      stop = p;
+    if (stop < end)
+      stop = lineEnd(stop, end) + 1;
+    if (stop > end)
+      stop = end;
+    chunks[i].begin = p;
+    chunks[i].end = stop;
+    p = stop;
+  }
+
+  // pass 1: count the data lines of every range
+  ThreadUtil::parallelFor(chunks.size(), [&](size_t i)
+                          { chunks[i].rows = countRows(chunks[i].begin, chunks[i].end); },
+                          threads);
+  size_t rows = 0;
+  for (auto &chunk : chunks)
+  {
+    chunk.firstRow = rows;
+    rows += chunk.rows;
+  }
+
+  // the first data line fixes the number of features (one per comma)
+  size_t cols = 0;
+  for (p = begin; p < end;)
+  {
+    const char *e = lineEnd(p, end);
+    if (!isBlankLine(p, e))
+    {
+      for (const char *c = p; c < e; ++c)
+        cols += *c == ',';
+      break;
+    }
+    p = e + 1;
+  }
+
+  // pass 2: allocate once, then parse every range into its own rows
+  size_t filenameBase = filenames.size();
+  filenames.resize(filenameBase + rows);
+  data = FeatureMatrix(rows, cols);
+  ThreadUtil::parallelFor(chunks.size(), [&](size_t i)
+                          { parseChunk(chunks[i], filenames, filenameBase, data); },
+                          threads);
+  munmap(map, size);
+
+  for (const auto &chunk : chunks)
+  {
+    if (!chunk.error.empty())
+    {
+      printf("%s\n", chunk.error.c_str());
+      filenames.resize(filenameBase);
+      data = FeatureMatrix();
+      return (-1);
+    }
+  }
+
+  printf("Finished reading CSV file (%zu rows, %zu threads)\n", rows, threads);
+  printf("--------------------\n");
+  return (0);
+}
+
 /*
 clears the contents of the specified file.
 @param filename The path to the file to be cleared.
@@ -0,0 +1,177 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  dbToolCLI.cpp
+
+  Path: project2/src/utils/dbToolCLI.cpp
+  Description: Command line interface for the feature database tool.
+*/
+
+#include "dbToolCLI.hpp"
+#include <getopt.h>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+Parses command line arguments for the feature database tool. argv[1] is the
+command; the options after it are parsed with getopt_long.
+- @param argc The number of command line arguments.
+- @param argv An array of character pointers representing the command line arguments.
+- @return An Args struct containing the parsed arguments.
+*/
+DbToolCLI::Args DbToolCLI::parse(int argc, char *argv[])
+{
+    Args args;
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        args.showHelp = true;
+        return args;
+    }
+    args.command = argv[1];
+
+    static struct option long_options[] = {
+        {"input", required_argument, 0, 'i'},
+        {"output", required_argument, 0, 'o'},
+        {"reference", required_argument, 0, 'r'},
+        {"quant", required_argument, 0, 'q'},
+        {"metric", required_argument, 0, 'm'},
+        {"ref-metric", required_argument, 0, 'M'},
+        {"topk", required_argument, 0, 'k'},
+        {"queries", required_argument, 0, 'n'},
+        {"index", required_argument, 0, 'x'},
+        {"feature", required_argument, 0, 'f'},
+        {"position", required_argument, 0, 'p'},
+        {"links", required_argument, 0, 'L'},
+        {"ef-construction", required_argument, 0, 'E'},
+        {"ef", required_argument, 0, 'e'},
+        {"lists", required_argument, 0, 'l'},
+        {"nprobe", required_argument, 0, 'P'},
+        {"subspaces", required_argument, 0, 'S'},
+        {"rerank", required_argument, 0, 'R'},
+        {"threads", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    optind = 1; // reset getopt state
+
+    // skip the command so getopt starts at the first option
+    int opt;
+    while ((opt = getopt_long(argc - 1, argv + 1, "i:o:r:q:m:M:k:n:x:f:p:L:E:e:l:P:S:R:j:h", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            args.inputPath = optarg;
+            break;
+        case 'o':
+            args.outputPath = optarg;
+            break;
+        case 'r':
+            args.referencePath = optarg;
+            break;
+        case 'q':
+            args.quantStr = optarg;
+            break;
+        case 'm':
+            args.metricStr = optarg;
+            break;
+        case 'M':
+            args.refMetricStr = optarg;
+            break;
+        case 'k':
+            args.topK = std::atoi(optarg);
+            break;
+        case 'n':
+            args.numQueries = std::atoi(optarg);
+            break;
+        case 'x':
+            args.indexStr = optarg;
+            break;
+        case 'f':
+            args.featureStr = optarg;
+            break;
+        case 'p':
+            args.positionStr = optarg;
+            break;
+        case 'L':
+            args.links = std::atoi(optarg);
+            break;
+        case 'E':
+            args.efConstruction = std::atoi(optarg);
+            break;
+        case 'e':
+            args.efSearch = std::atoi(optarg);
+            break;
+        case 'l':
+            args.lists = std::atoi(optarg);
+            break;
+        case 'P':
+            args.nprobe = std::atoi(optarg);
+            break;
+        case 'S':
+            args.subspaces = std::atoi(optarg);
+            break;
+        case 'R':
+            args.rerank = std::atoi(optarg);
+            break;
+        case 'j':
+            args.threads = std::atoi(optarg);
+            break;
+        case 'h':
+            args.showHelp = true;
+            break;
+        default:
+            args.showHelp = true;
+            break;
+        }
+    }
+    return args;
+}
+
+/*
+Prints the usage information for the feature database tool.
+- @param prog The name of the program.
+*/
+void DbToolCLI::printUsage(const char *prog)
+{
+    printf("usage:\n");
+    printf("  %s quantize -i <in.fdb|fst> -o <out.fdb|fst> -q <u8|f16>\n", prog);
+    printf("  %s compare  -r <reference.fdb> -i <test.fdb> [-m <metric>] [-M <metric>] [-k <K>] [-n <queries>]\n", prog);
+    printf("  %s index    -i <db> [-x hnsw|ivf|pq|vptree|bins] [-m <metric>] [-f <feature> -p <position>] [-L <M>] [-E <ef>] [-l <lists>] [-S <M>] [-j <N>]\n", prog);
+    printf("  %s recall   -i <db> [-x hnsw|ivf|pq|vptree|bins] [-f <feature> -p <position>] [-k <K>] [-n <queries>] [-e <ef>] [-P <nprobe>] [-R <N>]\n", prog);
+    printf("  %s selftest\n", prog);
+    printf("  %s bench\n", prog);
+    printf("\n");
+    printf("commands:\n");
+    printf("  quantize   re-encode a float32 feature DB or store as uint8 or fp16 (in == out is allowed)\n");
+    printf("  compare    rank sampled queries in both DBs and report how much the rankings differ\n");
+    printf("  index      build the search index of a DB (of every shard of a .shards DB) next to it\n");
+    printf("  recall     search sampled queries through the index and report recall@K against\n");
+    printf("             an exact scan, and the cost of a query both ways\n");
+    printf("  selftest   check the SIMD distance kernels of this CPU against the scalar ones\n");
+    printf("  bench      time the generic and the fixed-length distance kernels of this CPU\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -i, --input      <path>    input feature DB (.fdb, or .fst for quantize; any DB for\n");
+    printf("                             index and recall)\n");
+    printf("  -o, --output     <path>    output feature DB (.fdb, or .fst for quantize)\n");
+    printf("  -r, --reference  <path>    reference feature DB, usually float32 (.fdb)\n");
+    printf("  -q, --quant      <type>    f32 | u8 | f16 (default u8)\n");
+    printf("  -m, --metric     <metric>  ssd | hist_ix | cosine | hellinger (default ssd)\n");
+    printf("  -M, --ref-metric <metric>  metric of the reference DB, e.g. hist_ix on the raw\n");
+    printf("                             histograms of a sqrt test DB (default: --metric)\n");
+    printf("  -k, --topk       <K>       neighbours compared per query (default 10)\n");
+    printf("  -n, --queries    <N>       number of rows used as queries (default 100)\n");
+    printf("  -x, --index      <type>    hnsw (default; ssd or cosine) | ivf | pq (any metric)\n");
+    printf("                             | vptree (ssd, exact) | bins (hist_ix, exact)\n");
+    printf("  -f, --feature    <feature> group of a .fst DB to index, e.g. gabor\n");
+    printf("  -p, --position   <pos>     position of that group (default whole)\n");
+    printf("  -L, --links      <M>       hnsw neighbours per node (default 16)\n");
+    printf("  -E, --ef-construction <N>  hnsw candidates per insertion (default 200)\n");
+    printf("  -e, --ef         <N>       hnsw candidates per query (default 64)\n");
+    printf("  -l, --lists      <N>       ivf clusters (default: square root of the rows)\n");
+    printf("  -P, --nprobe     <N>       ivf lists scanned per query (default 8)\n");
+    printf("  -S, --subspaces  <M>       pq code bytes per row (default: one per 8 features)\n");
+    printf("  -R, --rerank     <N>       pq rows re-scored exactly per query (default 0: none)\n");
+    printf("  -j, --threads    <N>       index build threads (default: all cores)\n");
+    printf("  -h, --help                 show help\n");
+}
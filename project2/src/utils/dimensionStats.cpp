@@ -0,0 +1,94 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  dimensionStats.cpp
+
+  Path: project2/src/utils/dimensionStats.cpp
+  Description: Orders the dimensions of a feature database by their variance.
+*/
+
+#include "dimensionStats.hpp"
+#include <algorithm>
+
+/*
+Forgets all rows added so far.
+- @param dim The number of features of the rows to come.
+*/
+void DimensionStats::reset(size_t dim)
+{
+    rows_ = 0;
+    sum_.assign(dim, 0.0);
+    sumSq_.assign(dim, 0.0);
+}
+
+/*
+Adds one stored row. U8 and fp16 rows are decoded first, so the variances are
+those of the values the distance metrics see.
+- @param type The storage type of the row.
+- @param qp The U8 scale/offset, ignored for other types.
+- @param row The stored elements of the row.
+*/
+void DimensionStats::add(FeatureDataType type, const QuantParams &qp, const void *row)
+{
+    if (type == FeatureDataType::F32)
+    {
+        add(static_cast<const float *>(row));
+        return;
+    }
+    decoded_.resize(sum_.size());
+    Quantization::decode(type, qp, row, sum_.size(), decoded_.data());
+    add(decoded_.data());
+}
+
+/*
+Adds one float32 row.
+- @param row The features of the row, one per dimension.
+*/
+void DimensionStats::add(const float *row)
+{
+    for (size_t d = 0; d < sum_.size(); ++d)
+    {
+        sum_[d] += row[d];
+        sumSq_[d] += (double)row[d] * row[d];
+    }
+    ++rows_;
+}
+
+/*
+Orders the dimensions by decreasing variance. An SSD that stops once it exceeds a
+threshold gets there soonest by summing the dimensions that vary most first.
+- @return A permutation of [0, dim), highest variance first, ties by index.
+*/
+std::vector<uint32_t> DimensionStats::order() const
+{
+    const size_t dim = sum_.size();
+    std::vector<double> variance(dim, 0.0);
+    for (size_t d = 0; d < dim && rows_ > 0; ++d)
+    {
+        double mean = sum_[d] / rows_;
+        variance[d] = sumSq_[d] / rows_ - mean * mean;
+    }
+    std::vector<uint32_t> order(dim);
+    for (size_t d = 0; d < dim; ++d)
+        order[d] = (uint32_t)d;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return variance[a] > variance[b]; });
+    return order;
+}
+
+/*
+Checks that an order holds every dimension once.
+- @param order The order to check, dim entries.
+- @param dim The number of dimensions.
+- @return true if order is a permutation of [0, dim).
+*/
+bool DimensionStats::isOrder(const uint32_t *order, size_t dim)
+{
+    std::vector<char> seen(dim, 0);
+    for (size_t d = 0; d < dim; ++d)
+    {
+        if (order[d] >= dim || seen[order[d]])
+            return false;
+        seen[order[d]] = 1;
+    }
+    return true;
+}
@@ -0,0 +1,1365 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  distanceKernels.cpp
+
+  Path: project2/src/utils/distanceKernels.cpp
+  Description: Scalar and SIMD float32 distance kernels and their selection at runtime.
+*/
+
+#include "distanceKernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CBIR_KERNELS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CBIR_KERNELS_NEON 1
+#endif
+
+namespace
+{
+    /*
+    Scalar reference kernels. They sum in the order of the original metric loops;
+    dotNorms and dot accumulate in double like std::inner_product with a double start
+    value. Every dot kernel sums like the dotNorms kernel of its set, so a cosine
+    distance gets the same dot product from either.
+    */
+
+    float scalarSsd(const float *a, const float *b, size_t n)
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; ++i)
+        {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+
+    float scalarMinSum(const float *a, const float *b, size_t n)
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; ++i)
+            sum += std::min(a[i], b[i]);
+        return sum;
+    }
+
+    DotNorms scalarDotNorms(const float *a, const float *b, size_t n)
+    {
+        DotNorms r{0.0, 0.0, 0.0};
+        for (size_t i = 0; i < n; ++i)
+        {
+            r.dot += a[i] * b[i];
+            r.sq1 += a[i] * a[i];
+            r.sq2 += b[i] * b[i];
+        }
+        return r;
+    }
+
+    double scalarDot(const float *a, const float *b, size_t n)
+    {
+        double dot = 0.0;
+        for (size_t i = 0; i < n; ++i)
+            dot += a[i] * b[i];
+        return dot;
+    }
+
+    /*
+    Early-abandoning SSD: sums the blocks of kBlockDims dimensions in the given order
+    and stops once the sum exceeds limit. Every kernel set checks after each block.
+    */
+    float scalarSsdWithin(const float *a, const float *b, const uint32_t *blocks, size_t n, float limit)
+    {
+        const size_t kBlock = DistanceKernels::kBlockDims;
+        float sum = 0.0f;
+        for (size_t k = 0, numBlocks = (n + kBlock - 1) / kBlock; k < numBlocks && sum <= limit; ++k)
+        {
+            size_t start = blocks[k] * kBlock;
+            sum += scalarSsd(a + start, b + start, std::min(kBlock, n - start));
+        }
+        return sum;
+    }
+
+    /*
+    Tiles of kTileQueries x kTileRows pairs for the batch mode of the matcher. The
+    scalar reference computes each pair on its own; the SIMD sets keep the two rows in
+    registers and stream the queries past them, so each loaded vector feeds several
+    multiply-adds. Rows of a tile are fixed at two below.
+    */
+    const size_t kTileQ = DistanceKernels::kTileQueries;
+    static_assert(DistanceKernels::kTileRows == 2, "the tile kernels keep two rows in registers");
+
+    void scalarDotTile(const float *const *q, const float *const *r, size_t n, float *out)
+    {
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = (float)scalarDot(q[t], r[j], n);
+    }
+
+    void scalarMinSumTile(const float *const *q, const float *const *r, size_t n, float *out)
+    {
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = scalarMinSum(q[t], r[j], n);
+    }
+
+    /*
+    The ADC kernels sum the table entries of a row in subspace order, in float, like
+    this one; only the number of rows summed at once differs, so every set returns
+    exactly the scalar result.
+    */
+    const size_t kAdcB = DistanceKernels::kAdcBlock;
+    const size_t kAdcC = DistanceKernels::kAdcCodes;
+    static_assert(DistanceKernels::kAdcBlock == 32, "the ADC kernels keep 32 row sums in registers");
+
+    void scalarAdcScan(const float *lut, const uint8_t *codes, size_t m, float *out)
+    {
+        float acc[kAdcB] = {};
+        for (size_t j = 0; j < m; ++j)
+        {
+            const float *table = lut + j * kAdcC;
+            const uint8_t *c = codes + j * kAdcB;
+            for (size_t r = 0; r < kAdcB; ++r)
+                acc[r] += table[c[r]];
+        }
+        std::copy(acc, acc + kAdcB, out);
+    }
+
+#ifdef CBIR_KERNELS_X86
+    /*
+    SSE4.1 kernels: 4 floats per instruction, two accumulators to hide the latency
+    of the adds. Tails shorter than a vector go through the scalar kernels.
+    */
+
+    __attribute__((target("sse4.1"))) inline float hsum128(__m128 v)
+    {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+        return _mm_cvtss_f32(v);
+    }
+
+    __attribute__((target("sse4.1"))) float sseSsd(const float *a, const float *b, size_t n)
+    {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+        }
+        float sum = hsum128(_mm_add_ps(acc0, acc1));
+        return sum + scalarSsd(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) float sseSsdWithin(const float *a, const float *b, const uint32_t *blocks,
+                                                         size_t n, float limit)
+    {
+        const size_t kBlock = DistanceKernels::kBlockDims;
+        float sum = 0.0f;
+        for (size_t k = 0, numBlocks = (n + kBlock - 1) / kBlock; k < numBlocks && sum <= limit; ++k)
+        {
+            size_t start = blocks[k] * kBlock;
+            if (start + kBlock > n)
+            {
+                sum += scalarSsd(a + start, b + start, n - start);
+                continue;
+            }
+            const float *pa = a + start, *pb = b + start;
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(pa), _mm_loadu_ps(pb));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(pa + 4), _mm_loadu_ps(pb + 4));
+            __m128 d2 = _mm_sub_ps(_mm_loadu_ps(pa + 8), _mm_loadu_ps(pb + 8));
+            __m128 d3 = _mm_sub_ps(_mm_loadu_ps(pa + 12), _mm_loadu_ps(pb + 12));
+            __m128 acc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)),
+                                    _mm_add_ps(_mm_mul_ps(d2, d2), _mm_mul_ps(d3, d3)));
+            sum += hsum128(acc);
+        }
+        return sum;
+    }
+
+    __attribute__((target("sse4.1"))) float sseMinSum(const float *a, const float *b, size_t n)
+    {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            acc0 = _mm_add_ps(acc0, _mm_min_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            acc1 = _mm_add_ps(acc1, _mm_min_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        float sum = hsum128(_mm_add_ps(acc0, acc1));
+        return sum + scalarMinSum(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) DotNorms sseDotNorms(const float *a, const float *b, size_t n)
+    {
+        __m128 dot = _mm_setzero_ps(), sq1 = _mm_setzero_ps(), sq2 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+            dot = _mm_add_ps(dot, _mm_mul_ps(va, vb));
+            sq1 = _mm_add_ps(sq1, _mm_mul_ps(va, va));
+            sq2 = _mm_add_ps(sq2, _mm_mul_ps(vb, vb));
+        }
+        DotNorms tail = scalarDotNorms(a + i, b + i, n - i);
+        return DotNorms{hsum128(dot) + tail.dot, hsum128(sq1) + tail.sq1, hsum128(sq2) + tail.sq2};
+    }
+
+    __attribute__((target("sse4.1"))) double sseDot(const float *a, const float *b, size_t n)
+    {
+        __m128 dot = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            dot = _mm_add_ps(dot, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        return hsum128(dot) + scalarDot(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) void sseDotTile(const float *const *q, const float *const *r,
+                                                      size_t n, float *out)
+    {
+        __m128 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 r0 = _mm_loadu_ps(r[0] + i), r1 = _mm_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m128 vq = _mm_loadu_ps(q[t] + i);
+                acc[t][0] = _mm_add_ps(acc[t][0], _mm_mul_ps(vq, r0));
+                acc[t][1] = _mm_add_ps(acc[t][1], _mm_mul_ps(vq, r1));
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = hsum128(acc[t][j]) + (float)scalarDot(q[t] + i, r[j] + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) void sseMinSumTile(const float *const *q, const float *const *r,
+                                                         size_t n, float *out)
+    {
+        __m128 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 r0 = _mm_loadu_ps(r[0] + i), r1 = _mm_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m128 vq = _mm_loadu_ps(q[t] + i);
+                acc[t][0] = _mm_add_ps(acc[t][0], _mm_min_ps(vq, r0));
+                acc[t][1] = _mm_add_ps(acc[t][1], _mm_min_ps(vq, r1));
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = hsum128(acc[t][j]) + (float)scalarMinSum(q[t] + i, r[j] + i, n - i);
+    }
+
+    // SSE has no gather: the entries are looked up one by one and summed 4 rows at a time
+    __attribute__((target("sse4.1"))) void sseAdcScan(const float *lut, const uint8_t *codes, size_t m,
+                                                      float *out)
+    {
+        __m128 acc[kAdcB / 4];
+        for (size_t g = 0; g < kAdcB / 4; ++g)
+            acc[g] = _mm_setzero_ps();
+        for (size_t j = 0; j < m; ++j)
+        {
+            const float *table = lut + j * kAdcC;
+            const uint8_t *c = codes + j * kAdcB;
+            for (size_t g = 0; g < kAdcB / 4; ++g)
+            {
+                const uint8_t *cg = c + 4 * g;
+                acc[g] = _mm_add_ps(acc[g], _mm_set_ps(table[cg[3]], table[cg[2]], table[cg[1]], table[cg[0]]));
+            }
+        }
+        for (size_t g = 0; g < kAdcB / 4; ++g)
+            _mm_storeu_ps(out + 4 * g, acc[g]);
+    }
+
+    /*
+    AVX2 kernels: 8 floats per instruction with fused multiply-adds.
+    */
+
+    __attribute__((target("avx2,fma"))) inline float hsum256(__m256 v)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+        return _mm_cvtss_f32(s);
+    }
+
+    __attribute__((target("avx2,fma"))) float avx2Ssd(const float *a, const float *b, size_t n)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        }
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+            acc0 = _mm256_fmadd_ps(d, d, acc0);
+        }
+        float sum = hsum256(_mm256_add_ps(acc0, acc1));
+        return sum + scalarSsd(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma"))) float avx2SsdWithin(const float *a, const float *b, const uint32_t *blocks,
+                                                            size_t n, float limit)
+    {
+        const size_t kBlock = DistanceKernels::kBlockDims;
+        float sum = 0.0f;
+        for (size_t k = 0, numBlocks = (n + kBlock - 1) / kBlock; k < numBlocks && sum <= limit; ++k)
+        {
+            size_t start = blocks[k] * kBlock;
+            if (start + kBlock > n)
+            {
+                sum += scalarSsd(a + start, b + start, n - start);
+                continue;
+            }
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + start), _mm256_loadu_ps(b + start));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + start + 8), _mm256_loadu_ps(b + start + 8));
+            sum += hsum256(_mm256_fmadd_ps(d1, d1, _mm256_mul_ps(d0, d0)));
+        }
+        return sum;
+    }
+
+    __attribute__((target("avx2,fma"))) float avx2MinSum(const float *a, const float *b, size_t n)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        }
+        for (; i + 8 <= n; i += 8)
+            acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        float sum = hsum256(_mm256_add_ps(acc0, acc1));
+        return sum + scalarMinSum(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma"))) DotNorms avx2DotNorms(const float *a, const float *b, size_t n)
+    {
+        __m256 dot = _mm256_setzero_ps(), sq1 = _mm256_setzero_ps(), sq2 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 va = _mm256_loadu_ps(a + i), vb = _mm256_loadu_ps(b + i);
+            dot = _mm256_fmadd_ps(va, vb, dot);
+            sq1 = _mm256_fmadd_ps(va, va, sq1);
+            sq2 = _mm256_fmadd_ps(vb, vb, sq2);
+        }
+        DotNorms tail = scalarDotNorms(a + i, b + i, n - i);
+        return DotNorms{hsum256(dot) + tail.dot, hsum256(sq1) + tail.sq1, hsum256(sq2) + tail.sq2};
+    }
+
+    __attribute__((target("avx2,fma"))) double avx2Dot(const float *a, const float *b, size_t n)
+    {
+        __m256 dot = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            dot = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), dot);
+        return hsum256(dot) + scalarDot(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma"))) void avx2DotTile(const float *const *q, const float *const *r,
+                                                         size_t n, float *out)
+    {
+        __m256 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 r0 = _mm256_loadu_ps(r[0] + i), r1 = _mm256_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m256 vq = _mm256_loadu_ps(q[t] + i);
+                acc[t][0] = _mm256_fmadd_ps(vq, r0, acc[t][0]);
+                acc[t][1] = _mm256_fmadd_ps(vq, r1, acc[t][1]);
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = hsum256(acc[t][j]) + (float)scalarDot(q[t] + i, r[j] + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma"))) void avx2MinSumTile(const float *const *q, const float *const *r,
+                                                            size_t n, float *out)
+    {
+        __m256 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 r0 = _mm256_loadu_ps(r[0] + i), r1 = _mm256_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m256 vq = _mm256_loadu_ps(q[t] + i);
+                acc[t][0] = _mm256_add_ps(acc[t][0], _mm256_min_ps(vq, r0));
+                acc[t][1] = _mm256_add_ps(acc[t][1], _mm256_min_ps(vq, r1));
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = hsum256(acc[t][j]) + (float)scalarMinSum(q[t] + i, r[j] + i, n - i);
+    }
+
+    // 8 codes widened to 32-bit indexes gather 8 table entries per instruction
+    __attribute__((target("avx2,fma"))) void avx2AdcScan(const float *lut, const uint8_t *codes, size_t m,
+                                                         float *out)
+    {
+        __m256 acc[kAdcB / 8];
+        for (size_t g = 0; g < kAdcB / 8; ++g)
+            acc[g] = _mm256_setzero_ps();
+        for (size_t j = 0; j < m; ++j)
+        {
+            const float *table = lut + j * kAdcC;
+            const uint8_t *c = codes + j * kAdcB;
+            for (size_t g = 0; g < kAdcB / 8; ++g)
+            {
+                __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(c + 8 * g)));
+                acc[g] = _mm256_add_ps(acc[g], _mm256_i32gather_ps(table, idx, 4));
+            }
+        }
+        for (size_t g = 0; g < kAdcB / 8; ++g)
+            _mm256_storeu_ps(out + 8 * g, acc[g]);
+    }
+
+    /*
+    AVX-512 kernels: 16 floats per instruction; the tail is a masked load instead of
+    a scalar loop.
+    */
+
+    // Loads the n - i < 16 remaining floats, zero filling the rest of the vector
+    __attribute__((target("avx512f"))) inline __m512 loadTail512(const float *p, size_t count)
+    {
+        return _mm512_maskz_loadu_ps((__mmask16)((1u << count) - 1), p);
+    }
+
+    __attribute__((target("avx512f"))) float avx512Ssd(const float *a, const float *b, size_t n)
+    {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        }
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+            acc0 = _mm512_fmadd_ps(d, d, acc0);
+        }
+        if (i < n)
+        {
+            __m512 d = _mm512_sub_ps(loadTail512(a + i, n - i), loadTail512(b + i, n - i));
+            acc1 = _mm512_fmadd_ps(d, d, acc1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    __attribute__((target("avx512f"))) float avx512SsdWithin(const float *a, const float *b, const uint32_t *blocks,
+                                                             size_t n, float limit)
+    {
+        const size_t kBlock = DistanceKernels::kBlockDims;
+        float sum = 0.0f;
+        for (size_t k = 0, numBlocks = (n + kBlock - 1) / kBlock; k < numBlocks && sum <= limit; ++k)
+        {
+            size_t start = blocks[k] * kBlock;
+            __m512 d = start + kBlock <= n
+                           ? _mm512_sub_ps(_mm512_loadu_ps(a + start), _mm512_loadu_ps(b + start))
+                           : _mm512_sub_ps(loadTail512(a + start, n - start), loadTail512(b + start, n - start));
+            sum += _mm512_reduce_add_ps(_mm512_mul_ps(d, d));
+        }
+        return sum;
+    }
+
+    __attribute__((target("avx512f"))) float avx512MinSum(const float *a, const float *b, size_t n)
+    {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+            acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
+        }
+        for (; i + 16 <= n; i += 16)
+            acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        // min(0, 0) adds nothing for the zero filled lanes
+        if (i < n)
+            acc1 = _mm512_add_ps(acc1, _mm512_min_ps(loadTail512(a + i, n - i), loadTail512(b + i, n - i)));
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    __attribute__((target("avx512f"))) DotNorms avx512DotNorms(const float *a, const float *b, size_t n)
+    {
+        __m512 dot = _mm512_setzero_ps(), sq1 = _mm512_setzero_ps(), sq2 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 va = _mm512_loadu_ps(a + i), vb = _mm512_loadu_ps(b + i);
+            dot = _mm512_fmadd_ps(va, vb, dot);
+            sq1 = _mm512_fmadd_ps(va, va, sq1);
+            sq2 = _mm512_fmadd_ps(vb, vb, sq2);
+        }
+        if (i < n)
+        {
+            __m512 va = loadTail512(a + i, n - i), vb = loadTail512(b + i, n - i);
+            dot = _mm512_fmadd_ps(va, vb, dot);
+            sq1 = _mm512_fmadd_ps(va, va, sq1);
+            sq2 = _mm512_fmadd_ps(vb, vb, sq2);
+        }
+        return DotNorms{_mm512_reduce_add_ps(dot), _mm512_reduce_add_ps(sq1), _mm512_reduce_add_ps(sq2)};
+    }
+
+    __attribute__((target("avx512f"))) double avx512Dot(const float *a, const float *b, size_t n)
+    {
+        __m512 dot = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            dot = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), dot);
+        if (i < n)
+            dot = _mm512_fmadd_ps(loadTail512(a + i, n - i), loadTail512(b + i, n - i), dot);
+        return _mm512_reduce_add_ps(dot);
+    }
+
+    // min(0, 0) and 0 * 0 add nothing for the zero filled lanes of the tail
+    __attribute__((target("avx512f"))) void avx512DotTile(const float *const *q, const float *const *r,
+                                                          size_t n, float *out)
+    {
+        __m512 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 r0 = _mm512_loadu_ps(r[0] + i), r1 = _mm512_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m512 vq = _mm512_loadu_ps(q[t] + i);
+                acc[t][0] = _mm512_fmadd_ps(vq, r0, acc[t][0]);
+                acc[t][1] = _mm512_fmadd_ps(vq, r1, acc[t][1]);
+            }
+        }
+        if (i < n)
+        {
+            __m512 r0 = loadTail512(r[0] + i, n - i), r1 = loadTail512(r[1] + i, n - i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m512 vq = loadTail512(q[t] + i, n - i);
+                acc[t][0] = _mm512_fmadd_ps(vq, r0, acc[t][0]);
+                acc[t][1] = _mm512_fmadd_ps(vq, r1, acc[t][1]);
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = _mm512_reduce_add_ps(acc[t][j]);
+    }
+
+    __attribute__((target("avx512f"))) void avx512MinSumTile(const float *const *q, const float *const *r,
+                                                             size_t n, float *out)
+    {
+        __m512 acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 r0 = _mm512_loadu_ps(r[0] + i), r1 = _mm512_loadu_ps(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m512 vq = _mm512_loadu_ps(q[t] + i);
+                acc[t][0] = _mm512_add_ps(acc[t][0], _mm512_min_ps(vq, r0));
+                acc[t][1] = _mm512_add_ps(acc[t][1], _mm512_min_ps(vq, r1));
+            }
+        }
+        if (i < n)
+        {
+            __m512 r0 = loadTail512(r[0] + i, n - i), r1 = loadTail512(r[1] + i, n - i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                __m512 vq = loadTail512(q[t] + i, n - i);
+                acc[t][0] = _mm512_add_ps(acc[t][0], _mm512_min_ps(vq, r0));
+                acc[t][1] = _mm512_add_ps(acc[t][1], _mm512_min_ps(vq, r1));
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = _mm512_reduce_add_ps(acc[t][j]);
+    }
+
+    __attribute__((target("avx512f"))) void avx512AdcScan(const float *lut, const uint8_t *codes, size_t m,
+                                                          float *out)
+    {
+        __m512 acc[kAdcB / 16];
+        for (size_t g = 0; g < kAdcB / 16; ++g)
+            acc[g] = _mm512_setzero_ps();
+        for (size_t j = 0; j < m; ++j)
+        {
+            const float *table = lut + j * kAdcC;
+            const uint8_t *c = codes + j * kAdcB;
+            for (size_t g = 0; g < kAdcB / 16; ++g)
+            {
+                __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(c + 16 * g)));
+                acc[g] = _mm512_add_ps(acc[g], _mm512_i32gather_ps(idx, table, 4));
+            }
+        }
+        for (size_t g = 0; g < kAdcB / 16; ++g)
+            _mm512_storeu_ps(out + 16 * g, acc[g]);
+    }
+
+    /*
+    AVX2 kernels for a length D known at compile time (see DistanceKernels::forDim).
+    They sum in the same order as the generic AVX2 kernels, but the loops have a
+    constant trip count and are unrolled completely, and the tail is a constant
+    number of elements, so no loop counter or remainder branch is left.
+    */
+
+    template <size_t D>
+    __attribute__((target("avx2,fma"))) float avx2SsdFixed(const float *a, const float *b, size_t)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 16 * 16; i += 16)
+        {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        }
+        if constexpr (D % 16 >= 8)
+        {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + D / 16 * 16), _mm256_loadu_ps(b + D / 16 * 16));
+            acc0 = _mm256_fmadd_ps(d, d, acc0);
+        }
+        float sum = hsum256(_mm256_add_ps(acc0, acc1));
+        return sum + scalarSsd(a + D / 8 * 8, b + D / 8 * 8, D % 8);
+    }
+
+    template <size_t D>
+    __attribute__((target("avx2,fma"))) float avx2MinSumFixed(const float *a, const float *b, size_t)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 16 * 16; i += 16)
+        {
+            acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        }
+        if constexpr (D % 16 >= 8)
+            acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + D / 16 * 16),
+                                                     _mm256_loadu_ps(b + D / 16 * 16)));
+        float sum = hsum256(_mm256_add_ps(acc0, acc1));
+        return sum + scalarMinSum(a + D / 8 * 8, b + D / 8 * 8, D % 8);
+    }
+
+    template <size_t D>
+    __attribute__((target("avx2,fma"))) double avx2DotFixed(const float *a, const float *b, size_t)
+    {
+        __m256 dot = _mm256_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 8 * 8; i += 8)
+            dot = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), dot);
+        return hsum256(dot) + scalarDot(a + D / 8 * 8, b + D / 8 * 8, D % 8);
+    }
+
+    /*
+    AVX-512 kernels for a length D known at compile time, summing like the generic
+    AVX-512 kernels; the mask of the tail is a constant.
+    */
+
+    template <size_t D>
+    __attribute__((target("avx512f"))) float avx512SsdFixed(const float *a, const float *b, size_t)
+    {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 32 * 32; i += 32)
+        {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        }
+        if constexpr (D % 32 >= 16)
+        {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + D / 32 * 32), _mm512_loadu_ps(b + D / 32 * 32));
+            acc0 = _mm512_fmadd_ps(d, d, acc0);
+        }
+        if constexpr (D % 16 != 0)
+        {
+            __m512 d = _mm512_sub_ps(loadTail512(a + D / 16 * 16, D % 16), loadTail512(b + D / 16 * 16, D % 16));
+            acc1 = _mm512_fmadd_ps(d, d, acc1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    template <size_t D>
+    __attribute__((target("avx512f"))) float avx512MinSumFixed(const float *a, const float *b, size_t)
+    {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 32 * 32; i += 32)
+        {
+            acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+            acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
+        }
+        if constexpr (D % 32 >= 16)
+            acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + D / 32 * 32),
+                                                     _mm512_loadu_ps(b + D / 32 * 32)));
+        if constexpr (D % 16 != 0)
+            acc1 = _mm512_add_ps(acc1, _mm512_min_ps(loadTail512(a + D / 16 * 16, D % 16),
+                                                     loadTail512(b + D / 16 * 16, D % 16)));
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    template <size_t D>
+    __attribute__((target("avx512f"))) double avx512DotFixed(const float *a, const float *b, size_t)
+    {
+        __m512 dot = _mm512_setzero_ps();
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 16 * 16; i += 16)
+            dot = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), dot);
+        if constexpr (D % 16 != 0)
+            dot = _mm512_fmadd_ps(loadTail512(a + D / 16 * 16, D % 16), loadTail512(b + D / 16 * 16, D % 16), dot);
+        return _mm512_reduce_add_ps(dot);
+    }
+
+    const DistanceKernelSet kSse41 = {"sse4.1", sseSsd, sseMinSum, sseDotNorms, sseDot, sseSsdWithin,
+                                        sseDotTile, sseMinSumTile, sseAdcScan};
+    const DistanceKernelSet kAvx2 = {"avx2", avx2Ssd, avx2MinSum, avx2DotNorms, avx2Dot, avx2SsdWithin,
+                                       avx2DotTile, avx2MinSumTile, avx2AdcScan};
+    const DistanceKernelSet kAvx512 = {"avx512", avx512Ssd, avx512MinSum, avx512DotNorms, avx512Dot,
+                                         avx512SsdWithin, avx512DotTile, avx512MinSumTile, avx512AdcScan};
+#endif // CBIR_KERNELS_X86
+
+#ifdef CBIR_KERNELS_NEON
+    /*
+    NEON kernels for AArch64 (e.g. Apple Silicon): 4 floats per instruction with
+    fused multiply-adds.
+    */
+
+    float neonSsd(const float *a, const float *b, size_t n)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+            float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+            acc0 = vfmaq_f32(acc0, d0, d0);
+            acc1 = vfmaq_f32(acc1, d1, d1);
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        return sum + scalarSsd(a + i, b + i, n - i);
+    }
+
+    float neonSsdWithin(const float *a, const float *b, const uint32_t *blocks, size_t n, float limit)
+    {
+        const size_t kBlock = DistanceKernels::kBlockDims;
+        float sum = 0.0f;
+        for (size_t k = 0, numBlocks = (n + kBlock - 1) / kBlock; k < numBlocks && sum <= limit; ++k)
+        {
+            size_t start = blocks[k] * kBlock;
+            if (start + kBlock > n)
+            {
+                sum += scalarSsd(a + start, b + start, n - start);
+                continue;
+            }
+            const float *pa = a + start, *pb = b + start;
+            float32x4_t d0 = vsubq_f32(vld1q_f32(pa), vld1q_f32(pb));
+            float32x4_t d1 = vsubq_f32(vld1q_f32(pa + 4), vld1q_f32(pb + 4));
+            float32x4_t d2 = vsubq_f32(vld1q_f32(pa + 8), vld1q_f32(pb + 8));
+            float32x4_t d3 = vsubq_f32(vld1q_f32(pa + 12), vld1q_f32(pb + 12));
+            float32x4_t acc = vfmaq_f32(vfmaq_f32(vmulq_f32(d0, d0), d1, d1), d2, d2);
+            sum += vaddvq_f32(vfmaq_f32(acc, d3, d3));
+        }
+        return sum;
+    }
+
+    float neonMinSum(const float *a, const float *b, size_t n)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            acc0 = vaddq_f32(acc0, vminq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+            acc1 = vaddq_f32(acc1, vminq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        return sum + scalarMinSum(a + i, b + i, n - i);
+    }
+
+    DotNorms neonDotNorms(const float *a, const float *b, size_t n)
+    {
+        float32x4_t dot = vdupq_n_f32(0.0f), sq1 = vdupq_n_f32(0.0f), sq2 = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            float32x4_t va = vld1q_f32(a + i), vb = vld1q_f32(b + i);
+            dot = vfmaq_f32(dot, va, vb);
+            sq1 = vfmaq_f32(sq1, va, va);
+            sq2 = vfmaq_f32(sq2, vb, vb);
+        }
+        DotNorms tail = scalarDotNorms(a + i, b + i, n - i);
+        return DotNorms{vaddvq_f32(dot) + tail.dot, vaddvq_f32(sq1) + tail.sq1, vaddvq_f32(sq2) + tail.sq2};
+    }
+
+    double neonDot(const float *a, const float *b, size_t n)
+    {
+        float32x4_t dot = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            dot = vfmaq_f32(dot, vld1q_f32(a + i), vld1q_f32(b + i));
+        return vaddvq_f32(dot) + scalarDot(a + i, b + i, n - i);
+    }
+
+    void neonDotTile(const float *const *q, const float *const *r, size_t n, float *out)
+    {
+        float32x4_t acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            float32x4_t r0 = vld1q_f32(r[0] + i), r1 = vld1q_f32(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                float32x4_t vq = vld1q_f32(q[t] + i);
+                acc[t][0] = vfmaq_f32(acc[t][0], vq, r0);
+                acc[t][1] = vfmaq_f32(acc[t][1], vq, r1);
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = vaddvq_f32(acc[t][j]) + (float)scalarDot(q[t] + i, r[j] + i, n - i);
+    }
+
+    void neonMinSumTile(const float *const *q, const float *const *r, size_t n, float *out)
+    {
+        float32x4_t acc[kTileQ][2];
+        for (size_t t = 0; t < kTileQ; ++t)
+            acc[t][0] = acc[t][1] = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            float32x4_t r0 = vld1q_f32(r[0] + i), r1 = vld1q_f32(r[1] + i);
+            for (size_t t = 0; t < kTileQ; ++t)
+            {
+                float32x4_t vq = vld1q_f32(q[t] + i);
+                acc[t][0] = vaddq_f32(acc[t][0], vminq_f32(vq, r0));
+                acc[t][1] = vaddq_f32(acc[t][1], vminq_f32(vq, r1));
+            }
+        }
+        for (size_t t = 0; t < kTileQ; ++t)
+            for (size_t j = 0; j < 2; ++j)
+                out[t * 2 + j] = vaddvq_f32(acc[t][j]) + (float)scalarMinSum(q[t] + i, r[j] + i, n - i);
+    }
+
+    // NEON has no gather: the entries are looked up one by one and summed 4 rows at a time
+    void neonAdcScan(const float *lut, const uint8_t *codes, size_t m, float *out)
+    {
+        float32x4_t acc[kAdcB / 4];
+        for (size_t g = 0; g < kAdcB / 4; ++g)
+            acc[g] = vdupq_n_f32(0.0f);
+        for (size_t j = 0; j < m; ++j)
+        {
+            const float *table = lut + j * kAdcC;
+            const uint8_t *c = codes + j * kAdcB;
+            for (size_t g = 0; g < kAdcB / 4; ++g)
+            {
+                const uint8_t *cg = c + 4 * g;
+                const float entries[4] = {table[cg[0]], table[cg[1]], table[cg[2]], table[cg[3]]};
+                acc[g] = vaddq_f32(acc[g], vld1q_f32(entries));
+            }
+        }
+        for (size_t g = 0; g < kAdcB / 4; ++g)
+            vst1q_f32(out + 4 * g, acc[g]);
+    }
+
+    /*
+    NEON kernels for a length D known at compile time, summing like the generic
+    NEON kernels.
+    */
+
+    template <size_t D>
+    float neonSsdFixed(const float *a, const float *b, size_t)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 8 * 8; i += 8)
+        {
+            float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+            float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+            acc0 = vfmaq_f32(acc0, d0, d0);
+            acc1 = vfmaq_f32(acc1, d1, d1);
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        return sum + scalarSsd(a + D / 8 * 8, b + D / 8 * 8, D % 8);
+    }
+
+    template <size_t D>
+    float neonMinSumFixed(const float *a, const float *b, size_t)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 8 * 8; i += 8)
+        {
+            acc0 = vaddq_f32(acc0, vminq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+            acc1 = vaddq_f32(acc1, vminq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        return sum + scalarMinSum(a + D / 8 * 8, b + D / 8 * 8, D % 8);
+    }
+
+    template <size_t D>
+    double neonDotFixed(const float *a, const float *b, size_t)
+    {
+        float32x4_t dot = vdupq_n_f32(0.0f);
+#pragma GCC unroll 128
+        for (size_t i = 0; i < D / 4 * 4; i += 4)
+            dot = vfmaq_f32(dot, vld1q_f32(a + i), vld1q_f32(b + i));
+        return vaddvq_f32(dot) + scalarDot(a + D / 4 * 4, b + D / 4 * 4, D % 4);
+    }
+
+    const DistanceKernelSet kNeon = {"neon", neonSsd, neonMinSum, neonDotNorms, neonDot, neonSsdWithin,
+                                       neonDotTile, neonMinSumTile, neonAdcScan};
+#endif // CBIR_KERNELS_NEON
+
+    const DistanceKernelSet kScalar = {"scalar", scalarSsd, scalarMinSum, scalarDotNorms, scalarDot,
+                                         scalarSsdWithin, scalarDotTile, scalarMinSumTile, scalarAdcScan};
+
+    /*
+    Copies a kernel set with its ssd, minSum and dot kernels replaced by the ones
+    compiled for length D. Sets without fixed-length kernels (scalar, SSE4.1) are
+    copied unchanged.
+    - @param base The kernel set.
+    - @return The specialized set.
+    */
+    template <size_t D>
+    DistanceKernelSet specialize(const DistanceKernelSet &base)
+    {
+        DistanceKernelSet set = base;
+#ifdef CBIR_KERNELS_X86
+        if (&base == &kAvx2)
+        {
+            set.ssd = avx2SsdFixed<D>;
+            set.minSum = avx2MinSumFixed<D>;
+            set.dot = avx2DotFixed<D>;
+        }
+        else if (&base == &kAvx512)
+        {
+            set.ssd = avx512SsdFixed<D>;
+            set.minSum = avx512MinSumFixed<D>;
+            set.dot = avx512DotFixed<D>;
+        }
+#endif
+#ifdef CBIR_KERNELS_NEON
+        if (&base == &kNeon)
+        {
+            set.ssd = neonSsdFixed<D>;
+            set.minSum = neonMinSumFixed<D>;
+            set.dot = neonDotFixed<D>;
+        }
+#endif
+        return set;
+    }
+
+    /*
+    One entry of the dispatch table of DistanceKernels::forDim().
+    - dim: The feature length.
+    - kernels: The kernel set specialized for it.
+    */
+    struct FixedDimKernels
+    {
+        size_t dim;
+        DistanceKernelSet kernels;
+    };
+
+    /*
+    Builds the dispatch table for a kernel set: one entry per length in
+    DistanceKernels::kFixedDims, none if the set has no fixed-length kernels.
+    The specializations are instantiated from kFixedDims itself, so a new length
+    only needs to be added there.
+    - @param base The kernel set.
+    - @return The table.
+    */
+    template <size_t... I>
+    std::vector<FixedDimKernels> fixedDimTable(const DistanceKernelSet &base, std::index_sequence<I...>)
+    {
+        using Specialize = DistanceKernelSet (*)(const DistanceKernelSet &);
+        static constexpr Specialize kSpecialize[] = {specialize<DistanceKernels::kFixedDims[I]>...};
+        std::vector<FixedDimKernels> table;
+        for (size_t i = 0; i < sizeof...(I); ++i)
+        {
+            const DistanceKernelSet set = kSpecialize[i](base);
+            // Sets without fixed-length kernels keep an empty table
+            if (set.ssd != base.ssd)
+                table.push_back({DistanceKernels::kFixedDims[i], set});
+        }
+        return table;
+    }
+
+    std::vector<FixedDimKernels> fixedDimTable(const DistanceKernelSet &base)
+    {
+        return fixedDimTable(base, std::make_index_sequence<std::size(DistanceKernels::kFixedDims)>());
+    }
+
+    /*
+    Looks a length up in a dispatch table.
+    - @param table The table.
+    - @param n The feature length.
+    - @return The entry of n, nullptr if n has no fixed-length kernels.
+    */
+    const DistanceKernelSet *findFixed(const std::vector<FixedDimKernels> &table, size_t n)
+    {
+        for (const FixedDimKernels &entry : table)
+            if (entry.dim == n)
+                return &entry.kernels;
+        return nullptr;
+    }
+
+    /*
+    Checks one kernel result against the scalar reference. Sums in a different order
+    differ by rounding, which grows with the magnitude of the summed terms.
+    - @param got The result of the tested kernel.
+    - @param ref The result of the scalar kernel.
+    - @param magnitude The sum of the absolute values of the summed terms.
+    - @param maxError Updated with the largest error relative to magnitude.
+    - @return true if the error is within tolerance.
+    */
+    bool withinTolerance(double got, double ref, double magnitude, double &maxError)
+    {
+        double error = std::fabs(got - ref) / std::max(magnitude, 1e-30);
+        maxError = std::max(maxError, error);
+        return error <= 1e-5;
+    }
+} // namespace
+
+/*
+Returns the kernels of the best instruction set of this CPU, chosen on first use.
+- @return The kernel set.
+*/
+const DistanceKernelSet &DistanceKernels::active()
+{
+    static const DistanceKernelSet *best = supported().back();
+    return *best;
+}
+
+/*
+Returns the portable scalar kernels.
+- @return The kernel set.
+*/
+const DistanceKernelSet &DistanceKernels::scalar()
+{
+    return kScalar;
+}
+
+/*
+Lists the kernel sets this CPU can run, asking CPUID on x86.
+- @return The kernel sets, scalar first and fastest last.
+*/
+std::vector<const DistanceKernelSet *> DistanceKernels::supported()
+{
+    std::vector<const DistanceKernelSet *> sets = {&kScalar};
+#ifdef CBIR_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+        sets.push_back(&kSse41);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        sets.push_back(&kAvx2);
+    if (__builtin_cpu_supports("avx512f"))
+        sets.push_back(&kAvx512);
+#endif
+#ifdef CBIR_KERNELS_NEON
+    sets.push_back(&kNeon);
+#endif
+    return sets;
+}
+
+/*
+Returns the kernels for vectors of length n: the active set specialized for n if n
+is one of kFixedDims, the active set otherwise. The metrics call it once per batch,
+with the dimension of the database.
+- @param n The feature length.
+- @return The kernel set.
+*/
+const DistanceKernelSet &DistanceKernels::forDim(size_t n)
+{
+    static const std::vector<FixedDimKernels> table = fixedDimTable(active());
+    const DistanceKernelSet *fixed = findFixed(table, n);
+    return fixed ? *fixed : active();
+}
+
+/*
+Orders the blocks of kBlockDims dimensions for ssdWithin by the mean position of
+their dimensions in a dimension order, so the blocks whose dimensions vary most
+come first. The kernels load whole blocks, which keeps their loads contiguous
+where visiting single dimensions in order would need a gather per element.
+- @param dimOrder The dimensions by decreasing variance, nullptr for the natural order.
+- @param n The number of dimensions.
+- @return The block indices in the order to visit them.
+*/
+std::vector<uint32_t> DistanceKernels::blockOrder(const uint32_t *dimOrder, size_t n)
+{
+    const size_t numBlocks = (n + kBlockDims - 1) / kBlockDims;
+    std::vector<uint32_t> blocks(numBlocks);
+    for (size_t k = 0; k < numBlocks; ++k)
+        blocks[k] = (uint32_t)k;
+    if (!dimOrder)
+        return blocks;
+
+    std::vector<double> meanRank(numBlocks, 0.0);
+    for (size_t r = 0; r < n; ++r)
+        meanRank[dimOrder[r] / kBlockDims] += (double)r;
+    for (size_t k = 0; k < numBlocks; ++k)
+        meanRank[k] /= (double)std::min(kBlockDims, n - k * kBlockDims);
+    std::stable_sort(blocks.begin(), blocks.end(),
+                     [&](uint32_t a, uint32_t b) { return meanRank[a] < meanRank[b]; });
+    return blocks;
+}
+
+/*
+Runs every supported kernel set on random vectors and compares it with the scalar
+set. Lengths cover empty vectors, every tail length of the widest vectors and the
+feature lengths of the extractors; the start of each vector is shifted so unaligned
+loads are exercised too.
+- @return 0 if every kernel is within tolerance, -1 otherwise.
+*/
+int DistanceKernels::selfTest()
+{
+    const size_t lengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 63, 64,
+                              65, 128, 147, 256, 512, 1000, 4099};
+    const size_t kMaxShift = 3;
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> signedValue(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> binValue(0.0f, 1.0f);
+
+    int failures = 0;
+    for (const DistanceKernelSet *set : supported())
+    {
+        double maxError = 0.0;
+        int setFailures = 0;
+        for (size_t n : lengths)
+        {
+            for (size_t shift = 0; shift <= kMaxShift; ++shift)
+            {
+                std::vector<float> a(n + shift), b(n + shift), ha(n + shift), hb(n + shift);
+                for (size_t i = 0; i < n + shift; ++i)
+                {
+                    a[i] = signedValue(rng);
+                    b[i] = signedValue(rng);
+                    ha[i] = binValue(rng) / (float)std::max<size_t>(n, 1);
+                    hb[i] = binValue(rng) / (float)std::max<size_t>(n, 1);
+                }
+                const float *pa = a.data() + shift, *pb = b.data() + shift;
+                const float *pha = ha.data() + shift, *phb = hb.data() + shift;
+
+                // squared differences and histogram bins are non-negative, so the
+                // reference result is the magnitude of its terms
+                float ssdRef = kScalar.ssd(pa, pb, n);
+                if (!withinTolerance(set->ssd(pa, pb, n), ssdRef, ssdRef, maxError))
+                {
+                    printf("  %s ssd differs from scalar at n=%zu shift=%zu\n", set->name, n, shift);
+                    ++setFailures;
+                }
+                float minRef = kScalar.minSum(pha, phb, n);
+                if (!withinTolerance(set->minSum(pha, phb, n), minRef, minRef, maxError))
+                {
+                    printf("  %s minSum differs from scalar at n=%zu shift=%zu\n", set->name, n, shift);
+                    ++setFailures;
+                }
+                DotNorms ref = kScalar.dotNorms(pa, pb, n);
+                DotNorms got = set->dotNorms(pa, pb, n);
+                // |a.b| <= |a||b| bounds the magnitude of the dot product terms
+                if (!withinTolerance(got.dot, ref.dot, std::sqrt(ref.sq1 * ref.sq2), maxError) ||
+                    !withinTolerance(got.sq1, ref.sq1, ref.sq1, maxError) ||
+                    !withinTolerance(got.sq2, ref.sq2, ref.sq2, maxError))
+                {
+                    printf("  %s dotNorms differs from scalar at n=%zu shift=%zu\n", set->name, n, shift);
+                    ++setFailures;
+                }
+                if (!withinTolerance(set->dot(pa, pb, n), ref.dot, std::sqrt(ref.sq1 * ref.sq2), maxError))
+                {
+                    printf("  %s dot differs from scalar at n=%zu shift=%zu\n", set->name, n, shift);
+                    ++setFailures;
+                }
+
+                // In any block order, the early-abandoning SSD must give the full sum
+                // without a limit and a sum above the limit when the SSD exceeds it
+                std::vector<uint32_t> blocks(blockOrder(nullptr, n));
+                std::shuffle(blocks.begin(), blocks.end(), rng);
+                const float inf = std::numeric_limits<float>::infinity();
+                if (!withinTolerance(set->ssdWithin(pa, pb, blocks.data(), n, inf), ssdRef, ssdRef, maxError) ||
+                    (n > 0 && !(set->ssdWithin(pa, pb, blocks.data(), n, ssdRef * 0.5f) > ssdRef * 0.5f)))
+                {
+                    printf("  %s ssdWithin differs from scalar at n=%zu shift=%zu\n", set->name, n, shift);
+                    ++setFailures;
+                }
+
+                // The tiles pair both vectors with themselves and each other, each query
+                // and row starting at its own alignment
+                const float *tq[kTileQ] = {pa, pb, pa, pb};
+                const float *tr[2] = {pb, pa};
+                const float *hq[kTileQ] = {pha, phb, pha, phb};
+                const float *hr[2] = {phb, pha};
+                float tile[kTileQ * 2];
+                set->dotTile(tq, tr, n, tile);
+                bool tileOk = true;
+                for (size_t t = 0; t < kTileQ * 2; ++t)
+                {
+                    DotNorms pair = kScalar.dotNorms(tq[t / 2], tr[t % 2], n);
+                    tileOk = withinTolerance(tile[t], pair.dot, std::sqrt(pair.sq1 * pair.sq2), maxError) && tileOk;
+                }
+                set->minSumTile(hq, hr, n, tile);
+                for (size_t t = 0; t < kTileQ * 2; ++t)
+                {
+                    float pair = kScalar.minSum(hq[t / 2], hr[t % 2], n);
+                    tileOk = withinTolerance(tile[t], pair, pair, maxError) && tileOk;
+                }
+                if (!tileOk)
+                {
+                    printf("  %s dotTile / minSumTile differ from scalar at n=%zu shift=%zu\n", set->name, n,
+                           shift);
+                    ++setFailures;
+                }
+            }
+        }
+        // The fixed-length kernels must agree with the generic ones of their set
+        const std::vector<FixedDimKernels> fixedTable = fixedDimTable(*set);
+        for (const FixedDimKernels &entry : fixedTable)
+        {
+            const size_t n = entry.dim;
+            for (size_t shift = 0; shift <= kMaxShift; ++shift)
+            {
+                std::vector<float> a(n + shift), b(n + shift);
+                for (size_t i = 0; i < n + shift; ++i)
+                {
+                    a[i] = binValue(rng);
+                    b[i] = binValue(rng);
+                }
+                const float *pa = a.data() + shift, *pb = b.data() + shift;
+                float ssdRef = set->ssd(pa, pb, n), minRef = set->minSum(pa, pb, n);
+                double dotRef = set->dot(pa, pb, n);
+                if (!withinTolerance(entry.kernels.ssd(pa, pb, n), ssdRef, ssdRef, maxError) ||
+                    !withinTolerance(entry.kernels.minSum(pa, pb, n), minRef, minRef, maxError) ||
+                    !withinTolerance(entry.kernels.dot(pa, pb, n), dotRef, dotRef, maxError))
+                {
+                    printf("  %s fixed-length kernels differ from generic at n=%zu shift=%zu\n", set->name, n,
+                           shift);
+                    ++setFailures;
+                }
+            }
+        }
+
+        // The ADC kernels sum in the same order as the scalar one, so they must match it exactly
+        std::uniform_int_distribution<int> code(0, (int)kAdcC - 1);
+        for (size_t m : {1, 2, 3, 8, 16, 49, 64})
+        {
+            std::vector<float> lut(m * kAdcC);
+            std::vector<uint8_t> codes(m * kAdcB);
+            for (float &v : lut)
+                v = signedValue(rng);
+            for (uint8_t &c : codes)
+                c = (uint8_t)code(rng);
+            float got[kAdcB], ref[kAdcB];
+            set->adcScan(lut.data(), codes.data(), m, got);
+            kScalar.adcScan(lut.data(), codes.data(), m, ref);
+            if (!std::equal(got, got + kAdcB, ref))
+            {
+                printf("  %s adcScan differs from scalar at m=%zu\n", set->name, m);
+                ++setFailures;
+            }
+        }
+
+        printf("%-8s %s (max relative error %.2e)%s\n", set->name, setFailures == 0 ? "ok" : "FAILED",
+               maxError, set == &active() ? ", active" : "");
+        failures += setFailures;
+    }
+    return failures == 0 ? 0 : -1;
+}
+
+/*
+Times the generic kernels of the active set against the ones compiled for each
+length of kFixedDims. Every kernel compares one vector with a block of rows that
+stays in the L2 cache, so the time is the kernel's and not the memory's.
+- @return 0.
+*/
+int DistanceKernels::benchmark()
+{
+    const size_t kBlockBytes = 256 << 10;
+    const size_t kFloatsPerRun = 16 << 20; // work per timing, about 10-30 ms
+    const size_t kTrials = 7;
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    const DistanceKernelSet &generic = active();
+
+    printf("kernel set: %s\n", generic.name);
+    printf("%6s %8s %14s %14s %9s\n", "dim", "kernel", "generic ns/row", "fixed ns/row", "speedup");
+    volatile double sink = 0.0; // keeps the timed calls from being optimized away
+    for (size_t n : kFixedDims)
+    {
+        const DistanceKernelSet &fixed = forDim(n);
+        const size_t rows = std::max<size_t>(1, kBlockBytes / (n * sizeof(float)));
+        const size_t runs = std::max<size_t>(1, kFloatsPerRun / (rows * n));
+        std::vector<float> query(n), data(rows * n);
+        for (float &v : query)
+            v = value(rng);
+        for (float &v : data)
+            v = value(rng);
+
+        // Times one kernel over every row, runs times, and returns ns per row
+        auto time = [&](auto kernel) {
+            double sum = 0.0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t run = 0; run < runs; ++run)
+                for (size_t i = 0; i < rows; ++i)
+                    sum += kernel(query.data(), data.data() + i * n, n);
+            auto end = std::chrono::steady_clock::now();
+            sink = sink + sum;
+            return std::chrono::duration<double, std::nano>(end - start).count() / (double)(runs * rows);
+        };
+        // Generic and fixed runs alternate and the fastest of each is kept, so
+        // other load on the machine does not decide the comparison
+        const char *names[] = {"ssd", "minSum", "dot"};
+        const double inf = std::numeric_limits<double>::infinity();
+        double genericNs[] = {inf, inf, inf}, fixedNs[] = {inf, inf, inf};
+        for (size_t trial = 0; trial < kTrials; ++trial)
+        {
+            genericNs[0] = std::min(genericNs[0], time(generic.ssd));
+            fixedNs[0] = std::min(fixedNs[0], time(fixed.ssd));
+            genericNs[1] = std::min(genericNs[1], time(generic.minSum));
+            fixedNs[1] = std::min(fixedNs[1], time(fixed.minSum));
+            genericNs[2] = std::min(genericNs[2], time(generic.dot));
+            fixedNs[2] = std::min(fixedNs[2], time(fixed.dot));
+        }
+        for (size_t k = 0; k < 3; ++k)
+            printf("%6zu %8s %14.2f %14.2f %8.2fx\n", n, names[k], genericNs[k], fixedNs[k],
+                   genericNs[k] / fixedNs[k]);
+    }
+    if (&forDim(kFixedDims[0]) == &generic)
+        printf("The %s set has no fixed-length kernels; both columns time the generic ones.\n", generic.name);
+    printf("Other lengths use the generic kernels.\n");
+    return 0;
+}
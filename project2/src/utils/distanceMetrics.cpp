@@ -8,97 +8,462 @@
 
 #include "distanceMetrics.hpp"
 #include "csvUtil.hpp"
+#include "distanceKernels.hpp"
 #include "opencv2/opencv.hpp"
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <limits>
 #include <vector>
-#include <numeric>
+
+namespace
+{
+    // Products of two codes are < 2^16, so a uint32 sum of this many cannot overflow
+    const size_t kU8Block = 1 << 15;
+
+    /*
+    Sums a[i] * b[i] over two U8 code vectors. The inner loop accumulates in
+    uint32 so it vectorizes to widening multiply-adds; blocks keep it from overflowing.
+    - @param a The first code vector.
+    - @param b The second code vector.
+    - @param n The number of codes.
+    - @return The exact integer dot product.
+    */
+    uint64_t dotU8(const uint8_t *a, const uint8_t *b, size_t n)
+    {
+        uint64_t total = 0;
+        for (size_t start = 0; start < n; start += kU8Block)
+        {
+            size_t end = std::min(n, start + kU8Block);
+            uint32_t sum = 0;
+            for (size_t i = start; i < end; ++i)
+                sum += (uint32_t)a[i] * b[i];
+            total += sum;
+        }
+        return total;
+    }
+
+    /*
+    Sums the codes of a U8 vector.
+    - @param a The code vector.
+    - @param n The number of codes.
+    - @return The sum of the codes.
+    */
+    uint64_t sumU8(const uint8_t *a, size_t n)
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < n; ++i)
+            total += a[i];
+        return total;
+    }
+
+    /*
+    Cosine distance of two U8 code vectors when the code sums of the first are known.
+    Expanding x = offset + scale * q gives every inner product from integer sums of
+    the codes, e.g. x1.x2 = n * offset^2 + offset * scale * (sum(q1) + sum(q2)) + scale^2 * q1.q2.
+    - @param q1 The codes of the first feature vector.
+    - @param sum1 sum(q1).
+    - @param self1 q1.q1.
+    - @param q2 The codes of the second feature vector.
+    - @param n The number of features in each vector.
+    - @param qp The scale/offset shared by both vectors.
+    - @return The cosine distance of the decoded vectors, 1.0 if either has zero magnitude.
+    */
+    float cosineU8(const uint8_t *q1, double sum1, double self1, const uint8_t *q2, size_t n,
+                   const QuantParams &qp)
+    {
+        double s = qp.scale, o = qp.offset;
+        double sum2 = (double)sumU8(q2, n);
+        double base = (double)n * o * o;
+
+        double dot = base + o * s * (sum1 + sum2) + s * s * (double)dotU8(q1, q2, n);
+        double sum_sq1 = base + 2.0 * o * s * sum1 + s * s * self1;
+        double sum_sq2 = base + 2.0 * o * s * sum2 + s * s * (double)dotU8(q2, q2, n);
+
+        if (sum_sq1 <= 0.0 || sum_sq2 <= 0.0)
+            return 1.0f;
+        return static_cast<float>(1.0 - dot / (std::sqrt(sum_sq1) * std::sqrt(sum_sq2)));
+    }
+
+    /*
+    Sums a[i] * b[i] and b[i] over two U8 code vectors in one pass.
+    - @param a The first code vector.
+    - @param b The second code vector.
+    - @param n The number of codes.
+    - @param sumB Receives sum(b).
+    - @return The exact integer dot product.
+    */
+    uint64_t dotSumU8(const uint8_t *a, const uint8_t *b, size_t n, uint64_t &sumB)
+    {
+        uint64_t total = 0, sum = 0;
+        for (size_t start = 0; start < n; start += kU8Block)
+        {
+            size_t end = std::min(n, start + kU8Block);
+            uint32_t dot = 0, blockSum = 0;
+            for (size_t i = start; i < end; ++i)
+            {
+                dot += (uint32_t)a[i] * b[i];
+                blockSum += b[i];
+            }
+            total += dot;
+            sum += blockSum;
+        }
+        sumB = sum;
+        return total;
+    }
+
+    /*
+    Dot product of two U8 code vectors when the code sum of the first is known,
+    expanded as in cosineU8: x1.x2 = n * offset^2 + offset * scale * (sum(q1) + sum(q2))
+    + scale^2 * q1.q2.
+    - @param q1 The codes of the first feature vector.
+    - @param sum1 sum(q1).
+    - @param q2 The codes of the second feature vector.
+    - @param n The number of features in each vector.
+    - @param qp The scale/offset shared by both vectors.
+    - @return The dot product of the decoded vectors.
+    */
+    double decodedDotU8(const uint8_t *q1, double sum1, const uint8_t *q2, size_t n,
+                        const QuantParams &qp)
+    {
+        double s = qp.scale, o = qp.offset;
+        uint64_t sum2 = 0;
+        uint64_t codeDot = dotSumU8(q1, q2, n, sum2);
+        return (double)n * o * o + o * s * (sum1 + (double)sum2) + s * s * (double)codeDot;
+    }
+
+    /*
+    Turns a dot product and two known norms into a cosine distance.
+    - @param dot The dot product.
+    - @param norm1 The L2 norm of the first vector.
+    - @param norm2 The L2 norm of the second vector.
+    - @return 1 - cosine similarity, 1.0 if either vector has zero magnitude.
+    */
+    float cosineFromNorms(double dot, double norm1, double norm2)
+    {
+        if (norm1 <= 0.0 || norm2 <= 0.0)
+            return 1.0f;
+        return static_cast<float>(1.0 - dot / (norm1 * norm2));
+    }
+
+    /*
+    Runs a tile kernel over every (query, row) pair. Rows are taken two at a time and
+    the queries streamed past them kTileQueries at a time, so the rows stay in
+    registers and the queries in cache. Partial tiles repeat their last vector and
+    drop its extra results.
+    - @param tile The tile kernel, e.g. dotTile.
+    - @param queries The queries.
+    - @param rows The rows, as many features as the queries.
+    - @param out Receives queries.rows() x rows.rows() results, one row per query.
+    */
+    void crossTiles(void (*tile)(const float *const *, const float *const *, size_t, float *),
+                    const FeatureMatrix &queries, const FeatureMatrix &rows, float *out)
+    {
+        const size_t kQ = DistanceKernels::kTileQueries, kR = DistanceKernels::kTileRows;
+        const size_t numQueries = queries.rows(), numRows = rows.rows();
+        const float *q[kQ], *r[kR];
+        float result[kQ * kR];
+        for (size_t r0 = 0; r0 < numRows; r0 += kR)
+        {
+            const size_t nr = std::min(kR, numRows - r0);
+            for (size_t j = 0; j < kR; ++j)
+                r[j] = rows.row(r0 + std::min(j, nr - 1));
+            for (size_t q0 = 0; q0 < numQueries; q0 += kQ)
+            {
+                const size_t nq = std::min(kQ, numQueries - q0);
+                for (size_t t = 0; t < kQ; ++t)
+                    q[t] = queries.row(q0 + std::min(t, nq - 1));
+                tile(q, r, rows.cols(), result);
+                for (size_t t = 0; t < nq; ++t)
+                    for (size_t j = 0; j < nr; ++j)
+                        out[(q0 + t) * numRows + r0 + j] = result[t * kR + j];
+            }
+        }
+    }
+
+    /*
+    Computes the L2 norm of every row of a matrix.
+    - @param m The matrix.
+    - @return One norm per row.
+    */
+    std::vector<double> matrixNorms(const FeatureMatrix &m)
+    {
+        std::vector<double> norms(m.rows());
+        for (size_t i = 0; i < m.rows(); ++i)
+            norms[i] = Quantization::norm(FeatureDataType::F32, QuantParams(), m.row(i), m.cols());
+        return norms;
+    }
+} // namespace
 
 /*
 Sum of Squared Distance (SSD) metric
 Computes the sum of squared differences between two feature vectors.
-Lower values indicate more similar features.
+Lower values indicate more similar features. The loop runs in the SIMD kernel of
+the CPU, see distanceKernels.hpp.
 
 - @param v1 The first feature vector.
 - @param v2 The second feature vector.
+- @param n The number of features in each vector.
 - @return The computed SSD distance between the two vectors.
-    If the vectors are of different lengths, it returns INFINITY.
 */
-float SumSquaredDistance::compute(
-    const std::vector<float> &v1,
-    const std::vector<float> &v2) const
+float SumSquaredDistance::compute(const float *v1, const float *v2, size_t n) const
 {
-    // v1 and v2 not the same size, return infinity to indicate they cannot be compared
-    if (v1.size() != v2.size())
+    return DistanceKernels::forDim(n).ssd(v1, v2, n);
+}
+
+/*
+SSD on U8 codes. The shared offset cancels in every difference, so the distance is
+scale^2 times the integer sum of squared code differences.
+
+- @param q1 The codes of the first feature vector.
+- @param q2 The codes of the second feature vector.
+- @param n The number of features in each vector.
+- @param qp The scale/offset shared by both vectors.
+- @return The SSD distance of the decoded vectors.
+*/
+float SumSquaredDistance::computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const
+{
+    uint64_t total = 0;
+    for (size_t start = 0; start < n; start += kU8Block)
     {
-        printf("Feature vectors size does not match\n");
-        return std::numeric_limits<float>::infinity();
+        size_t end = std::min(n, start + kU8Block);
+        uint32_t sum = 0;
+        for (size_t i = start; i < end; ++i)
+        {
+            int diff = (int)q1[i] - (int)q2[i];
+            sum += (uint32_t)(diff * diff);
+        }
+        total += sum;
     }
+    return (float)((double)qp.scale * qp.scale * (double)total);
+}
+
+/*
+SSD on fp16 features, widened to float per element.
 
-    float sum = 0.0f; // Initialize the sum of squared differences as 0
-    for (size_t i = 0; i < v1.size(); ++i)
+- @param h1 The first feature vector.
+- @param h2 The second feature vector.
+- @param n The number of features in each vector.
+- @return The SSD distance.
+*/
+float SumSquaredDistance::computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i)
     {
-        float diff = v1[i] - v2[i];
+        float diff = Quantization::halfToFloat(h1[i]) - Quantization::halfToFloat(h2[i]);
         sum += diff * diff;
     }
     return sum;
 }
 
+/*
+SSD from query to every row of a matrix. The kernel is looked up once and the
+loop runs over the contiguous rows.
+
+- @param query The query vector, rows.cols() features.
+- @param rows The rows to compare with.
+- @param out Receives rows.rows() distances.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void SumSquaredDistance::computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                                     const double *rowNorms) const
+{
+    // The kernel is looked up once per batch, specialized for the row length if it has one
+    auto ssd = DistanceKernels::forDim(rows.cols()).ssd;
+    for (size_t i = 0; i < rows.rows(); ++i)
+        out[i] = ssd(query, rows.row(i), rows.cols());
+}
+
+/*
+SSD that stops once it exceeds limit. The kernel sums the dimension blocks in the
+given order, most varying first, and checks the sum after every block. A row that
+stays within the limit is summed again in the usual order, so its distance is the
+same as compute() gives and rankings do not depend on the limit; rows that exceed it
+are the vast majority once a scan has found good matches. The limit is widened a
+little so rounding in the different summation order never abandons such a row.
+
+- @param query The query vector.
+- @param row The row to compare with.
+- @param n The number of features in each vector.
+- @param blocks The order of the dimension blocks.
+- @param limit Distances above this are not needed.
+- @return The SSD, or a value above limit.
+*/
+float SumSquaredDistance::computeWithin(const float *query, const float *row, size_t n, const uint32_t *blocks,
+                                        float limit) const
+{
+    if (!(limit < std::numeric_limits<float>::infinity()))
+        return compute(query, row, n);
+    float partial = DistanceKernels::active().ssdWithin(query, row, blocks, n, limit + limit * 1e-5f);
+    return partial > limit ? partial : compute(query, row, n);
+}
+
+/*
+Lower bound of the SSD: a sum of squares is never negative.
+
+- @param query Unused.
+- @param n Unused.
+- @return 0.
+*/
+float SumSquaredDistance::lowerBound(const float *query, size_t n) const
+{
+    return 0.0f;
+}
+
+/*
+SSD from every query to every row, expanded as |q|^2 + |r|^2 - 2 q.r so the pairs
+only need dot products, which the tile kernel computes for several queries and rows
+per pass. The expansion rounds differently from summing the squared differences, so
+results match compute() to about 1e-6 of the squared norms; they are clamped at 0.
+
+- @param queries The queries, rows.cols() features each.
+- @param rows The rows to compare with.
+- @param out Receives queries.rows() x rows.rows() distances, one row per query.
+- @param rowNorms The L2 norm of every row, or nullptr to compute them.
+*/
+void SumSquaredDistance::computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                                      const double *rowNorms) const
+{
+    crossTiles(DistanceKernels::active().dotTile, queries, rows, out);
+    std::vector<double> queryNorms = matrixNorms(queries), computed;
+    if (!rowNorms)
+    {
+        computed = matrixNorms(rows);
+        rowNorms = computed.data();
+    }
+    for (size_t q = 0; q < queries.rows(); ++q)
+    {
+        float *dist = out + q * rows.rows();
+        double q2 = queryNorms[q] * queryNorms[q];
+        for (size_t i = 0; i < rows.rows(); ++i)
+            dist[i] = (float)std::max(0.0, q2 + rowNorms[i] * rowNorms[i] - 2.0 * dist[i]);
+    }
+}
+
 /*
 Histogram Intersection metric
 Computes the rghistogram intersection between two feature vectors (already normalized).
 Higher values indicate more similar features, so we convert it to a distance by
-subtracting from 1.
+subtracting from 1. The min-sum runs in the SIMD kernel of the CPU.
 
 - @param v1 The first feature vector (normalized).
 - @param v2 The second feature vector (normalized).
+- @param n The number of features in each vector.
 - @return The computed histogram intersection distance between the two vectors.
-    If the vectors are of different lengths, it returns INFINITY.
 */
-float HistogramIntersection::compute(
-    const std::vector<float> &v1,
-    const std::vector<float> &v2) const
+float HistogramIntersection::compute(const float *v1, const float *v2, size_t n) const
 {
-    // v1 and v2 not the same size, return infinity to indicate they cannot be compared
-    if (v1.size() != v2.size())
-    {
-        printf("Feature vectors size does not match\n");
-        return std::numeric_limits<float>::infinity();
-    }
-
-    float intersection = 0.0f; // Initialize the intersection value as 0
-    for (size_t i = 0; i < v1.size(); ++i)
-    {
-        intersection += std::min(v1[i], v2[i]);
-    }
+    float intersection = DistanceKernels::forDim(n).minSum(v1, v2, n);
     return 1.0f - intersection; // Convert similarity to distance
 }
 
+/*
+Histogram intersection on U8 codes. With a shared scale/offset, min() commutes with
+the decoding, so sum(min) = n * offset + scale * sum(min(q1, q2)).
+
+- @param q1 The codes of the first feature vector.
+- @param q2 The codes of the second feature vector.
+- @param n The number of features in each vector.
+- @param qp The scale/offset shared by both vectors.
+- @return The histogram intersection distance of the decoded vectors.
+*/
+float HistogramIntersection::computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const
+{
+    uint32_t sum = 0; // at most 255 * n
+    for (size_t i = 0; i < n; ++i)
+        sum += std::min(q1[i], q2[i]);
+    return 1.0f - (float)((double)n * qp.offset + (double)qp.scale * sum);
+}
+
+/*
+Histogram intersection on fp16 features, widened to float per element.
+
+- @param h1 The first feature vector.
+- @param h2 The second feature vector.
+- @param n The number of features in each vector.
+- @return The histogram intersection distance.
+*/
+float HistogramIntersection::computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const
+{
+    float intersection = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+        intersection += std::min(Quantization::halfToFloat(h1[i]), Quantization::halfToFloat(h2[i]));
+    return 1.0f - intersection;
+}
+
+/*
+Histogram intersection distance from query to every row of a matrix. The kernel is looked up once and the
+loop runs over the contiguous rows.
+
+- @param query The query vector, rows.cols() features.
+- @param rows The rows to compare with.
+- @param out Receives rows.rows() distances.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HistogramIntersection::computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                                        const double *rowNorms) const
+{
+    auto minSum = DistanceKernels::forDim(rows.cols()).minSum;
+    for (size_t i = 0; i < rows.rows(); ++i)
+        out[i] = 1.0f - minSum(query, rows.row(i), rows.cols());
+}
+
+/*
+Lower bound of the histogram intersection distance. Every min(query[i], row[i]) is at
+most query[i], so the intersection is at most the sum of the query and the distance at
+least 1 minus it, whatever the rows hold. The margin covers the rounding of the sums.
+
+- @param query The query vector.
+- @param n The number of features.
+- @return A value no distance from query falls below.
+*/
+float HistogramIntersection::lowerBound(const float *query, size_t n) const
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        sum += query[i];
+    return (float)(1.0 - sum - 1e-5 * (1.0 + std::fabs(sum)));
+}
+
+/*
+Histogram intersection distance from every query to every row, the min-sums
+computed by the tile kernel for several queries and rows per pass.
+
+- @param queries The queries, rows.cols() features each.
+- @param rows The rows to compare with.
+- @param out Receives queries.rows() x rows.rows() distances, one row per query.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HistogramIntersection::computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                                         const double *rowNorms) const
+{
+    crossTiles(DistanceKernels::active().minSumTile, queries, rows, out);
+    for (size_t i = 0, total = queries.rows() * rows.rows(); i < total; ++i)
+        out[i] = 1.0f - out[i];
+}
+
 /*
  * Cosine Distance Metric
  *
- * Computes the cosine distance between two feature vectors.
+ * Computes the cosine distance between two feature vectors. The dot product and
+ * both squared norms come from one pass of the SIMD kernel of the CPU.
  *
  * @param v1 The first feature vector.
  * @param v2 The second feature vector.
+ * @param n The number of features in each vector.
  * @return The computed cosine distance.
  * Returns 1.0 if either vector has zero magnitude (undefined angle).
 */
-float CosDistance::compute(
-    const std::vector<float> &v1,
-    const std::vector<float> &v2) const
+float CosDistance::compute(const float *v1, const float *v2, size_t n) const
 {
-    // Inner Product
-    double dot = std::inner_product(v1.begin(), v1.end(), v2.begin(), 0.0);
-
-    // sum square
-    double sum_sq1 = std::inner_product(v1.begin(), v1.end(), v1.begin(), 0.0);
-    double sum_sq2 = std::inner_product(v2.begin(), v2.end(), v2.begin(), 0.0);
+    // Inner product and sum squares
+    DotNorms sums = DistanceKernels::forDim(n).dotNorms(v1, v2, n);
+    double dot = sums.dot;
 
     // L2 norm
-    double norm1 = std::sqrt(sum_sq1);
-    double norm2 = std::sqrt(sum_sq2);
+    double norm1 = std::sqrt(sums.sq1);
+    double norm2 = std::sqrt(sums.sq2);
 
     // avoid 0
     if (norm1 == 0.0 || norm2 == 0.0) {
@@ -110,4 +475,310 @@ float CosDistance::compute(
 
     // Transfer Cosine distance 
     return static_cast<float>(1.0 - similarity);
-}
\ No newline at end of file
+}
+
+/*
+Cosine distance on U8 codes, computed from integer sums of the codes (see cosineU8).
+
+- @param q1 The codes of the first feature vector.
+- @param q2 The codes of the second feature vector.
+- @param n The number of features in each vector.
+- @param qp The scale/offset shared by both vectors.
+- @return The cosine distance of the decoded vectors, 1.0 if either has zero magnitude.
+*/
+float CosDistance::computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const
+{
+    return cosineU8(q1, (double)sumU8(q1, n), (double)dotU8(q1, q1, n), q2, n, qp);
+}
+
+/*
+Cosine distance on fp16 features, widened to float per element.
+
+- @param h1 The first feature vector.
+- @param h2 The second feature vector.
+- @param n The number of features in each vector.
+- @return The cosine distance, 1.0 if either vector has zero magnitude.
+*/
+float CosDistance::computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const
+{
+    double dot = 0.0, sum_sq1 = 0.0, sum_sq2 = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double a = Quantization::halfToFloat(h1[i]);
+        double b = Quantization::halfToFloat(h2[i]);
+        dot += a * b;
+        sum_sq1 += a * a;
+        sum_sq2 += b * b;
+    }
+    if (sum_sq1 == 0.0 || sum_sq2 == 0.0)
+        return 1.0f;
+    return static_cast<float>(1.0 - dot / (std::sqrt(sum_sq1) * std::sqrt(sum_sq2)));
+}
+
+/*
+Cosine distance from query to every row of a matrix. The kernel is looked up once and the
+loop runs over the contiguous rows.
+
+- @param query The query vector, rows.cols() features.
+- @param rows The rows to compare with.
+- @param out Receives rows.rows() distances.
+- @param rowNorms The L2 norm of every row, or nullptr.
+*/
+void CosDistance::computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                              const double *rowNorms) const
+{
+    const DistanceKernelSet &kernels = DistanceKernels::forDim(rows.cols());
+    if (!rowNorms)
+    {
+        for (size_t i = 0; i < rows.rows(); ++i)
+        {
+            DotNorms sums = kernels.dotNorms(query, rows.row(i), rows.cols());
+            out[i] = cosineFromNorms(sums.dot, std::sqrt(sums.sq1), std::sqrt(sums.sq2));
+        }
+        return;
+    }
+    // With the row norms known, each row costs a single dot product
+    double queryNorm = Quantization::norm(FeatureDataType::F32, QuantParams(), query, rows.cols());
+    for (size_t i = 0; i < rows.rows(); ++i)
+        out[i] = cosineFromNorms(kernels.dot(query, rows.row(i), rows.cols()), queryNorm, rowNorms[i]);
+}
+
+/*
+Cosine distance from a U8 query to count U8 rows sharing the scale/offset qp.
+
+- @param query The codes of the query.
+- @param rows The codes of the first row.
+- @param count The number of rows.
+- @param n The number of features in each vector.
+- @param stride The number of codes between the starts of two rows.
+- @param qp The scale/offset shared by the query and the rows.
+- @param out Receives count distances.
+- @param rowNorms The L2 norm of every row, or nullptr.
+*/
+void CosDistance::computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n,
+                                size_t stride, const QuantParams &qp, float *out,
+                                const double *rowNorms) const
+{
+    // The sums of the query codes are the same for every row
+    double sum1 = (double)sumU8(query, n), self1 = (double)dotU8(query, query, n);
+    if (!rowNorms)
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = cosineU8(query, sum1, self1, rows + i * stride, n, qp);
+        return;
+    }
+    // With the row norms known, each row needs only q1.q2 and sum(q2) (see cosineU8)
+    double s = qp.scale, o = qp.offset;
+    double base = (double)n * o * o;
+    double queryNorm = std::sqrt(std::max(0.0, base + 2.0 * o * s * sum1 + s * s * self1));
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t sum2 = 0;
+        uint64_t codeDot = dotSumU8(query, rows + i * stride, n, sum2);
+        double dot = base + o * s * (sum1 + (double)sum2) + s * s * (double)codeDot;
+        out[i] = cosineFromNorms(dot, queryNorm, rowNorms[i]);
+    }
+}
+
+/*
+Cosine distance from an fp16 query to count fp16 rows.
+
+- @param query The query vector.
+- @param rows The first row.
+- @param count The number of rows.
+- @param n The number of features in each vector.
+- @param stride The number of elements between the starts of two rows.
+- @param out Receives count distances.
+- @param rowNorms The L2 norm of every row, or nullptr.
+*/
+void CosDistance::computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n,
+                                 size_t stride, float *out, const double *rowNorms) const
+{
+    if (!rowNorms)
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = CosDistance::computeF16(query, rows + i * stride, n);
+        return;
+    }
+    // The query is widened once instead of once per row
+    std::vector<float> q(n);
+    Quantization::decode(FeatureDataType::F16, QuantParams(), query, n, q.data());
+    double queryNorm = Quantization::norm(FeatureDataType::F32, QuantParams(), q.data(), n);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint16_t *row = rows + i * stride;
+        double dot = 0.0;
+        for (size_t j = 0; j < n; ++j)
+            dot += (double)q[j] * Quantization::halfToFloat(row[j]);
+        out[i] = cosineFromNorms(dot, queryNorm, rowNorms[i]);
+    }
+}
+
+/*
+Lower bound of the cosine distance: the similarity is at most 1, so the distance is at
+least 0, less a margin for rounding.
+
+- @param query Unused.
+- @param n Unused.
+- @return A value no distance falls below.
+*/
+float CosDistance::lowerBound(const float *query, size_t n) const
+{
+    return -1e-5f;
+}
+
+/*
+Cosine distance from every query to every row: the dot products come from the tile
+kernel, the norms of the queries are computed once per call.
+
+- @param queries The queries, rows.cols() features each.
+- @param rows The rows to compare with.
+- @param out Receives queries.rows() x rows.rows() distances, one row per query.
+- @param rowNorms The L2 norm of every row, or nullptr to compute them.
+*/
+void CosDistance::computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                               const double *rowNorms) const
+{
+    crossTiles(DistanceKernels::active().dotTile, queries, rows, out);
+    std::vector<double> queryNorms = matrixNorms(queries), computed;
+    if (!rowNorms)
+    {
+        computed = matrixNorms(rows);
+        rowNorms = computed.data();
+    }
+    for (size_t q = 0; q < queries.rows(); ++q)
+    {
+        float *dist = out + q * rows.rows();
+        for (size_t i = 0; i < rows.rows(); ++i)
+            dist[i] = cosineFromNorms(dist[i], queryNorms[q], rowNorms[i]);
+    }
+}
+
+/*
+Hellinger Distance metric
+Computes 1 minus the Bhattacharyya coefficient of two square-rooted histograms, which
+is their dot product, so the loop runs in the dot kernel of the CPU like cosine does.
+
+- @param v1 The first feature vector (square-rooted histogram).
+- @param v2 The second feature vector (square-rooted histogram).
+- @param n The number of features in each vector.
+- @return The squared Hellinger distance of the two histograms.
+*/
+float HellingerDistance::compute(const float *v1, const float *v2, size_t n) const
+{
+    return static_cast<float>(1.0 - DistanceKernels::forDim(n).dot(v1, v2, n));
+}
+
+/*
+Hellinger distance on U8 codes, the dot product computed from integer sums of the
+codes (see decodedDotU8).
+
+- @param q1 The codes of the first feature vector.
+- @param q2 The codes of the second feature vector.
+- @param n The number of features in each vector.
+- @param qp The scale/offset shared by both vectors.
+- @return The Hellinger distance of the decoded vectors.
+*/
+float HellingerDistance::computeU8(const uint8_t *q1, const uint8_t *q2, size_t n, const QuantParams &qp) const
+{
+    return static_cast<float>(1.0 - decodedDotU8(q1, (double)sumU8(q1, n), q2, n, qp));
+}
+
+/*
+Hellinger distance on fp16 features, widened to float per element.
+
+- @param h1 The first feature vector.
+- @param h2 The second feature vector.
+- @param n The number of features in each vector.
+- @return The Hellinger distance.
+*/
+float HellingerDistance::computeF16(const uint16_t *h1, const uint16_t *h2, size_t n) const
+{
+    double dot = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        dot += (double)Quantization::halfToFloat(h1[i]) * Quantization::halfToFloat(h2[i]);
+    return static_cast<float>(1.0 - dot);
+}
+
+/*
+Hellinger distance from query to every row of a matrix. The kernel is looked up once and
+the loop runs over the contiguous rows, one dot product per row.
+
+- @param query The query vector, rows.cols() features.
+- @param rows The rows to compare with.
+- @param out Receives rows.rows() distances.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HellingerDistance::computeMany(const float *query, const FeatureMatrix &rows, float *out,
+                                    const double *rowNorms) const
+{
+    auto dot = DistanceKernels::forDim(rows.cols()).dot;
+    for (size_t i = 0; i < rows.rows(); ++i)
+        out[i] = static_cast<float>(1.0 - dot(query, rows.row(i), rows.cols()));
+}
+
+/*
+Hellinger distance from a U8 query to count U8 rows sharing the scale/offset qp.
+
+- @param query The codes of the query.
+- @param rows The codes of the first row.
+- @param count The number of rows.
+- @param n The number of features in each vector.
+- @param stride The number of codes between the starts of two rows.
+- @param qp The scale/offset shared by the query and the rows.
+- @param out Receives count distances.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HellingerDistance::computeManyU8(const uint8_t *query, const uint8_t *rows, size_t count, size_t n,
+                                      size_t stride, const QuantParams &qp, float *out,
+                                      const double *rowNorms) const
+{
+    // The code sum of the query is the same for every row
+    double sum1 = (double)sumU8(query, n);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = static_cast<float>(1.0 - decodedDotU8(query, sum1, rows + i * stride, n, qp));
+}
+
+/*
+Hellinger distance from an fp16 query to count fp16 rows.
+
+- @param query The query vector.
+- @param rows The first row.
+- @param count The number of rows.
+- @param n The number of features in each vector.
+- @param stride The number of elements between the starts of two rows.
+- @param out Receives count distances.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HellingerDistance::computeManyF16(const uint16_t *query, const uint16_t *rows, size_t count, size_t n,
+                                       size_t stride, float *out, const double *rowNorms) const
+{
+    // The query is widened once instead of once per row
+    std::vector<float> q(n);
+    Quantization::decode(FeatureDataType::F16, QuantParams(), query, n, q.data());
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint16_t *row = rows + i * stride;
+        double dot = 0.0;
+        for (size_t j = 0; j < n; ++j)
+            dot += (double)q[j] * Quantization::halfToFloat(row[j]);
+        out[i] = static_cast<float>(1.0 - dot);
+    }
+}
+
+/*
+Hellinger distance from every query to every row: the dot products come from the tile
+kernel, several queries and rows per pass, the same as for cosine.
+
+- @param queries The queries, rows.cols() features each.
+- @param rows The rows to compare with.
+- @param out Receives queries.rows() x rows.rows() distances, one row per query.
+- @param rowNorms Unused, the metric needs no norms.
+*/
+void HellingerDistance::computeCross(const FeatureMatrix &queries, const FeatureMatrix &rows, float *out,
+                                     const double *rowNorms) const
+{
+    crossTiles(DistanceKernels::active().dotTile, queries, rows, out);
+    for (size_t i = 0, total = queries.rows() * rows.rows(); i < total; ++i)
+        out[i] = 1.0f - out[i];
+}
@@ -0,0 +1,284 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  featureDB.cpp
+
+  Path: project2/src/utils/featureDB.cpp
+  Description: Writes and memory-maps binary feature databases (.fdb).
+*/
+
+#include "featureDB.hpp"
+#include "dimensionStats.hpp"
+#include "featureWriter.hpp"
+#include "fileUtil.hpp"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'F', 'D', 'B', '\0'};
+    const uint32_t kVersion = 1;
+    const uint64_t kPageSize = 4096;
+} // namespace
+
+/*
+Unmaps the database file if it is still open.
+*/
+FeatureDB::~FeatureDB()
+{
+    close();
+}
+
+/*
+Maps a binary feature database into memory and validates its header. Only the
+header page is read here; rows and filenames are paged in when they are accessed.
+
+- @param path The path to the .fdb file.
+- @return 0 on success, -1 on error.
+*/
+int FeatureDB::open(const char *path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(FeatureDBHeader), "feature DB", mapSize_);
+    if (!map_)
+        return -1;
+
+    const FeatureDBHeader *h = static_cast<const FeatureDBHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(FeatureDBHeader))
+    {
+        printf("%s is not a version %u feature DB\n", path, kVersion);
+        close();
+        return -1;
+    }
+
+    FeatureDataType type = static_cast<FeatureDataType>(h->dataType);
+    if (type != FeatureDataType::F32 && type != FeatureDataType::U8 && type != FeatureDataType::F16)
+    {
+        printf("Feature DB %s has unknown data type %d\n", path, h->dataType);
+        close();
+        return -1;
+    }
+    if (h->transform > static_cast<uint32_t>(FeatureTransform::SQRT))
+    {
+        printf("Feature DB %s has unknown transform %u\n", path, h->transform);
+        close();
+        return -1;
+    }
+
+    // Check that every section lies inside the file before handing out pointers
+    size_t elemSize = Quantization::elementSize(type);
+    uint64_t dataEnd = h->dataOffset + h->rows * h->stride * elemSize;
+    uint64_t blobStart = h->namesOffset + (h->rows + 1) * sizeof(uint64_t);
+    if (h->fileSize > mapSize_ || h->stride != Quantization::strideFor(type, h->dim) ||
+        h->dataOffset % FeatureMatrix::kAlignBytes != 0 ||
+        dataEnd > h->namesOffset || blobStart > mapSize_)
+    {
+        printf("Feature DB %s is truncated or corrupt\n", path);
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    header_ = h;
+    data_ = base + h->dataOffset;
+    rowBytes_ = h->stride * elemSize;
+    nameOffsets_ = reinterpret_cast<const uint64_t *>(base + h->namesOffset);
+    names_ = base + blobStart;
+
+    if (blobStart + nameOffsets_[h->rows] > mapSize_)
+    {
+        printf("Feature DB %s has a truncated filename table\n", path);
+        close();
+        return -1;
+    }
+    if (h->normsOffset != 0)
+    {
+        if (h->normsOffset % sizeof(double) != 0 || h->normsOffset < blobStart + nameOffsets_[h->rows] ||
+            h->normsOffset + h->rows * sizeof(double) > mapSize_)
+        {
+            printf("Feature DB %s has a truncated norms table\n", path);
+            close();
+            return -1;
+        }
+        norms_ = reinterpret_cast<const double *>(base + h->normsOffset);
+    }
+    if (h->orderOffset != 0)
+    {
+        if (h->orderOffset % sizeof(uint32_t) != 0 || h->orderOffset < blobStart + nameOffsets_[h->rows] ||
+            h->orderOffset + h->dim * sizeof(uint32_t) > mapSize_ ||
+            !DimensionStats::isOrder(reinterpret_cast<const uint32_t *>(base + h->orderOffset), h->dim))
+        {
+            printf("Feature DB %s has a corrupt dimension order\n", path);
+            close();
+            return -1;
+        }
+        dimOrder_ = reinterpret_cast<const uint32_t *>(base + h->orderOffset);
+    }
+
+    printf("Opened %s (%llu rows, dim %u, %s%s)\n", path, (unsigned long long)h->rows, h->dim,
+           Quantization::dataTypeToString(type).c_str(),
+           h->transform == static_cast<uint32_t>(FeatureTransform::SQRT) ? ", sqrt" : "");
+    return 0;
+}
+
+/*
+Unmaps the database file and resets the accessors.
+*/
+void FeatureDB::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    header_ = nullptr;
+    data_ = nullptr;
+    rowBytes_ = 0;
+    nameOffsets_ = nullptr;
+    names_ = nullptr;
+    norms_ = nullptr;
+    dimOrder_ = nullptr;
+}
+
+/*
+Writes filenames and their feature vectors to a binary feature database. All
+feature vectors must have the same length. The file appears under its final name
+only once it is complete.
+
+- @param path The path of the .fdb file to create (replaced if it exists).
+- @param featureType The feature type stored in the header.
+- @param position The region of interest stored in the header.
+- @param filenames The image filenames, one per row.
+- @param data The feature vectors, one per row.
+- @return 0 on success, -1 on error.
+*/
+int FeatureDB::write(const char *path,
+                     FeatureType featureType,
+                     Position position,
+                     const std::vector<std::string> &filenames,
+                     const std::vector<std::vector<float>> &data)
+{
+    if (filenames.size() != data.size())
+    {
+        printf("Feature DB write: %zu filenames but %zu feature vectors\n", filenames.size(), data.size());
+        return -1;
+    }
+
+    FDBFeatureWriter writer(featureType, position);
+    if (writer.open(path) != 0)
+        return -1;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        if (writer.append(filenames[i].c_str(), data[i]) != 0)
+            return -1; // the writer removes its temporary file
+    }
+    return writer.commit();
+}
+
+/*
+Re-encodes a float32 database as U8 or F16. U8 needs the value range of the whole
+database, which is only known once every row has been written, so quantization is a
+pass over a finished database rather than an option of the streaming writer. inPath
+and outPath may be the same file: the output is committed atomically and the input
+stays mapped until then.
+
+- @param inPath The float32 .fdb file to read.
+- @param outPath The .fdb file to create (replaced if it exists).
+- @param dataType The storage type of the new database.
+- @return 0 on success, -1 on error.
+*/
+int FeatureDB::quantize(const char *inPath, const char *outPath, FeatureDataType dataType)
+{
+    FeatureDB in;
+    if (in.open(inPath) != 0)
+        return -1;
+    if (in.dataType() != FeatureDataType::F32)
+    {
+        printf("Feature DB %s is already stored as %s\n", inPath,
+               Quantization::dataTypeToString(in.dataType()).c_str());
+        return -1;
+    }
+
+    const FeatureMatrix m = in.matrix();
+    QuantParams qp;
+    if (dataType == FeatureDataType::U8)
+        qp = Quantization::fitU8(m.data(), m.rows(), m.cols(), m.stride());
+
+    FDBFeatureWriter writer(in.featureType(), in.position(), dataType, qp, in.transform());
+    if (writer.open(outPath) != 0)
+        return -1;
+    std::vector<float> values;
+    for (size_t i = 0; i < in.rows(); ++i)
+    {
+        values.assign(m.rowView(i).begin(), m.rowView(i).end());
+        if (writer.append(in.filename(i), values) != 0)
+            return -1;
+    }
+    if (writer.commit() != 0)
+        return -1;
+
+    printf("Wrote %s (%zu rows, %s", outPath, in.rows(), Quantization::dataTypeToString(dataType).c_str());
+    if (dataType == FeatureDataType::U8)
+        printf(", scale %g, offset %g", qp.scale, qp.offset);
+    printf(")\n");
+    return 0;
+}
+
+/*
+Fills in a header for a database with the given shape. The matrix starts on the
+first page boundary after the header, the filename table follows the matrix, the
+row norms follow the filename table and the dimension order follows the norms.
+
+- @param featureType The feature type stored in the header.
+- @param position The region of interest stored in the header.
+- @param dim The number of features per row.
+- @param rows The number of rows.
+- @param namesBytes The size of the filename blob, including terminators.
+- @param dataType The storage type of the matrix.
+- @param qp The U8 scale/offset, ignored for other types.
+- @param transform The transform applied to the stored features.
+- @return The completed header.
+*/
+FeatureDBHeader FeatureDB::makeHeader(FeatureType featureType,
+                                      Position position,
+                                      size_t dim,
+                                      uint64_t rows,
+                                      uint64_t namesBytes,
+                                      FeatureDataType dataType,
+                                      const QuantParams &qp,
+                                      FeatureTransform transform)
+{
+    FeatureDBHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(FeatureDBHeader);
+    h.featureType = featureType;
+    h.position = static_cast<int32_t>(position);
+    h.dim = (uint32_t)dim;
+    h.stride = (uint32_t)Quantization::strideFor(dataType, dim);
+    h.rows = rows;
+    h.dataOffset = FileUtil::alignUp(sizeof(FeatureDBHeader), kPageSize);
+    h.namesOffset = h.dataOffset + h.rows * h.stride * Quantization::elementSize(dataType);
+    h.normsOffset =
+        FileUtil::alignUp(h.namesOffset + (rows + 1) * sizeof(uint64_t) + namesBytes, sizeof(double));
+    h.orderOffset = h.normsOffset + rows * sizeof(double);
+    h.fileSize = h.orderOffset + dim * sizeof(uint32_t);
+    h.dataType = static_cast<int32_t>(dataType);
+    h.transform = static_cast<uint32_t>(transform);
+    if (dataType == FeatureDataType::U8)
+    {
+        h.quantScale = qp.scale;
+        h.quantOffset = qp.offset;
+    }
+    return h;
+}
+
+/*
+Checks whether a path names a binary feature database.
+- @param path The path to check.
+- @return true if the path ends with ".fdb", false otherwise.
+*/
+bool FeatureDB::isFeatureDBPath(const std::string &path)
+{
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".fdb") == 0;
+}
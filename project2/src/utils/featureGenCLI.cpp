@@ -10,6 +10,7 @@
 #include <getopt.h>
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 
 /*
 Parses command line arguments for the feature generator.
@@ -26,13 +27,19 @@ FeatureGenCLI::Args FeatureGenCLI::parse(int argc, char *argv[])
         {"feature", required_argument, 0, 'f'},
         {"output", required_argument, 0, 'o'},
         {"pos", required_argument, 0, 'p'},
+        {"quant", required_argument, 0, 'q'},
+        {"transform", required_argument, 0, 't'},
+        {"compact", no_argument, 0, 'c'},
+        {"shards", required_argument, 0, 's'},
+        {"shard-by", required_argument, 0, 'b'},
+        {"shard-dirs", required_argument, 0, 'D'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}};
 
     optind = 1; // reset getopt state
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:f:o:p:h", long_options, nullptr)) != -1)
+    while ((opt = getopt_long(argc, argv, "i:f:o:p:q:t:cs:b:D:h", long_options, nullptr)) != -1)
     {
         switch (opt)
         {
@@ -51,6 +58,27 @@ FeatureGenCLI::Args FeatureGenCLI::parse(int argc, char *argv[])
         case 'p':
             args.positionStr = optarg;
             break;
+        case 'q':
+            args.quantStr = optarg;
+            break;
+        case 't':
+            args.transformStr = optarg;
+            break;
+        case 'c':
+            args.compact = true;
+            break;
+        case 's':
+            args.numShards = std::atoi(optarg);
+            break;
+        case 'b':
+            args.shardScheme = optarg;
+            break;
+        case 'D':
+        {
+            auto parts = splitCSV(optarg);
+            args.shardDirs.insert(args.shardDirs.end(), parts.begin(), parts.end());
+            break;
+        }
         case 'h':
             args.showHelp = true;
             break;
@@ -69,15 +97,23 @@ Prints the usage information for the feature generator.
 void FeatureGenCLI::printUsage(const char *prog)
 {
     printf("usage:\n");
-    printf("  %s --input <dir> --feature <type> [--feature <type> ...] --output <csv>\n", prog);
+    printf("  %s --input <dir> --feature <type> [--feature <type> ...] --output <csv|fdb|fst>\n", prog);
     printf("  %s -i <dir> -f <type1,type2,...> -o <csv>\n", prog);
     printf("\n");
     printf("options:\n");
     printf("  -i, --input    <dir>     input image directory\n");
     printf("  -f, --feature  <type>    baseline | cielab | gabor | magnitude | rghist2d | rgbhist3d\n");
     printf("                           can be repeated, or comma-separated\n");
-    printf("  -o, --output   <csv>     output csv path\n");
+    printf("  -o, --output   <path>    output path, .csv (text), .fdb (binary feature DB) or\n");
+    printf("                           .fst (one feature store holding every feature)\n");
     printf("  -p, --pos      <pos>     whole | up | bottom | center\n");
+    printf("  -q, --quant    <type>    f32 | u8 | f16, storage type of .fdb/.fst output (default f32)\n");
+    printf("  -t, --transform <t>      none | sqrt, stored form of .fdb/.fst features; sqrt lets\n");
+    printf("                           histograms be matched with -m hellinger (default none)\n");
+    printf("  -c, --compact            drop dead rows of existing DBs now (default: once 25%% are dead)\n");
+    printf("  -s, --shards   <N>       split each DB into N shards listed in a .shards index\n");
+    printf("  -b, --shard-by <scheme>  hash | range, how images are assigned to shards (default hash)\n");
+    printf("  -D, --shard-dirs <dirs>  comma-separated directories to spread the shards over\n");
     printf("  -h, --help               show help\n");
 }
 
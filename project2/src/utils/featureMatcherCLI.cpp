@@ -79,15 +79,17 @@ namespace
 
 /*
 Infer the feature key from a database filename.
-@param dbPath The path to the database CSV file.
+@param dbPath The path to the database file (.csv, .fdb, .fst or .shards).
 @return The inferred feature key.
 */
 std::string FeatureMatcherCLI::inferFeatureKeyFromFilename(const std::string &dbPath)
 {
     std::string base = basename_no_dirs(dbPath);
 
-    if (ends_with_str(base, ".csv"))
+    if (ends_with_str(base, ".csv") || ends_with_str(base, ".fdb") || ends_with_str(base, ".fst"))
         base = base.substr(0, base.size() - 4);
+    else if (ends_with_str(base, ".shards"))
+        base = base.substr(0, base.size() - 7);
 
     size_t us = base.find_last_of('_');
     if (us == std::string::npos || us + 1 >= base.size())
@@ -168,31 +170,41 @@ FeatureMatcherCLI::Args FeatureMatcherCLI::parse(int argc, char *argv[])
 
     static struct option long_options[] = {
         {"target", required_argument, 0, 't'},
+        {"targets", required_argument, 0, 'T'},
         {"db", required_argument, 0, 'd'}, // repeatable
         {"metric", required_argument, 0, 'm'},
         {"top", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 'j'},
+        {"index", required_argument, 0, 'x'},
+        {"ef", required_argument, 0, 'e'},
+        {"nprobe", required_argument, 0, 'P'},
+        {"rerank", required_argument, 0, 'R'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}};
 
     optind = 1;
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "t:d:m:n:h", long_options, nullptr)) != -1)
+    while ((opt = getopt_long(argc, argv, "t:T:d:m:n:j:x:e:P:R:h", long_options, nullptr)) != -1)
     {
         switch (opt)
         {
         case 't':
             args.targetPath = optarg;
             break;
+        case 'T':
+            args.targetsPath = optarg;
+            break;
         case 'd':
         {
             for (const auto &one : split_str(optarg, ','))
             {
                 if (one.empty())
                     continue;
-                if (!ends_with_str(one, ".csv"))
+                if (!ends_with_str(one, ".csv") && !ends_with_str(one, ".fdb") &&
+                    !ends_with_str(one, ".fst") && !ends_with_str(one, ".shards"))
                 {
-                    printf("Error: --db spec must end with .csv '%s'\n", one.c_str());
+                    printf("Error: --db spec must end with .csv, .fdb, .fst or .shards '%s'\n", one.c_str());
                     args.showHelp = true;
                     break;
                 }
@@ -210,6 +222,32 @@ FeatureMatcherCLI::Args FeatureMatcherCLI::parse(int argc, char *argv[])
         case 'n':
             args.topN = std::atoi(optarg);
             break;
+        case 'j':
+            args.threads = std::atoi(optarg);
+            break;
+        case 'x':
+        {
+            // The index belongs to the --db entry given before it
+            IndexType type = IndexFactory::stringToIndexType(optarg);
+            if (args.dbs.empty() || type == UNKNOWN_INDEX)
+            {
+                printf("Error: --index needs a --db before it and one of: hnsw, ivf, pq, vptree, bins '%s'\n", optarg);
+                args.showHelp = true;
+                break;
+            }
+            args.dbs.back().indexType = type;
+            args.dbs.back().hasIndex = true;
+            break;
+        }
+        case 'e':
+            args.indexParams.efSearch = (size_t)std::max(1, std::atoi(optarg));
+            break;
+        case 'P':
+            args.indexParams.nprobe = (size_t)std::max(1, std::atoi(optarg));
+            break;
+        case 'R':
+            args.indexParams.rerank = (size_t)std::max(0, std::atoi(optarg));
+            break;
         case 'h':
             args.showHelp = true;
             break;
@@ -231,14 +269,28 @@ void FeatureMatcherCLI::printUsage(const char *prog)
     printf("usage:\n");
     printf("  %s --target <img> --db <feature=csv | csv> [--db ...] --metric <type> --top <N>\n", prog);
     printf("  %s -t <img> -d <feature=csv | csv> [-d ...] -m <type> -n <N>\n", prog);
+    printf("  %s -T <list> -d <feature=csv | csv> [-d ...] -n <N>   (batch mode)\n", prog);
     printf("\n");
     printf("options:\n");
     printf("  -t, --target   <img>   target image path\n");
+    printf("  -T, --targets  <file>  file listing one target image per line; ranks all of them\n");
+    printf("                         in one pass over the DBs and prints the top N of each\n");
     printf("  -d, --db       <spec>  (repeatable, or comma-separated)\n");
-    printf("                         format: feature:position:metric:[weight]=db_filename.csv\n");
+    printf("                         format: feature:position:metric:[weight]=db_filename.csv|.fdb|.fst|.shards\n");
     printf("                            feature: baseline | cielab | gabor | magnitude | rghist2d | rgbhist3d\n");
     printf("                            position: up | bottom | whole | center\n");
-    printf("                            metric: ssd | hist_ix | cosine\n");
+    printf("                            metric: ssd | hist_ix | cosine | hellinger\n");
     printf("  -n, --top      <N>     number of matches to return\n");
+    printf("  -j, --threads  <N>     scan threads (default: all cores)\n");
+    printf("  -x, --index    <type>  search the --db entry before it with its index instead of\n");
+    printf("                         scanning it: hnsw | ivf | pq | vptree | bins (built by dbtool\n");
+    printf("                         index; without one, or if the DB changed since, the DB\n");
+    printf("                         is scanned exactly)\n");
+    printf("  -e, --ef       <N>     candidates an hnsw search keeps, and rows taken from an\n");
+    printf("                         approximate index (default 64); more raise recall and cost\n");
+    printf("  -P, --nprobe   <N>     lists an ivf search scans (default 8); more raise recall\n");
+    printf("                         and cost\n");
+    printf("  -R, --rerank   <N>     rows a pq search re-scores exactly before handing them\n");
+    printf("                         on (default 0: its estimates)\n");
     printf("  -h, --help             show help\n");
 }
@@ -0,0 +1,160 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  featureMatrix.cpp
+
+  Path: project2/src/utils/featureMatrix.cpp
+  Description: Implements the contiguous, 64-byte aligned feature matrix.
+*/
+
+#include "featureMatrix.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+/*
+Allocates a zero-filled rows x cols matrix.
+- @param rows The number of rows.
+- @param cols The number of columns.
+*/
+FeatureMatrix::FeatureMatrix(size_t rows, size_t cols)
+{
+    cols_ = cols;
+    stride_ = strideFor(cols);
+    reallocate(rows);
+    rows_ = rows;
+}
+
+/*
+Frees the matrix memory if it is owned.
+*/
+FeatureMatrix::~FeatureMatrix()
+{
+    free(owned_);
+}
+
+/*
+Takes over the memory of another matrix, leaving it empty.
+*/
+FeatureMatrix::FeatureMatrix(FeatureMatrix &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+/*
+Takes over the memory of another matrix, leaving it empty.
+*/
+FeatureMatrix &FeatureMatrix::operator=(FeatureMatrix &&other) noexcept
+{
+    if (this != &other)
+    {
+        free(owned_);
+        data_ = other.data_;
+        owned_ = other.owned_;
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        stride_ = other.stride_;
+        capacityRows_ = other.capacityRows_;
+        other.data_ = nullptr;
+        other.owned_ = nullptr;
+        other.rows_ = other.cols_ = other.stride_ = other.capacityRows_ = 0;
+    }
+    return *this;
+}
+
+/*
+Wraps existing row-major data. The data must outlive the returned view and every
+row must start stride floats after the previous one.
+
+- @param data Pointer to the first row.
+- @param rows The number of rows.
+- @param cols The number of columns.
+- @param stride The distance between rows in floats (>= cols).
+- @return A read-only matrix over data.
+*/
+const FeatureMatrix FeatureMatrix::view(const float *data, size_t rows, size_t cols, size_t stride)
+{
+    FeatureMatrix m;
+    m.data_ = data;
+    m.rows_ = rows;
+    m.cols_ = cols;
+    m.stride_ = stride;
+    return m;
+}
+
+/*
+Grows the capacity to at least rows rows. Existing rows are kept. Has no effect
+until the number of columns is known.
+- @param rows The number of rows to make room for.
+*/
+void FeatureMatrix::reserveRows(size_t rows)
+{
+    if (stride_ > 0 && (!owned_ || rows > capacityRows_))
+        reallocate(rows > rows_ ? rows : rows_);
+}
+
+/*
+Appends a row to an owned matrix, doubling the capacity when it is full so a
+database load does a logarithmic number of allocations instead of one per image.
+
+- @param values The features of the new row.
+- @param n The number of features.
+- @return 0 on success, -1 if n differs from the number of columns of earlier rows.
+*/
+int FeatureMatrix::appendRow(const float *values, size_t n)
+{
+    if (rows_ == 0 && cols_ == 0)
+    {
+        cols_ = n;
+        stride_ = strideFor(n);
+    }
+    if (n != cols_)
+        return -1;
+
+    if (!owned_ || rows_ == capacityRows_)
+        reallocate(rows_ < 32 ? 64 : rows_ * 2);
+
+    float *dst = owned_ + rows_ * stride_;
+    std::memcpy(dst, values, n * sizeof(float));
+    ++rows_;
+    return 0;
+}
+
+/*
+Removes all rows but keeps the allocation for reuse.
+*/
+void FeatureMatrix::clear()
+{
+    rows_ = 0;
+    if (!owned_)
+    {
+        data_ = nullptr;
+        cols_ = stride_ = 0;
+    }
+}
+
+/*
+Moves the rows into a new zero-filled, 64-byte aligned allocation of capacityRows
+rows. Also turns a view into an owned copy.
+
+- @param capacityRows The new capacity in rows.
+*/
+void FeatureMatrix::reallocate(size_t capacityRows)
+{
+    size_t bytes = capacityRows * stride_ * sizeof(float);
+    void *mem = nullptr;
+    if (posix_memalign(&mem, kAlignBytes, bytes > 0 ? bytes : kAlignBytes) != 0)
+    {
+        printf("FeatureMatrix: out of memory allocating %zu bytes\n", bytes);
+        throw std::bad_alloc();
+    }
+    std::memset(mem, 0, bytes);
+    if (data_ && rows_ > 0)
+        std::memcpy(mem, data_, rows_ * stride_ * sizeof(float));
+
+    free(owned_);
+    owned_ = static_cast<float *>(mem);
+    data_ = owned_;
+    capacityRows_ = capacityRows;
+}
@@ -0,0 +1,263 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  featureStore.cpp
+
+  Path: project2/src/utils/featureStore.cpp
+  Description: Memory-maps and re-encodes multi-feature stores (.fst).
+*/
+
+#include "featureStore.hpp"
+#include "dimensionStats.hpp"
+#include "featureMatrix.hpp"
+#include "featureWriter.hpp"
+#include "fileUtil.hpp"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'F', 'S', 'T', '\0'};
+    const uint32_t kVersion = 1;
+} // namespace
+
+/*
+Unmaps the store file if it is still open.
+*/
+FeatureStore::~FeatureStore()
+{
+    close();
+}
+
+/*
+Maps a feature store into memory and validates its header and group directory.
+Only the pages of the header, the directory and the filename offsets are touched
+here; group matrices are paged in when they are scanned.
+
+- @param path The path to the .fst file.
+- @return 0 on success, -1 on error.
+*/
+int FeatureStore::open(const char *path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(FeatureStoreHeader), "feature store", mapSize_);
+    if (!map_)
+        return -1;
+
+    const FeatureStoreHeader *h = static_cast<const FeatureStoreHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(FeatureStoreHeader) ||
+        h->groupHeaderSize != sizeof(FeatureGroupHeader))
+    {
+        printf("%s is not a version %u feature store\n", path, kVersion);
+        close();
+        return -1;
+    }
+    uint64_t blobStart = h->namesOffset + (h->rows + 1) * sizeof(uint64_t);
+    if (h->fileSize != mapSize_ ||
+        h->groupsOffset + h->groupCount * sizeof(FeatureGroupHeader) > mapSize_ ||
+        blobStart > mapSize_)
+    {
+        printf("Feature store %s is truncated or corrupt\n", path);
+        close();
+        return -1;
+    }
+
+    // Check that every group matrix lies inside the file before handing out pointers
+    const char *base = static_cast<const char *>(map_);
+    const FeatureGroupHeader *groups = reinterpret_cast<const FeatureGroupHeader *>(base + h->groupsOffset);
+    for (uint32_t g = 0; g < h->groupCount; ++g)
+    {
+        const FeatureGroupHeader &gh = groups[g];
+        FeatureDataType type = static_cast<FeatureDataType>(gh.dataType);
+        if (type != FeatureDataType::F32 && type != FeatureDataType::U8 && type != FeatureDataType::F16)
+        {
+            printf("Feature store %s group %u has unknown data type %d\n", path, g, gh.dataType);
+            close();
+            return -1;
+        }
+        if (gh.transform > static_cast<uint32_t>(FeatureTransform::SQRT))
+        {
+            printf("Feature store %s group %u has unknown transform %u\n", path, g, gh.transform);
+            close();
+            return -1;
+        }
+        size_t rowBytes = gh.stride * Quantization::elementSize(type);
+        if (gh.stride != Quantization::strideFor(type, gh.dim) ||
+            gh.dataOffset % FeatureMatrix::kAlignBytes != 0 ||
+            gh.dataOffset + h->rows * rowBytes > h->namesOffset)
+        {
+            printf("Feature store %s group %u is truncated or corrupt\n", path, g);
+            close();
+            return -1;
+        }
+        if (gh.normsOffset != 0 &&
+            (gh.normsOffset % sizeof(double) != 0 || gh.normsOffset < blobStart ||
+             gh.normsOffset + h->rows * sizeof(double) > mapSize_))
+        {
+            printf("Feature store %s group %u has a truncated norms table\n", path, g);
+            close();
+            return -1;
+        }
+        if (gh.orderOffset != 0 &&
+            (gh.orderOffset % sizeof(uint32_t) != 0 || gh.orderOffset < blobStart ||
+             gh.orderOffset + gh.dim * sizeof(uint32_t) > mapSize_ ||
+             !DimensionStats::isOrder(reinterpret_cast<const uint32_t *>(base + gh.orderOffset), gh.dim)))
+        {
+            printf("Feature store %s group %u has a corrupt dimension order\n", path, g);
+            close();
+            return -1;
+        }
+        groupData_.push_back(base + gh.dataOffset);
+        rowBytes_.push_back(rowBytes);
+        norms_.push_back(gh.normsOffset ? reinterpret_cast<const double *>(base + gh.normsOffset) : nullptr);
+        dimOrders_.push_back(gh.orderOffset ? reinterpret_cast<const uint32_t *>(base + gh.orderOffset) : nullptr);
+    }
+
+    header_ = h;
+    groups_ = groups;
+    nameOffsets_ = reinterpret_cast<const uint64_t *>(base + h->namesOffset);
+    names_ = base + blobStart;
+    if (blobStart + nameOffsets_[h->rows] > mapSize_)
+    {
+        printf("Feature store %s has a truncated filename table\n", path);
+        close();
+        return -1;
+    }
+
+    printf("Opened %s (%llu rows, %u groups)\n", path, (unsigned long long)h->rows, h->groupCount);
+    return 0;
+}
+
+/*
+Unmaps the store file and resets the accessors.
+*/
+void FeatureStore::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    header_ = nullptr;
+    groups_ = nullptr;
+    groupData_.clear();
+    rowBytes_.clear();
+    norms_.clear();
+    dimOrders_.clear();
+    nameOffsets_ = nullptr;
+    names_ = nullptr;
+}
+
+/*
+Finds the column group of a feature and region.
+- @param featureType The feature type.
+- @param position The region of interest.
+- @return The group index, -1 if the store has no such group.
+*/
+int FeatureStore::findGroup(FeatureType featureType, Position position) const
+{
+    for (size_t g = 0; g < groupCount(); ++g)
+    {
+        if (this->featureType(g) == featureType && this->position(g) == position)
+            return (int)g;
+    }
+    return -1;
+}
+
+/*
+Re-encodes every group of a float32 store as U8 or F16, like FeatureDB::quantize.
+Each U8 group gets the scale and offset of its own value range, since features such
+as histograms and filter responses live on very different scales. inPath and outPath
+may be the same file.
+
+- @param inPath The float32 .fst file to read.
+- @param outPath The .fst file to create (replaced if it exists).
+- @param dataType The storage type of the new store.
+- @return 0 on success, -1 on error.
+*/
+int FeatureStore::quantize(const char *inPath, const char *outPath, FeatureDataType dataType)
+{
+    FeatureStore in;
+    if (in.open(inPath) != 0)
+        return -1;
+
+    std::vector<FeatureGroupSpec> specs(in.groupCount());
+    for (size_t g = 0; g < in.groupCount(); ++g)
+    {
+        if (in.dataType(g) != FeatureDataType::F32)
+        {
+            printf("Feature store %s is already stored as %s\n", inPath,
+                   Quantization::dataTypeToString(in.dataType(g)).c_str());
+            return -1;
+        }
+        specs[g].featureType = in.featureType(g);
+        specs[g].position = in.position(g);
+        specs[g].dataType = dataType;
+        specs[g].transform = in.transform(g);
+        if (dataType == FeatureDataType::U8)
+            specs[g].qp = Quantization::fitU8(static_cast<const float *>(in.rawRow(g, 0)), in.rows(),
+                                              in.dim(g), in.stride(g));
+    }
+
+    FSTFeatureWriter writer(specs);
+    if (writer.open(outPath) != 0)
+        return -1;
+    std::vector<std::vector<float>> values(in.groupCount());
+    for (size_t i = 0; i < in.rows(); ++i)
+    {
+        for (size_t g = 0; g < in.groupCount(); ++g)
+        {
+            values[g].resize(in.dim(g));
+            in.readRow(g, i, values[g].data());
+        }
+        if (writer.appendGroups(in.filename(i), values) != 0)
+            return -1;
+    }
+    if (writer.commit() != 0)
+        return -1;
+
+    printf("Wrote %s (%zu rows, %zu groups, %s)\n", outPath, in.rows(), in.groupCount(),
+           Quantization::dataTypeToString(dataType).c_str());
+    return 0;
+}
+
+/*
+Fills in a header for a store. The group directory follows the header; the group
+matrices are placed by the writer, which records their offsets in the directory.
+The row norms of all groups follow the filename table and the dimension orders of
+all groups fill the end of the file.
+
+- @param groupCount The number of column groups.
+- @param rows The number of rows.
+- @param namesOffset The byte offset of the filename table.
+- @param namesBytes The size of the filename blob, including terminators.
+- @param totalDim The sum of the dimensions of all groups.
+- @return The completed header.
+*/
+FeatureStoreHeader FeatureStore::makeHeader(size_t groupCount, uint64_t rows, uint64_t namesOffset,
+                                            uint64_t namesBytes, uint64_t totalDim)
+{
+    FeatureStoreHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(FeatureStoreHeader);
+    h.groupCount = (uint32_t)groupCount;
+    h.groupHeaderSize = sizeof(FeatureGroupHeader);
+    h.rows = rows;
+    h.groupsOffset = sizeof(FeatureStoreHeader);
+    h.namesOffset = namesOffset;
+    uint64_t namesEnd = namesOffset + (rows + 1) * sizeof(uint64_t) + namesBytes;
+    uint64_t normsStart = (namesEnd + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+    h.fileSize = normsStart + groupCount * rows * sizeof(double) + totalDim * sizeof(uint32_t);
+    return h;
+}
+
+/*
+Checks whether a path names a feature store.
+- @param path The path to check.
+- @return true if the path ends with ".fst", false otherwise.
+*/
+bool FeatureStore::isFeatureStorePath(const std::string &path)
+{
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".fst") == 0;
+}
@@ -0,0 +1,268 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  featureTable.cpp
+
+  Path: project2/src/utils/featureTable.cpp
+  Description: Reads a CSV file, a binary feature database or a group of a feature
+               store through one interface.
+*/
+
+#include "featureTable.hpp"
+#include "dimensionStats.hpp"
+#include "manifest.hpp"
+#include "pageUtil.hpp"
+#include "readFiles.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+    // Without CBIR_RESIDENT_MB, mapped rows may keep this share of physical memory
+    const size_t kResidentShareOfMemory = 4;
+    // Bytes of mapped rows claimed by the tables kept resident
+    std::atomic<size_t> residentBytes{0};
+
+    /*
+    Returns how many bytes of mapped rows the process keeps resident between scans: the
+    CBIR_RESIDENT_MB environment variable if set, otherwise a quarter of physical
+    memory. A table that fits in what is left when it is loaded keeps its scanned
+    pages; a larger one gives each block back once it is scanned, so it never holds
+    more than the blocks in flight.
+    @return The budget in bytes.
+    */
+    size_t residentBudget()
+    {
+        static const size_t budget = []
+        {
+            if (const char *mb = getenv("CBIR_RESIDENT_MB"))
+                return (size_t)strtoull(mb, nullptr, 10) << 20;
+            long pages = sysconf(_SC_PHYS_PAGES);
+            return pages > 0 ? (size_t)pages * PageUtil::pageSize() / kResidentShareOfMemory
+                             : (size_t)256 << 20;
+        }();
+        return budget;
+    }
+} // namespace
+
+/*
+Returns the table's share of the resident budget.
+*/
+FeatureTable::~FeatureTable()
+{
+    if (keepResident_)
+        residentBytes -= rows_ * rowBytes_;
+}
+
+/*
+Loads a feature database and the tombstones of its manifest. A database that
+cannot be read is left empty.
+- @param path The path of the .csv, .fdb or .fst file.
+- @param csvThreads The number of threads to parse a CSV file with, <= 0 for one per core.
+- @param featureType The feature to use of a .fst store, ignored otherwise.
+- @param position The region to use of a .fst store, ignored otherwise.
+- @return 0 on success, -1 on error.
+*/
+int FeatureTable::load(const std::string &path, int csvThreads, FeatureType featureType, Position position)
+{
+    path_ = path;
+    if (FeatureStore::isFeatureStorePath(path))
+    {
+        kind_ = Kind::STORE;
+        if (store_.open(path.c_str()) != 0)
+            return -1;
+        int g = store_.findGroup(featureType, position);
+        if (g < 0)
+        {
+            printf("Feature store %s has no group for feature %s at %s\n", path.c_str(),
+                   ExtractorFactory::featureTypeToString(featureType).c_str(),
+                   positionToString(position).c_str());
+            store_.close();
+            return -1;
+        }
+        rows_ = store_.rows();
+        dim_ = store_.dim(g);
+        dataType_ = store_.dataType(g);
+        qp_ = store_.quantParams(g);
+        transform_ = store_.transform(g);
+        data_ = static_cast<const char *>(store_.rawRow(g, 0));
+        rowBytes_ = store_.stride(g) * Quantization::elementSize(dataType_);
+        norms_ = store_.norms(g);
+        dimOrder_ = store_.dimOrder(g);
+    }
+    else if (FeatureDB::isFeatureDBPath(path))
+    {
+        kind_ = Kind::DB;
+        if (ReadFiles::readFeaturesFromDB(path.c_str(), db_) != 0)
+            return -1;
+        rows_ = db_.rows();
+        dim_ = db_.dim();
+        dataType_ = db_.dataType();
+        qp_ = db_.quantParams();
+        transform_ = db_.transform();
+        data_ = static_cast<const char *>(db_.rawRow(0));
+        rowBytes_ = db_.stride() * Quantization::elementSize(dataType_);
+        norms_ = db_.norms();
+        dimOrder_ = db_.dimOrder();
+    }
+    else
+    {
+        kind_ = Kind::CSV;
+        if (ReadFiles::readFeaturesFromCSV(path.c_str(), csvNames_, csvData_, csvThreads) != 0)
+            return -1;
+        rows_ = csvData_.rows();
+        dim_ = csvData_.cols();
+        data_ = reinterpret_cast<const char *>(csvData_.row(0));
+        rowBytes_ = csvData_.stride() * sizeof(float);
+        computeCsvStats();
+    }
+    if (kind_ != Kind::CSV)
+        keepResident_ = claimResident(rows_ * rowBytes_);
+    // rows replaced or deleted by incremental fg runs must not be matched; an
+    // unreadable manifest only costs the tombstones, so it is not an error
+    Manifest::readDeadRows(path, rows(), dead_);
+    return 0;
+}
+
+/*
+Takes bytes out of the process's resident budget if they fit in what is left.
+- @param bytes The size of the table's rows.
+- @return true if the bytes were taken.
+*/
+bool FeatureTable::claimResident(size_t bytes)
+{
+    size_t used = residentBytes.load();
+    while (used + bytes <= residentBudget())
+        if (residentBytes.compare_exchange_weak(used, used + bytes))
+            return true;
+    return false;
+}
+
+/*
+Computes the row norms and the dimension order of a CSV table. The rows are in memory
+already, so one pass gives the norms cosine needs and the dimension order SSD needs.
+*/
+void FeatureTable::computeCsvStats()
+{
+    DimensionStats stats;
+    stats.reset(dim_);
+    csvNorms_.resize(rows_);
+    for (size_t i = 0; i < rows_; ++i)
+    {
+        csvNorms_[i] = Quantization::norm(FeatureDataType::F32, qp_, csvData_.row(i), dim_);
+        stats.add(csvData_.row(i));
+    }
+    csvOrder_ = stats.order();
+    norms_ = csvNorms_.data();
+    dimOrder_ = csvOrder_.data();
+}
+
+/*
+Transforms the features of a table that stores them as extracted. CSV rows are owned
+memory and are transformed in place, with their norms and dimension order recomputed;
+mapped binary tables are read-only and must be built with the transform instead.
+- @param t The transform.
+- @return 0 if the table now holds transformed features, -1 otherwise.
+*/
+int FeatureTable::applyTransform(FeatureTransform t)
+{
+    if (t == transform_)
+        return 0;
+    if (kind_ != Kind::CSV || transform_ != FeatureTransform::NONE)
+        return -1;
+    for (size_t i = 0; i < rows_; ++i)
+        Quantization::applyTransform(t, csvData_.row(i), dim_);
+    transform_ = t;
+    computeCsvStats();
+    return 0;
+}
+
+/*
+Returns the image filename of row i.
+- @param i The row index.
+- @return The 0-terminated filename.
+*/
+const char *FeatureTable::filename(size_t i) const
+{
+    switch (kind_)
+    {
+    case Kind::STORE:
+        return store_.filename(i);
+    case Kind::DB:
+        return db_.filename(i);
+    default:
+        return csvNames_[i].c_str();
+    }
+}
+
+/*
+Starts paging in a block of rows of a mapped table ahead of a scan.
+- @param first The first row.
+- @param count The number of rows.
+*/
+void FeatureTable::prefetch(size_t first, size_t count) const
+{
+    if (kind_ != Kind::CSV && count > 0)
+        PageUtil::willNeed(rawRow(first), count * rowBytes_);
+}
+
+/*
+Drops a block of rows of a mapped table from the process after a scan, unless the
+table fit in the resident budget when it was loaded. CSV rows are owned memory and
+are kept.
+- @param first The first row.
+- @param count The number of rows.
+*/
+void FeatureTable::release(size_t first, size_t count) const
+{
+    if (kind_ != Kind::CSV && !keepResident_ && count > 0)
+        PageUtil::release(rawRow(first), count * rowBytes_);
+}
+
+/*
+Finds the live row of a target image, compared by filename like the matcher does.
+- @param targetPath The target image path.
+- @return The row index, -1 if the image is not in the table.
+*/
+long FeatureTable::findRow(const char *targetPath) const
+{
+    for (size_t i = 0; i < rows(); ++i)
+    {
+        if (!isDead(i) && ReadFiles::isTargetImageInDatabase(targetPath, filename(i)))
+            return (long)i;
+    }
+    return -1;
+}
+
+/*
+Hashes the shape and storage type of the table and a sample of its rows, their
+features and filenames, with FNV-1a. Indexes keep the hash of the table they were
+built from; a table rebuilt or replaced since hashes differently, while computing it
+touches only the sampled rows.
+- @return The hash.
+*/
+uint64_t FeatureTable::fingerprint() const
+{
+    const size_t kSamples = 64;
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const void *data, size_t bytes)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < bytes; ++i)
+            h = (h ^ p[i]) * 1099511628211ull;
+    };
+    const uint64_t shape[3] = {rows_, dim_, (uint64_t)dataType_};
+    mix(shape, sizeof(shape));
+    const size_t samples = std::min(rows_, kSamples);
+    for (size_t s = 0; s < samples; ++s)
+    {
+        // spread over the table, the last row included
+        size_t i = samples > 1 ? s * (rows_ - 1) / (samples - 1) : 0;
+        mix(rawRow(i), dim_ * Quantization::elementSize(dataType_));
+        mix(filename(i), std::strlen(filename(i)));
+    }
+    return h;
+}
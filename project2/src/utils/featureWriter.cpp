@@ -0,0 +1,972 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  featureWriter.cpp
+
+  Path: project2/src/utils/featureWriter.cpp
+  Description: Implements buffered, atomically committed feature database writers.
+*/
+
+#include "featureWriter.hpp"
+#include "fileUtil.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Longest "%.4f" rendering of a float: sign, 39 integer digits, '.', 4 decimals
+    const size_t kMaxFloatChars = 48;
+    const uint64_t kPageSize = 4096;
+} // namespace
+
+/*
+Removes the temporary file of a writer that was never committed.
+*/
+IFeatureWriter::~IFeatureWriter()
+{
+    abort();
+}
+
+/*
+Creates the temporary output file next to path. The temporary name includes the
+process id so two runs writing the same database do not clobber each other.
+
+- @param path The final path of the database.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::open(const char *path)
+{
+    return start(path, false, nullptr);
+}
+
+/*
+Opens the existing database at path so appends extend it. Formats that grow in place
+write the new rows into the file itself and commit() makes them visible; the others
+copy the existing rows into a temporary file first, as openCompact() does.
+
+- @param path The path of the existing database.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::openAppend(const char *path)
+{
+    if (!growsInPlace())
+        return start(path, true, nullptr);
+
+    abort();
+    path_ = path;
+    tmpPath_.clear();
+    fp_ = fopen(path, "r+b");
+    if (!fp_)
+    {
+        printf("Unable to open %s for appending\n", path);
+        return -1;
+    }
+    setvbuf(fp_, nullptr, _IONBF, 0);
+
+    buffer_.resize(kBufferSize);
+    used_ = 0;
+    rows_ = 0;
+    off_t size = fseeko(fp_, 0, SEEK_END) == 0 ? ftello(fp_) : -1;
+    keepSize_ = size < 0 ? 0 : (uint64_t)size;
+    if (size < 0 || resume() != 0)
+    {
+        abort();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Creates the temporary output file next to path and copies the rows of the existing
+database at path into it, except the dropped ones. commit() then replaces the
+database with the copy.
+
+- @param path The path of the existing database.
+- @param dropRows Rows flagged non-zero are not copied.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::openCompact(const char *path, const std::vector<char> &dropRows)
+{
+    return start(path, true, &dropRows);
+}
+
+/*
+Shared implementation of open() and openAppend().
+- @param path The final path of the database.
+- @param append true to copy the rows of the existing database first.
+- @param dropRows Optional; rows flagged non-zero are not copied.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::start(const char *path, bool append, const std::vector<char> *dropRows)
+{
+    abort();
+
+    path_ = path;
+    fp_ = FileUtil::createTemp(path_, tmpPath_);
+    if (!fp_)
+        return -1;
+    // All writes go through our own buffer in large blocks
+    setvbuf(fp_, nullptr, _IONBF, 0);
+
+    buffer_.resize(kBufferSize);
+    used_ = 0;
+    rows_ = 0;
+    if (begin() != 0 || (append && copyRows(dropRows) != 0))
+    {
+        abort();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Writes the trailer, flushes the buffer, syncs the temporary file to disk and renames
+it to the final path, replacing any previous database there. An append in place is
+synced and cut to the bytes its new header covers.
+
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::commit()
+{
+    if (!fp_)
+        return -1;
+
+    bool ok = finish() == 0 && flushBuffer() == 0;
+    FILE *fp = fp_;
+    fp_ = nullptr;
+    if (tmpPath_.empty())
+        return FileUtil::commitInPlace(fp, path_, keepSize_, ok);
+    return FileUtil::commitTemp(fp, tmpPath_, path_, ok);
+}
+
+/*
+Closes and deletes the temporary file, leaving the destination untouched. An append
+in place is cut back to the bytes the header on disk covers.
+*/
+void IFeatureWriter::abort()
+{
+    if (!fp_)
+        return;
+    if (tmpPath_.empty())
+        FileUtil::restoreInPlace(fp_, keepSize_);
+    else
+        FileUtil::discardTemp(fp_, tmpPath_);
+    fp_ = nullptr;
+}
+
+/*
+Makes sure at least n bytes are free at the end of the buffer, flushing it or
+growing it for rows larger than the buffer.
+
+- @param n The number of bytes the caller is about to write.
+- @return Pointer to the first free byte, or nullptr if the flush failed.
+*/
+char *IFeatureWriter::reserve(size_t n)
+{
+    if (used_ + n > buffer_.size())
+    {
+        if (flushBuffer() != 0)
+            return nullptr;
+        if (n > buffer_.size())
+            buffer_.resize(n);
+    }
+    return buffer_.data() + used_;
+}
+
+/*
+Copies n bytes into the output buffer.
+- @param data The bytes to copy.
+- @param n The number of bytes.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::writeBytes(const void *data, size_t n)
+{
+    char *dst = reserve(n);
+    if (!dst)
+        return -1;
+    std::memcpy(dst, data, n);
+    advance(n);
+    return 0;
+}
+
+/*
+Writes the buffered bytes to the temporary file.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::flushBuffer()
+{
+    if (used_ > 0 && std::fwrite(buffer_.data(), 1, used_, fp_) != used_)
+    {
+        printf("Error writing %s\n", tmpPath_.c_str());
+        return -1;
+    }
+    used_ = 0;
+    return 0;
+}
+
+/*
+Flushes the buffer and syncs the output file to disk, so the writes so far are
+durable before the next step of an append in place depends on them.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::syncOutput()
+{
+    if (flushBuffer() != 0 || !FileUtil::syncFile(fp_))
+    {
+        printf("Error writing %s\n", path_.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Copies bytes of the output file to another offset through the output buffer, in
+order from the first byte. The target must lie below the source or not overlap it,
+so no byte is overwritten before it is read. The buffer must be empty.
+- @param from The offset of the first byte to copy.
+- @param to The offset to copy it to.
+- @param n The number of bytes.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::copyWithin(uint64_t from, uint64_t to, uint64_t n)
+{
+    for (uint64_t done = 0; done < n;)
+    {
+        size_t chunk = (size_t)std::min<uint64_t>(n - done, buffer_.size());
+        if (fseeko(fp_, (off_t)(from + done), SEEK_SET) != 0 ||
+            std::fread(buffer_.data(), 1, chunk, fp_) != chunk ||
+            fseeko(fp_, (off_t)(to + done), SEEK_SET) != 0 ||
+            std::fwrite(buffer_.data(), 1, chunk, fp_) != chunk)
+        {
+            printf("Error writing %s\n", path_.c_str());
+            return -1;
+        }
+        done += chunk;
+    }
+    return 0;
+}
+
+/*
+Adds a row given as column groups. Single-feature formats hold exactly one group.
+- @param imageFilename The image filename.
+- @param groups The feature vectors of the row, one per column group.
+- @return 0 on success, -1 on error.
+*/
+int IFeatureWriter::appendGroups(const char *imageFilename, const std::vector<std::vector<float>> &groups)
+{
+    if (groups.size() != 1)
+    {
+        printf("Feature DB write: %s has %zu feature groups, the format holds one\n",
+               imageFilename, groups.size());
+        return -1;
+    }
+    return append(imageFilename, groups[0]);
+}
+
+/*
+Creates the writer matching the extension of the output path.
+- @param path The final path of the database.
+- @param featureType The feature type, recorded by binary databases.
+- @param position The region of interest, recorded by binary databases.
+- @param transform The transform the rows have been through, recorded by binary databases.
+- @return An FDBFeatureWriter for ".fdb" paths, a CSVFeatureWriter otherwise.
+*/
+std::shared_ptr<IFeatureWriter> IFeatureWriter::create(const std::string &path,
+                                                       FeatureType featureType,
+                                                       Position position,
+                                                       FeatureTransform transform)
+{
+    if (FeatureDB::isFeatureDBPath(path))
+        return std::make_shared<FDBFeatureWriter>(featureType, position, FeatureDataType::F32,
+                                                  QuantParams(), transform);
+    return std::make_shared<CSVFeatureWriter>();
+}
+
+/*
+Creates the writer for several features of the same images.
+- @param path The final path of the database.
+- @param featureTypes The features, one column group each in a feature store.
+- @param position The region of interest of every feature.
+- @param transform The transform the rows of every feature have been through.
+- @return An FSTFeatureWriter for ".fst" paths, otherwise the writer create() returns
+    for the first feature type.
+*/
+std::shared_ptr<IFeatureWriter> IFeatureWriter::create(const std::string &path,
+                                                       const std::vector<FeatureType> &featureTypes,
+                                                       Position position,
+                                                       FeatureTransform transform)
+{
+    if (FeatureStore::isFeatureStorePath(path))
+    {
+        std::vector<FeatureGroupSpec> specs(featureTypes.size());
+        for (size_t g = 0; g < featureTypes.size(); ++g)
+        {
+            specs[g].featureType = featureTypes[g];
+            specs[g].position = position;
+            specs[g].transform = transform;
+        }
+        return std::make_shared<FSTFeatureWriter>(specs);
+    }
+    return create(path, featureTypes.empty() ? UNKNOWN_FEATURE : featureTypes[0], position, transform);
+}
+
+/*
+Appends one CSV line: the image filename followed by ",%.4f" for every feature.
+The numbers are formatted in place in the output buffer with std::to_chars.
+
+- @param imageFilename The image filename written to the first column.
+- @param features The feature vector.
+- @return 0 on success, -1 on error.
+*/
+int CSVFeatureWriter::append(const char *imageFilename, const std::vector<float> &features)
+{
+    size_t nameLen = strlen(imageFilename);
+    char *p = reserve(nameLen + features.size() * (kMaxFloatChars + 1) + 1);
+    if (!p)
+        return -1;
+    char *start = p;
+
+    std::memcpy(p, imageFilename, nameLen);
+    p += nameLen;
+    for (float v : features)
+    {
+        *p++ = ',';
+        p = std::to_chars(p, p + kMaxFloatChars, v, std::chars_format::fixed, 4).ptr;
+    }
+    *p++ = '\n'; // EOL
+
+    advance(p - start);
+    ++rows_;
+    return 0;
+}
+
+/*
+Prepares an append to the existing CSV file: the new lines go after its end, after
+a newline if its last line has none.
+
+- @return 0 on success, -1 on error.
+*/
+int CSVFeatureWriter::resume()
+{
+    int last = '\n';
+    if (keepSize_ > 0 && (fseeko(fp_, (off_t)keepSize_ - 1, SEEK_SET) != 0 || (last = fgetc(fp_)) == EOF))
+    {
+        printf("Unable to read %s\n", path_.c_str());
+        return -1;
+    }
+    if (fseeko(fp_, (off_t)keepSize_, SEEK_SET) != 0)
+        return -1;
+    return last == '\n' ? 0 : writeBytes("\n", 1);
+}
+
+/*
+Flushes the lines; everything an append wrote is kept.
+
+- @return 0 on success, -1 on error.
+*/
+int CSVFeatureWriter::finish()
+{
+    if (flushBuffer() != 0)
+        return -1;
+    keepSize_ = (uint64_t)ftello(fp_);
+    return 0;
+}
+
+/*
+Copies the lines of the existing CSV file, except the dropped rows, byte for byte.
+A missing newline after the last line is added.
+
+- @param dropRows Optional; rows flagged non-zero are not copied.
+- @return 0 on success, -1 on error.
+*/
+int CSVFeatureWriter::copyRows(const std::vector<char> *dropRows)
+{
+    int fd = ::open(path_.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("Unable to open %s for appending\n", path_.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0)
+    {
+        ::close(fd);
+        return 0;
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("Unable to mmap %s\n", path_.c_str());
+        return -1;
+    }
+
+    const char *p = static_cast<const char *>(map);
+    const char *end = p + size;
+    int rc = 0;
+    size_t row = 0;
+    while (p < end && rc == 0)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char *lineEnd = nl ? nl : end;
+        if (lineEnd > p && !(dropRows && row < dropRows->size() && (*dropRows)[row]))
+        {
+            rc = writeBytes(p, lineEnd - p);
+            if (rc == 0)
+                rc = writeBytes("\n", 1);
+            ++rows_;
+        }
+        if (lineEnd > p)
+            ++row;
+        p = lineEnd + 1;
+    }
+    munmap(map, size);
+    return rc;
+}
+
+/*
+Writes a zeroed placeholder header and pads up to the start of the matrix. A file
+with a zeroed header is rejected by FeatureDB::open.
+
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::begin()
+{
+    dim_ = 0;
+    stride_ = 0;
+    names_.clear();
+    nameOffsets_.assign(1, 0);
+    norms_.clear();
+    stats_.reset(0);
+
+    uint64_t dataOffset = FeatureDB::makeHeader(featureType_, position_, 0, 0, 0).dataOffset;
+    char *p = reserve(dataOffset);
+    if (!p)
+        return -1;
+    std::memset(p, 0, dataOffset);
+    advance(dataOffset);
+    return 0;
+}
+
+/*
+Appends one row to the matrix, encoded in the data type of the writer and padded
+with zeros up to the row stride. The first row fixes the dimension; later rows of a
+different length are rejected.
+
+- @param imageFilename The image filename stored in the filename table.
+- @param features The feature vector.
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::append(const char *imageFilename, const std::vector<float> &features)
+{
+    if (dim_ == 0)
+    {
+        dim_ = features.size();
+        stride_ = FeatureDB::makeHeader(featureType_, position_, dim_, 0, 0, dataType_).stride;
+        stats_.reset(dim_);
+    }
+    if (features.size() != dim_)
+    {
+        printf("Feature DB write: %s has %zu features, expected %zu\n",
+               imageFilename, features.size(), dim_);
+        return -1;
+    }
+
+    size_t elemSize = Quantization::elementSize(dataType_);
+    size_t rowBytes = stride_ * elemSize;
+    char *p = reserve(rowBytes);
+    if (!p)
+        return -1;
+    Quantization::encode(dataType_, qp_, features.data(), dim_, p);
+    std::memset(p + dim_ * elemSize, 0, rowBytes - dim_ * elemSize);
+    norms_.push_back(Quantization::norm(dataType_, qp_, p, dim_));
+    stats_.add(dataType_, qp_, p);
+    advance(rowBytes);
+
+    names_.append(imageFilename, strlen(imageFilename) + 1);
+    nameOffsets_.push_back(names_.size());
+    ++rows_;
+    return 0;
+}
+
+/*
+Copies the rows of the existing binary database, except the dropped rows, without
+decoding them. The dimension, storage type and transform of the new rows follow the
+existing database.
+
+- @param dropRows Optional; rows flagged non-zero are not copied.
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::copyRows(const std::vector<char> *dropRows)
+{
+    FeatureDB db;
+    if (db.open(path_.c_str()) != 0)
+        return -1;
+    adopt(db);
+
+    size_t rowBytes = stride_ * Quantization::elementSize(dataType_);
+    for (size_t i = 0; i < db.rows(); ++i)
+    {
+        if (dropRows && i < dropRows->size() && (*dropRows)[i])
+            continue;
+        if (writeBytes(db.rawRow(i), rowBytes) != 0)
+            return -1;
+        // files written before norms were stored get them on their first update
+        norms_.push_back(db.norms() ? db.norms()[i] : Quantization::norm(dataType_, qp_, db.rawRow(i), dim_));
+        stats_.add(dataType_, qp_, db.rawRow(i));
+        names_.append(db.filename(i), strlen(db.filename(i)) + 1);
+        nameOffsets_.push_back(names_.size());
+        ++rows_;
+    }
+    return 0;
+}
+
+/*
+Takes over the shape, storage type and transform of an existing database, so the
+rows appended to it match its own.
+
+- @param db The existing database.
+*/
+void FDBFeatureWriter::adopt(const FeatureDB &db)
+{
+    featureType_ = db.featureType();
+    position_ = db.position();
+    dataType_ = db.dataType();
+    qp_ = db.quantParams();
+    transform_ = db.transform();
+    dim_ = db.dim();
+    stride_ = db.stride();
+    stats_.reset(dim_);
+    keptOrder_.clear();
+}
+
+/*
+Prepares an append in place. The filename table and the row norms of the existing
+rows are read into memory, since the new trailer repeats them, but the rows stay
+where they are. Its dimension order is kept as well; files without one get it from
+their rows. The new rows are written past the end of the file until commit() moves
+them after the existing rows, so the file stays valid under its old header meanwhile.
+
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::resume()
+{
+    FeatureDB db;
+    if (db.open(path_.c_str()) != 0 || fseeko(fp_, 0, SEEK_SET) != 0 ||
+        std::fread(&old_, sizeof(old_), 1, fp_) != 1)
+        return -1;
+    adopt(db);
+    names_.clear();
+    nameOffsets_.assign(1, 0);
+    norms_.clear();
+    for (size_t i = 0; i < db.rows(); ++i)
+    {
+        norms_.push_back(db.norms() ? db.norms()[i] : Quantization::norm(dataType_, qp_, db.rawRow(i), dim_));
+        if (!db.dimOrder())
+            stats_.add(dataType_, qp_, db.rawRow(i));
+        names_.append(db.filename(i), strlen(db.filename(i)) + 1);
+        nameOffsets_.push_back(names_.size());
+    }
+    if (db.dimOrder())
+        keptOrder_.assign(db.dimOrder(), db.dimOrder() + dim_);
+    rows_ = oldRows_ = db.rows();
+
+    // bytes past the header's file size are left over from an interrupted append
+    spillStart_ = FileUtil::alignUp(keepSize_, kPageSize);
+    keepSize_ = old_.fileSize;
+    return fseeko(fp_, (off_t)spillStart_, SEEK_SET) == 0 ? 0 : -1;
+}
+
+/*
+Writes the filename table, the row norms and the dimension order after the matrix
+and then overwrites the placeholder header with the final one. An append in place
+is finished by finishInPlace().
+
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::finish()
+{
+    FeatureDBHeader h = FeatureDB::makeHeader(featureType_, position_, dim_, rows_, names_.size(),
+                                              dataType_, qp_, transform_);
+    if (tmpPath_.empty())
+        return finishInPlace(h);
+    if (writeTrailer(h) != 0 || writeHeader(h) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+Finishes an append in place in steps that each leave a valid file behind:
+1. The new rows will overwrite the old trailer, so it is first copied past both the
+   new layout and the new rows, and the header is pointed at the copy.
+2. The new rows are moved after the existing rows and the new trailer after them.
+3. Once that is synced, the final header is written; commit() cuts the file to it.
+A crash before step 3 leaves the old database, after it the new one.
+
+- @param h The final header.
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::finishInPlace(const FeatureDBHeader &h)
+{
+    if (rows_ == oldRows_)
+        return 0;
+    if (flushBuffer() != 0)
+        return -1;
+    uint64_t rowBytes = stride_ * Quantization::elementSize(dataType_);
+    uint64_t added = (rows_ - oldRows_) * rowBytes;
+
+    if (old_.namesOffset < h.fileSize)
+    {
+        // rows are whole cache lines, so the sections keep their alignment when moved
+        uint64_t target = FileUtil::alignUp(std::max(spillStart_ + added, h.fileSize), kPageSize);
+        uint64_t shift = target - old_.namesOffset;
+        FeatureDBHeader moved = old_;
+        moved.namesOffset += shift;
+        moved.normsOffset += moved.normsOffset ? shift : 0;
+        moved.orderOffset += moved.orderOffset ? shift : 0;
+        moved.fileSize += shift;
+        if (copyWithin(old_.namesOffset, target, old_.fileSize - old_.namesOffset) != 0 ||
+            syncOutput() != 0 || writeHeader(moved) != 0 || syncOutput() != 0)
+            return -1;
+        keepSize_ = moved.fileSize;
+    }
+
+    if (copyWithin(spillStart_, h.namesOffset - added, added) != 0 ||
+        fseeko(fp_, (off_t)h.namesOffset, SEEK_SET) != 0 || writeTrailer(h) != 0 ||
+        syncOutput() != 0 || writeHeader(h) != 0)
+        return -1;
+    keepSize_ = h.fileSize;
+    return 0;
+}
+
+/*
+Writes the filename table, the row norms and the dimension order at the current
+position, which is h.namesOffset, and flushes them.
+
+- @param h The header of the file being written.
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::writeTrailer(const FeatureDBHeader &h)
+{
+    uint64_t namesEnd = h.namesOffset + nameOffsets_.size() * sizeof(uint64_t) + names_.size();
+    std::vector<uint32_t> order = keptOrder_.empty() ? stats_.order() : keptOrder_;
+    const char padding[sizeof(double)] = {};
+    if (writeBytes(nameOffsets_.data(), nameOffsets_.size() * sizeof(uint64_t)) != 0 ||
+        writeBytes(names_.data(), names_.size()) != 0 ||
+        writeBytes(padding, h.normsOffset - namesEnd) != 0 ||
+        writeBytes(norms_.data(), norms_.size() * sizeof(double)) != 0 ||
+        writeBytes(order.data(), order.size() * sizeof(uint32_t)) != 0 || flushBuffer() != 0)
+        return -1;
+    return 0;
+}
+
+/*
+Overwrites the header at the start of the file.
+- @param h The header.
+- @return 0 on success, -1 on error.
+*/
+int FDBFeatureWriter::writeHeader(const FeatureDBHeader &h)
+{
+    if (fseeko(fp_, 0, SEEK_SET) != 0 || std::fwrite(&h, sizeof(h), 1, fp_) != 1)
+        return -1;
+    return 0;
+}
+
+/*
+Creates a feature store writer with one column group per spec. The data type,
+scale/offset and transform of each spec are used for new stores.
+- @param groups The column groups, in the order appendGroups() receives them.
+*/
+FSTFeatureWriter::FSTFeatureWriter(const std::vector<FeatureGroupSpec> &groups)
+{
+    for (const auto &spec : groups)
+    {
+        Column c;
+        c.spec = spec;
+        columns_.push_back(c);
+    }
+}
+
+/*
+Closes the spill files; the base class removes the temporary output.
+*/
+FSTFeatureWriter::~FSTFeatureWriter()
+{
+    closeSpills();
+}
+
+/*
+Closes the spill files. They are unlinked when created, so this frees them.
+*/
+void FSTFeatureWriter::closeSpills()
+{
+    for (auto &c : columns_)
+    {
+        if (c.spill)
+            fclose(c.spill);
+        c.spill = nullptr;
+    }
+}
+
+/*
+Creates one spill file per column group and writes a zeroed placeholder for the
+header and the group directory, padded to the first page boundary.
+
+- @return 0 on success, -1 on error.
+*/
+int FSTFeatureWriter::begin()
+{
+    closeSpills();
+    names_.clear();
+    nameOffsets_.assign(1, 0);
+
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        Column &c = columns_[g];
+        c.dim = 0;
+        c.stride = 0;
+        c.norms.clear();
+        c.stats.reset(0);
+        std::string spillPath = tmpPath_ + ".g" + std::to_string(g);
+        c.spill = fopen(spillPath.c_str(), "w+b");
+        if (!c.spill)
+        {
+            printf("Unable to open spill file %s\n", spillPath.c_str());
+            return -1;
+        }
+        std::remove(spillPath.c_str()); // the open handle keeps the data alive
+    }
+
+    uint64_t headerBytes =
+        FileUtil::alignUp(sizeof(FeatureStoreHeader) + columns_.size() * sizeof(FeatureGroupHeader), kPageSize);
+    char *p = reserve(headerBytes);
+    if (!p)
+        return -1;
+    std::memset(p, 0, headerBytes);
+    advance(headerBytes);
+    return 0;
+}
+
+/*
+Adds the filename of a new row.
+- @param imageFilename The image filename.
+- @return 0.
+*/
+int FSTFeatureWriter::addName(const char *imageFilename)
+{
+    names_.append(imageFilename, strlen(imageFilename) + 1);
+    nameOffsets_.push_back(names_.size());
+    ++rows_;
+    return 0;
+}
+
+/*
+Appends one row to a store with a single column group.
+- @param imageFilename The image filename.
+- @param features The feature vector.
+- @return 0 on success, -1 on error.
+*/
+int FSTFeatureWriter::append(const char *imageFilename, const std::vector<float> &features)
+{
+    return appendGroups(imageFilename, std::vector<std::vector<float>>{features});
+}
+
+/*
+Appends one row: every feature vector is encoded in the data type of its group,
+padded to the row stride and added to the group's spill file. The first row fixes
+the dimension of each group.
+
+- @param imageFilename The image filename stored in the filename table.
+- @param groups The feature vectors of the row, one per column group.
+- @return 0 on success, -1 on error.
+*/
+int FSTFeatureWriter::appendGroups(const char *imageFilename, const std::vector<std::vector<float>> &groups)
+{
+    if (groups.size() != columns_.size())
+    {
+        printf("Feature store write: %s has %zu feature groups, expected %zu\n",
+               imageFilename, groups.size(), columns_.size());
+        return -1;
+    }
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        Column &c = columns_[g];
+        const std::vector<float> &features = groups[g];
+        if (c.dim == 0)
+        {
+            c.dim = features.size();
+            c.stride = Quantization::strideFor(c.spec.dataType, c.dim);
+            c.stats.reset(c.dim);
+        }
+        if (features.size() != c.dim)
+        {
+            printf("Feature store write: %s has %zu features in group %zu, expected %zu\n",
+                   imageFilename, features.size(), g, c.dim);
+            return -1;
+        }
+
+        size_t rowBytes = c.stride * Quantization::elementSize(c.spec.dataType);
+        rowBuffer_.assign(rowBytes, 0);
+        Quantization::encode(c.spec.dataType, c.spec.qp, features.data(), c.dim, rowBuffer_.data());
+        c.norms.push_back(Quantization::norm(c.spec.dataType, c.spec.qp, rowBuffer_.data(), c.dim));
+        c.stats.add(c.spec.dataType, c.spec.qp, rowBuffer_.data());
+        if (std::fwrite(rowBuffer_.data(), 1, rowBytes, c.spill) != rowBytes)
+        {
+            printf("Error writing %s\n", tmpPath_.c_str());
+            return -1;
+        }
+    }
+    return addName(imageFilename);
+}
+
+/*
+Copies the rows of the existing store, except the dropped rows, without decoding
+them. Every requested group must exist in the store, matched by feature and region;
+its data type, scale/offset, transform and dimension are kept.
+
+- @param dropRows Optional; rows flagged non-zero are not copied.
+- @return 0 on success, -1 on error.
+*/
+int FSTFeatureWriter::copyRows(const std::vector<char> *dropRows)
+{
+    FeatureStore store;
+    if (store.open(path_.c_str()) != 0)
+        return -1;
+
+    std::vector<int> source(columns_.size());
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        Column &c = columns_[g];
+        source[g] = store.findGroup(c.spec.featureType, c.spec.position);
+        if (source[g] < 0 || store.groupCount() != columns_.size())
+        {
+            printf("Feature store %s holds different feature groups; rebuild it\n", path_.c_str());
+            return -1;
+        }
+        c.spec.dataType = store.dataType(source[g]);
+        c.spec.qp = store.quantParams(source[g]);
+        c.spec.transform = store.transform(source[g]);
+        c.dim = store.dim(source[g]);
+        c.stride = store.stride(source[g]);
+        c.stats.reset(c.dim);
+    }
+
+    for (size_t i = 0; i < store.rows(); ++i)
+    {
+        if (dropRows && i < dropRows->size() && (*dropRows)[i])
+            continue;
+        for (size_t g = 0; g < columns_.size(); ++g)
+        {
+            Column &c = columns_[g];
+            size_t rowBytes = c.stride * Quantization::elementSize(c.spec.dataType);
+            if (std::fwrite(store.rawRow(source[g], i), 1, rowBytes, c.spill) != rowBytes)
+            {
+                printf("Error writing %s\n", tmpPath_.c_str());
+                return -1;
+            }
+            // stores written before norms were stored get them on their first update
+            const double *norms = store.norms(source[g]);
+            c.norms.push_back(norms ? norms[i]
+                                    : Quantization::norm(c.spec.dataType, c.spec.qp, store.rawRow(source[g], i), c.dim));
+            c.stats.add(c.spec.dataType, c.spec.qp, store.rawRow(source[g], i));
+        }
+        addName(store.filename(i));
+    }
+    return 0;
+}
+
+/*
+Copies every spill file into the output on its own page boundary, writes the
+filename table, the row norms and the dimension orders and then overwrites the
+placeholder header and group directory.
+
+- @return 0 on success, -1 on error.
+*/
+int FSTFeatureWriter::finish()
+{
+    std::vector<FeatureGroupHeader> dir(columns_.size());
+    uint64_t offset =
+        FileUtil::alignUp(sizeof(FeatureStoreHeader) + columns_.size() * sizeof(FeatureGroupHeader), kPageSize);
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        Column &c = columns_[g];
+        uint64_t start = FileUtil::alignUp(offset, kPageSize);
+        char *p = reserve(start - offset);
+        if (!p)
+            return -1;
+        std::memset(p, 0, start - offset);
+        advance(start - offset);
+
+        FeatureGroupHeader &gh = dir[g];
+        std::memset(&gh, 0, sizeof(gh));
+        gh.featureType = c.spec.featureType;
+        gh.position = static_cast<int32_t>(c.spec.position);
+        gh.dim = (uint32_t)c.dim;
+        gh.stride = (uint32_t)Quantization::strideFor(c.spec.dataType, c.dim);
+        gh.dataType = static_cast<int32_t>(c.spec.dataType);
+        gh.transform = static_cast<uint32_t>(c.spec.transform);
+        if (c.spec.dataType == FeatureDataType::U8)
+        {
+            gh.quantScale = c.spec.qp.scale;
+            gh.quantOffset = c.spec.qp.offset;
+        }
+        gh.dataOffset = start;
+
+        // copy the spill file through the output buffer
+        uint64_t bytes = rows_ * gh.stride * Quantization::elementSize(c.spec.dataType);
+        if (fflush(c.spill) != 0 || fseek(c.spill, 0, SEEK_SET) != 0)
+            return -1;
+        for (uint64_t left = bytes; left > 0;)
+        {
+            size_t n = (size_t)std::min<uint64_t>(left, kBufferSize);
+            char *dst = reserve(n);
+            if (!dst || std::fread(dst, 1, n, c.spill) != n)
+                return -1;
+            advance(n);
+            left -= n;
+        }
+        offset = start + bytes;
+    }
+
+    uint64_t totalDim = 0;
+    for (const Column &c : columns_)
+        totalDim += c.dim;
+    FeatureStoreHeader h = FeatureStore::makeHeader(columns_.size(), rows_, offset, names_.size(), totalDim);
+    uint64_t namesEnd = offset + nameOffsets_.size() * sizeof(uint64_t) + names_.size();
+    uint64_t orderStart = h.fileSize - totalDim * sizeof(uint32_t);
+    uint64_t normsStart = orderStart - columns_.size() * rows_ * sizeof(double);
+    const char padding[sizeof(double)] = {};
+    if (writeBytes(nameOffsets_.data(), nameOffsets_.size() * sizeof(uint64_t)) != 0 ||
+        writeBytes(names_.data(), names_.size()) != 0 ||
+        writeBytes(padding, normsStart - namesEnd) != 0)
+        return -1;
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        dir[g].normsOffset = normsStart + g * rows_ * sizeof(double);
+        if (writeBytes(columns_[g].norms.data(), columns_[g].norms.size() * sizeof(double)) != 0)
+            return -1;
+    }
+    for (size_t g = 0; g < columns_.size(); ++g)
+    {
+        dir[g].orderOffset = orderStart;
+        std::vector<uint32_t> order = columns_[g].stats.order();
+        if (writeBytes(order.data(), order.size() * sizeof(uint32_t)) != 0)
+            return -1;
+        orderStart += order.size() * sizeof(uint32_t);
+    }
+    if (flushBuffer() != 0)
+        return -1;
+    if (fseek(fp_, 0, SEEK_SET) != 0 || std::fwrite(&h, sizeof(h), 1, fp_) != 1 ||
+        (!dir.empty() && std::fwrite(dir.data(), sizeof(FeatureGroupHeader), dir.size(), fp_) != dir.size()))
+        return -1;
+    closeSpills();
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  fileUtil.cpp
+
+  Path: project2/src/utils/fileUtil.cpp
+  Description: Writes binary files atomically and maps them back read-only.
+*/
+
+#include "fileUtil.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Zero bytes written per call when padding a section to the next page
+    const uint64_t kPaddingBytes = 4096;
+} // namespace
+
+/*
+Rounds value up to the next multiple of align.
+- @param value The value to round.
+- @param align The alignment (non-zero).
+- @return The rounded value.
+*/
+uint64_t FileUtil::alignUp(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+/*
+Writes a buffer to a file.
+- @param fp The file.
+- @param data The bytes.
+- @param size The number of bytes.
+- @return true if all were written.
+*/
+bool FileUtil::writeAll(FILE *fp, const void *data, size_t size)
+{
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+/*
+Writes zero bytes to a file up to an offset.
+- @param fp The file.
+- @param from The current offset.
+- @param to The offset to pad to; nothing is written if it is not past from.
+- @return true if all were written.
+*/
+bool FileUtil::writePadding(FILE *fp, uint64_t from, uint64_t to)
+{
+    static const char zeros[kPaddingBytes] = {};
+    for (; from < to; from += std::min(to - from, kPaddingBytes))
+        if (!writeAll(fp, zeros, std::min(to - from, kPaddingBytes)))
+            return false;
+    return true;
+}
+
+/*
+Opens the temporary file that stands in for path until commitTemp() renames it. The
+process id in its name keeps two writers of the same file apart.
+- @param path The final path of the file.
+- @param tmpPath Receives the path of the temporary file.
+- @return The file, or nullptr on error.
+*/
+FILE *FileUtil::createTemp(const std::string &path, std::string &tmpPath)
+{
+    tmpPath = path + ".tmp." + std::to_string((long)getpid());
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp)
+        printf("Unable to open output file %s\n", tmpPath.c_str());
+    return fp;
+}
+
+/*
+Finishes a file opened by createTemp(): flushes and syncs it, closes it and renames
+it to its final path. On any failure, or if the caller's writes failed, the
+temporary file is removed and the final path is left as it was.
+- @param fp The temporary file; closed in every case.
+- @param tmpPath The path of the temporary file.
+- @param path The final path of the file.
+- @param ok false if writing the contents failed.
+- @return 0 on success, -1 on error.
+*/
+int FileUtil::commitTemp(FILE *fp, const std::string &tmpPath, const std::string &path, bool ok)
+{
+    ok = ok && syncFile(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        printf("Error writing %s\n", path.c_str());
+        std::remove(tmpPath.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Closes and removes a file opened by createTemp() that is not to be kept.
+- @param fp The temporary file, or nullptr if it is already closed.
+- @param tmpPath The path of the temporary file.
+*/
+void FileUtil::discardTemp(FILE *fp, const std::string &tmpPath)
+{
+    if (fp)
+        fclose(fp);
+    std::remove(tmpPath.c_str());
+}
+
+/*
+Flushes the buffered writes of a file and syncs it to disk.
+- @param fp The file.
+- @return true on success.
+*/
+bool FileUtil::syncFile(FILE *fp)
+{
+    return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+/*
+Finishes a file updated in place. The file is synced before it is cut to size, so
+the header that covers size is on disk before the bytes past it go.
+- @param fp The file; closed in every case.
+- @param path The path of the file, for the message.
+- @param size The bytes to keep.
+- @param ok false if writing the contents failed.
+- @return 0 on success, -1 on error.
+*/
+int FileUtil::commitInPlace(FILE *fp, const std::string &path, uint64_t size, bool ok)
+{
+    ok = ok && syncFile(fp) && ftruncate(fileno(fp), (off_t)size) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+    {
+        printf("Error writing %s\n", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Cuts a file updated in place back to the bytes its valid header covers and closes it.
+- @param fp The file, or nullptr if it is already closed.
+- @param size The bytes to keep.
+*/
+void FileUtil::restoreInPlace(FILE *fp, uint64_t size)
+{
+    if (!fp)
+        return;
+    fflush(fp);
+    if (ftruncate(fileno(fp), (off_t)size) != 0)
+        printf("Unable to cut back file to %llu bytes\n", (unsigned long long)size);
+    fclose(fp);
+}
+
+/*
+Maps a whole file into memory read-only. The pages are read when they are touched.
+- @param path The path of the file.
+- @param minSize The fewest bytes a valid file holds, usually its header.
+- @param what The kind of file, e.g. "feature DB", used in the messages.
+- @param size Receives the size of the mapping.
+- @return The mapping, or nullptr on error.
+*/
+void *FileUtil::mapReadOnly(const std::string &path, size_t minSize, const char *what, size_t &size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Unable to open %s %s\n", what, path.c_str());
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < minSize || st.st_size == 0)
+    {
+        printf("%s is too small to be a valid %s\n", path.c_str(), what);
+        ::close(fd);
+        return nullptr;
+    }
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+    if (map == MAP_FAILED)
+    {
+        printf("Unable to mmap %s %s\n", what, path.c_str());
+        return nullptr;
+    }
+    size = (size_t)st.st_size;
+    return map;
+}
+
+/*
+Unmaps a mapping returned by mapReadOnly().
+- @param map The mapping, or nullptr.
+- @param size The size of the mapping.
+*/
+void FileUtil::unmap(void *map, size_t size)
+{
+    if (map)
+        munmap(map, size);
+}
@@ -0,0 +1,689 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  hnswIndex.cpp
+
+  Path: project2/src/utils/hnswIndex.cpp
+  Description: Builds, saves, memory-maps and searches HNSW graph indexes.
+*/
+
+#include "hnswIndex.hpp"
+#include "IDistanceMetric.hpp"
+#include "fileUtil.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'H', 'N', 'S', '\0'};
+    const uint32_t kVersion = 1;
+    // A node reaches layer l with probability links^-l, so no table gets near this
+    const size_t kMaxLevel = 31;
+    // Neighbour lists share this many locks while the graph is built
+    const size_t kLockStripes = 1 << 16;
+    // Seed of the node levels, so a graph built on one thread is reproducible
+    const uint64_t kSeed = 0x484e5357;
+
+    typedef std::pair<float, uint32_t> Candidate; // distance, row
+
+    /*
+    The neighbour lists of a graph, wherever they are stored. While the graph is
+    built, locks guards the lists against the inserting threads.
+    */
+    struct Graph
+    {
+        const uint64_t *upperStart = nullptr;
+        const uint32_t *base = nullptr;
+        const uint32_t *upper = nullptr;
+        size_t links = 0;
+        size_t rows = 0;
+        std::vector<std::mutex> *locks = nullptr;
+
+        /*
+        Returns the list of a node on a layer: a count followed by the neighbours.
+        @param node The node.
+        @param level The layer, at most the node's level.
+        @return The list.
+        */
+        const uint32_t *list(uint32_t node, size_t level) const
+        {
+            if (level == 0)
+                return base + node * (1 + 2 * links);
+            return upper + upperStart[node] + (level - 1) * (1 + links);
+        }
+
+        /*
+        Returns how many neighbours a list of a layer has room for.
+        @param level The layer.
+        @return 2 * links on layer 0, links above.
+        */
+        size_t capacity(size_t level) const
+        {
+            return level == 0 ? 2 * links : links;
+        }
+
+        /*
+        Returns the lock of a node's lists.
+        @param node The node.
+        @return The lock; locks must be set.
+        */
+        std::mutex &lockOf(uint32_t node) const
+        {
+            return (*locks)[node % locks->size()];
+        }
+
+        /*
+        Copies the neighbours of a node on a layer, under its lock while building.
+        @param node The node.
+        @param level The layer.
+        @param out Receives the neighbours.
+        */
+        void neighbours(uint32_t node, size_t level, std::vector<uint32_t> &out) const
+        {
+            const uint32_t *l = list(node, level);
+            if (locks)
+            {
+                std::lock_guard<std::mutex> guard(lockOf(node));
+                out.assign(l + 1, l + 1 + l[0]);
+                return;
+            }
+            out.assign(l + 1, l + 1 + std::min<size_t>(l[0], capacity(level)));
+        }
+    };
+
+    /*
+    The distance from a query, encoded like the rows of a table, to a row of it.
+    */
+    struct RowDistance
+    {
+        const FeatureTable &table;
+        const IDistanceMetric &metric;
+
+        float operator()(const void *query, uint32_t row) const
+        {
+            return metric.computeEncoded(table.dataType(), query, table.rawRow(row), table.dim(),
+                                         table.quantParams());
+        }
+    };
+
+    /*
+    Marks the rows one insertion has reached. A row's tag is the number of the search
+    that reached it last, so starting a new search costs nothing. Every inserting
+    thread uses one of its own.
+    */
+    class VisitedTags
+    {
+    public:
+        explicit VisitedTags(size_t rows) : tags_(rows, 0) {}
+        void clear()
+        {
+            if (++epoch_ == 0)
+            {
+                std::fill(tags_.begin(), tags_.end(), 0);
+                epoch_ = 1;
+            }
+        }
+        bool insert(uint32_t row)
+        {
+            if (tags_[row] == epoch_)
+                return false;
+            tags_[row] = epoch_;
+            return true;
+        }
+
+    private:
+        std::vector<uint32_t> tags_;
+        uint32_t epoch_ = 1;
+    };
+
+    /*
+    Marks the rows one query has reached. A query reaches a few thousand rows, so an
+    open-addressing hash set, kept at most half full, costs less than a tag for every
+    row of the table and less than a node allocation per row.
+    */
+    class VisitedSet
+    {
+    public:
+        VisitedSet() : slots_(1024, kEmpty) {}
+        void clear()
+        {
+            std::fill(slots_.begin(), slots_.end(), kEmpty);
+            size_ = 0;
+        }
+        bool insert(uint32_t row)
+        {
+            if (2 * (size_ + 1) > slots_.size())
+                grow();
+            if (!place(slots_, row))
+                return false;
+            ++size_;
+            return true;
+        }
+
+    private:
+        static const uint32_t kEmpty = 0xffffffff;
+
+        /*
+        Puts a row into its slot, probing linearly from its hash.
+        @param slots The table, a power of two long with a free slot.
+        @param row The row.
+        @return false if the row was there already.
+        */
+        static bool place(std::vector<uint32_t> &slots, uint32_t row)
+        {
+            const size_t mask = slots.size() - 1;
+            for (size_t i = (row * 0x9e3779b1u) & mask;; i = (i + 1) & mask)
+            {
+                if (slots[i] == row)
+                    return false;
+                if (slots[i] == kEmpty)
+                {
+                    slots[i] = row;
+                    return true;
+                }
+            }
+        }
+        void grow()
+        {
+            std::vector<uint32_t> bigger(2 * slots_.size(), kEmpty);
+            for (uint32_t row : slots_)
+                if (row != kEmpty)
+                    place(bigger, row);
+            slots_.swap(bigger);
+        }
+
+        std::vector<uint32_t> slots_;
+        size_t size_ = 0;
+    };
+
+    /*
+    Searches one layer from the given entry nodes (Algorithm 2 of the paper): keeps
+    the ef nearest nodes found and expands the nearest one not yet expanded, until it
+    is farther than all ef of them. With a filter, dead rows of the filter table are
+    expanded but never returned, so the graph stays connected around them.
+    @param graph The graph.
+    @param dist The distance to a row.
+    @param query The query, encoded like the rows.
+    @param nearest In: the entry nodes and their distances. Out: up to ef nearest nodes.
+    @param ef The number of nodes to keep.
+    @param level The layer.
+    @param visited The rows reached, cleared first.
+    @param filter The table whose dead rows are not returned, nullptr to return all.
+    @param stats Receives the cost if not nullptr.
+    */
+    template <class Visited>
+    void searchLayer(const Graph &graph, const RowDistance &dist, const void *query,
+                     std::vector<Candidate> &nearest, size_t ef, size_t level, Visited &visited,
+                     const FeatureTable *filter, IndexStats *stats)
+    {
+        visited.clear();
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+        std::priority_queue<Candidate> best; // farthest on top
+        for (const Candidate &c : nearest)
+        {
+            visited.insert(c.second);
+            frontier.push(c);
+            if (!filter || !filter->isDead(c.second))
+                best.push(c);
+        }
+        while (best.size() > ef)
+            best.pop();
+
+        std::vector<uint32_t> links;
+        const float inf = std::numeric_limits<float>::infinity();
+        while (!frontier.empty())
+        {
+            const Candidate c = frontier.top();
+            const float bound = best.empty() ? inf : best.top().first;
+            if (c.first > bound && (best.size() >= ef || !filter))
+                break;
+            frontier.pop();
+            graph.neighbours(c.second, level, links);
+            if (stats)
+                ++stats->visited;
+            for (uint32_t e : links)
+            {
+                if (e >= graph.rows || !visited.insert(e))
+                    continue;
+                const float d = dist(query, e);
+                if (stats)
+                    ++stats->distances;
+                if (best.size() < ef || d < (best.empty() ? inf : best.top().first))
+                {
+                    frontier.push({d, e});
+                    if (!filter || !filter->isDead(e))
+                    {
+                        best.push({d, e});
+                        if (best.size() > ef)
+                            best.pop();
+                    }
+                }
+            }
+        }
+
+        nearest.clear();
+        for (; !best.empty(); best.pop())
+            nearest.push_back(best.top());
+    }
+
+    /*
+    Picks up to m neighbours for a node from candidates (Algorithm 4 of the paper):
+    nearest first, a candidate is kept only if it is nearer to the node than to every
+    neighbour kept so far, so the links spread out instead of all pointing into the
+    nearest cluster.
+    @param table The indexed table.
+    @param dist The distance to a row.
+    @param candidates In: the candidates and their distances to the node. Out: the
+        neighbours, nearest first.
+    @param m The maximum number of neighbours.
+    */
+    void selectNeighbours(const FeatureTable &table, const RowDistance &dist,
+                          std::vector<Candidate> &candidates, size_t m)
+    {
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<Candidate> chosen;
+        for (const Candidate &c : candidates)
+        {
+            if (chosen.size() >= m)
+                break;
+            bool diverse = true;
+            for (const Candidate &r : chosen)
+            {
+                if (dist(table.rawRow(c.second), r.second) < c.first)
+                {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse)
+                chosen.push_back(c);
+        }
+        candidates.swap(chosen);
+    }
+
+    /*
+    State shared by the threads inserting the rows of a table.
+    - graph, table, dist: The graph being built and what it indexes.
+    - levels: The level of every node, drawn up front.
+    - efConstruction: The candidate list length of an insertion.
+    - top: Guards entry and maxLevel.
+    - pool: Visited tags not in use, one per thread at most.
+    */
+    struct Builder
+    {
+        Graph graph;
+        const FeatureTable &table;
+        RowDistance dist;
+        const uint8_t *levels = nullptr;
+        size_t efConstruction = 0;
+        std::mutex top;
+        uint32_t entry = 0;
+        size_t maxLevel = 0;
+        std::mutex poolLock;
+        std::vector<std::unique_ptr<VisitedTags>> pool;
+
+        Builder(const FeatureTable &t, const IDistanceMetric &metric) : table(t), dist{t, metric} {}
+    };
+
+    /*
+    Links a node to its chosen neighbours on one layer and each neighbour back to it.
+    A neighbour whose list is full keeps the most diverse of its neighbours and the
+    node (see selectNeighbours()).
+    @param b The build state.
+    @param q The node.
+    @param level The layer.
+    @param chosen The neighbours of q and their distances to it.
+    */
+    void linkNode(Builder &b, uint32_t q, size_t level, const std::vector<Candidate> &chosen)
+    {
+        const size_t cap = b.graph.capacity(level);
+        {
+            std::lock_guard<std::mutex> guard(b.graph.lockOf(q));
+            // The graph is built in buffers the index owns, so its lists may be written
+            uint32_t *list = const_cast<uint32_t *>(b.graph.list(q, level));
+            list[0] = 0;
+            for (const Candidate &c : chosen)
+                list[1 + list[0]++] = c.second;
+        }
+        std::vector<Candidate> pruned;
+        for (const Candidate &c : chosen)
+        {
+            std::lock_guard<std::mutex> guard(b.graph.lockOf(c.second));
+            uint32_t *list = const_cast<uint32_t *>(b.graph.list(c.second, level));
+            if (list[0] < cap)
+            {
+                list[1 + list[0]++] = q;
+                continue;
+            }
+            const void *row = b.table.rawRow(c.second);
+            pruned.assign(1, {c.first, q});
+            for (uint32_t i = 0; i < list[0]; ++i)
+                pruned.push_back({b.dist(row, list[1 + i]), list[1 + i]});
+            selectNeighbours(b.table, b.dist, pruned, cap);
+            list[0] = 0;
+            for (const Candidate &p : pruned)
+                list[1 + list[0]++] = p.second;
+        }
+    }
+
+    /*
+    Inserts one node (Algorithm 1 of the paper): walks greedily down to the node's
+    top layer, then on each layer from there to 0 searches efConstruction candidates
+    and links the node to the chosen ones. A node that raises the top layer keeps the
+    entry point locked until it is linked, so no search starts from a half-linked node.
+    @param b The build state; the first node must be inserted already.
+    @param q The node.
+    */
+    void insertNode(Builder &b, uint32_t q)
+    {
+        const size_t level = b.levels[q];
+        std::unique_lock<std::mutex> top(b.top);
+        const uint32_t entry = b.entry;
+        const size_t maxLevel = b.maxLevel;
+        if (level <= maxLevel)
+            top.unlock();
+
+        std::unique_ptr<VisitedTags> visited;
+        {
+            std::lock_guard<std::mutex> guard(b.poolLock);
+            if (!b.pool.empty())
+            {
+                visited = std::move(b.pool.back());
+                b.pool.pop_back();
+            }
+        }
+        if (!visited)
+            visited = std::make_unique<VisitedTags>(b.graph.rows);
+
+        const void *query = b.table.rawRow(q);
+        std::vector<Candidate> nearest{{b.dist(query, entry), entry}};
+        for (size_t l = maxLevel; l > level; --l)
+            searchLayer(b.graph, b.dist, query, nearest, 1, l, *visited, nullptr, nullptr);
+        std::vector<Candidate> chosen;
+        for (size_t l = std::min(level, maxLevel) + 1; l-- > 0;)
+        {
+            searchLayer(b.graph, b.dist, query, nearest, b.efConstruction, l, *visited, nullptr,
+                        nullptr);
+            chosen.clear();
+            for (const Candidate &c : nearest)
+                if (c.second != q)
+                    chosen.push_back(c);
+            selectNeighbours(b.table, b.dist, chosen, b.graph.links);
+            linkNode(b, q, l, chosen);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(b.poolLock);
+            b.pool.push_back(std::move(visited));
+        }
+        if (level > maxLevel)
+        {
+            b.entry = q;
+            b.maxLevel = level;
+        }
+    }
+} // namespace
+
+/*
+Unmaps the index file if it is still open.
+*/
+HnswIndex::~HnswIndex()
+{
+    close();
+}
+
+/*
+Drops the graph, mapped or built.
+*/
+void HnswIndex::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    levelsBuf_.clear();
+    upperStartBuf_.clear();
+    baseBuf_.clear();
+    upperBuf_.clear();
+    levels_ = nullptr;
+    upperStart_ = nullptr;
+    base_ = nullptr;
+    upper_ = nullptr;
+    upperCount_ = 0;
+    rows_ = dim_ = 0;
+    fingerprint_ = 0;
+    entry_ = 0;
+    maxLevel_ = 0;
+}
+
+/*
+Builds the graph over every row of a table. The node levels are drawn up front, so
+the lists of every node can be laid out in their final place before any is filled;
+the first node is inserted alone and the rest on all threads.
+
+- @param table The table to index.
+- @param metric SSD or COSINE.
+- @param params links and efConstruction are used.
+- @param threads The number of threads, 0 for one per core.
+- @return 0 on success, -1 on error.
+*/
+int HnswIndex::build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                     size_t threads)
+{
+    if (metric != SSD && metric != COSINE)
+    {
+        printf("HNSW index supports ssd and cosine, not %s\n",
+               MetricFactory::metricTypeToString(metric).c_str());
+        return -1;
+    }
+    if (params.links < 2 || params.efConstruction == 0)
+    {
+        printf("HNSW index needs at least 2 links and a positive efConstruction\n");
+        return -1;
+    }
+    if (table.rows() == 0 || table.rows() >= std::numeric_limits<uint32_t>::max())
+    {
+        printf("HNSW index cannot index %zu rows of %s\n", table.rows(), table.path().c_str());
+        return -1;
+    }
+    auto distance = MetricFactory::create(metric);
+
+    close();
+    metric_ = metric;
+    rows_ = table.rows();
+    dim_ = table.dim();
+    fingerprint_ = table.fingerprint();
+    links_ = params.links;
+    efConstruction_ = params.efConstruction;
+
+    std::mt19937_64 rng(kSeed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double scale = 1.0 / std::log((double)links_);
+    levelsBuf_.resize(rows_);
+    upperStartBuf_.resize(rows_);
+    uint64_t upperCount = 0;
+    for (size_t i = 0; i < rows_; ++i)
+    {
+        double level = std::floor(-std::log(1.0 - uniform(rng)) * scale);
+        levelsBuf_[i] = (uint8_t)std::min<double>(level, kMaxLevel);
+        upperStartBuf_[i] = upperCount;
+        upperCount += levelsBuf_[i] * (1 + links_);
+    }
+    baseBuf_.assign(rows_ * (1 + 2 * links_), 0);
+    upperBuf_.assign(upperCount, 0);
+    levels_ = levelsBuf_.data();
+    upperStart_ = upperStartBuf_.data();
+    base_ = baseBuf_.data();
+    upper_ = upperBuf_.data();
+    upperCount_ = upperCount;
+
+    std::vector<std::mutex> locks(std::min(rows_, kLockStripes));
+    Builder b(table, *distance);
+    b.graph = {upperStart_, base_, upper_, links_, rows_, &locks};
+    b.levels = levels_;
+    b.efConstruction = efConstruction_;
+    b.entry = 0;
+    b.maxLevel = levels_[0];
+    ThreadUtil::parallelFor(rows_ - 1, [&](size_t i) { insertNode(b, (uint32_t)(i + 1)); }, threads);
+    entry_ = b.entry;
+    maxLevel_ = b.maxLevel;
+    return 0;
+}
+
+/*
+Writes the graph to an index file. The file appears under its final name only once
+it is complete.
+
+- @param path The path of the .hnsw file to create (replaced if it exists).
+- @return 0 on success, -1 on error.
+*/
+int HnswIndex::save(const std::string &path) const
+{
+    if (!base_)
+    {
+        printf("HNSW index is empty, nothing to save\n");
+        return -1;
+    }
+    HnswHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(HnswHeader);
+    h.metric = metric_;
+    h.dim = (uint32_t)dim_;
+    h.rows = rows_;
+    h.fingerprint = fingerprint_;
+    h.links = (uint32_t)links_;
+    h.efConstruction = (uint32_t)efConstruction_;
+    h.entryPoint = entry_;
+    h.maxLevel = (uint32_t)maxLevel_;
+    h.levelsOffset = sizeof(HnswHeader);
+    h.upperStartOffset = FileUtil::alignUp(h.levelsOffset + rows_, sizeof(uint64_t));
+    h.baseOffset = h.upperStartOffset + rows_ * sizeof(uint64_t);
+    h.upperOffset = h.baseOffset + rows_ * (1 + 2 * links_) * sizeof(uint32_t);
+    h.upperCount = upperCount_;
+    h.fileSize = h.upperOffset + upperCount_ * sizeof(uint32_t);
+
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+    bool ok = FileUtil::writeAll(fp, &h, sizeof(h)) && FileUtil::writeAll(fp, levels_, rows_) &&
+              FileUtil::writePadding(fp, h.levelsOffset + rows_, h.upperStartOffset) &&
+              FileUtil::writeAll(fp, upperStart_, rows_ * sizeof(uint64_t)) &&
+              FileUtil::writeAll(fp, base_, rows_ * (1 + 2 * links_) * sizeof(uint32_t)) &&
+              FileUtil::writeAll(fp, upper_, upperCount_ * sizeof(uint32_t));
+    return FileUtil::commitTemp(fp, tmpPath, path, ok);
+}
+
+/*
+Maps an index file into memory and validates its header. The lists are paged in
+when a search visits them.
+
+- @param path The path to the .hnsw file.
+- @return 0 on success, -1 on error.
+*/
+int HnswIndex::load(const std::string &path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(HnswHeader), "HNSW index", mapSize_);
+    if (!map_)
+        return -1;
+
+    const HnswHeader *h = static_cast<const HnswHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(HnswHeader))
+    {
+        printf("%s is not a version %u HNSW index\n", path.c_str(), kVersion);
+        close();
+        return -1;
+    }
+    if (h->fileSize != mapSize_ || (h->metric != SSD && h->metric != COSINE) || h->links < 2 ||
+        h->rows == 0 || h->entryPoint >= h->rows || h->maxLevel > kMaxLevel ||
+        h->levelsOffset + h->rows > h->upperStartOffset ||
+        h->upperStartOffset % sizeof(uint64_t) != 0 ||
+        h->upperStartOffset + h->rows * sizeof(uint64_t) > h->baseOffset ||
+        h->baseOffset + h->rows * (1 + 2 * (uint64_t)h->links) * sizeof(uint32_t) > h->upperOffset ||
+        h->upperOffset + h->upperCount * sizeof(uint32_t) > mapSize_)
+    {
+        printf("HNSW index %s is truncated or corrupt\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    metric_ = static_cast<MetricType>(h->metric);
+    rows_ = h->rows;
+    dim_ = h->dim;
+    fingerprint_ = h->fingerprint;
+    links_ = h->links;
+    efConstruction_ = h->efConstruction;
+    entry_ = h->entryPoint;
+    maxLevel_ = h->maxLevel;
+    levels_ = reinterpret_cast<const uint8_t *>(base + h->levelsOffset);
+    upperStart_ = reinterpret_cast<const uint64_t *>(base + h->upperStartOffset);
+    base_ = reinterpret_cast<const uint32_t *>(base + h->baseOffset);
+    upper_ = reinterpret_cast<const uint32_t *>(base + h->upperOffset);
+    upperCount_ = h->upperCount;
+    if (levels_[entry_] != maxLevel_ ||
+        upperStart_[entry_] + maxLevel_ * (1 + links_) > upperCount_)
+    {
+        printf("HNSW index %s has a corrupt entry point\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    printf("Opened %s (hnsw, %llu rows, %s, M %zu, %zu layers)\n", path.c_str(),
+           (unsigned long long)rows_, MetricFactory::metricTypeToString(metric_).c_str(), links_,
+           levels());
+    return 0;
+}
+
+/*
+Searches the graph for the rows nearest to a query: one greedy step per upper layer,
+then a search of max(efSearch, k) candidates on layer 0 that skips dead rows.
+
+- @param table The table the index was built from.
+- @param query The query, table.dim() features.
+- @param k The number of rows to return.
+- @param params efSearch is used.
+- @param out Receives up to k rows, nearest first.
+- @param stats Receives the cost if not nullptr.
+- @return 0 on success, -1 on error.
+*/
+int HnswIndex::search(const FeatureTable &table, const float *query, size_t k,
+                      const IndexParams &params, std::vector<IndexHit> &out,
+                      IndexStats *stats) const
+{
+    out.clear();
+    if (!checkShape(table, "HNSW", base_ != nullptr))
+        return -1;
+    if (k == 0)
+        return 0;
+    auto metric = MetricFactory::create(metric_);
+    const RowDistance dist{table, *metric};
+    const std::vector<uint8_t> encoded = encodeQuery(table, query);
+    const Graph graph{upperStart_, base_, upper_, links_, rows_, nullptr};
+
+    VisitedSet visited;
+    std::vector<Candidate> nearest{{dist(encoded.data(), entry_), entry_}};
+    if (stats)
+        ++stats->distances;
+    for (size_t l = maxLevel_; l > 0; --l)
+        searchLayer(graph, dist, encoded.data(), nearest, 1, l, visited, nullptr, stats);
+    searchLayer(graph, dist, encoded.data(), nearest, std::max(params.efSearch, k), 0, visited,
+                &table, stats);
+
+    std::sort(nearest.begin(), nearest.end());
+    for (size_t i = 0; i < nearest.size() && i < k; ++i)
+        out.push_back({nearest[i].second, nearest[i].first});
+    return 0;
+}
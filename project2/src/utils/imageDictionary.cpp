@@ -0,0 +1,22 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  imageDictionary.cpp
+
+  Path: project2/src/utils/imageDictionary.cpp
+  Description: Maps image filenames to dense integer IDs.
+*/
+
+#include "imageDictionary.hpp"
+
+/*
+Returns the ID of a filename, assigning the next free ID if it is new.
+- @param filename The 0-terminated filename; it must outlive the dictionary.
+- @return The ID of the filename.
+*/
+uint32_t ImageDictionary::intern(const char *filename)
+{
+    auto inserted = ids_.emplace(std::string_view(filename), (uint32_t)names_.size());
+    if (inserted.second)
+        names_.push_back(inserted.first->first);
+    return inserted.first->second;
+}
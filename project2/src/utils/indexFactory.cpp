@@ -0,0 +1,104 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  indexFactory.cpp
+
+  Path: project2/src/utils/indexFactory.cpp
+  Description: Implements the factory method for creating search index instances.
+*/
+
+#include "indexFactory.hpp"
+#include "featureStore.hpp"
+#include "hnswIndex.hpp"
+#include "invertedBinIndex.hpp"
+#include "ivfIndex.hpp"
+#include "pqIndex.hpp"
+#include "vpTreeIndex.hpp"
+#include <memory>
+#include <unordered_map>
+
+/*
+IndexFactory::create(IndexType type)
+This static method creates and returns a shared pointer to an empty IIndex instance
+based on the specified IndexType:
+- HNSW, it creates and returns a shared pointer to an HnswIndex instance.
+- IVF, it creates and returns a shared pointer to an IvfIndex instance.
+- PQ, it creates and returns a shared pointer to a PqIndex instance.
+- VP_TREE, it creates and returns a shared pointer to a VpTreeIndex instance.
+- INVERTED_BINS, it creates and returns a shared pointer to an InvertedBinIndex instance.
+- UNKNOWN_INDEX or any unrecognized type, it returns nullptr.
+*/
+std::shared_ptr<IIndex> IndexFactory::create(IndexType type)
+{
+    switch (type)
+    {
+    case HNSW:
+        return std::make_shared<HnswIndex>();
+    case IVF:
+        return std::make_shared<IvfIndex>();
+    case PQ:
+        return std::make_shared<PqIndex>();
+    case VP_TREE:
+        return std::make_shared<VpTreeIndex>();
+    case INVERTED_BINS:
+        return std::make_shared<InvertedBinIndex>();
+    default:
+        return nullptr;
+    }
+}
+
+/*
+IndexFactory::stringToIndexType(const char *typeStr)
+This static method converts the name of an index type to the corresponding IndexType:
+- "hnsw" returns HNSW
+- "ivf" returns IVF
+- "pq" returns PQ
+- "vptree" returns VP_TREE
+- "bins" returns INVERTED_BINS
+Any other string returns UNKNOWN_INDEX.
+*/
+IndexType IndexFactory::stringToIndexType(const char *typeStr)
+{
+    static const std::unordered_map<std::string, IndexType> typeMap = {
+        {"hnsw", HNSW},
+        {"ivf", IVF},
+        {"pq", PQ},
+        {"vptree", VP_TREE},
+        {"bins", INVERTED_BINS}};
+
+    auto it = typeMap.find(typeStr);
+    return (it != typeMap.end()) ? it->second : UNKNOWN_INDEX;
+}
+
+/*
+IndexFactory::indexTypeToString(IndexType type)
+This static method converts an IndexType back to its name, which is also the extension
+of its index files. If the type is unrecognized, it returns "Unknown".
+*/
+std::string IndexFactory::indexTypeToString(IndexType type)
+{
+    static const std::unordered_map<IndexType, std::string> typeMap = {
+        {HNSW, "hnsw"},
+        {IVF, "ivf"},
+        {PQ, "pq"},
+        {VP_TREE, "vptree"},
+        {INVERTED_BINS, "bins"}};
+
+    auto it = typeMap.find(type);
+    return (it != typeMap.end()) ? it->second : "Unknown";
+}
+
+/*
+IndexFactory::indexPath(const std::string &dbPath, IndexType type, FeatureType featureType,
+                        Position position)
+This static method returns the path of the index of a DB, next to the DB file: the DB
+path with the index type appended. A .fst store holds several features, each indexed
+on its own, so the feature and position of the group come before the type.
+*/
+std::string IndexFactory::indexPath(const std::string &dbPath, IndexType type, FeatureType featureType,
+                                    Position position)
+{
+    std::string path = dbPath;
+    if (FeatureStore::isFeatureStorePath(dbPath))
+        path += "." + ExtractorFactory::featureTypeToString(featureType) + "_" + positionToString(position);
+    return path + "." + indexTypeToString(type);
+}
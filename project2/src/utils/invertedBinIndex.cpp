@@ -0,0 +1,442 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  invertedBinIndex.cpp
+
+  Path: project2/src/utils/invertedBinIndex.cpp
+  Description: Builds, saves, memory-maps and searches inverted bin indexes.
+*/
+
+#include "invertedBinIndex.hpp"
+#include "IDistanceMetric.hpp"
+#include "fileUtil.hpp"
+#include "matchUtil.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'B', 'I', 'N', '\0'};
+    const uint32_t kVersion = 1;
+    // Rows read per task while the postings are collected
+    const size_t kBlockRows = 256;
+    // Postings taken from a bin at least per turn, which keeps the heap off the hot
+    // path; the stopping bound holds whatever order the postings are read in
+    const size_t kMinRun = 64;
+    // Postings read at least between two checks for the stopping condition
+    const size_t kCheckEvery = 4096;
+    // Slack, relative to the query's mass, for float rounding in the partial scores
+    const float kSlack = 1e-4f;
+} // namespace
+
+/*
+Unmaps the index file if it is still open.
+*/
+InvertedBinIndex::~InvertedBinIndex()
+{
+    close();
+}
+
+/*
+Drops the postings, mapped or built.
+*/
+void InvertedBinIndex::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    binStartBuf_.clear();
+    rowIdsBuf_.clear();
+    massesBuf_.clear();
+    binStart_ = nullptr;
+    rowIds_ = nullptr;
+    masses_ = nullptr;
+    rows_ = dim_ = 0;
+    fingerprint_ = 0;
+    postings_ = 0;
+    base_ = 0.0f;
+}
+
+/*
+Collects the postings of every bin in two passes over the rows, one block of rows per
+task: the first counts the occupied bins of each block, which places every block's
+postings, and the second writes them in row order. Each bin is then sorted by mass,
+one bin per task, so the index is the same on every thread count.
+
+- @param table The table to index, non-negative features (histograms).
+- @param metric hist_ix.
+- @param params Unused; the index has no settings.
+- @param threads The number of threads, 0 for one per core.
+- @return 0 on success, -1 on error.
+*/
+int InvertedBinIndex::build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                            size_t threads)
+{
+    (void)params;
+    if (metric != HIST_INTERSECTION)
+    {
+        printf("Inverted bin index needs the hist_ix metric (got %s)\n",
+               MetricFactory::metricTypeToString(metric).c_str());
+        return -1;
+    }
+    if (table.rows() == 0 || table.dim() == 0 || table.rows() >= std::numeric_limits<uint32_t>::max())
+    {
+        printf("Inverted bin index cannot index %zu rows of %s\n", table.rows(), table.path().c_str());
+        return -1;
+    }
+
+    close();
+    const size_t rows = table.rows(), dim = table.dim();
+    // A u8 code of 0 decodes to the offset, which is what an empty bin holds
+    const float base = table.dataType() == FeatureDataType::U8 ? table.quantParams().offset : 0.0f;
+    const size_t blocks = (rows + kBlockRows - 1) / kBlockRows;
+
+    std::vector<uint64_t> next(blocks * dim, 0);
+    std::vector<char> negative(blocks, 0);
+    ThreadUtil::parallelFor(blocks, [&](size_t b) {
+        const size_t first = b * kBlockRows, last = std::min(rows, first + kBlockRows);
+        std::vector<float> row(dim);
+        uint64_t *count = next.data() + b * dim;
+        for (size_t i = first; i < last; ++i)
+        {
+            table.readRow(i, row.data());
+            for (size_t j = 0; j < dim; ++j)
+            {
+                count[j] += row[j] > base;
+                negative[b] |= row[j] < base;
+            }
+        }
+    }, threads);
+    if (std::find(negative.begin(), negative.end(), 1) != negative.end())
+    {
+        printf("Inverted bin index needs histograms, but %s has negative features\n", table.path().c_str());
+        return -1;
+    }
+
+    // Turn the counts into where each block's postings of each bin start
+    binStartBuf_.assign(dim + 1, 0);
+    for (size_t j = 0; j < dim; ++j)
+    {
+        uint64_t pos = binStartBuf_[j];
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            const uint64_t count = next[b * dim + j];
+            next[b * dim + j] = pos;
+            pos += count;
+        }
+        binStartBuf_[j + 1] = pos;
+    }
+    postings_ = binStartBuf_[dim];
+    rowIdsBuf_.resize(postings_);
+    massesBuf_.resize(postings_);
+    ThreadUtil::parallelFor(blocks, [&](size_t b) {
+        const size_t first = b * kBlockRows, last = std::min(rows, first + kBlockRows);
+        std::vector<float> row(dim);
+        uint64_t *pos = next.data() + b * dim;
+        for (size_t i = first; i < last; ++i)
+        {
+            table.readRow(i, row.data());
+            for (size_t j = 0; j < dim; ++j)
+            {
+                if (row[j] <= base)
+                    continue;
+                rowIdsBuf_[pos[j]] = (uint32_t)i;
+                massesBuf_[pos[j]] = row[j] - base;
+                ++pos[j];
+            }
+        }
+    }, threads);
+
+    ThreadUtil::parallelFor(dim, [&](size_t j) {
+        const uint64_t first = binStartBuf_[j], last = binStartBuf_[j + 1];
+        std::vector<std::pair<float, uint32_t>> bin(last - first);
+        for (uint64_t p = first; p < last; ++p)
+            bin[p - first] = {massesBuf_[p], rowIdsBuf_[p]};
+        std::sort(bin.begin(), bin.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+        for (uint64_t p = first; p < last; ++p)
+        {
+            massesBuf_[p] = bin[p - first].first;
+            rowIdsBuf_[p] = bin[p - first].second;
+        }
+    }, threads);
+
+    metric_ = metric;
+    rows_ = rows;
+    dim_ = dim;
+    fingerprint_ = table.fingerprint();
+    base_ = base;
+    binStart_ = binStartBuf_.data();
+    rowIds_ = rowIdsBuf_.data();
+    masses_ = massesBuf_.data();
+    return 0;
+}
+
+/*
+Writes the index to an index file. The file appears under its final name only once
+it is complete.
+
+- @param path The path of the .bins file to create (replaced if it exists).
+- @return 0 on success, -1 on error.
+*/
+int InvertedBinIndex::save(const std::string &path) const
+{
+    if (!binStart_)
+    {
+        printf("Inverted bin index is empty, nothing to save\n");
+        return -1;
+    }
+    BinsHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(BinsHeader);
+    h.metric = metric_;
+    h.dim = (uint32_t)dim_;
+    h.base = base_;
+    h.rows = rows_;
+    h.fingerprint = fingerprint_;
+    h.postings = postings_;
+    h.binStartOffset = FileUtil::alignUp(sizeof(BinsHeader), sizeof(uint64_t));
+    h.rowIdsOffset = h.binStartOffset + (dim_ + 1) * sizeof(uint64_t);
+    h.massesOffset = h.rowIdsOffset + postings_ * sizeof(uint32_t);
+    h.fileSize = h.massesOffset + postings_ * sizeof(float);
+
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+    bool ok = FileUtil::writeAll(fp, &h, sizeof(h)) &&
+              FileUtil::writePadding(fp, sizeof(h), h.binStartOffset) &&
+              FileUtil::writeAll(fp, binStart_, (dim_ + 1) * sizeof(uint64_t)) &&
+              FileUtil::writeAll(fp, rowIds_, postings_ * sizeof(uint32_t)) &&
+              FileUtil::writeAll(fp, masses_, postings_ * sizeof(float));
+    return FileUtil::commitTemp(fp, tmpPath, path, ok);
+}
+
+/*
+Maps an index file into memory and validates its header and bin starts. The postings
+are paged in when a query reads them.
+
+- @param path The path to the .bins file.
+- @return 0 on success, -1 on error.
+*/
+int InvertedBinIndex::load(const std::string &path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(BinsHeader), "inverted bin index", mapSize_);
+    if (!map_)
+        return -1;
+
+    const BinsHeader *h = static_cast<const BinsHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(BinsHeader))
+    {
+        printf("%s is not a version %u inverted bin index\n", path.c_str(), kVersion);
+        close();
+        return -1;
+    }
+    if (h->fileSize != mapSize_ || h->metric != HIST_INTERSECTION || h->rows == 0 || h->dim == 0 ||
+        h->rows >= std::numeric_limits<uint32_t>::max() || h->binStartOffset % sizeof(uint64_t) != 0 ||
+        h->binStartOffset < sizeof(BinsHeader) ||
+        h->binStartOffset + (h->dim + 1) * sizeof(uint64_t) > h->rowIdsOffset ||
+        h->rowIdsOffset + h->postings * sizeof(uint32_t) > h->massesOffset ||
+        h->massesOffset % sizeof(float) != 0 || h->massesOffset + h->postings * sizeof(float) > mapSize_)
+    {
+        printf("Inverted bin index %s is truncated or corrupt\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    metric_ = static_cast<MetricType>(h->metric);
+    rows_ = h->rows;
+    dim_ = h->dim;
+    fingerprint_ = h->fingerprint;
+    postings_ = h->postings;
+    base_ = h->base;
+    binStart_ = reinterpret_cast<const uint64_t *>(base + h->binStartOffset);
+    rowIds_ = reinterpret_cast<const uint32_t *>(base + h->rowIdsOffset);
+    masses_ = reinterpret_cast<const float *>(base + h->massesOffset);
+    bool sorted = binStart_[0] == 0 && binStart_[dim_] == postings_;
+    for (size_t j = 0; sorted && j < dim_; ++j)
+        sorted = binStart_[j] <= binStart_[j + 1];
+    if (!sorted)
+    {
+        printf("Inverted bin index %s has corrupt bin starts\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    printf("Opened %s (bins, %llu rows, %s, %zu postings, %.1f bins per row)\n", path.c_str(),
+           (unsigned long long)rows_, MetricFactory::metricTypeToString(metric_).c_str(), postings_,
+           (double)postings_ / rows_);
+    return 0;
+}
+
+/*
+Finds the exact k nearest live rows under hist_ix, reading only the postings of the
+query's occupied bins. The bins are consumed score-at-a-time through a heap keyed by
+each bin's next contribution min(q, mass), which never grows along a bin. From time
+to time the search checks whether the K-th best partial score beats every other
+partial score plus the sum of the bins' next contributions (a bound on what any row
+can still gain); if so the top K cannot change and the rest is skipped. The rows
+whose partial scores tie or beat the K-th are scored exactly; when fewer than k rows
+share a bin with the query, rows sharing none fill up the result in row order.
+
+- @param table The table the index was built from.
+- @param query The query, table.dim() features.
+- @param k The number of rows to return.
+- @param params Unused; the search is exact.
+- @param out Receives up to k rows, nearest first.
+- @param stats Receives the cost if not nullptr; visited counts the postings read.
+- @return 0 on success, -1 on error.
+*/
+int InvertedBinIndex::search(const FeatureTable &table, const float *query, size_t k,
+                             const IndexParams &params, std::vector<IndexHit> &out,
+                             IndexStats *stats) const
+{
+    (void)params;
+    out.clear();
+    if (!checkShape(table, "Inverted bin", binStart_ != nullptr))
+        return -1;
+    if (k == 0)
+        return 0;
+
+    // Read the query back as the exact scan sees it
+    const std::vector<uint8_t> encoded = encodeQuery(table, query);
+    std::vector<float> q(dim_);
+    Quantization::decode(table.dataType(), table.quantParams(), encoded.data(), dim_, q.data());
+
+    // One cursor per bin that the query and some row both occupy
+    struct Cursor
+    {
+        uint64_t pos;
+        uint64_t end;
+        float mass;
+    };
+    std::vector<Cursor> cursors;
+    float queryMass = 0.0f;
+    for (size_t j = 0; j < dim_; ++j)
+    {
+        const float mass = q[j] - base_;
+        if (mass <= 0.0f)
+            continue;
+        queryMass += mass;
+        if (binStart_[j] < binStart_[j + 1])
+            cursors.push_back({binStart_[j], binStart_[j + 1], mass});
+    }
+    auto nextGain = [&](const Cursor &c) {
+        return c.pos < c.end ? std::min(c.mass, masses_[c.pos]) : 0.0f;
+    };
+
+    std::vector<float> score(rows_, 0.0f);
+    std::vector<uint32_t> touched;
+    std::priority_queue<std::pair<float, uint32_t>> heap;
+    for (size_t c = 0; c < cursors.size(); ++c)
+        heap.push({nextGain(cursors[c]), (uint32_t)c});
+    const float slack = kSlack * queryMass;
+    std::vector<float> scratch;
+    // The K-th best partial score once it is settled, 0 before
+    float kth = 0.0f;
+
+    // True if no row outside the current top k can still overtake the k-th
+    auto settled = [&]() {
+        if (touched.size() < k)
+            return false;
+        float remaining = 0.0f;
+        for (const Cursor &c : cursors)
+            remaining += nextGain(c);
+        scratch.resize(touched.size());
+        for (size_t i = 0; i < touched.size(); ++i)
+            scratch[i] = score[touched[i]];
+        std::nth_element(scratch.begin(), scratch.begin() + (k - 1), scratch.end(), std::greater<float>());
+        const float kthScore = scratch[k - 1];
+        float other = 0.0f;
+        if (touched.size() > k)
+            other = *std::max_element(scratch.begin() + k, scratch.end());
+        if (kthScore <= other + remaining + 2.0f * slack)
+            return false;
+        kth = kthScore;
+        return true;
+    };
+
+    size_t read = 0, nextCheck = kCheckEvery;
+    while (!heap.empty())
+    {
+        const uint32_t c = heap.top().second;
+        heap.pop();
+        Cursor &cur = cursors[c];
+        const float floor = heap.empty() ? 0.0f : heap.top().first;
+        // Take this bin's postings for as long as none of the other bins offers more
+        const uint64_t runEnd = std::min(cur.end, cur.pos + kMinRun);
+        do
+        {
+            const uint32_t row = rowIds_[cur.pos];
+            const float gain = std::min(cur.mass, masses_[cur.pos]);
+            ++cur.pos;
+            ++read;
+            if (table.isDead(row))
+                continue;
+            if (score[row] == 0.0f)
+                touched.push_back(row);
+            score[row] += gain;
+        } while (cur.pos < cur.end && (cur.pos < runEnd || nextGain(cur) >= floor));
+        if (cur.pos < cur.end)
+            heap.push({nextGain(cur), c});
+        if (read >= nextCheck)
+        {
+            if (settled())
+                break;
+            nextCheck = read + std::max(kCheckEvery, touched.size());
+        }
+    }
+    if (heap.empty() && touched.size() >= k)
+    {
+        // Every posting was read, so the partial scores are the full intersections
+        scratch.assign(touched.size(), 0.0f);
+        for (size_t i = 0; i < touched.size(); ++i)
+            scratch[i] = score[touched[i]];
+        std::nth_element(scratch.begin(), scratch.begin() + (k - 1), scratch.end(), std::greater<float>());
+        kth = scratch[k - 1];
+    }
+
+    auto metric = MetricFactory::create(HIST_INTERSECTION);
+    TopKSelector best(k);
+    size_t scored = 0;
+    for (uint32_t row : touched)
+    {
+        if (score[row] + slack < kth)
+            continue;
+        best.push(metric->computeEncoded(table.dataType(), encoded.data(), table.rawRow(row), dim_,
+                                         table.quantParams()),
+                  row);
+        ++scored;
+    }
+    // Rows sharing no bin with the query all tie; the first ones complete the result
+    for (size_t row = 0; best.size() < k && touched.size() < k && row < rows_; ++row)
+    {
+        if (score[row] != 0.0f || table.isDead(row))
+            continue;
+        best.push(metric->computeEncoded(table.dataType(), encoded.data(), table.rawRow(row), dim_,
+                                         table.quantParams()),
+                  (uint32_t)row);
+        ++scored;
+    }
+    if (stats)
+    {
+        stats->distances += scored;
+        stats->visited += read;
+    }
+
+    for (const TopKSelector::Entry &e : best.sorted())
+        out.push_back({e.id, e.distance});
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  ivfIndex.cpp
+
+  Path: project2/src/utils/ivfIndex.cpp
+  Description: Trains, saves, memory-maps and searches inverted file (IVF) indexes.
+*/
+
+#include "ivfIndex.hpp"
+#include "IDistanceMetric.hpp"
+#include "featureMatrix.hpp"
+#include "fileUtil.hpp"
+#include "kMeans.hpp"
+#include "matchUtil.hpp"
+#include "pageUtil.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'I', 'V', 'F', '\0'};
+    const uint32_t kVersion = 1;
+    const uint64_t kPageSize = 4096;
+    // Rows trained on per list; more barely moves the centroids but costs every iteration
+    const size_t kSamplePerList = 256;
+    // Lloyd iterations at most; training stops earlier once no sample row moves
+    const size_t kIterations = 20;
+    // Rows assigned per task when every row is filed
+    const size_t kBlockRows = 256;
+} // namespace
+
+/*
+Unmaps the index file if it is still open.
+*/
+IvfIndex::~IvfIndex()
+{
+    close();
+}
+
+/*
+Drops the lists, mapped or built.
+*/
+void IvfIndex::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    centroidsBuf_.clear();
+    listStartBuf_.clear();
+    rowIdsBuf_.clear();
+    dataBuf_.clear();
+    normsBuf_.clear();
+    centroids_ = nullptr;
+    listStart_ = nullptr;
+    rowIds_ = nullptr;
+    data_ = nullptr;
+    norms_ = nullptr;
+    rows_ = dim_ = 0;
+    fingerprint_ = 0;
+    lists_ = 0;
+    centroidStride_ = 0;
+    rowBytes_ = 0;
+}
+
+/*
+Trains the centroids on a sample of the live rows, spread evenly over the table (see
+KMeans::train()), and files every row under its nearest centroid. A build is the same
+on every run and thread count; both the training passes and the final assignment run
+on all threads, one block of rows per task.
+
+- @param table The table to index.
+- @param metric Any metric; rows go to the list whose centroid is nearest under it.
+- @param params lists is used (0 for the square root of the rows).
+- @param threads The number of threads, 0 for one per core.
+- @return 0 on success, -1 on error.
+*/
+int IvfIndex::build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                    size_t threads)
+{
+    auto distance = MetricFactory::create(metric);
+    if (!distance)
+    {
+        printf("IVF index needs a known metric\n");
+        return -1;
+    }
+    if (table.rows() == 0 || table.rows() >= std::numeric_limits<uint32_t>::max())
+    {
+        printf("IVF index cannot index %zu rows of %s\n", table.rows(), table.path().c_str());
+        return -1;
+    }
+
+    close();
+    metric_ = metric;
+    rows_ = table.rows();
+    dim_ = table.dim();
+    fingerprint_ = table.fingerprint();
+    dataType_ = table.dataType();
+    rowBytes_ = table.rowBytes();
+
+    std::vector<size_t> live;
+    for (size_t i = 0; i < rows_; ++i)
+        if (!table.isDead(i))
+            live.push_back(i);
+    if (live.empty())
+    {
+        live.resize(rows_);
+        std::iota(live.begin(), live.end(), 0);
+    }
+    size_t lists = params.lists > 0 ? params.lists : (size_t)std::lround(std::sqrt((double)live.size()));
+    lists = std::max<size_t>(1, std::min(lists, live.size()));
+    const size_t sampleRows = std::min(live.size(), lists * kSamplePerList);
+    FeatureMatrix sample(sampleRows, dim_);
+    for (size_t s = 0; s < sampleRows; ++s)
+        table.readRow(live[s * live.size() / sampleRows], sample.row(s));
+
+    const FeatureMatrix centroids = KMeans::train(*distance, sample, lists, kIterations, threads);
+
+    // File every row, dead ones included, under its nearest centroid
+    std::vector<uint32_t> listOf(rows_);
+    ThreadUtil::parallelFor((rows_ + kBlockRows - 1) / kBlockRows, [&](size_t b) {
+        const size_t first = b * kBlockRows, count = std::min(kBlockRows, rows_ - first);
+        FeatureMatrix block(count, dim_);
+        for (size_t i = 0; i < count; ++i)
+            table.readRow(first + i, block.row(i));
+        KMeans::assign(*distance, block, centroids, listOf.data() + first, 1);
+    }, threads);
+
+    lists_ = lists;
+    centroidStride_ = centroids.stride();
+    centroidsBuf_.assign(centroids.data(), centroids.data() + lists_ * centroidStride_);
+    listStartBuf_.assign(lists_ + 1, 0);
+    for (uint32_t l : listOf)
+        ++listStartBuf_[l + 1];
+    std::partial_sum(listStartBuf_.begin(), listStartBuf_.end(), listStartBuf_.begin());
+    std::vector<uint64_t> next(listStartBuf_.begin(), listStartBuf_.end() - 1);
+    rowIdsBuf_.resize(rows_);
+    dataBuf_.resize(rows_ * rowBytes_);
+    const double *tableNorms = table.rowNorms();
+    if (tableNorms)
+        normsBuf_.resize(rows_);
+    for (size_t i = 0; i < rows_; ++i)
+    {
+        const uint64_t pos = next[listOf[i]]++;
+        rowIdsBuf_[pos] = (uint32_t)i;
+        std::memcpy(dataBuf_.data() + pos * rowBytes_, table.rawRow(i), rowBytes_);
+        if (tableNorms)
+            normsBuf_[pos] = tableNorms[i];
+    }
+    centroids_ = centroidsBuf_.data();
+    listStart_ = listStartBuf_.data();
+    rowIds_ = rowIdsBuf_.data();
+    data_ = dataBuf_.data();
+    norms_ = tableNorms ? normsBuf_.data() : nullptr;
+    return 0;
+}
+
+/*
+Writes the index to an index file. The file appears under its final name only once
+it is complete.
+
+- @param path The path of the .ivf file to create (replaced if it exists).
+- @return 0 on success, -1 on error.
+*/
+int IvfIndex::save(const std::string &path) const
+{
+    if (!listStart_)
+    {
+        printf("IVF index is empty, nothing to save\n");
+        return -1;
+    }
+    IvfHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(IvfHeader);
+    h.metric = metric_;
+    h.dataType = static_cast<int32_t>(dataType_);
+    h.dim = (uint32_t)dim_;
+    h.lists = (uint32_t)lists_;
+    h.rows = rows_;
+    h.fingerprint = fingerprint_;
+    h.rowBytes = rowBytes_;
+    h.centroidStride = centroidStride_;
+    h.centroidsOffset = FileUtil::alignUp(sizeof(IvfHeader), FeatureMatrix::kAlignBytes);
+    h.listStartOffset = h.centroidsOffset + lists_ * centroidStride_ * sizeof(float);
+    h.rowIdsOffset = h.listStartOffset + (lists_ + 1) * sizeof(uint64_t);
+    h.dataOffset = FileUtil::alignUp(h.rowIdsOffset + rows_ * sizeof(uint32_t), kPageSize);
+    uint64_t end = h.dataOffset + rows_ * rowBytes_;
+    if (norms_)
+    {
+        h.normsOffset = FileUtil::alignUp(end, sizeof(double));
+        end = h.normsOffset + rows_ * sizeof(double);
+    }
+    h.fileSize = end;
+
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+    const uint64_t rowIdsEnd = h.rowIdsOffset + rows_ * sizeof(uint32_t);
+    const uint64_t dataEnd = h.dataOffset + rows_ * rowBytes_;
+    bool ok = FileUtil::writeAll(fp, &h, sizeof(h)) &&
+              FileUtil::writePadding(fp, sizeof(h), h.centroidsOffset) &&
+              FileUtil::writeAll(fp, centroids_, lists_ * centroidStride_ * sizeof(float)) &&
+              FileUtil::writeAll(fp, listStart_, (lists_ + 1) * sizeof(uint64_t)) &&
+              FileUtil::writeAll(fp, rowIds_, rows_ * sizeof(uint32_t)) &&
+              FileUtil::writePadding(fp, rowIdsEnd, h.dataOffset) &&
+              FileUtil::writeAll(fp, data_, rows_ * rowBytes_);
+    if (ok && norms_)
+        ok = FileUtil::writePadding(fp, dataEnd, h.normsOffset) &&
+             FileUtil::writeAll(fp, norms_, rows_ * sizeof(double));
+    return FileUtil::commitTemp(fp, tmpPath, path, ok);
+}
+
+/*
+Maps an index file into memory and validates its header. The lists are paged in
+when a search probes them.
+
+- @param path The path to the .ivf file.
+- @return 0 on success, -1 on error.
+*/
+int IvfIndex::load(const std::string &path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(IvfHeader), "IVF index", mapSize_);
+    if (!map_)
+        return -1;
+
+    const IvfHeader *h = static_cast<const IvfHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(IvfHeader))
+    {
+        printf("%s is not a version %u IVF index\n", path.c_str(), kVersion);
+        close();
+        return -1;
+    }
+    const FeatureDataType type = static_cast<FeatureDataType>(h->dataType);
+    const bool knownType = type == FeatureDataType::F32 || type == FeatureDataType::U8 ||
+                           type == FeatureDataType::F16;
+    if (h->fileSize != mapSize_ || !MetricFactory::create(static_cast<MetricType>(h->metric)) ||
+        !knownType || h->lists == 0 || h->rows == 0 || h->dim == 0 ||
+        h->centroidStride < h->dim || h->rowBytes < h->dim * Quantization::elementSize(type) ||
+        h->centroidsOffset % sizeof(float) != 0 ||
+        h->centroidsOffset + h->lists * h->centroidStride * sizeof(float) > h->listStartOffset ||
+        h->listStartOffset % sizeof(uint64_t) != 0 ||
+        h->listStartOffset + (h->lists + 1) * sizeof(uint64_t) > h->rowIdsOffset ||
+        h->rowIdsOffset + h->rows * sizeof(uint32_t) > h->dataOffset ||
+        h->dataOffset + h->rows * h->rowBytes > mapSize_ ||
+        (h->normsOffset != 0 && (h->normsOffset % sizeof(double) != 0 ||
+                                 h->normsOffset < h->dataOffset + h->rows * h->rowBytes ||
+                                 h->normsOffset + h->rows * sizeof(double) > mapSize_)))
+    {
+        printf("IVF index %s is truncated or corrupt\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    metric_ = static_cast<MetricType>(h->metric);
+    dataType_ = type;
+    rows_ = h->rows;
+    dim_ = h->dim;
+    fingerprint_ = h->fingerprint;
+    lists_ = h->lists;
+    centroidStride_ = h->centroidStride;
+    rowBytes_ = h->rowBytes;
+    centroids_ = reinterpret_cast<const float *>(base + h->centroidsOffset);
+    listStart_ = reinterpret_cast<const uint64_t *>(base + h->listStartOffset);
+    rowIds_ = reinterpret_cast<const uint32_t *>(base + h->rowIdsOffset);
+    data_ = base + h->dataOffset;
+    norms_ = h->normsOffset ? reinterpret_cast<const double *>(base + h->normsOffset) : nullptr;
+    for (size_t l = 0; l < lists_; ++l)
+    {
+        if (listStart_[l] > listStart_[l + 1])
+        {
+            printf("IVF index %s has corrupt list starts\n", path.c_str());
+            close();
+            return -1;
+        }
+    }
+    if (listStart_[0] != 0 || listStart_[lists_] != rows_)
+    {
+        printf("IVF index %s has corrupt list starts\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    printf("Opened %s (ivf, %llu rows, %s, %zu lists)\n", path.c_str(), (unsigned long long)rows_,
+           MetricFactory::metricTypeToString(metric_).c_str(), lists_);
+    return 0;
+}
+
+/*
+Searches the lists for the rows nearest to a query: ranks every centroid, then
+scans the nprobe nearest lists with one batch call each and keeps the k nearest
+live rows.
+
+- @param table The table the index was built from.
+- @param query The query, table.dim() features.
+- @param k The number of rows to return.
+- @param params nprobe is used.
+- @param out Receives up to k rows, nearest first.
+- @param stats Receives the cost if not nullptr; visited counts the lists probed.
+- @return 0 on success, -1 on error.
+*/
+int IvfIndex::search(const FeatureTable &table, const float *query, size_t k,
+                     const IndexParams &params, std::vector<IndexHit> &out,
+                     IndexStats *stats) const
+{
+    out.clear();
+    if (!checkShape(table, "IVF", listStart_ && dataType_ == table.dataType()))
+        return -1;
+    if (k == 0)
+        return 0;
+    auto metric = MetricFactory::create(metric_);
+
+    std::vector<float> centroidDist(lists_);
+    const FeatureMatrix centroids = FeatureMatrix::view(centroids_, lists_, dim_, centroidStride_);
+    metric->computeMany(query, centroids, centroidDist.data(), nullptr);
+    std::vector<uint32_t> order(lists_);
+    std::iota(order.begin(), order.end(), 0);
+    const size_t probes = std::min(std::max<size_t>(params.nprobe, 1), lists_);
+    std::partial_sort(order.begin(), order.begin() + probes, order.end(), [&](uint32_t a, uint32_t b) {
+        return centroidDist[a] < centroidDist[b] || (centroidDist[a] == centroidDist[b] && a < b);
+    });
+    for (size_t p = 0; p < probes; ++p)
+    {
+        const uint64_t first = listStart_[order[p]], count = listStart_[order[p] + 1] - first;
+        PageUtil::willNeed(data_ + first * rowBytes_, count * rowBytes_);
+    }
+
+    const std::vector<uint8_t> encoded = encodeQuery(table, query);
+    const size_t stride = rowBytes_ / Quantization::elementSize(dataType_);
+    TopKSelector best(k);
+    std::vector<float> dist;
+    size_t scanned = 0;
+    for (size_t p = 0; p < probes; ++p)
+    {
+        const uint64_t first = listStart_[order[p]], count = listStart_[order[p] + 1] - first;
+        if (count == 0)
+            continue;
+        dist.resize(count);
+        scanned += count;
+        metric->computeManyEncoded(dataType_, encoded.data(), data_ + first * rowBytes_, count, dim_,
+                                   stride, table.quantParams(), dist.data(),
+                                   norms_ ? norms_ + first : nullptr);
+        for (size_t i = 0; i < count; ++i)
+            if (!table.isDead(rowIds_[first + i]))
+                best.push(dist[i], rowIds_[first + i]);
+    }
+    if (stats)
+    {
+        stats->distances += lists_ + scanned;
+        stats->visited += probes;
+    }
+
+    for (const TopKSelector::Entry &e : best.sorted())
+        out.push_back({e.id, e.distance});
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  kMeans.cpp
+
+  Path: project2/src/utils/kMeans.cpp
+  Description: Lloyd's k-means over the rows of a feature matrix, for the quantizers
+               of the search indexes.
+*/
+
+#include "kMeans.hpp"
+#include "IDistanceMetric.hpp"
+#include "quantization.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // Rows assigned per task, one computeCross call each
+    const size_t kBlockRows = 256;
+    // Relative nudge that separates the two halves of a split cluster
+    const float kSplitEps = 1.0f / 1024.0f;
+
+    /*
+    Computes the L2 norm of every centroid, which the ssd and cosine batch kernels
+    would otherwise recompute for every block of rows.
+    @param centroids The centroids.
+    @return One norm per centroid.
+    */
+    std::vector<double> centroidNorms(const FeatureMatrix &centroids)
+    {
+        std::vector<double> norms(centroids.rows());
+        for (size_t l = 0; l < centroids.rows(); ++l)
+            norms[l] = Quantization::norm(FeatureDataType::F32, QuantParams(), centroids.row(l),
+                                          centroids.cols());
+        return norms;
+    }
+
+    /*
+    Finds the nearest centroid of every row of a block, ties going to the lower one.
+    @param metric The metric.
+    @param block The rows.
+    @param centroids The centroids.
+    @param norms The norms of the centroids.
+    @param out Receives block.rows() centroid numbers.
+    */
+    void assignBlock(const IDistanceMetric &metric, const FeatureMatrix &block,
+                     const FeatureMatrix &centroids, const std::vector<double> &norms, uint32_t *out)
+    {
+        const size_t k = centroids.rows();
+        std::vector<float> dist(block.rows() * k);
+        metric.computeCross(block, centroids, dist.data(), norms.data());
+        for (size_t i = 0; i < block.rows(); ++i)
+        {
+            const float *d = dist.data() + i * k;
+            out[i] = (uint32_t)(std::min_element(d, d + k) - d);
+        }
+    }
+
+    /*
+    Moves every centroid to the mean of its rows. An empty cluster takes over half of
+    the largest one: it copies that centroid and both are nudged apart, in opposite
+    directions on alternate dimensions so the split also separates them under cosine.
+    @param sample The rows.
+    @param assign The cluster of every row.
+    @param centroids The centroids to update.
+    */
+    void updateCentroids(const FeatureMatrix &sample, const std::vector<uint32_t> &assign,
+                         FeatureMatrix &centroids)
+    {
+        const size_t k = centroids.rows(), dim = centroids.cols();
+        std::vector<double> sums(k * dim, 0.0);
+        std::vector<size_t> counts(k, 0);
+        for (size_t s = 0; s < sample.rows(); ++s)
+        {
+            double *sum = sums.data() + assign[s] * dim;
+            const float *row = sample.row(s);
+            for (size_t d = 0; d < dim; ++d)
+                sum[d] += row[d];
+            ++counts[assign[s]];
+        }
+        for (size_t l = 0; l < k; ++l)
+        {
+            if (counts[l] == 0)
+                continue;
+            float *c = centroids.row(l);
+            for (size_t d = 0; d < dim; ++d)
+                c[d] = (float)(sums[l * dim + d] / counts[l]);
+        }
+        for (size_t l = 0; l < k; ++l)
+        {
+            if (counts[l] > 0)
+                continue;
+            size_t big = std::max_element(counts.begin(), counts.end()) - counts.begin();
+            if (counts[big] < 2)
+                break;
+            float *c = centroids.row(l), *b = centroids.row(big);
+            for (size_t d = 0; d < dim; ++d)
+            {
+                const float eps = (d % 2 == 0) ? kSplitEps : -kSplitEps;
+                c[d] = b[d] * (1.0f + eps);
+                b[d] = b[d] * (1.0f - eps);
+            }
+            counts[l] = counts[big] / 2;
+            counts[big] -= counts[l];
+        }
+    }
+} // namespace
+
+/*
+Clusters the rows of a sample with Lloyd's algorithm: assign every row to its nearest
+centroid, move every centroid to the mean of its rows, and repeat until no row moves
+or the iterations run out.
+
+- @param metric The metric rows are assigned by.
+- @param sample The rows to cluster.
+- @param k The number of clusters, 1 .. sample.rows().
+- @param iterations The maximum number of assignment passes.
+- @param threads The number of threads, 0 for one per core.
+- @return The centroids, k rows of sample.cols() floats.
+*/
+FeatureMatrix KMeans::train(const IDistanceMetric &metric, const FeatureMatrix &sample, size_t k,
+                            size_t iterations, size_t threads)
+{
+    const size_t rows = sample.rows(), dim = sample.cols();
+    FeatureMatrix centroids(k, dim);
+    for (size_t l = 0; l < k; ++l)
+        std::memcpy(centroids.row(l), sample.row(l * rows / k), dim * sizeof(float));
+
+    std::vector<uint32_t> assignment(rows, 0), previous;
+    for (size_t iter = 0; iter < iterations; ++iter)
+    {
+        assign(metric, sample, centroids, assignment.data(), threads);
+        if (assignment == previous)
+            break;
+        updateCentroids(sample, assignment, centroids);
+        previous = assignment;
+    }
+    return centroids;
+}
+
+/*
+Finds the nearest centroid of every row, one block of rows per task.
+
+- @param metric The metric rows are assigned by.
+- @param rows The rows.
+- @param centroids The centroids, as many columns as rows.
+- @param out Receives rows.rows() centroid numbers.
+- @param threads The number of threads, 0 for one per core.
+*/
+void KMeans::assign(const IDistanceMetric &metric, const FeatureMatrix &rows,
+                    const FeatureMatrix &centroids, uint32_t *out, size_t threads)
+{
+    const std::vector<double> norms = centroidNorms(centroids);
+    const size_t blocks = (rows.rows() + kBlockRows - 1) / kBlockRows;
+    ThreadUtil::parallelFor(blocks, [&](size_t b) {
+        const size_t first = b * kBlockRows, count = std::min(kBlockRows, rows.rows() - first);
+        const FeatureMatrix block = FeatureMatrix::view(rows.row(first), count, rows.cols(), rows.stride());
+        assignBlock(metric, block, centroids, norms, out + first);
+    }, threads);
+}
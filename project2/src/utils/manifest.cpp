@@ -0,0 +1,446 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  manifest.cpp
+
+  Path: project2/src/utils/manifest.cpp
+  Description: Implements the per-row manifest that makes feature generation incremental.
+*/
+
+#include "manifest.hpp"
+#include "fileUtil.hpp"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace
+{
+    const char kHeader[] = "# CBIR feature manifest v2";
+    // Read but no longer written: mtimes in std::filesystem clock ticks
+    const char kHeaderV1[] = "# CBIR feature manifest v1";
+
+    /*
+    Checks the first line of a manifest.
+    @param line The line.
+    @return true for the header of a version this code reads.
+    */
+    bool isHeader(const std::string &line)
+    {
+        return line == kHeader || line == kHeaderV1;
+    }
+
+    /*
+    Parses an unsigned decimal or hexadecimal number followed by a space.
+    @param p The position to parse at, advanced past the number and the space.
+    @param base 10 or 16.
+    @param out Receives the number.
+    @return true on success, false if there is no number or no space after it.
+    */
+    bool parseField(const char *&p, int base, uint64_t &out)
+    {
+        char *end = nullptr;
+        out = std::strtoull(p, &end, base);
+        if (end == p || *end != ' ')
+            return false;
+        p = end + 1;
+        return true;
+    }
+
+    /*
+    Parses a modification time "<sec>.<nsec>" followed by a space. A version 1
+    tick count has no fraction and is read as seconds.
+    @param p The position to parse at, advanced past the time and the space.
+    @param sec Receives the seconds.
+    @param nsec Receives the nanoseconds.
+    @return true on success, false if there is no time or no space after it.
+    */
+    bool parseTime(const char *&p, int64_t &sec, int64_t &nsec)
+    {
+        char *end = nullptr;
+        sec = std::strtoll(p, &end, 10);
+        nsec = 0;
+        if (end != p && *end == '.')
+        {
+            const char *frac = end + 1;
+            nsec = std::strtoll(frac, &end, 10);
+            if (end == frac)
+                return false;
+        }
+        if (end == p || *end != ' ')
+            return false;
+        p = end + 1;
+        return true;
+    }
+} // namespace
+
+/*
+Returns the path of the manifest that belongs to a database.
+- @param dbPath The path of the .csv or .fdb database.
+- @return dbPath + ".manifest".
+*/
+std::string Manifest::pathFor(const std::string &dbPath)
+{
+    return dbPath + ".manifest";
+}
+
+/*
+Reads the manifest of a database.
+- @param dbPath The path of the database.
+- @return 0 on success, -1 if the manifest is missing or invalid.
+*/
+int Manifest::load(const std::string &dbPath)
+{
+    entries_.clear();
+    dead_.clear();
+    deadCount_ = 0;
+    modified_ = false;
+
+    std::ifstream in(pathFor(dbPath));
+    if (!in)
+        return -1;
+
+    std::string line;
+    size_t rows = 0;
+    if (!std::getline(in, line) || !isHeader(line) || !std::getline(in, line) ||
+        std::sscanf(line.c_str(), "rows %zu", &rows) != 1)
+    {
+        printf("Manifest %s has an invalid header\n", pathFor(dbPath).c_str());
+        return -1;
+    }
+    std::string deadLine;
+    if (!std::getline(in, deadLine) || deadLine.compare(0, 4, "dead") != 0)
+    {
+        printf("Manifest %s has no dead row list\n", pathFor(dbPath).c_str());
+        return -1;
+    }
+
+    entries_.reserve(rows);
+    while (entries_.size() < rows && std::getline(in, line))
+    {
+        ManifestEntry e;
+        const char *p = line.c_str();
+        if (!parseField(p, 10, e.size) || !parseTime(p, e.mtimeSec, e.mtimeNsec) ||
+            !parseField(p, 16, e.hash))
+        {
+            printf("Manifest %s: invalid entry for row %zu\n", pathFor(dbPath).c_str(), entries_.size());
+            return -1;
+        }
+        e.path = p;
+        entries_.push_back(std::move(e));
+    }
+    if (entries_.size() != rows)
+    {
+        printf("Manifest %s has %zu of %zu rows\n", pathFor(dbPath).c_str(), entries_.size(), rows);
+        return -1;
+    }
+
+    dead_.assign(rows, 0);
+    const char *p = deadLine.c_str() + 4;
+    char *end = nullptr;
+    for (uint64_t row = std::strtoull(p, &end, 10); end != p; row = std::strtoull(p, &end, 10))
+    {
+        if (row < rows)
+            markDead(row);
+        p = end;
+    }
+    modified_ = false;
+    return 0;
+}
+
+/*
+Writes the manifest next to the database. The file is written under a temporary
+name, synced and renamed, so readers see either the old or the new manifest.
+- @param dbPath The path of the database.
+- @return 0 on success, -1 on error.
+*/
+int Manifest::save(const std::string &dbPath) const
+{
+    std::string path = pathFor(dbPath);
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+
+    fprintf(fp, "%s\nrows %zu\ndead", kHeader, entries_.size());
+    for (size_t i = 0; i < entries_.size(); ++i)
+    {
+        if (dead_[i])
+            fprintf(fp, " %zu", i);
+    }
+    fputc('\n', fp);
+    for (const auto &e : entries_)
+        fprintf(fp, "%" PRIu64 " %" PRId64 ".%09" PRId64 " %016" PRIx64 " %s\n", e.size, e.mtimeSec,
+                e.mtimeNsec, e.hash, e.path.c_str());
+
+    if (FileUtil::commitTemp(fp, tmpPath, path, !ferror(fp)) != 0)
+        return -1;
+    modified_ = false;
+    return 0;
+}
+
+/*
+Builds a manifest for a database that was written before it had one. The rows are
+assumed to match the images currently on disk, whose hashes are left unknown.
+Missing images and all but the last row of a duplicated image are marked dead.
+- @param dbFilenames The filename column of the database, one per row.
+*/
+void Manifest::bootstrap(const std::vector<std::string> &dbFilenames)
+{
+    entries_.clear();
+    dead_.assign(dbFilenames.size(), 0);
+    deadCount_ = 0;
+    modified_ = true;
+
+    std::unordered_map<std::string, size_t> lastRow;
+    for (size_t i = 0; i < dbFilenames.size(); ++i)
+    {
+        ManifestEntry e;
+        e.path = dbFilenames[i];
+        bool exists = statFile(e.path, e) == 0;
+        entries_.push_back(e);
+
+        auto it = lastRow.find(e.path);
+        if (it != lastRow.end())
+            markDead(it->second);
+        lastRow[e.path] = i;
+        if (!exists)
+            markDead(i);
+    }
+}
+
+/*
+Repairs the manifest after a run that stopped between committing the database
+and its manifest. Rows appended by that run are unknown and marked dead, so their
+images are extracted again. A database that was compacted matches the manifest
+without its dead rows.
+- @param dbRows The number of rows of the database.
+- @return 0 if the manifest now describes the database, -1 if it cannot.
+*/
+int Manifest::reconcile(size_t dbRows)
+{
+    if (dbRows > entries_.size())
+    {
+        printf("Manifest: %zu rows from an interrupted run, marked dead\n", dbRows - entries_.size());
+        while (entries_.size() < dbRows)
+        {
+            entries_.push_back(ManifestEntry());
+            dead_.push_back(0);
+            markDead(entries_.size() - 1);
+        }
+    }
+    else if (dbRows < entries_.size())
+    {
+        if (dbRows != entries_.size() - deadCount_)
+            return -1;
+        printf("Manifest: database was compacted by an interrupted run\n");
+        compact();
+    }
+    return 0;
+}
+
+/*
+Compares the images in the input directory with the manifest. Unchanged images are
+those with the same size and mtime, or with the same size and content hash (the
+mtime is refreshed then). The rows of changed and deleted images are marked dead.
+
+- @param imagePaths The images currently in the input directory.
+- @param toExtract Receives the new and changed images, in input order.
+- @return The number of rows marked dead.
+*/
+size_t Manifest::update(const std::vector<std::string> &imagePaths, std::vector<std::string> &toExtract)
+{
+    size_t deadBefore = deadCount_;
+    std::unordered_map<std::string, size_t> liveRow;
+    liveRow.reserve(entries_.size());
+    for (size_t i = 0; i < entries_.size(); ++i)
+    {
+        if (!dead_[i])
+            liveRow[entries_[i].path] = i;
+    }
+
+    std::vector<char> seen(entries_.size(), 0);
+    for (const auto &path : imagePaths)
+    {
+        auto it = liveRow.find(path);
+        if (it == liveRow.end())
+        {
+            toExtract.push_back(path);
+            continue;
+        }
+
+        ManifestEntry &e = entries_[it->second];
+        ManifestEntry now;
+        if (statFile(path, now) != 0)
+            continue; // unreadable now, handled like a deleted image
+        seen[it->second] = 1;
+        if (now.size == e.size && now.mtimeSec == e.mtimeSec && now.mtimeNsec == e.mtimeNsec)
+            continue;
+        if (now.size == e.size && e.hash != 0 && hashFile(path) == e.hash)
+        {
+            // touched but not modified
+            e.mtimeSec = now.mtimeSec;
+            e.mtimeNsec = now.mtimeNsec;
+            modified_ = true;
+            continue;
+        }
+        markDead(it->second);
+        toExtract.push_back(path);
+    }
+
+    // Rows whose image is no longer in the directory
+    for (size_t i = 0; i < entries_.size(); ++i)
+    {
+        if (!dead_[i] && !seen[i])
+            markDead(i);
+    }
+    return deadCount_ - deadBefore;
+}
+
+/*
+Records the row appended to the database for an image.
+- @param path The image path.
+- @return 0 on success, -1 if the image can no longer be read.
+*/
+int Manifest::append(const std::string &path)
+{
+    ManifestEntry e;
+    e.path = path;
+    if (statFile(path, e) != 0)
+        return -1;
+    e.hash = hashFile(path);
+    entries_.push_back(std::move(e));
+    dead_.push_back(0);
+    modified_ = true;
+    return 0;
+}
+
+/*
+Drops the dead rows, renumbering the others in order.
+*/
+void Manifest::compact()
+{
+    size_t out = 0;
+    for (size_t i = 0; i < entries_.size(); ++i)
+    {
+        if (dead_[i])
+            continue;
+        if (out != i)
+            entries_[out] = std::move(entries_[i]);
+        ++out;
+    }
+    entries_.resize(out);
+    dead_.assign(out, 0);
+    deadCount_ = 0;
+    modified_ = true;
+}
+
+/*
+Marks a row dead if it is not already.
+- @param row The row to mark.
+*/
+void Manifest::markDead(size_t row)
+{
+    if (!dead_[row])
+    {
+        dead_[row] = 1;
+        ++deadCount_;
+        modified_ = true;
+    }
+}
+
+/*
+Flags the rows of a database that readers must skip: tombstones, and rows appended
+by a run that has not committed the manifest yet. Only the manifest header is read.
+
+- @param dbPath The path of the database.
+- @param dbRows The number of rows of the database.
+- @param dead Receives one flag per row, or stays empty if no row is skipped.
+- @return 0 on success, -1 if the manifest header is invalid.
+*/
+int Manifest::readDeadRows(const std::string &dbPath, size_t dbRows, std::vector<char> &dead)
+{
+    dead.clear();
+    std::ifstream in(pathFor(dbPath));
+    if (!in)
+        return 0; // no manifest, every row is live
+
+    std::string header, rowsLine, deadLine;
+    size_t rows = 0;
+    if (!std::getline(in, header) || !isHeader(header) || !std::getline(in, rowsLine) ||
+        std::sscanf(rowsLine.c_str(), "rows %zu", &rows) != 1 || !std::getline(in, deadLine) ||
+        deadLine.compare(0, 4, "dead") != 0)
+    {
+        printf("Warning: manifest of %s is invalid, no rows skipped\n", dbPath.c_str());
+        return -1;
+    }
+    if (dbRows < rows)
+    {
+        // compacted by a run that has not written the new manifest
+        printf("Info: manifest of %s is older than the DB, no rows skipped\n", dbPath.c_str());
+        return 0;
+    }
+
+    dead.assign(dbRows, 0);
+    for (size_t i = rows; i < dbRows; ++i)
+        dead[i] = 1; // appended by a run that has not written the new manifest
+    const char *p = deadLine.c_str() + 4;
+    char *end = nullptr;
+    for (uint64_t row = std::strtoull(p, &end, 10); end != p; row = std::strtoull(p, &end, 10))
+    {
+        if (row < dbRows)
+            dead[row] = 1;
+        p = end;
+    }
+    return 0;
+}
+
+/*
+Reads the size and modification time of a file with stat(), which follows symlinks
+to the image they name.
+- @param path The file to inspect.
+- @param out Receives the size and the mtime in seconds and nanoseconds.
+- @return 0 on success, -1 if the file does not exist.
+*/
+int Manifest::statFile(const std::string &path, ManifestEntry &out)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+    out.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    out.mtimeSec = (int64_t)st.st_mtimespec.tv_sec;
+    out.mtimeNsec = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+    out.mtimeSec = (int64_t)st.st_mtim.tv_sec;
+    out.mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+#endif
+    return 0;
+}
+
+/*
+Hashes the contents of a file with 64-bit FNV-1a.
+- @param path The file to hash.
+- @return The hash, never 0 (which marks an unknown hash); 0 if the file cannot be read.
+*/
+uint64_t Manifest::hashFile(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+
+    uint64_t h = 14695981039346656037ULL;
+    std::vector<unsigned char> buf(1 << 16);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), fp)) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            h ^= buf[i];
+            h *= 1099511628211ULL;
+        }
+    }
+    fclose(fp);
+    return h != 0 ? h : 1;
+}
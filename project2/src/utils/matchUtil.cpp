@@ -8,6 +8,7 @@
 
 #include "matchUtil.hpp"
 #include "matchResult.hpp"
+#include "threadUtil.hpp"
 #include <algorithm>
 #include <vector>
 
@@ -42,3 +43,134 @@ std::vector<MatchResult> MatchUtil::getTopNMatches(const std::vector<MatchResult
     }
     return topMatches;
 }
+
+
+/*
+Adds a pair that beats the worst kept one (or fills a free slot), evicting the
+worst pair when the selector is full.
+- @param e: The pair to add.
+*/
+void TopKSelector::insert(const Entry &e)
+{
+    if (k_ <= kSmallK)
+    {
+        // shift the worse entries up by one; the last one drops out when full
+        if (entries_.size() < k_)
+            entries_.push_back(e);
+        size_t i = entries_.size() - 1;
+        for (; i > 0 && before(e, entries_[i - 1]); --i)
+            entries_[i] = entries_[i - 1];
+        entries_[i] = e;
+        return;
+    }
+    if (entries_.size() == k_)
+    {
+        std::pop_heap(entries_.begin(), entries_.end(), before);
+        entries_.back() = e;
+    }
+    else
+    {
+        entries_.push_back(e);
+    }
+    std::push_heap(entries_.begin(), entries_.end(), before);
+}
+
+/*
+Offers every pair another selector kept. The K best pairs of a union are among the
+K best of each part, so selectors of disjoint parts merge into the selector of the
+whole.
+- @param other: The selector to merge in.
+*/
+void TopKSelector::merge(const TopKSelector &other)
+{
+    for (const Entry &e : other.entries_)
+        push(e.distance, e.id);
+}
+
+/*
+Returns the kept pairs, nearest first.
+- @return: The pairs sorted by distance, ties by ID.
+*/
+std::vector<TopKSelector::Entry> TopKSelector::sorted() const
+{
+    std::vector<Entry> out(entries_);
+    if (k_ > kSmallK)
+        std::sort_heap(out.begin(), out.end(), before);
+    return out;
+}
+
+/*
+Appends the kept pairs, nearest first, as match results. Filenames are only looked
+up here, for the K winners.
+- @param dict The dictionary the IDs were interned in.
+- @param out Receives one result per kept pair.
+*/
+void TopKSelector::appendResults(const ImageDictionary &dict, std::vector<MatchResult> &out) const
+{
+    std::vector<Entry> winners = sorted();
+    out.reserve(out.size() + winners.size());
+    for (const Entry &e : winners)
+    {
+        MatchResult res;
+        res.filename = std::string(dict.name(e.id));
+        res.distance = e.distance;
+        out.push_back(res);
+    }
+}
+
+/*
+Streams the covered images of an ID range into a selector, skipping 64 unscored
+images at a time.
+- @param first: The first ID.
+- @param last: One past the last ID.
+- @param best: Receives the (score, ID) pairs.
+*/
+void ScoreBoard::select(uint32_t first, uint32_t last, TopKSelector &best) const
+{
+    for (uint32_t id = first; id < last; ++id)
+    {
+        if ((id & 63) == 0 && covered_[id >> 6] == 0 && id + 64 <= last)
+        {
+            id += 63;
+            continue;
+        }
+        if (isCovered(id))
+            best.push(score_[id], id);
+    }
+}
+
+/*
+Appends the N covered images with the smallest scores to out, nearest first. Ties
+are broken by image ID, so the order does not depend on hash map iteration or on
+the number of threads.
+- @param dict: The dictionary the IDs come from.
+- @param N: The number of matches to return.
+- @param out: Receives the matches.
+- @param threads: The maximum number of threads to select on.
+*/
+void ScoreBoard::topN(const ImageDictionary &dict, int N, std::vector<MatchResult> &out, size_t threads) const
+{
+    const size_t k = (size_t)std::max(N, 0);
+    const uint32_t numImages = (uint32_t)score_.size();
+    // a range per thread, but not so small that the merge dominates
+    const size_t kMinRange = 1 << 16;
+    size_t parts = std::max<size_t>(1, std::min<size_t>(threads, numImages / kMinRange));
+
+    TopKSelector best(k);
+    if (parts == 1)
+    {
+        select(0, numImages, best);
+    }
+    else
+    {
+        std::vector<TopKSelector> partial(parts, TopKSelector(k));
+        ThreadUtil::parallelFor(parts, [&](size_t p)
+                                { select((uint32_t)(p * numImages / parts), (uint32_t)((p + 1) * numImages / parts),
+                                         partial[p]); },
+                                parts);
+        for (const TopKSelector &part : partial)
+            best.merge(part);
+    }
+
+    best.appendResults(dict, out);
+}
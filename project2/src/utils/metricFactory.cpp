@@ -19,6 +19,7 @@ metric to create:
 - SSD, it creates and returns a shared pointer to a SumSquaredDistance instance.
 - HIST_INTERSECTION, it creates and returns a shared pointer to a HistogramIntersection instance.
 - COSINE, it creates and returns a shared pointer to a CosDistance instance.
+- HELLINGER, it creates and returns a shared pointer to a HellingerDistance instance.
 - UNKNOWN_METRIC or any unrecognized type, it returns nullptr to indicate that no valid
     metric could be created.
 */
@@ -32,6 +33,8 @@ std::shared_ptr<IDistanceMetric> MetricFactory::create(MetricType type)
         return std::make_shared<HistogramIntersection>(type);
     case COSINE:
         return std::make_shared<CosDistance>(type);
+    case HELLINGER:
+        return std::make_shared<HellingerDistance>(type);
     default:
         return nullptr;
     }
@@ -44,13 +47,15 @@ MetricType enum value. It compares the input string to known metric type strings
 - "ssd" returns SSD
 - "hist_intersection" returns HIST_INTERSECTION
 - "cosine" returns COSINE
+- "hellinger" returns HELLINGER
 */
 MetricType MetricFactory::stringToMetricType(const char *typeStr)
 {
     static const std::unordered_map<std::string, MetricType> typeMap = {
         {"ssd", SSD},
         {"hist_ix", HIST_INTERSECTION},
-        {"cosine", COSINE}};
+        {"cosine", COSINE},
+        {"hellinger", HELLINGER}};
 
     auto it = typeMap.find(typeStr);
     return (it != typeMap.end()) ? it->second : UNKNOWN_METRIC;
@@ -64,6 +69,7 @@ metric type:
 - SSD returns "ssd"
 - HIST_INTERSECTION returns "hist_intersection"
 - COSINE returns "cosine"
+- HELLINGER returns "hellinger"
 If the type is unrecognized, it returns "Unknown".
 */
 std::string MetricFactory::metricTypeToString(MetricType type)
@@ -71,8 +77,20 @@ std::string MetricFactory::metricTypeToString(MetricType type)
     static const std::unordered_map<MetricType, std::string> typeMap = {
         {SSD, "ssd"},
         {HIST_INTERSECTION, "hist_ix"},
-        {COSINE, "cosine"}};
+        {COSINE, "cosine"},
+        {HELLINGER, "hellinger"}};
 
     auto it = typeMap.find(type);
     return (it != typeMap.end()) ? it->second : "Unknown";
-}
\ No newline at end of file
+}
+
+/*
+MetricFactory::transformFor(MetricType type)
+This static method returns the transform a feature DB must store its features with for the
+metric to apply: HELLINGER works on square-rooted histograms, every other metric on the
+features as they are stored.
+*/
+FeatureTransform MetricFactory::transformFor(MetricType type)
+{
+    return type == HELLINGER ? FeatureTransform::SQRT : FeatureTransform::NONE;
+}
@@ -0,0 +1,54 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  pageUtil.cpp
+
+  Path: project2/src/utils/pageUtil.cpp
+  Description: Controls which pages of a memory-mapped file are resident.
+*/
+
+#include "pageUtil.hpp"
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+Returns the size of a virtual memory page.
+- @return The page size in bytes.
+*/
+size_t PageUtil::pageSize()
+{
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/*
+Asks the kernel to read a range of a mapping ahead of its use. The range is widened
+to whole pages.
+- @param addr The start of the range.
+- @param bytes The length of the range.
+*/
+void PageUtil::willNeed(const void *addr, size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    uintptr_t page = pageSize();
+    uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + bytes + page - 1) & ~(page - 1);
+    madvise((void *)begin, end - begin, MADV_WILLNEED);
+}
+
+/*
+Drops the pages of a range of a read-only file mapping from the process. Only pages
+that lie completely inside the range are dropped, so rows sharing a page with the
+range stay resident.
+- @param addr The start of the range.
+- @param bytes The length of the range.
+*/
+void PageUtil::release(const void *addr, size_t bytes)
+{
+    uintptr_t page = pageSize();
+    uintptr_t begin = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + bytes) & ~(page - 1);
+    if (end > begin)
+        madvise((void *)begin, end - begin, MADV_DONTNEED);
+}
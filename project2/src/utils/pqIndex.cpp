@@ -0,0 +1,410 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  pqIndex.cpp
+
+  Path: project2/src/utils/pqIndex.cpp
+  Description: Trains, saves, memory-maps and searches product quantization indexes.
+*/
+
+#include "pqIndex.hpp"
+#include "IDistanceMetric.hpp"
+#include "distanceKernels.hpp"
+#include "featureMatrix.hpp"
+#include "fileUtil.hpp"
+#include "kMeans.hpp"
+#include "matchUtil.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'P', 'Q', '\0', '\0'};
+    const uint32_t kVersion = 1;
+    const uint64_t kPageSize = 4096;
+    const size_t kBlock = DistanceKernels::kAdcBlock;
+    const size_t kCodes = DistanceKernels::kAdcCodes;
+    // Rows the codebooks are trained on at most, 64 per centroid
+    const size_t kSampleRows = 64 * kCodes;
+    // Lloyd iterations per codebook at most
+    const size_t kIterations = 20;
+    // Default features per subspace when the number of subspaces is not given
+    const size_t kDefaultSubDims = 8;
+    // Rows encoded per task, a whole number of code blocks
+    const size_t kEncodeRows = 8 * kBlock;
+
+    /*
+    Scales a row to unit length, for the codebooks and queries of cosine; a zero row
+    is left as it is.
+    @param row The features.
+    @param n The number of features.
+    */
+    void normalize(float *row, size_t n)
+    {
+        double sq = 0.0;
+        for (size_t i = 0; i < n; ++i)
+            sq += (double)row[i] * row[i];
+        if (sq <= 0.0)
+            return;
+        const float inv = (float)(1.0 / std::sqrt(sq));
+        for (size_t i = 0; i < n; ++i)
+            row[i] *= inv;
+    }
+
+    /*
+    Copies columns [first, first + n) of every row of a matrix.
+    @param rows The matrix.
+    @param first The first column.
+    @param n The number of columns.
+    @return A matrix of rows.rows() rows of n features.
+    */
+    FeatureMatrix columns(const FeatureMatrix &rows, size_t first, size_t n)
+    {
+        FeatureMatrix sub(rows.rows(), n);
+        for (size_t i = 0; i < rows.rows(); ++i)
+            std::memcpy(sub.row(i), rows.row(i) + first, n * sizeof(float));
+        return sub;
+    }
+} // namespace
+
+/*
+Unmaps the index file if it is still open.
+*/
+PqIndex::~PqIndex()
+{
+    close();
+}
+
+/*
+Drops the codebooks and codes, mapped or built.
+*/
+void PqIndex::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    codebooksBuf_.clear();
+    rowCodesBuf_.clear();
+    codebooks_ = nullptr;
+    rowCodes_ = nullptr;
+    rows_ = dim_ = 0;
+    fingerprint_ = 0;
+    subspaces_ = 0;
+    codes_ = 0;
+    codeStride_ = 0;
+}
+
+/*
+Returns the first feature of a subspace; the first dim % subspaces subspaces hold
+one feature more than the others.
+- @param j The subspace, up to subspaces_ for the end of the last one.
+- @return The feature index.
+*/
+size_t PqIndex::subStart(size_t j) const
+{
+    return j * (dim_ / subspaces_) + std::min(j, dim_ % subspaces_);
+}
+
+/*
+Returns the number of code blocks of kAdcBlock rows.
+- @return The blocks, the last one possibly partial.
+*/
+size_t PqIndex::blocks() const
+{
+    return (rows_ + kBlock - 1) / kBlock;
+}
+
+/*
+Trains one codebook per subspace on a sample of the live rows, spread evenly over
+the table, and encodes every row. The codebooks are trained in parallel, one
+subspace per task, and the rows are encoded in parallel, one run of code blocks per
+task; the result is the same on every run and thread count.
+
+- @param table The table to index.
+- @param metric ssd, cosine, hist_ix or hellinger.
+- @param params subspaces is used (0 for one per 8 features).
+- @param threads The number of threads, 0 for one per core.
+- @return 0 on success, -1 on error.
+*/
+int PqIndex::build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                   size_t threads)
+{
+    if (!MetricFactory::create(metric))
+    {
+        printf("PQ index needs a known metric\n");
+        return -1;
+    }
+    if (table.rows() == 0 || table.dim() == 0 || table.rows() >= std::numeric_limits<uint32_t>::max())
+    {
+        printf("PQ index cannot index %zu rows of %s\n", table.rows(), table.path().c_str());
+        return -1;
+    }
+    size_t subspaces = params.subspaces > 0 ? params.subspaces : (table.dim() + kDefaultSubDims - 1) / kDefaultSubDims;
+    if (subspaces > table.dim())
+    {
+        printf("PQ index cannot split %zu features into %zu subspaces\n", table.dim(), subspaces);
+        return -1;
+    }
+    // Codebooks are trained for squared differences; cosine on unit rows is half of it
+    auto ssd = MetricFactory::create(SSD);
+
+    close();
+    metric_ = metric;
+    rows_ = table.rows();
+    dim_ = table.dim();
+    fingerprint_ = table.fingerprint();
+    subspaces_ = subspaces;
+
+    std::vector<size_t> live;
+    for (size_t i = 0; i < rows_; ++i)
+        if (!table.isDead(i))
+            live.push_back(i);
+    if (live.empty())
+    {
+        live.resize(rows_);
+        std::iota(live.begin(), live.end(), 0);
+    }
+    const size_t sampleRows = std::min(live.size(), kSampleRows);
+    FeatureMatrix sample(sampleRows, dim_);
+    for (size_t s = 0; s < sampleRows; ++s)
+    {
+        table.readRow(live[s * live.size() / sampleRows], sample.row(s));
+        if (metric_ == COSINE)
+            normalize(sample.row(s), dim_);
+    }
+
+    codes_ = std::min(kCodes, sampleRows);
+    size_t widest = 0;
+    for (size_t j = 0; j < subspaces_; ++j)
+        widest = std::max(widest, subStart(j + 1) - subStart(j));
+    codeStride_ = FeatureMatrix::strideFor(widest);
+    codebooksBuf_.assign(subspaces_ * kCodes * codeStride_, 0.0f);
+    ThreadUtil::parallelFor(subspaces_, [&](size_t j) {
+        const size_t first = subStart(j), n = subStart(j + 1) - first;
+        const FeatureMatrix centroids =
+            KMeans::train(*ssd, columns(sample, first, n), codes_, kIterations, 1);
+        for (size_t c = 0; c < codes_; ++c)
+            std::memcpy(&codebooksBuf_[(j * kCodes + c) * codeStride_], centroids.row(c), n * sizeof(float));
+    }, threads);
+    codebooks_ = codebooksBuf_.data();
+
+    rowCodesBuf_.assign(blocks() * subspaces_ * kBlock, 0);
+    ThreadUtil::parallelFor((rows_ + kEncodeRows - 1) / kEncodeRows, [&](size_t t) {
+        const size_t firstRow = t * kEncodeRows, count = std::min(kEncodeRows, rows_ - firstRow);
+        FeatureMatrix rows(count, dim_);
+        for (size_t i = 0; i < count; ++i)
+        {
+            table.readRow(firstRow + i, rows.row(i));
+            if (metric_ == COSINE)
+                normalize(rows.row(i), dim_);
+        }
+        std::vector<uint32_t> nearest(count);
+        for (size_t j = 0; j < subspaces_; ++j)
+        {
+            const size_t first = subStart(j), n = subStart(j + 1) - first;
+            const FeatureMatrix codebook =
+                FeatureMatrix::view(codebooks_ + j * kCodes * codeStride_, codes_, n, codeStride_);
+            KMeans::assign(*ssd, columns(rows, first, n), codebook, nearest.data(), 1);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const size_t row = firstRow + i;
+                rowCodesBuf_[(row / kBlock) * subspaces_ * kBlock + j * kBlock + row % kBlock] =
+                    (uint8_t)nearest[i];
+            }
+        }
+    }, threads);
+    rowCodes_ = rowCodesBuf_.data();
+    return 0;
+}
+
+/*
+Writes the index to an index file. The file appears under its final name only once
+it is complete.
+
+- @param path The path of the .pq file to create (replaced if it exists).
+- @return 0 on success, -1 on error.
+*/
+int PqIndex::save(const std::string &path) const
+{
+    if (!rowCodes_)
+    {
+        printf("PQ index is empty, nothing to save\n");
+        return -1;
+    }
+    PqHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(PqHeader);
+    h.metric = metric_;
+    h.dim = (uint32_t)dim_;
+    h.subspaces = (uint32_t)subspaces_;
+    h.codes = (uint32_t)codes_;
+    h.rows = rows_;
+    h.fingerprint = fingerprint_;
+    h.codeStride = codeStride_;
+    h.codebooksOffset = FileUtil::alignUp(sizeof(PqHeader), FeatureMatrix::kAlignBytes);
+    const uint64_t codebookBytes = subspaces_ * kCodes * codeStride_ * sizeof(float);
+    h.codesOffset = FileUtil::alignUp(h.codebooksOffset + codebookBytes, kPageSize);
+    const uint64_t codeBytes = blocks() * subspaces_ * kBlock;
+    h.fileSize = h.codesOffset + codeBytes;
+
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+    bool ok = FileUtil::writeAll(fp, &h, sizeof(h)) &&
+              FileUtil::writePadding(fp, sizeof(h), h.codebooksOffset) &&
+              FileUtil::writeAll(fp, codebooks_, codebookBytes) &&
+              FileUtil::writePadding(fp, h.codebooksOffset + codebookBytes, h.codesOffset) &&
+              FileUtil::writeAll(fp, rowCodes_, codeBytes);
+    return FileUtil::commitTemp(fp, tmpPath, path, ok);
+}
+
+/*
+Maps an index file into memory and validates its header.
+
+- @param path The path to the .pq file.
+- @return 0 on success, -1 on error.
+*/
+int PqIndex::load(const std::string &path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(PqHeader), "PQ index", mapSize_);
+    if (!map_)
+        return -1;
+
+    const PqHeader *h = static_cast<const PqHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(PqHeader))
+    {
+        printf("%s is not a version %u PQ index\n", path.c_str(), kVersion);
+        close();
+        return -1;
+    }
+    const uint64_t blockCount = (h->rows + kBlock - 1) / kBlock;
+    if (h->fileSize != mapSize_ || !MetricFactory::create(static_cast<MetricType>(h->metric)) ||
+        h->rows == 0 || h->subspaces == 0 || h->subspaces > h->dim || h->codes == 0 ||
+        h->codes > kCodes || h->codeStride < (h->dim + h->subspaces - 1) / h->subspaces ||
+        h->codebooksOffset % sizeof(float) != 0 ||
+        h->codebooksOffset + h->subspaces * kCodes * h->codeStride * sizeof(float) > h->codesOffset ||
+        h->codesOffset + blockCount * h->subspaces * kBlock > mapSize_)
+    {
+        printf("PQ index %s is truncated or corrupt\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    metric_ = static_cast<MetricType>(h->metric);
+    rows_ = h->rows;
+    dim_ = h->dim;
+    fingerprint_ = h->fingerprint;
+    subspaces_ = h->subspaces;
+    codes_ = h->codes;
+    codeStride_ = h->codeStride;
+    codebooks_ = reinterpret_cast<const float *>(base + h->codebooksOffset);
+    rowCodes_ = reinterpret_cast<const uint8_t *>(base + h->codesOffset);
+
+    printf("Opened %s (pq, %llu rows, %s, %zu subspaces of %zu codes, %zu bytes per row)\n", path.c_str(),
+           (unsigned long long)rows_, MetricFactory::metricTypeToString(metric_).c_str(), subspaces_,
+           codes_, subspaces_);
+    return 0;
+}
+
+/*
+Ranks every row by its asymmetric distance to the query: fills one table per
+subspace with the partial distances from the query to the centroids and sums the
+entries of each row's codes, a block of rows at a time. With rerank, the rerank best
+rows (at least k) are then re-scored exactly on the table's rows.
+
+- @param table The table the index was built from.
+- @param query The query, table.dim() features.
+- @param k The number of rows to return.
+- @param params rerank is used.
+- @param out Receives up to k rows, nearest first: exact distances with rerank,
+    estimated ones without.
+- @param stats Receives the cost if not nullptr; visited counts the code blocks.
+- @return 0 on success, -1 on error.
+*/
+int PqIndex::search(const FeatureTable &table, const float *query, size_t k, const IndexParams &params,
+                    std::vector<IndexHit> &out, IndexStats *stats) const
+{
+    out.clear();
+    if (!checkShape(table, "PQ", rowCodes_ != nullptr))
+        return -1;
+    if (k == 0)
+        return 0;
+
+    // The distance is scale * (sum of the table entries) + shift
+    const DistanceKernelSet &kernels = DistanceKernels::active();
+    std::vector<float> q(query, query + dim_);
+    float scale = 1.0f, shift = 0.0f;
+    if (metric_ == COSINE)
+    {
+        normalize(q.data(), dim_);
+        scale = 0.5f;
+    }
+    else if (metric_ == HIST_INTERSECTION || metric_ == HELLINGER)
+    {
+        shift = 1.0f;
+    }
+    std::vector<float> lut(subspaces_ * kCodes, 0.0f);
+    for (size_t j = 0; j < subspaces_; ++j)
+    {
+        const size_t first = subStart(j), n = subStart(j + 1) - first;
+        const float *qj = q.data() + first;
+        for (size_t c = 0; c < codes_; ++c)
+        {
+            const float *centroid = codebooks_ + (j * kCodes + c) * codeStride_;
+            float term;
+            if (metric_ == HIST_INTERSECTION)
+                term = -kernels.minSum(qj, centroid, n);
+            else if (metric_ == HELLINGER)
+                term = -(float)kernels.dot(qj, centroid, n);
+            else
+                term = kernels.ssd(qj, centroid, n);
+            lut[j * kCodes + c] = term;
+        }
+    }
+
+    const size_t candidates = std::max(k, params.rerank);
+    TopKSelector best(candidates);
+    float sums[kBlock];
+    for (size_t b = 0; b < blocks(); ++b)
+    {
+        kernels.adcScan(lut.data(), rowCodes_ + b * subspaces_ * kBlock, subspaces_, sums);
+        const size_t first = b * kBlock, count = std::min(kBlock, rows_ - first);
+        for (size_t r = 0; r < count; ++r)
+            if (!table.isDead(first + r))
+                best.push(scale * sums[r] + shift, (uint32_t)(first + r));
+    }
+    std::vector<TopKSelector::Entry> ranked = best.sorted();
+    if (stats)
+    {
+        stats->distances += rows_;
+        stats->visited += blocks();
+    }
+
+    if (params.rerank > 0)
+    {
+        auto metric = MetricFactory::create(metric_);
+        const std::vector<uint8_t> encoded = encodeQuery(table, query);
+        TopKSelector exact(k);
+        for (const TopKSelector::Entry &e : ranked)
+            exact.push(metric->computeEncoded(table.dataType(), encoded.data(), table.rawRow(e.id), dim_,
+                                              table.quantParams()),
+                       e.id);
+        if (stats)
+            stats->distances += ranked.size();
+        ranked = exact.sorted();
+    }
+    for (size_t i = 0; i < ranked.size() && i < k; ++i)
+        out.push_back({ranked[i].id, ranked[i].distance});
+    return 0;
+}
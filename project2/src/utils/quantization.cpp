@@ -0,0 +1,328 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  quantization.cpp
+
+  Path: project2/src/utils/quantization.cpp
+  Description: Implements uint8 / fp16 encoding of feature vectors.
+*/
+
+#include "quantization.hpp"
+#include <algorithm>
+#include <cmath>
+
+/*
+Returns the number of bytes used to store one feature.
+- @param type The storage type.
+- @return 4 for F32, 2 for F16, 1 for U8.
+*/
+size_t Quantization::elementSize(FeatureDataType type)
+{
+    switch (type)
+    {
+    case FeatureDataType::U8:
+        return 1;
+    case FeatureDataType::F16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+/*
+Returns the padded row length in elements for dim features, so every row of a
+database occupies a whole number of 64-byte cache lines.
+- @param type The storage type.
+- @param dim The number of features per row.
+- @return The row stride in elements.
+*/
+size_t Quantization::strideFor(FeatureDataType type, size_t dim)
+{
+    size_t perLine = 64 / elementSize(type);
+    return (dim + perLine - 1) / perLine * perLine;
+}
+
+/*
+Fits the U8 parameters to the range of a matrix: the smallest value maps to code 0
+and the largest to code 255. Row padding is not included.
+- @param data The first row of the values to be quantized.
+- @param rows The number of rows.
+- @param cols The number of values per row.
+- @param stride The distance between rows in floats.
+- @return The scale and offset of the mapping.
+*/
+QuantParams Quantization::fitU8(const float *data, size_t rows, size_t cols, size_t stride)
+{
+    QuantParams qp;
+    if (rows == 0 || cols == 0)
+        return qp;
+    float lo = data[0], hi = data[0];
+    for (size_t r = 0; r < rows; ++r)
+    {
+        auto mm = std::minmax_element(data + r * stride, data + r * stride + cols);
+        lo = std::min(lo, *mm.first);
+        hi = std::max(hi, *mm.second);
+    }
+    qp.offset = lo;
+    qp.scale = hi > lo ? (hi - lo) / 255.0f : 1.0f;
+    return qp;
+}
+
+/*
+Encodes n values in the given storage type. U8 codes are rounded to the nearest
+step and clamped to 0..255.
+- @param type The storage type.
+- @param qp The U8 scale/offset (ignored for other types).
+- @param values The values to encode.
+- @param n The number of values.
+- @param out Destination with room for n elements of the storage type.
+*/
+void Quantization::encode(FeatureDataType type, const QuantParams &qp,
+                          const float *values, size_t n, void *out)
+{
+    switch (type)
+    {
+    case FeatureDataType::U8:
+    {
+        uint8_t *dst = static_cast<uint8_t *>(out);
+        float inv = 1.0f / qp.scale;
+        for (size_t i = 0; i < n; ++i)
+        {
+            float q = std::nearbyint((values[i] - qp.offset) * inv);
+            dst[i] = (uint8_t)std::min(255.0f, std::max(0.0f, q));
+        }
+        break;
+    }
+    case FeatureDataType::F16:
+    {
+        uint16_t *dst = static_cast<uint16_t *>(out);
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = floatToHalf(values[i]);
+        break;
+    }
+    default:
+        std::memcpy(out, values, n * sizeof(float));
+        break;
+    }
+}
+
+/*
+Encodes a feature vector into a new byte vector.
+- @param type The storage type.
+- @param qp The U8 scale/offset (ignored for other types).
+- @param values The values to encode.
+- @return The encoded bytes.
+*/
+std::vector<uint8_t> Quantization::encode(FeatureDataType type, const QuantParams &qp,
+                                          const std::vector<float> &values)
+{
+    std::vector<uint8_t> out(values.size() * elementSize(type));
+    encode(type, qp, values.data(), values.size(), out.data());
+    return out;
+}
+
+/*
+Decodes n stored elements back to floats.
+- @param type The storage type.
+- @param qp The U8 scale/offset (ignored for other types).
+- @param in The encoded elements.
+- @param n The number of elements.
+- @param out Destination for n floats.
+*/
+void Quantization::decode(FeatureDataType type, const QuantParams &qp,
+                          const void *in, size_t n, float *out)
+{
+    switch (type)
+    {
+    case FeatureDataType::U8:
+    {
+        const uint8_t *src = static_cast<const uint8_t *>(in);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = qp.offset + qp.scale * src[i];
+        break;
+    }
+    case FeatureDataType::F16:
+    {
+        const uint16_t *src = static_cast<const uint16_t *>(in);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = halfToFloat(src[i]);
+        break;
+    }
+    default:
+        std::memcpy(out, in, n * sizeof(float));
+        break;
+    }
+}
+
+/*
+Computes the L2 norm of encoded values as they decode, in double precision. The
+norms stored in feature DBs come from here, so cosine distances can divide by them
+instead of summing every row again.
+- @param type The storage type.
+- @param qp The U8 scale/offset (ignored for other types).
+- @param in The encoded elements.
+- @param n The number of elements.
+- @return sqrt of the sum of the squared decoded values.
+*/
+double Quantization::norm(FeatureDataType type, const QuantParams &qp, const void *in, size_t n)
+{
+    double sum = 0.0;
+    switch (type)
+    {
+    case FeatureDataType::U8:
+    {
+        const uint8_t *src = static_cast<const uint8_t *>(in);
+        for (size_t i = 0; i < n; ++i)
+        {
+            double v = (double)qp.offset + (double)qp.scale * src[i];
+            sum += v * v;
+        }
+        break;
+    }
+    case FeatureDataType::F16:
+    {
+        const uint16_t *src = static_cast<const uint16_t *>(in);
+        for (size_t i = 0; i < n; ++i)
+        {
+            double v = halfToFloat(src[i]);
+            sum += v * v;
+        }
+        break;
+    }
+    default:
+    {
+        const float *src = static_cast<const float *>(in);
+        for (size_t i = 0; i < n; ++i)
+            sum += (double)src[i] * src[i];
+        break;
+    }
+    }
+    return std::sqrt(sum);
+}
+
+/*
+Converts a float to IEEE half precision, rounding to nearest even. Values beyond
+the half range become infinity; tiny values become subnormals or zero.
+- @param v The value to convert.
+- @return The half precision bits.
+*/
+uint16_t Quantization::floatToHalf(float v)
+{
+#if defined(__ARM_FP16_FORMAT_IEEE)
+    __fp16 h = (__fp16)v;
+    uint16_t bits;
+    std::memcpy(&bits, &h, sizeof(bits));
+    return bits;
+#else
+    uint32_t f;
+    std::memcpy(&f, &v, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t exp = (f >> 23) & 0xff;
+    uint32_t mant = f & 0x7fffff;
+
+    if (exp == 0xff) // inf / nan
+        return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+
+    int e = (int)exp - 127 + 15;
+    if (e >= 0x1f) // overflow
+        return (uint16_t)(sign | 0x7c00);
+    if (e <= 0) // subnormal half or zero
+    {
+        if (e < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000; // implicit leading one
+        uint32_t shift = (uint32_t)(14 - e);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1)))
+            ++half;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        ++half; // may carry into the exponent, which is still correct
+    return (uint16_t)(sign | half);
+#endif
+}
+
+/*
+Converts "f32", "u8" or "f16" to the storage type.
+- @param s The string to convert.
+- @param ok Optional; set to false if s is not a known type.
+- @return The storage type, F32 if s is unknown.
+*/
+FeatureDataType Quantization::stringToDataType(const char *s, bool *ok)
+{
+    std::string str = s ? s : "";
+    if (ok)
+        *ok = true;
+    if (str == "u8")
+        return FeatureDataType::U8;
+    if (str == "f16")
+        return FeatureDataType::F16;
+    if (str != "f32" && ok)
+        *ok = false;
+    return FeatureDataType::F32;
+}
+
+/*
+Converts a storage type to "f32", "u8" or "f16".
+- @param type The storage type.
+- @return Its string form.
+*/
+std::string Quantization::dataTypeToString(FeatureDataType type)
+{
+    switch (type)
+    {
+    case FeatureDataType::U8:
+        return "u8";
+    case FeatureDataType::F16:
+        return "f16";
+    default:
+        return "f32";
+    }
+}
+
+/*
+Applies a storage transform to feature values in place.
+- @param t The transform.
+- @param values The values.
+- @param n The number of values.
+*/
+void Quantization::applyTransform(FeatureTransform t, float *values, size_t n)
+{
+    if (t != FeatureTransform::SQRT)
+        return;
+    for (size_t i = 0; i < n; ++i)
+        values[i] = values[i] > 0.0f ? std::sqrt(values[i]) : 0.0f;
+}
+
+/*
+Converts "none" or "sqrt" to the transform.
+- @param s The string to convert.
+- @param ok Optional; set to false if s is not a known transform.
+- @return The transform, NONE if s is unknown.
+*/
+FeatureTransform Quantization::stringToTransform(const char *s, bool *ok)
+{
+    std::string str = s ? s : "";
+    if (ok)
+        *ok = true;
+    if (str == "sqrt")
+        return FeatureTransform::SQRT;
+    if (str != "none" && ok)
+        *ok = false;
+    return FeatureTransform::NONE;
+}
+
+/*
+Converts a transform to "none" or "sqrt".
+- @param t The transform.
+- @return Its string form.
+*/
+std::string Quantization::transformToString(FeatureTransform t)
+{
+    return t == FeatureTransform::SQRT ? "sqrt" : "none";
+}
@@ -8,11 +8,13 @@
 
 #include "readFiles.hpp"
 #include "csvUtil.hpp"
+#include "featureStore.hpp"
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <dirent.h>
 #include <filesystem>
+#include <fstream>
 
 /*
   Given a directory on the command line, scans through the directory for image files.
@@ -72,15 +74,17 @@ int ReadFiles::readFilesInDir(char *dirname, std::vector<std::string> &files)
 Reads image features from a CSV file. The CSV file is expected to have a string as the first
 column (the filename) and floating point numbers as the remaining columns (the features).
 The function populates the provided vectors with the filenames and their corresponding feature data.
+The file is parsed in parallel, one line-aligned byte range per thread.
 
 - @param filename The path to the CSV file to read.
-- @param filenames A reference to a vector of character pointers where the filenames will be stored.
-- @param data A reference to a 2D vector of floats where the feature data will be stored. Each inner vector corresponds to the features of one image.
+- @param filenames A reference to a vector of strings where the filenames will be stored.
+- @param data A reference to a FeatureMatrix where the feature data will be stored. Each row corresponds to the features of one image.
+- @param numThreads The number of parsing threads, <= 0 for one per core.
 - @return 0 on success, non-zero value on error.
 */
-int ReadFiles::readFeaturesFromCSV(const char *filename, std::vector<std::string> &filenames, std::vector<std::vector<float>> &data)
+int ReadFiles::readFeaturesFromCSV(const char *filename, std::vector<std::string> &filenames, FeatureMatrix &data, int numThreads)
 {
-    if (csvUtil::read_image_data_csv(filename, filenames, data, 0) != 0)
+    if (csvUtil::read_image_data_csv_parallel(filename, filenames, data, numThreads) != 0)
     {
         printf("Error reading CSV file.\n");
         return -1;
@@ -88,6 +92,72 @@ int ReadFiles::readFeaturesFromCSV(const char *filename, std::vector<std::string
     return 0;
 }
 
+/*
+Opens a binary feature database (.fdb). The file is memory-mapped, so this does not
+depend on the number of images; feature rows are paged in as they are scanned.
+
+- @param filename The path to the .fdb file to open.
+- @param db The FeatureDB to open the file into.
+- @return 0 on success, non-zero value on error.
+*/
+int ReadFiles::readFeaturesFromDB(const char *filename, FeatureDB &db)
+{
+    if (db.open(filename) != 0)
+    {
+        printf("Error reading feature DB.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Reads the filename column of a feature database without its features. Binary
+databases are mapped; for CSV files only the text up to the first comma of each
+line is kept.
+
+- @param filename The path to the .csv or .fdb file.
+- @param filenames Receives one filename per row.
+- @return 0 on success, non-zero value on error.
+*/
+int ReadFiles::readFilenamesFromDB(const char *filename, std::vector<std::string> &filenames)
+{
+    filenames.clear();
+    if (FeatureDB::isFeatureDBPath(filename))
+    {
+        FeatureDB db;
+        if (db.open(filename) != 0)
+            return -1;
+        filenames.reserve(db.rows());
+        for (size_t i = 0; i < db.rows(); ++i)
+            filenames.push_back(db.filename(i));
+        return 0;
+    }
+    if (FeatureStore::isFeatureStorePath(filename))
+    {
+        FeatureStore store;
+        if (store.open(filename) != 0)
+            return -1;
+        filenames.reserve(store.rows());
+        for (size_t i = 0; i < store.rows(); ++i)
+            filenames.push_back(store.filename(i));
+        return 0;
+    }
+
+    std::ifstream in(filename);
+    if (!in)
+    {
+        printf("Unable to open feature file %s\n", filename);
+        return -1;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (!line.empty())
+            filenames.push_back(line.substr(0, line.find(',')));
+    }
+    return 0;
+}
+
 /*
 Checks if the target image is present in the database by comparing filenames.
 
@@ -0,0 +1,184 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  shardIndex.cpp
+
+  Path: project2/src/utils/shardIndex.cpp
+  Description: Reads and writes the shard index of a sharded feature database.
+*/
+
+#include "shardIndex.hpp"
+#include "fileUtil.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    const char kHeader[] = "# CBIR shard index v1";
+} // namespace
+
+/*
+Reads a shard index.
+- @param indexPath The path of the .shards file.
+- @return 0 on success, -1 if it is missing or invalid.
+*/
+int ShardIndex::load(const std::string &indexPath)
+{
+    paths_.clear();
+    dir_ = std::filesystem::path(indexPath).parent_path().string();
+
+    std::ifstream in(indexPath);
+    if (!in)
+    {
+        printf("Unable to open shard index %s\n", indexPath.c_str());
+        return -1;
+    }
+
+    std::string line;
+    char scheme[16] = {0};
+    size_t count = 0;
+    bool ok = false;
+    if (!std::getline(in, line) || line != kHeader || !std::getline(in, line) ||
+        std::sscanf(line.c_str(), "scheme %15s", scheme) != 1 || !std::getline(in, line) ||
+        std::sscanf(line.c_str(), "shards %zu", &count) != 1 || count == 0)
+    {
+        printf("Shard index %s has an invalid header\n", indexPath.c_str());
+        return -1;
+    }
+    scheme_ = stringToScheme(scheme, &ok);
+    if (!ok)
+    {
+        printf("Shard index %s has unknown scheme '%s'\n", indexPath.c_str(), scheme);
+        return -1;
+    }
+
+    while (paths_.size() < count && std::getline(in, line))
+    {
+        if (!line.empty())
+            paths_.push_back(line);
+    }
+    if (paths_.size() != count)
+    {
+        printf("Shard index %s lists %zu of %zu shards\n", indexPath.c_str(), paths_.size(), count);
+        paths_.clear();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Writes the shard index under a temporary name and renames it into place.
+- @param indexPath The path of the .shards file.
+- @return 0 on success, -1 on error.
+*/
+int ShardIndex::save(const std::string &indexPath) const
+{
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(indexPath, tmpPath);
+    if (!fp)
+        return -1;
+    fprintf(fp, "%s\nscheme %s\nshards %zu\n", kHeader, schemeToString(scheme_).c_str(), paths_.size());
+    for (const auto &p : paths_)
+        fprintf(fp, "%s\n", p.c_str());
+    return FileUtil::commitTemp(fp, tmpPath, indexPath, !ferror(fp));
+}
+
+/*
+Lays out the shards of a new database. Shard i is named "<index base>.<i><ext>" and
+placed in dirs[i % dirs.size()], or next to the index if dirs is empty. Shards in
+other directories are recorded with absolute paths, so the index does not depend on
+the working directory of the run that created it.
+
+- @param indexPath The path of the .shards file.
+- @param numShards The number of shards (at least 1).
+- @param scheme How images are assigned to shards.
+- @param ext The extension of the shard files, ".csv" or ".fdb".
+- @param dirs Optional directories to spread the shards over.
+- @return The new index (not yet saved).
+*/
+ShardIndex ShardIndex::create(const std::string &indexPath, size_t numShards, ShardScheme scheme,
+                              const std::string &ext, const std::vector<std::string> &dirs)
+{
+    namespace fs = std::filesystem;
+    ShardIndex index;
+    index.scheme_ = scheme;
+    index.dir_ = fs::path(indexPath).parent_path().string();
+
+    std::string stem = fs::path(indexPath).stem().string();
+    for (size_t i = 0; i < numShards; ++i)
+    {
+        std::string name = stem + "." + std::to_string(i) + ext;
+        index.paths_.push_back(dirs.empty() ? name
+                                            : (fs::absolute(dirs[i % dirs.size()]) / name).string());
+    }
+    return index;
+}
+
+/*
+Returns the path of a shard, resolving paths relative to the index directory.
+- @param i The shard number.
+- @return The shard path.
+*/
+std::string ShardIndex::shardPath(size_t i) const
+{
+    namespace fs = std::filesystem;
+    fs::path p(paths_[i]);
+    if (p.is_absolute() || dir_.empty())
+        return p.string();
+    return (fs::path(dir_) / p).string();
+}
+
+/*
+Returns the HASH shard of an image: FNV-1a of its filename without directories, so
+the shard does not depend on where the image directory is mounted and matches the
+filename comparison the matcher uses to find the target image.
+- @param imagePath The image path.
+- @param numShards The number of shards.
+- @return The shard number.
+*/
+size_t ShardIndex::hashShard(const std::string &imagePath, size_t numShards)
+{
+    size_t slash = imagePath.find_last_of("/\\");
+    const char *p = imagePath.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+    uint64_t h = 14695981039346656037ULL;
+    for (; *p; ++p)
+    {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)(h % numShards);
+}
+
+/*
+Checks whether a path names a shard index.
+- @param path The path to check.
+- @return true if the path ends with ".shards", false otherwise.
+*/
+bool ShardIndex::isShardIndexPath(const std::string &path)
+{
+    return path.size() >= 7 && path.compare(path.size() - 7, 7, ".shards") == 0;
+}
+
+/*
+Converts "hash" or "range" to the shard scheme.
+- @param s The string to convert.
+- @param ok Optional; set to false if s is not a known scheme.
+- @return The scheme, HASH if s is unknown.
+*/
+ShardScheme ShardIndex::stringToScheme(const char *s, bool *ok)
+{
+    std::string str = s ? s : "";
+    if (ok)
+        *ok = str == "hash" || str == "range";
+    return str == "range" ? ShardScheme::RANGE : ShardScheme::HASH;
+}
+
+/*
+Converts a shard scheme to "hash" or "range".
+- @param scheme The scheme.
+- @return Its string form.
+*/
+std::string ShardIndex::schemeToString(ShardScheme scheme)
+{
+    return scheme == ShardScheme::RANGE ? "range" : "hash";
+}
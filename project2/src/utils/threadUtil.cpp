@@ -0,0 +1,54 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  threadUtil.cpp
+
+  Path: project2/src/utils/threadUtil.cpp
+  Description: Runs independent tasks on several threads.
+*/
+
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+Returns the number of hardware threads.
+- @return The number of hardware threads, at least 1.
+*/
+size_t ThreadUtil::defaultThreads()
+{
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/*
+Runs fn(i) for every i in [0, n) on up to maxThreads threads, including the calling
+thread. Each thread takes the next unclaimed index until none are left.
+- @param n The number of tasks.
+- @param fn The task, called once per index.
+- @param maxThreads The maximum number of threads, 0 for defaultThreads().
+*/
+void ThreadUtil::parallelFor(size_t n, const std::function<void(size_t)> &fn, size_t maxThreads)
+{
+    size_t threads = std::min(n, maxThreads > 0 ? maxThreads : defaultThreads());
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < n; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t)
+        workers.emplace_back(work);
+    work();
+    for (auto &w : workers)
+        w.join();
+}
@@ -0,0 +1,374 @@
+/*
+  Claire Liu, Yu-Jing Wei
+  vpTreeIndex.cpp
+
+  Path: project2/src/utils/vpTreeIndex.cpp
+  Description: Builds, saves, memory-maps and searches vantage-point tree indexes.
+*/
+
+#include "vpTreeIndex.hpp"
+#include "IDistanceMetric.hpp"
+#include "fileUtil.hpp"
+#include "matchUtil.hpp"
+#include "threadUtil.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <utility>
+
+namespace
+{
+    const char kMagic[8] = {'C', 'B', 'I', 'R', 'V', 'P', 'T', '\0'};
+    const uint32_t kVersion = 1;
+    // Rows a leaf holds at most; smaller leaves prune finer but cost more nodes
+    const size_t kLeafRows = 16;
+    // Rows of a node looked at when picking its vantage point
+    const size_t kVantageSample = 64;
+    // Relative slack taken off every bound, so float rounding never prunes a row that
+    // ties the K-th best distance
+    const float kSlack = 1e-4f;
+
+    // A node to split, with the rows it covers
+    struct Range
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    /*
+    Counts the nodes of a tree over n rows. The shape of a tree depends only on its
+    number of rows, which places every subtree before it is built.
+    @param n The number of rows.
+    @param leafRows The largest number of rows in a leaf.
+    @param memo Counts already known, by number of rows.
+    @return The number of nodes.
+    */
+    size_t nodeCount(size_t n, size_t leafRows, std::map<size_t, size_t> &memo)
+    {
+        if (n <= leafRows)
+            return 1;
+        auto it = memo.find(n);
+        if (it != memo.end())
+            return it->second;
+        const size_t inside = (n - 1) / 2;
+        const size_t count = 1 + nodeCount(inside, leafRows, memo) + nodeCount(n - 1 - inside, leafRows, memo);
+        memo[n] = count;
+        return count;
+    }
+} // namespace
+
+/*
+Unmaps the index file if it is still open.
+*/
+VpTreeIndex::~VpTreeIndex()
+{
+    close();
+}
+
+/*
+Drops the tree, mapped or built.
+*/
+void VpTreeIndex::close()
+{
+    FileUtil::unmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    nodesBuf_.clear();
+    orderBuf_.clear();
+    nodes_ = nullptr;
+    order_ = nullptr;
+    rows_ = dim_ = 0;
+    fingerprint_ = 0;
+    nodeCount_ = 0;
+}
+
+/*
+Builds the tree one level at a time: the nodes of a level cover disjoint rows, so they
+are split in parallel, one node per task. A node's vantage point is the row, among
+up to 64 spread over the node, farthest from its first row, and its other rows are
+split at the median distance to it, ties going by row number. The place of every
+node follows from the row counts alone, so the tree is the same on every thread count.
+
+- @param table The table to index.
+- @param metric ssd.
+- @param params Unused; the tree has no settings.
+- @param threads The number of threads, 0 for one per core.
+- @return 0 on success, -1 on error.
+*/
+int VpTreeIndex::build(const FeatureTable &table, MetricType metric, const IndexParams &params,
+                       size_t threads)
+{
+    (void)params;
+    if (metric != SSD)
+    {
+        printf("VP-tree index needs the ssd metric (got %s)\n", MetricFactory::metricTypeToString(metric).c_str());
+        return -1;
+    }
+    if (table.rows() == 0 || table.rows() >= std::numeric_limits<uint32_t>::max())
+    {
+        printf("VP-tree index cannot index %zu rows of %s\n", table.rows(), table.path().c_str());
+        return -1;
+    }
+
+    close();
+    metric_ = metric;
+    rows_ = table.rows();
+    dim_ = table.dim();
+    fingerprint_ = table.fingerprint();
+
+    auto ssd = MetricFactory::create(SSD);
+    const FeatureDataType type = table.dataType();
+    const QuantParams &qp = table.quantParams();
+    auto distance = [&](uint32_t a, uint32_t b) {
+        return std::sqrt(std::max(0.0f, ssd->computeEncoded(type, table.rawRow(a), table.rawRow(b), dim_, qp)));
+    };
+
+    std::map<size_t, size_t> memo;
+    nodesBuf_.assign(nodeCount(rows_, kLeafRows, memo), VpNode{0, 0, 0, 0.0f, 0.0f});
+    orderBuf_.resize(rows_);
+    std::iota(orderBuf_.begin(), orderBuf_.end(), 0);
+
+    std::vector<Range> level{{0, 0, (uint32_t)rows_}};
+    while (!level.empty())
+    {
+        ThreadUtil::parallelFor(level.size(), [&](size_t t) {
+            const Range &r = level[t];
+            VpNode &node = nodesBuf_[r.node];
+            node.begin = r.begin;
+            node.end = r.end;
+            const size_t n = r.end - r.begin;
+            if (n <= kLeafRows)
+                return;
+            uint32_t *rows = orderBuf_.data() + r.begin;
+
+            size_t vantage = 0;
+            float farthest = -1.0f;
+            const size_t samples = std::min(n, kVantageSample);
+            for (size_t s = 0; s < samples; ++s)
+            {
+                const size_t i = s * n / samples;
+                const float d = distance(rows[0], rows[i]);
+                if (d > farthest)
+                {
+                    farthest = d;
+                    vantage = i;
+                }
+            }
+            std::swap(rows[0], rows[vantage]);
+
+            std::vector<std::pair<float, uint32_t>> byDistance(n - 1);
+            for (size_t i = 1; i < n; ++i)
+                byDistance[i - 1] = {distance(rows[0], rows[i]), rows[i]};
+            const size_t inside = (n - 1) / 2;
+            std::nth_element(byDistance.begin(), byDistance.begin() + inside, byDistance.end());
+            float insideMax = 0.0f;
+            for (size_t i = 0; i < inside; ++i)
+                insideMax = std::max(insideMax, byDistance[i].first);
+            node.insideMax = insideMax;
+            node.outsideMin = byDistance[inside].first;
+            for (size_t i = 0; i < n - 1; ++i)
+                rows[i + 1] = byDistance[i].second;
+        }, threads);
+
+        std::vector<Range> next;
+        for (const Range &r : level)
+        {
+            const size_t n = r.end - r.begin;
+            if (n <= kLeafRows)
+                continue;
+            const uint32_t mid = r.begin + 1 + (uint32_t)((n - 1) / 2);
+            const uint32_t outside = r.node + 1 + (uint32_t)nodeCount(mid - r.begin - 1, kLeafRows, memo);
+            nodesBuf_[r.node].outside = outside;
+            next.push_back({r.node + 1, r.begin + 1, mid});
+            next.push_back({outside, mid, r.end});
+        }
+        level.swap(next);
+    }
+
+    nodeCount_ = nodesBuf_.size();
+    nodes_ = nodesBuf_.data();
+    order_ = orderBuf_.data();
+    return 0;
+}
+
+/*
+Writes the index to an index file. The file appears under its final name only once
+it is complete.
+
+- @param path The path of the .vptree file to create (replaced if it exists).
+- @return 0 on success, -1 on error.
+*/
+int VpTreeIndex::save(const std::string &path) const
+{
+    if (!nodes_)
+    {
+        printf("VP-tree index is empty, nothing to save\n");
+        return -1;
+    }
+    VpHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(VpHeader);
+    h.metric = metric_;
+    h.dim = (uint32_t)dim_;
+    h.leafRows = (uint32_t)kLeafRows;
+    h.rows = rows_;
+    h.fingerprint = fingerprint_;
+    h.nodes = nodeCount_;
+    h.nodesOffset = FileUtil::alignUp(sizeof(VpHeader), sizeof(uint64_t));
+    h.orderOffset = h.nodesOffset + nodeCount_ * sizeof(VpNode);
+    h.fileSize = h.orderOffset + rows_ * sizeof(uint32_t);
+
+    std::string tmpPath;
+    FILE *fp = FileUtil::createTemp(path, tmpPath);
+    if (!fp)
+        return -1;
+    bool ok = FileUtil::writeAll(fp, &h, sizeof(h)) &&
+              FileUtil::writePadding(fp, sizeof(h), h.nodesOffset) &&
+              FileUtil::writeAll(fp, nodes_, nodeCount_ * sizeof(VpNode)) &&
+              FileUtil::writeAll(fp, order_, rows_ * sizeof(uint32_t));
+    return FileUtil::commitTemp(fp, tmpPath, path, ok);
+}
+
+/*
+Maps an index file into memory and validates its header. The nodes and row order are
+paged in as searches walk them.
+
+- @param path The path to the .vptree file.
+- @return 0 on success, -1 on error.
+*/
+int VpTreeIndex::load(const std::string &path)
+{
+    close();
+
+    map_ = FileUtil::mapReadOnly(path, sizeof(VpHeader), "VP-tree index", mapSize_);
+    if (!map_)
+        return -1;
+
+    const VpHeader *h = static_cast<const VpHeader *>(map_);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion ||
+        h->headerSize != sizeof(VpHeader))
+    {
+        printf("%s is not a version %u VP-tree index\n", path.c_str(), kVersion);
+        close();
+        return -1;
+    }
+    // The node count follows from the rows, so a mismatch means a damaged header
+    std::map<size_t, size_t> memo;
+    if (h->fileSize != mapSize_ || h->metric != SSD || h->rows == 0 || h->dim == 0 || h->leafRows < 2 ||
+        h->rows >= std::numeric_limits<uint32_t>::max() || h->nodes != nodeCount(h->rows, h->leafRows, memo) ||
+        h->nodesOffset % sizeof(uint32_t) != 0 || h->nodesOffset < sizeof(VpHeader) ||
+        h->nodesOffset + h->nodes * sizeof(VpNode) > h->orderOffset ||
+        h->orderOffset % sizeof(uint32_t) != 0 || h->orderOffset + h->rows * sizeof(uint32_t) > mapSize_)
+    {
+        printf("VP-tree index %s is truncated or corrupt\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    const char *base = static_cast<const char *>(map_);
+    metric_ = static_cast<MetricType>(h->metric);
+    rows_ = h->rows;
+    dim_ = h->dim;
+    fingerprint_ = h->fingerprint;
+    nodeCount_ = h->nodes;
+    nodes_ = reinterpret_cast<const VpNode *>(base + h->nodesOffset);
+    order_ = reinterpret_cast<const uint32_t *>(base + h->orderOffset);
+    if (nodes_[0].begin != 0 || nodes_[0].end != rows_)
+    {
+        printf("VP-tree index %s has a corrupt root\n", path.c_str());
+        close();
+        return -1;
+    }
+
+    printf("Opened %s (vptree, %llu rows, %s, %zu nodes)\n", path.c_str(), (unsigned long long)rows_,
+           MetricFactory::metricTypeToString(metric_).c_str(), nodeCount_);
+    return 0;
+}
+
+/*
+Finds the exact k nearest live rows under ssd. The tree is walked depth first, the
+child on the query's side of the median first; the triangle inequality gives every
+child a lower bound on the Euclidean distance from the query to its rows, and a child
+whose bound exceeds the K-th best distance so far is skipped.
+
+- @param table The table the index was built from.
+- @param query The query, table.dim() features.
+- @param k The number of rows to return.
+- @param params Unused; the search is exact.
+- @param out Receives up to k rows, nearest first, with their ssd.
+- @param stats Receives the cost if not nullptr; visited counts the tree nodes.
+- @return 0 on success, -1 on error.
+*/
+int VpTreeIndex::search(const FeatureTable &table, const float *query, size_t k,
+                        const IndexParams &params, std::vector<IndexHit> &out, IndexStats *stats) const
+{
+    (void)params;
+    out.clear();
+    if (!checkShape(table, "VP-tree", nodes_ != nullptr))
+        return -1;
+    if (k == 0)
+        return 0;
+
+    auto ssd = MetricFactory::create(SSD);
+    const std::vector<uint8_t> encoded = encodeQuery(table, query);
+    size_t computed = 0, visited = 0;
+    TopKSelector best(k);
+    auto score = [&](uint32_t row) {
+        const float d = ssd->computeEncoded(table.dataType(), encoded.data(), table.rawRow(row), dim_,
+                                            table.quantParams());
+        ++computed;
+        if (!table.isDead(row))
+            best.push(d, row);
+        return std::sqrt(std::max(0.0f, d));
+    };
+
+    // Nodes still to visit, with the lower bound on the distance to their rows
+    std::vector<std::pair<uint32_t, float>> pending{{0, 0.0f}};
+    while (!pending.empty())
+    {
+        const std::pair<uint32_t, float> next = pending.back();
+        pending.pop_back();
+        if (next.second > std::sqrt(best.threshold()))
+            continue;
+        ++visited;
+        const VpNode &node = nodes_[next.first];
+        if (node.outside == 0)
+        {
+            for (uint32_t pos = node.begin; pos < node.end; ++pos)
+                score(order_[pos]);
+            continue;
+        }
+        const float d = score(order_[node.begin]);
+        const float insideBound = d - node.insideMax - kSlack * (d + node.insideMax);
+        const float outsideBound = node.outsideMin - d - kSlack * (node.outsideMin + d);
+        const std::pair<uint32_t, float> inside{next.first + 1, std::max(0.0f, insideBound)};
+        const std::pair<uint32_t, float> outside{node.outside, std::max(0.0f, outsideBound)};
+        // The nearer child goes on top, so it tightens the K-th distance first
+        if (2.0f * d < node.insideMax + node.outsideMin)
+        {
+            pending.push_back(outside);
+            pending.push_back(inside);
+        }
+        else
+        {
+            pending.push_back(inside);
+            pending.push_back(outside);
+        }
+    }
+    if (stats)
+    {
+        stats->distances += computed;
+        stats->visited += visited;
+    }
+
+    for (const TopKSelector::Entry &e : best.sorted())
+        out.push_back({e.id, e.distance});
+    return 0;
+}